@@ -13,6 +13,7 @@
 static ngx_int_t ngx_conf_add_dump(ngx_conf_t *cf, ngx_str_t *filename);
 static ngx_int_t ngx_conf_handler(ngx_conf_t *cf, ngx_int_t last);
 static ngx_int_t ngx_conf_read_token(ngx_conf_t *cf);
+static void ngx_conf_hash(ngx_conf_t *cf, uint32_t *hash, ngx_int_t last);
 static void ngx_conf_flush_files(ngx_cycle_t *cycle);
 
 
@@ -263,6 +264,8 @@ ngx_conf_parse(ngx_conf_t *cf, ngx_str_t *filename)
                 goto failed;
             }
 
+            ngx_conf_hash(cf, &cf->cycle->conf_hash, rc);
+
             goto done;
         }
 
@@ -301,6 +304,8 @@ ngx_conf_parse(ngx_conf_t *cf, ngx_str_t *filename)
                 goto failed;
             }
 
+            ngx_conf_hash(cf, &cf->cycle->conf_hash, rc);
+
             rv = (*cf->handler)(cf, NULL, cf->handler_conf);
             if (rv == NGX_CONF_OK) {
                 continue;
@@ -460,6 +465,11 @@ ngx_conf_handler(ngx_conf_t *cf, ngx_int_t last)
                 }
             }
 
+            ngx_conf_hash(cf, (cmd->type & NGX_CONF_DYNAMIC)
+                              ? &cf->cycle->conf_dynamic_hash
+                              : &cf->cycle->conf_hash,
+                          last);
+
             rv = cmd->set(cf, cmd, conf);
 
             if (rv == NGX_CONF_OK) {
@@ -817,6 +827,36 @@ ngx_conf_read_token(ngx_conf_t *cf)
 }
 
 
+
+static void
+ngx_conf_hash(ngx_conf_t *cf, uint32_t *hash, ngx_int_t last)
+{
+    u_char      c;
+    ngx_str_t  *value;
+    ngx_uint_t  i;
+
+    /*
+     * the checksum of all directives lets an incremental reconfiguration
+     * find out which parts of the configuration were changed
+     */
+
+    if (last == NGX_CONF_BLOCK_DONE) {
+        c = '}';
+        ngx_crc32_update(hash, &c, 1);
+        return;
+    }
+
+    value = cf->args->elts;
+
+    for (i = 0; i < cf->args->nelts; i++) {
+        ngx_crc32_update(hash, (u_char *) &value[i].len, sizeof(size_t));
+        ngx_crc32_update(hash, value[i].data, value[i].len);
+    }
+
+    c = (last == NGX_CONF_BLOCK_START) ? '{' : ';';
+    ngx_crc32_update(hash, &c, 1);
+}
+
 char *
 ngx_conf_include(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -953,6 +993,7 @@ ngx_conf_open_file(ngx_cycle_t *cycle, ngx_str_t *name)
 
     file->flush = NULL;
     file->data = NULL;
+    ngx_str_null(&file->header);
 
     return file;
 }
@@ -45,6 +45,7 @@
 #define NGX_CONF_ANY         0x00000400
 #define NGX_CONF_1MORE       0x00000800
 #define NGX_CONF_2MORE       0x00001000
+#define NGX_CONF_DYNAMIC     0x00002000
 
 #define NGX_DIRECT_CONF      0x00010000
 
@@ -92,6 +93,9 @@ struct ngx_open_file_s {
 
     void                (*flush)(ngx_open_file_t *file, ngx_log_t *log);
     void                 *data;
+
+    /* written each time the file is opened by the master process */
+    ngx_str_t             header;
 };
 
 
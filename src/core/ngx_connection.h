@@ -184,6 +184,7 @@ struct ngx_connection_s {
     unsigned            reusable:1;
     unsigned            close:1;
     unsigned            shared:1;
+    unsigned            handoff:1;
 
     unsigned            sendfile:1;
     unsigned            sndlowat:1;
@@ -95,6 +95,9 @@ typedef void (*ngx_connection_handler_pt)(ngx_connection_t *c);
 #include <ngx_os.h>
 #include <ngx_connection.h>
 #include <ngx_syslog.h>
+#include <ngx_log_ring.h>
+#include <ngx_metrics.h>
+#include <ngx_sdt.h>
 #include <ngx_proxy_protocol.h>
 #if (NGX_HAVE_BPF)
 #include <ngx_bpf.h>
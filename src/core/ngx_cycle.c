@@ -14,6 +14,7 @@ static void ngx_destroy_cycle_pools(ngx_conf_t *conf);
 static ngx_int_t ngx_init_zone_pool(ngx_cycle_t *cycle,
     ngx_shm_zone_t *shm_zone);
 static ngx_int_t ngx_test_lockfile(u_char *file, ngx_log_t *log);
+static void ngx_write_file_header(ngx_open_file_t *file, ngx_log_t *log);
 static void ngx_clean_old_cycles(ngx_event_t *ev);
 static void ngx_shutdown_timer_handler(ngx_event_t *ev);
 
@@ -275,6 +276,9 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     log->log_level = NGX_LOG_DEBUG_ALL;
 #endif
 
+    ngx_crc32_init(cycle->conf_hash);
+    ngx_crc32_init(cycle->conf_dynamic_hash);
+
     if (ngx_conf_param(&conf) != NGX_CONF_OK) {
         environ = senv;
         ngx_destroy_cycle_pools(&conf);
@@ -404,12 +408,35 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
             goto failed;
         }
 #endif
+
+        if (file[i].header.len && !ngx_test_config) {
+            ngx_write_file_header(&file[i], log);
+        }
     }
 
     cycle->log = &cycle->new_log;
     pool->log = &cycle->new_log;
 
 
+    /*
+     * if only dynamic parts of the configuration were changed, e.g. server
+     * lists of upstreams in shared memory, the running worker processes
+     * are updated through shared memory instead of being replaced
+     */
+
+    if (!ngx_is_init_cycle(old_cycle)
+        && !ngx_test_config
+        && ccf->incremental_reload
+        && cycle->conf_hash == old_cycle->conf_hash
+        && cycle->conf_dynamic_hash != old_cycle->conf_dynamic_hash)
+    {
+        ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                      "incremental reconfiguration");
+
+        cycle->incremental = 1;
+    }
+
+
     /* create shared memory */
 
     part = &cycle->shared_memory.part;
@@ -463,7 +490,10 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                 continue;
             }
 
-            if (shm_zone[i].tag == oshm_zone[n].tag && shm_zone[i].noreuse) {
+            if (shm_zone[i].tag == oshm_zone[n].tag
+                && shm_zone[i].noreuse
+                && !cycle->incremental)
+            {
                 data = oshm_zone[n].data;
                 break;
             }
@@ -690,7 +720,7 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
 
             if (oshm_zone[i].tag == shm_zone[n].tag
                 && oshm_zone[i].shm.size == shm_zone[n].shm.size
-                && !oshm_zone[i].noreuse)
+                && (!oshm_zone[i].noreuse || cycle->incremental))
             {
                 goto live_shm_zone;
             }
@@ -907,7 +937,7 @@ failed:
 
             if (shm_zone[i].tag == oshm_zone[n].tag
                 && shm_zone[i].shm.size == oshm_zone[n].shm.size
-                && !shm_zone[i].noreuse)
+                && (!shm_zone[i].noreuse || cycle->incremental))
             {
                 goto old_shm_zone_found;
             }
@@ -1358,12 +1388,51 @@ ngx_reopen_files(ngx_cycle_t *cycle, ngx_uid_t user)
         }
 
         file[i].fd = fd;
+
+        if (file[i].header.len
+            && (ngx_process == NGX_PROCESS_MASTER
+                || ngx_process == NGX_PROCESS_SINGLE))
+        {
+            ngx_write_file_header(&file[i], cycle->log);
+        }
     }
 
     (void) ngx_log_redirect_stderr(cycle);
 }
 
 
+static void
+ngx_write_file_header(ngx_open_file_t *file, ngx_log_t *log)
+{
+    ssize_t          n;
+    ngx_file_info_t  fi;
+
+    /* the header is written only at the beginning of a file */
+
+    if (ngx_fd_info(file->fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", file->name.data);
+        return;
+    }
+
+    if (ngx_file_size(&fi) != 0) {
+        return;
+    }
+
+    n = ngx_write_fd(file->fd, file->header.data, file->header.len);
+
+    if (n == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_write_fd_n " to \"%s\" failed", file->name.data);
+
+    } else if ((size_t) n != file->header.len) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      ngx_write_fd_n " to \"%s\" was incomplete: %z of %uz",
+                      file->name.data, n, file->header.len);
+    }
+}
+
+
 ngx_shm_zone_t *
 ngx_shared_memory_add(ngx_conf_t *cf, ngx_str_t *name, size_t size, void *tag)
 {
@@ -64,6 +64,10 @@ struct ngx_cycle_s {
     ngx_rbtree_t              config_dump_rbtree;
     ngx_rbtree_node_t         config_dump_sentinel;
 
+    uint32_t                  conf_hash;
+    uint32_t                  conf_dynamic_hash;
+    ngx_uint_t                incremental;     /* unsigned  incremental:1; */
+
     ngx_list_t                open_files;
     ngx_list_t                shared_memory;
 
@@ -92,6 +96,8 @@ typedef struct {
 
     ngx_msec_t                timer_resolution;
     ngx_msec_t                shutdown_timeout;
+    ngx_flag_t                shutdown_handoff;
+    ngx_flag_t                incremental_reload;
 
     ngx_int_t                 worker_processes;
     ngx_int_t                 debug_points;
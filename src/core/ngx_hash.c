@@ -9,6 +9,36 @@
 #include <ngx_core.h>
 
 
+/*
+ * Perfect hash for large tables, see "Hash, displace, and compress" by
+ * Belazzougui, Botelho, and Dietzfelbinger.  The keys are spread over
+ * displacement buckets, about 4 keys per bucket, and each bucket gets
+ * a pair of displacements which places all its keys into free slots, one
+ * key per slot.  A lookup is a single probe, and the key hash stored
+ * in the slot rejects most misses without comparing names.
+ */
+
+#define NGX_HASH_PERFECT_MIN      1024
+#define NGX_HASH_PERFECT_LAMBDA   4
+#define NGX_HASH_PERFECT_SPARE    8
+#define NGX_HASH_PERFECT_TRIES    32     /* per key */
+
+
+typedef struct {
+    uint32_t          f1;
+    uint32_t          f2;
+    uint32_t          bucket;
+    uint32_t          slot;
+} ngx_hash_perfect_key_t;
+
+
+static ngx_inline uint64_t ngx_hash_perfect_mix(ngx_uint_t key);
+static ngx_inline ngx_uint_t ngx_hash_perfect_slot(ngx_hash_t *hash,
+    ngx_uint_t key);
+static ngx_int_t ngx_hash_perfect_init(ngx_hash_init_t *hinit,
+    ngx_hash_key_t *names, ngx_uint_t nelts);
+
+
 void *
 ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
 {
@@ -19,7 +49,18 @@ ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
     ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "hf:\"%*s\"", len, name);
 #endif
 
-    elt = hash->buckets[key % hash->size];
+    if (hash->disps) {
+        i = ngx_hash_perfect_slot(hash, key);
+
+        if (hash->fingerprints[i] != (uint32_t) key) {
+            return NULL;
+        }
+
+        elt = hash->buckets[i];
+
+    } else {
+        elt = hash->buckets[key % hash->size];
+    }
 
     if (elt == NULL) {
         return NULL;
@@ -254,6 +295,7 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
     u_char          *elts;
     size_t           len;
     u_short         *test;
+    ngx_int_t        rc;
     ngx_uint_t       i, n, key, size, start, bucket_size;
     ngx_hash_elt_t  *elt, **buckets;
 
@@ -288,6 +330,14 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
         }
     }
 
+    if (nelts >= NGX_HASH_PERFECT_MIN) {
+        rc = ngx_hash_perfect_init(hinit, names, nelts);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+    }
+
     test = ngx_alloc(hinit->max_size * sizeof(u_short), hinit->pool->log);
     if (test == NULL) {
         return NGX_ERROR;
@@ -451,6 +501,9 @@ found:
 
     hinit->hash->buckets = buckets;
     hinit->hash->size = size;
+    hinit->hash->disps = NULL;
+    hinit->hash->fingerprints = NULL;
+    hinit->hash->ndisps = 0;
 
 #if 0
 
@@ -486,6 +539,285 @@ found:
 }
 
 
+static ngx_inline uint64_t
+ngx_hash_perfect_mix(ngx_uint_t key)
+{
+    uint64_t  h;
+
+    /* MurmurHash3 finalizer */
+
+    h = (uint64_t) key;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+
+static ngx_inline ngx_uint_t
+ngx_hash_perfect_slot(ngx_hash_t *hash, ngx_uint_t key)
+{
+    uint32_t  d, f1, f2;
+    uint64_t  h;
+
+    h = ngx_hash_perfect_mix(key);
+
+    d = hash->disps[(h >> 32) % hash->ndisps];
+
+    f1 = (uint32_t) h;
+    f2 = (uint32_t) ((h * 0x9e3779b97f4a7c15ULL) >> 32);
+
+    return (ngx_uint_t) (((uint64_t) f1 + (uint64_t) (d >> 16) * f2
+                          + (d & 0xffff))
+                         % hash->size);
+}
+
+
+static ngx_int_t
+ngx_hash_perfect_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
+    ngx_uint_t nelts)
+{
+    u_char                  *elts, *taken;
+    size_t                   len;
+    uint32_t                *disps, *fingerprints, d1, d2, slot;
+    uint64_t                 h;
+    ngx_int_t                rc;
+    ngx_uint_t               i, j, k, n, b, size, nkeys, ndisps, nbucket,
+                             max, tries;
+    ngx_uint_t              *count, *start, *order;
+    ngx_hash_elt_t          *elt, **buckets;
+    ngx_hash_perfect_key_t  *keys, *key;
+
+    nkeys = 0;
+
+    for (n = 0; n < nelts; n++) {
+        if (names[n].key.data != NULL) {
+            nkeys++;
+        }
+    }
+
+    if (nkeys == 0) {
+        return NGX_DECLINED;
+    }
+
+    ndisps = (nkeys + NGX_HASH_PERFECT_LAMBDA - 1) / NGX_HASH_PERFECT_LAMBDA;
+
+    /* spare slots make displacements for the last buckets easy to find */
+
+    size = nkeys + nkeys / NGX_HASH_PERFECT_SPARE;
+
+    keys = ngx_alloc(nkeys * sizeof(ngx_hash_perfect_key_t)
+                     + (3 * ndisps + nkeys + 1) * sizeof(ngx_uint_t) + size,
+                     hinit->pool->log);
+    if (keys == NULL) {
+        return NGX_ERROR;
+    }
+
+    count = (ngx_uint_t *) &keys[nkeys];
+    start = &count[ndisps + 1];
+    order = &start[ndisps];
+    taken = (u_char *) &order[ndisps + nkeys];
+
+    ngx_memzero(count, (ndisps + 1) * sizeof(ngx_uint_t));
+    ngx_memzero(taken, size);
+
+    max = 0;
+
+    for (n = 0, i = 0; n < nelts; n++) {
+        if (names[n].key.data == NULL) {
+            continue;
+        }
+
+        h = ngx_hash_perfect_mix(names[n].key_hash);
+
+        key = &keys[i++];
+
+        key->f1 = (uint32_t) h;
+        key->f2 = (uint32_t) ((h * 0x9e3779b97f4a7c15ULL) >> 32);
+        key->bucket = (uint32_t) ((h >> 32) % ndisps);
+
+        if (++count[key->bucket] > max) {
+            max = count[key->bucket];
+        }
+    }
+
+    /* group the keys by buckets, order the buckets by size, largest first */
+
+    for (b = 0, j = 0; b < ndisps; b++) {
+        start[b] = j;
+        j += count[b];
+    }
+
+    for (i = 0; i < nkeys; i++) {
+        b = keys[i].bucket;
+        order[ndisps + start[b] + --count[b]] = i;
+    }
+
+    for (b = 0; b < ndisps; b++) {
+        count[b] = (b + 1 < ndisps ? start[b + 1] : nkeys) - start[b];
+    }
+
+    for (k = max, j = 0; k > 0; k--) {
+        for (b = 0; b < ndisps; b++) {
+            if (count[b] == k) {
+                order[j++] = b;
+            }
+        }
+    }
+
+    disps = ngx_pcalloc(hinit->pool, ndisps * sizeof(uint32_t));
+    if (disps == NULL) {
+        rc = NGX_ERROR;
+        goto done;
+    }
+
+    tries = 0;
+
+    for (n = 0; n < j; n++) {
+        b = order[n];
+        nbucket = count[b];
+
+        /* keys with equal hashes cannot be told apart */
+
+        for (i = 0; i < nbucket; i++) {
+            key = &keys[order[ndisps + start[b] + i]];
+
+            for (k = 0; k < i; k++) {
+                if (key->f1 == keys[order[ndisps + start[b] + k]].f1
+                    && key->f2 == keys[order[ndisps + start[b] + k]].f2)
+                {
+                    rc = NGX_DECLINED;
+                    goto done;
+                }
+            }
+        }
+
+        for (d1 = 0; d1 < 0x10000; d1++) {
+            for (d2 = 0; d2 < 0x10000; d2++) {
+
+                if (++tries > NGX_HASH_PERFECT_TRIES * nkeys) {
+                    rc = NGX_DECLINED;
+                    goto done;
+                }
+
+                for (i = 0; i < nbucket; i++) {
+                    key = &keys[order[ndisps + start[b] + i]];
+
+                    slot = (uint32_t) (((uint64_t) key->f1
+                                        + (uint64_t) d1 * key->f2 + d2)
+                                       % size);
+
+                    if (taken[slot]) {
+                        break;
+                    }
+
+                    for (k = 0; k < i; k++) {
+                        if (keys[order[ndisps + start[b] + k]].slot == slot) {
+                            break;
+                        }
+                    }
+
+                    if (k < i) {
+                        break;
+                    }
+
+                    key->slot = slot;
+                }
+
+                if (i == nbucket) {
+                    goto found;
+                }
+            }
+        }
+
+        rc = NGX_DECLINED;
+        goto done;
+
+    found:
+
+        for (i = 0; i < nbucket; i++) {
+            taken[keys[order[ndisps + start[b] + i]].slot] = 1;
+        }
+
+        disps[b] = (d1 << 16) | d2;
+    }
+
+    if (hinit->hash == NULL) {
+        hinit->hash = ngx_pcalloc(hinit->pool, sizeof(ngx_hash_wildcard_t));
+        if (hinit->hash == NULL) {
+            rc = NGX_ERROR;
+            goto done;
+        }
+    }
+
+    buckets = ngx_pcalloc(hinit->pool, size * sizeof(ngx_hash_elt_t *));
+    fingerprints = ngx_pcalloc(hinit->pool, size * sizeof(uint32_t));
+
+    if (buckets == NULL || fingerprints == NULL) {
+        rc = NGX_ERROR;
+        goto done;
+    }
+
+    len = 0;
+
+    for (n = 0; n < nelts; n++) {
+        if (names[n].key.data != NULL) {
+            len += NGX_HASH_ELT_SIZE(&names[n]) + sizeof(void *);
+        }
+    }
+
+    elts = ngx_palloc(hinit->pool, len);
+    if (elts == NULL) {
+        rc = NGX_ERROR;
+        goto done;
+    }
+
+    /* each slot is a bucket with a single element */
+
+    for (n = 0, i = 0; n < nelts; n++) {
+        if (names[n].key.data == NULL) {
+            continue;
+        }
+
+        slot = keys[i++].slot;
+
+        buckets[slot] = (ngx_hash_elt_t *) elts;
+        fingerprints[slot] = (uint32_t) names[n].key_hash;
+
+        elt = (ngx_hash_elt_t *) elts;
+
+        elt->value = names[n].value;
+        elt->len = (u_short) names[n].key.len;
+
+        ngx_strlow(elt->name, names[n].key.data, names[n].key.len);
+
+        elts += NGX_HASH_ELT_SIZE(&names[n]);
+
+        ((ngx_hash_elt_t *) elts)->value = NULL;
+
+        elts += sizeof(void *);
+    }
+
+    hinit->hash->buckets = buckets;
+    hinit->hash->size = size;
+    hinit->hash->disps = disps;
+    hinit->hash->fingerprints = fingerprints;
+    hinit->hash->ndisps = ndisps;
+
+    rc = NGX_OK;
+
+done:
+
+    ngx_free(keys);
+
+    return rc;
+}
+
+
 ngx_int_t
 ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
     ngx_uint_t nelts)
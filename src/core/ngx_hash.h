@@ -23,6 +23,11 @@ typedef struct {
 typedef struct {
     ngx_hash_elt_t  **buckets;
     ngx_uint_t        size;
+
+    /* perfect hash, a bucket per key */
+    uint32_t         *disps;
+    uint32_t         *fingerprints;
+    ngx_uint_t        ndisps;
 } ngx_hash_t;
 
 
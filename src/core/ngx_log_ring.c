@@ -0,0 +1,575 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_LOG_RING_BUFFER_SIZE  (1024 * 1024)
+
+
+typedef struct {
+    ngx_atomic_t           pos;
+    uint32_t               size;
+    uint32_t               len;
+    ngx_pid_t              pid;
+} ngx_log_ring_rec_t;
+
+
+typedef struct {
+    ngx_atomic_t           head;
+    ngx_atomic_t           tail;
+    ngx_atomic_t           drops;
+    ngx_atomic_uint_t      limit;
+    size_t                 size;
+    u_char                *data;
+} ngx_log_ring_buf_t;
+
+
+typedef struct {
+    ngx_uint_t             nbufs;
+    ngx_atomic_uint_t      reported;
+    ngx_log_ring_buf_t     bufs[1];
+} ngx_log_ring_sh_t;
+
+
+struct ngx_log_ring_s {
+    ngx_log_ring_sh_t     *sh;
+    ngx_slab_pool_t       *shpool;
+    ngx_open_file_t       *file;
+    ngx_cycle_t           *cycle;
+    time_t                 error_log_time;
+    ngx_atomic_uint_t     *stop;
+};
+
+
+static ngx_int_t ngx_log_ring_init_zone(ngx_shm_zone_t *shm_zone, void *data);
+static size_t ngx_log_ring_drain(ngx_log_ring_t *ring, ngx_log_ring_buf_t *buf,
+    ngx_atomic_uint_t head, ngx_log_t *log);
+static ngx_uint_t ngx_log_ring_orphaned(ngx_log_ring_rec_t *rec);
+static size_t ngx_log_ring_flush(ngx_log_ring_t *ring, u_char *buf, size_t len,
+    ngx_log_t *log);
+
+
+static u_char  *ngx_log_ring_buffer;
+
+
+#define ngx_log_ring_next(buf, pos, n)                                        \
+    (((pos) + (n) >= (buf)->limit) ? (pos) + (n) - (buf)->limit : (pos) + (n))
+
+#define ngx_log_ring_fill(buf, head, tail)                                    \
+    (((head) >= (tail)) ? (head) - (tail) : (head) + ((buf)->limit - (tail)))
+
+
+ngx_log_ring_t *
+ngx_log_ring_add(ngx_conf_t *cf, ngx_open_file_t *file, size_t size)
+{
+    ngx_log_ring_t  *ring;
+    ngx_shm_zone_t  *shm_zone;
+
+    if (size < 8 * ngx_pagesize) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "ring of access_log \"%V\" is too small",
+                           &file->name);
+        return NULL;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &file->name, size,
+                                     (void *) ngx_log_ring_add);
+    if (shm_zone == NULL) {
+        return NULL;
+    }
+
+    if (shm_zone->data) {
+        return shm_zone->data;
+    }
+
+    ring = ngx_pcalloc(cf->pool, sizeof(ngx_log_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    ring->file = file;
+    ring->cycle = cf->cycle;
+
+    shm_zone->init = ngx_log_ring_init_zone;
+    shm_zone->data = ring;
+
+    return ring;
+}
+
+
+static ngx_int_t
+ngx_log_ring_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_log_ring_t  *oring = data;
+
+    size_t               size;
+    ngx_uint_t           i, n;
+    ngx_log_ring_t      *ring;
+    ngx_core_conf_t     *ccf;
+    ngx_slab_pool_t     *shpool;
+    ngx_log_ring_sh_t   *sh;
+    ngx_log_ring_buf_t  *buf;
+
+    ring = shm_zone->data;
+
+    if (oring) {
+        ring->sh = oring->sh;
+        ring->shpool = oring->shpool;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    ring->shpool = shpool;
+
+    if (shm_zone->shm.exists) {
+        ring->sh = shpool->data;
+        return NGX_OK;
+    }
+
+    /*
+     * each worker process appends to its own ring,
+     * so producers rarely contend for the same head
+     */
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(ring->cycle->conf_ctx,
+                                           ngx_core_module);
+
+    n = ccf->worker_processes > 0 ? ccf->worker_processes : 1;
+
+    sh = ngx_slab_alloc(shpool, sizeof(ngx_log_ring_sh_t)
+                                + (n - 1) * sizeof(ngx_log_ring_buf_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ring->sh = sh;
+    shpool->data = sh;
+
+    sh->nbufs = n;
+    sh->reported = 0;
+
+    size = shpool->pfree / n * ngx_pagesize;
+
+    if (size < 2 * ngx_pagesize) {
+        ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                      "ring of access_log \"%V\" is too small "
+                      "for %ui worker processes", &shm_zone->shm.name, n);
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < n; i++) {
+        buf = &sh->bufs[i];
+
+        buf->data = ngx_slab_alloc(shpool, size);
+        if (buf->data == NULL) {
+            return NGX_ERROR;
+        }
+
+        buf->head = 0;
+        buf->tail = 0;
+        buf->drops = 0;
+        buf->size = size;
+
+        /* positions wrap at a multiple of size, so offsets stay continuous */
+
+        buf->limit = ((ngx_atomic_uint_t) -1 / size - 1) * size;
+    }
+
+    return NGX_OK;
+}
+
+
+u_char *
+ngx_log_ring_alloc(ngx_log_ring_t *ring, size_t len)
+{
+    size_t               need, skip, off;
+    ngx_atomic_uint_t    head, tail, pos;
+    ngx_log_ring_rec_t  *rec;
+    ngx_log_ring_buf_t  *buf;
+
+    buf = &ring->sh->bufs[ngx_worker % ring->sh->nbufs];
+
+    need = ngx_align(sizeof(ngx_log_ring_rec_t) + len,
+                     sizeof(ngx_atomic_uint_t));
+
+    if (need > buf->size / 2 || len > NGX_LOG_RING_BUFFER_SIZE) {
+        goto drop;
+    }
+
+    /*
+     * a ring normally has a single producer, but during reconfiguration
+     * the old and the new worker with the same number share it,
+     * so space is reserved with compare-and-set
+     */
+
+    for ( ;; ) {
+        tail = buf->tail;
+        ngx_memory_barrier();
+        head = buf->head;
+
+        off = head % buf->size;
+        skip = (buf->size - off < need) ? buf->size - off : 0;
+
+        if (ngx_log_ring_fill(buf, head, tail) + skip + need > buf->size) {
+            goto drop;
+        }
+
+        if (ngx_atomic_cmp_set(&buf->head, head,
+                               ngx_log_ring_next(buf, head, skip + need)))
+        {
+            break;
+        }
+    }
+
+    if (skip >= sizeof(ngx_log_ring_rec_t)) {
+
+        /* padding up to the end of the ring */
+
+        rec = (ngx_log_ring_rec_t *) (buf->data + off);
+
+        rec->size = skip;
+        rec->len = 0;
+        ngx_memory_barrier();
+        rec->pos = head;
+    }
+
+    pos = ngx_log_ring_next(buf, head, skip);
+
+    rec = (ngx_log_ring_rec_t *) (buf->data + pos % buf->size);
+
+    /*
+     * the record becomes visible to the writer
+     * once its pos matches the ring position
+     */
+
+    rec->size = need;
+    rec->pid = ngx_pid;
+    ngx_memory_barrier();
+    rec->pos = ~pos;
+
+    return (u_char *) rec + sizeof(ngx_log_ring_rec_t);
+
+drop:
+
+    (void) ngx_atomic_fetch_add(&buf->drops, 1);
+
+    return NULL;
+}
+
+
+void
+ngx_log_ring_commit(u_char *p, size_t len)
+{
+    ngx_log_ring_rec_t  *rec;
+
+    rec = (ngx_log_ring_rec_t *) (p - sizeof(ngx_log_ring_rec_t));
+
+    rec->len = len;
+    ngx_memory_barrier();
+    rec->pos = ~rec->pos;
+}
+
+
+ngx_uint_t
+ngx_log_ring_used(ngx_cycle_t *cycle)
+{
+    ngx_uint_t        i;
+    ngx_shm_zone_t   *shm_zone;
+    ngx_list_part_t  *part;
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].tag == (void *) ngx_log_ring_add) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+void
+ngx_log_ring_stop(ngx_cycle_t *cycle)
+{
+    ngx_uint_t          i, n;
+    ngx_log_ring_t     *ring;
+    ngx_shm_zone_t     *shm_zone;
+    ngx_list_part_t    *part;
+    ngx_log_ring_sh_t  *sh;
+
+    /*
+     * the rings are shared with workers of a new configuration,
+     * so an exiting writer only drains records appended before now
+     */
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].tag != (void *) ngx_log_ring_add) {
+            continue;
+        }
+
+        ring = shm_zone[i].data;
+        sh = ring->sh;
+
+        if (ring->stop == NULL) {
+            ring->stop = ngx_alloc(sh->nbufs * sizeof(ngx_atomic_uint_t),
+                                   cycle->log);
+            if (ring->stop == NULL) {
+                continue;
+            }
+        }
+
+        for (n = 0; n < sh->nbufs; n++) {
+            ring->stop[n] = sh->bufs[n].head;
+        }
+    }
+}
+
+
+size_t
+ngx_log_ring_write(ngx_cycle_t *cycle)
+{
+    size_t               total;
+    ngx_uint_t           i, n;
+    ngx_atomic_uint_t    drops, head, tail;
+    ngx_log_ring_buf_t  *buf;
+    ngx_log_ring_t      *ring;
+    ngx_shm_zone_t      *shm_zone;
+    ngx_list_part_t     *part;
+    ngx_log_ring_sh_t   *sh;
+
+    if (ngx_log_ring_buffer == NULL) {
+        ngx_log_ring_buffer = ngx_alloc(NGX_LOG_RING_BUFFER_SIZE, cycle->log);
+        if (ngx_log_ring_buffer == NULL) {
+            return 0;
+        }
+    }
+
+    total = 0;
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].tag != (void *) ngx_log_ring_add) {
+            continue;
+        }
+
+        ring = shm_zone[i].data;
+        sh = ring->sh;
+
+        /* the writer of the previous configuration may still be draining */
+
+        if (!ngx_shmtx_trylock(&ring->shpool->mutex)) {
+            continue;
+        }
+
+        drops = 0;
+
+        for (n = 0; n < sh->nbufs; n++) {
+            buf = &sh->bufs[n];
+            drops += buf->drops;
+
+            head = buf->head;
+
+            if (ring->stop) {
+                tail = buf->tail;
+
+                if (ngx_log_ring_fill(buf, ring->stop[n], tail)
+                    > ngx_log_ring_fill(buf, head, tail))
+                {
+                    /* drained past the stop position by another writer */
+                    continue;
+                }
+
+                head = ring->stop[n];
+            }
+
+            total += ngx_log_ring_drain(ring, buf, head, cycle->log);
+        }
+
+        if (drops != sh->reported) {
+            ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                          "%uA records dropped in ring of access_log \"%V\"",
+                          drops - sh->reported, &ring->file->name);
+
+            sh->reported = drops;
+        }
+
+        ngx_shmtx_unlock(&ring->shpool->mutex);
+    }
+
+    return total;
+}
+
+
+static size_t
+ngx_log_ring_drain(ngx_log_ring_t *ring, ngx_log_ring_buf_t *buf,
+    ngx_atomic_uint_t head, ngx_log_t *log)
+{
+    u_char              *p, *last;
+    size_t               off, total;
+    ngx_atomic_uint_t    tail;
+    ngx_log_ring_rec_t  *rec;
+
+    total = 0;
+
+    p = ngx_log_ring_buffer;
+    last = ngx_log_ring_buffer + NGX_LOG_RING_BUFFER_SIZE;
+
+    /* records appended while draining are left for the next pass */
+
+    tail = buf->tail;
+
+    while (tail != head) {
+
+        off = tail % buf->size;
+
+        if (buf->size - off < sizeof(ngx_log_ring_rec_t)) {
+            tail = ngx_log_ring_next(buf, tail, buf->size - off);
+            continue;
+        }
+
+        rec = (ngx_log_ring_rec_t *) (buf->data + off);
+
+        if (rec->pos != tail) {
+
+            if (rec->pos == ~tail && ngx_log_ring_orphaned(rec)) {
+
+                /*
+                 * the process which reserved the record exited before
+                 * committing it, the record is skipped as an empty one
+                 */
+
+                ngx_log_error(NGX_LOG_ALERT, log, 0,
+                              "skipping uncommitted record of exited "
+                              "process %P in ring of access_log \"%V\"",
+                              rec->pid, &ring->file->name);
+
+                (void) ngx_atomic_fetch_add(&buf->drops, 1);
+
+                tail = ngx_log_ring_next(buf, tail, rec->size);
+                continue;
+            }
+
+            /* not committed yet */
+            break;
+        }
+
+        ngx_memory_barrier();
+
+        if (rec->len > (size_t) (last - p)) {
+            total += ngx_log_ring_flush(ring, ngx_log_ring_buffer,
+                                        p - ngx_log_ring_buffer, log);
+            p = ngx_log_ring_buffer;
+
+            ngx_memory_barrier();
+            buf->tail = tail;
+        }
+
+        p = ngx_cpymem(p, (u_char *) rec + sizeof(ngx_log_ring_rec_t),
+                       rec->len);
+
+        tail = ngx_log_ring_next(buf, tail, rec->size);
+    }
+
+    if (p != ngx_log_ring_buffer) {
+        total += ngx_log_ring_flush(ring, ngx_log_ring_buffer,
+                                    p - ngx_log_ring_buffer, log);
+    }
+
+    ngx_memory_barrier();
+    buf->tail = tail;
+
+    return total;
+}
+
+
+static ngx_uint_t
+ngx_log_ring_orphaned(ngx_log_ring_rec_t *rec)
+{
+#if !(NGX_WIN32)
+
+    if (kill(rec->pid, 0) == -1 && ngx_errno == NGX_ESRCH) {
+        return 1;
+    }
+
+#endif
+
+    return 0;
+}
+
+
+static size_t
+ngx_log_ring_flush(ngx_log_ring_t *ring, u_char *buf, size_t len,
+    ngx_log_t *log)
+{
+    time_t   now;
+    ssize_t  n;
+
+    n = ngx_write_fd(ring->file->fd, buf, len);
+
+    if (n == (ssize_t) len) {
+        return len;
+    }
+
+    now = ngx_time();
+
+    if (now - ring->error_log_time > 59) {
+
+        if (n == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_write_fd_n " to \"%V\" failed",
+                          &ring->file->name);
+
+        } else {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          ngx_write_fd_n " to \"%V\" was incomplete: "
+                          "%z of %uz", &ring->file->name, n, len);
+        }
+
+        ring->error_log_time = now;
+    }
+
+    return len;
+}
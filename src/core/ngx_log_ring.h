@@ -0,0 +1,31 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_LOG_RING_H_INCLUDED_
+#define _NGX_LOG_RING_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_LOG_RING_EXIT_TIME  5000
+
+
+typedef struct ngx_log_ring_s  ngx_log_ring_t;
+
+
+ngx_log_ring_t *ngx_log_ring_add(ngx_conf_t *cf, ngx_open_file_t *file,
+    size_t size);
+u_char *ngx_log_ring_alloc(ngx_log_ring_t *ring, size_t len);
+void ngx_log_ring_commit(u_char *p, size_t len);
+
+ngx_uint_t ngx_log_ring_used(ngx_cycle_t *cycle);
+void ngx_log_ring_stop(ngx_cycle_t *cycle);
+size_t ngx_log_ring_write(ngx_cycle_t *cycle);
+
+
+#endif /* _NGX_LOG_RING_H_INCLUDED_ */
@@ -0,0 +1,678 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_METRICS_BUFFER_SIZE  (64 * 1024)
+
+
+/* entries of a block start at the next cache line after its header */
+
+#define ngx_metrics_block_size                                                \
+    ngx_align(sizeof(ngx_metrics_block_t), ngx_cacheline_size)
+
+#define ngx_metrics_block(data)                                               \
+    ((ngx_metrics_block_t *) ((data) - ngx_metrics_block_size))
+
+
+typedef struct ngx_metrics_block_s  ngx_metrics_block_t;
+
+struct ngx_metrics_block_s {
+    ngx_metrics_block_t       *next;
+};
+
+
+typedef struct {
+    u_char                    *current;
+    ngx_metrics_block_t       *retired;
+} ngx_metrics_sh_t;
+
+
+typedef struct {
+    ngx_pool_t                *pool;
+    ngx_chain_t               *out;
+    ngx_chain_t              **last;
+    ngx_buf_t                 *buf;
+} ngx_metrics_ctx_t;
+
+
+static ngx_int_t ngx_metrics_init_zone(ngx_shm_zone_t *shm_zone, void *data);
+static void ngx_metrics_sweep(ngx_slab_pool_t *shpool, ngx_metrics_sh_t *sh,
+    u_char *live);
+static ngx_uint_t ngx_metrics_compatible(ngx_metrics_t *om, ngx_metrics_t *m);
+static ngx_int_t ngx_metrics_export_family(ngx_metrics_ctx_t *ctx,
+    ngx_metrics_t *m, ngx_metrics_family_t *f);
+static u_char *ngx_metrics_reserve(ngx_metrics_ctx_t *ctx, size_t len);
+static u_char *ngx_metrics_name(u_char *p, ngx_metrics_desc_t *d, char *suffix,
+    ngx_str_t *labels);
+static u_char *ngx_metrics_separator(u_char *p);
+static u_char *ngx_metrics_value(u_char *p, uint64_t value, ngx_uint_t unit);
+
+
+ngx_metrics_t *
+ngx_metrics_add(ngx_conf_t *cf, ngx_str_t *name, size_t size)
+{
+    ngx_metrics_t   *m;
+    ngx_shm_zone_t  *shm_zone;
+
+    if (size && size < 8 * ngx_pagesize) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "metrics zone \"%V\" is too small", name);
+        return NULL;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, name, size, (void *) ngx_metrics_add);
+    if (shm_zone == NULL) {
+        return NULL;
+    }
+
+    if (shm_zone->data) {
+        return shm_zone->data;
+    }
+
+    m = ngx_pcalloc(cf->pool, sizeof(ngx_metrics_t));
+    if (m == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&m->families, cf->pool, 4,
+                       sizeof(ngx_metrics_family_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    m->name = *name;
+    m->cycle = cf->cycle;
+
+    shm_zone->init = ngx_metrics_init_zone;
+    shm_zone->data = m;
+
+    return m;
+}
+
+
+ngx_metrics_family_t *
+ngx_metrics_add_family(ngx_conf_t *cf, ngx_metrics_t *m,
+    ngx_metrics_desc_t *desc, size_t size)
+{
+    ngx_metrics_family_t  *f, **fp;
+
+    f = ngx_pcalloc(cf->pool, sizeof(ngx_metrics_family_t));
+    if (f == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&f->labels, cf->pool, 16, sizeof(ngx_str_t)) != NGX_OK) {
+        return NULL;
+    }
+
+    f->desc = desc;
+    f->size = ngx_align(size, sizeof(uint64_t));
+
+    fp = ngx_array_push(&m->families);
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    *fp = f;
+
+    return f;
+}
+
+
+ngx_int_t
+ngx_metrics_add_entry(ngx_conf_t *cf, ngx_metrics_family_t *f,
+    ngx_keyval_t *labels, ngx_uint_t n)
+{
+    u_char      *p, *v, *last;
+    size_t       len;
+    ngx_str_t   *s;
+    ngx_uint_t   i;
+
+    len = 0;
+
+    for (i = 0; i < n; i++) {
+        len += labels[i].key.len + sizeof(",=\"\"") - 1
+               + 2 * labels[i].value.len;
+    }
+
+    p = ngx_pnalloc(cf->pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    last = p;
+
+    for (i = 0; i < n; i++) {
+
+        if (i) {
+            *last++ = ',';
+        }
+
+        last = ngx_sprintf(last, "%V=\"", &labels[i].key);
+
+        /* label values are escaped as per the text exposition format */
+
+        for (v = labels[i].value.data;
+             v < labels[i].value.data + labels[i].value.len;
+             v++)
+        {
+            switch (*v) {
+
+            case '\\':
+            case '"':
+                *last++ = '\\';
+                *last++ = *v;
+                break;
+
+            case LF:
+                *last++ = '\\';
+                *last++ = 'n';
+                break;
+
+            default:
+                *last++ = *v;
+            }
+        }
+
+        *last++ = '"';
+    }
+
+    len = last - p;
+
+    s = f->labels.elts;
+
+    for (i = 0; i < f->labels.nelts; i++) {
+        if (s[i].len == len && ngx_strncmp(s[i].data, p, len) == 0) {
+            return i;
+        }
+    }
+
+    s = ngx_array_push(&f->labels);
+    if (s == NULL) {
+        return NGX_ERROR;
+    }
+
+    s->len = len;
+    s->data = p;
+
+    return f->labels.nelts - 1;
+}
+
+
+static ngx_int_t
+ngx_metrics_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_metrics_t  *om = data;
+
+    u_char                 *p;
+    size_t                  len, size;
+    ngx_uint_t              i;
+    ngx_metrics_t          *m;
+    ngx_core_conf_t        *ccf;
+    ngx_slab_pool_t        *shpool;
+    ngx_metrics_sh_t       *sh;
+    ngx_metrics_block_t    *block;
+    ngx_metrics_family_t  **fp;
+
+    m = shm_zone->data;
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    m->shpool = shpool;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(m->cycle->conf_ctx,
+                                           ngx_core_module);
+
+    m->workers = ccf->worker_processes > 0 ? ccf->worker_processes : 1;
+
+    /*
+     * each worker process has its own block of entries, aligned
+     * to a cache line so that workers never write to the same lines
+     */
+
+    fp = m->families.elts;
+
+    for (i = 0; i < m->families.nelts; i++) {
+        fp[i]->offset = m->worker_size;
+        m->worker_size += fp[i]->labels.nelts * fp[i]->size;
+    }
+
+    m->worker_size = ngx_align(m->worker_size, ngx_cacheline_size);
+
+    if (shpool->data == NULL) {
+        len = sizeof(" in metrics zone \"\"") + shm_zone->shm.name.len;
+
+        shpool->log_ctx = ngx_slab_alloc(shpool, len);
+        if (shpool->log_ctx == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_sprintf(shpool->log_ctx, " in metrics zone \"%V\"%Z",
+                    &shm_zone->shm.name);
+
+        sh = ngx_slab_calloc(shpool, sizeof(ngx_metrics_sh_t));
+        if (sh == NULL) {
+            return NGX_ERROR;
+        }
+
+        shpool->data = sh;
+    }
+
+    sh = shpool->data;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    if (om && sh->current && sh->current != om->data) {
+        /* allocated for a configuration which failed to load */
+        ngx_slab_free_locked(shpool, ngx_metrics_block(sh->current));
+    }
+
+    if (om && om->data && ngx_metrics_compatible(om, m)) {
+
+        /*
+         * counters survive reloads which do not change the set of entries;
+         * increments made by an exiting worker and its replacement
+         * at the same time may occasionally be lost
+         */
+
+        ngx_metrics_sweep(shpool, sh, om->data);
+        sh->current = om->data;
+
+        ngx_shmtx_unlock(&shpool->mutex);
+
+        m->data = om->data;
+        m->workers = om->workers;
+
+        return NGX_OK;
+    }
+
+    /*
+     * worker processes of the previous configuration write counters
+     * to its block until they exit, so the block is only retired here
+     */
+
+    ngx_metrics_sweep(shpool, sh, om ? om->data : NULL);
+
+    if (om && om->data) {
+        block = ngx_metrics_block(om->data);
+        block->next = sh->retired;
+        sh->retired = block;
+    }
+
+    sh->current = NULL;
+
+    size = m->workers * m->worker_size;
+
+    if (size == 0) {
+        ngx_shmtx_unlock(&shpool->mutex);
+        return NGX_OK;
+    }
+
+    p = ngx_slab_alloc_locked(shpool, ngx_metrics_block_size + size);
+
+    if (p) {
+        p += ngx_metrics_block_size;
+        sh->current = p;
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    if (p == NULL) {
+        ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                      "metrics zone \"%V\" is too small for %uz bytes",
+                      &shm_zone->shm.name, size);
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(p, size);
+
+    m->data = p;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_metrics_sweep(ngx_slab_pool_t *shpool, ngx_metrics_sh_t *sh, u_char *live)
+{
+    ngx_int_t             i;
+    ngx_uint_t            exiting;
+    ngx_metrics_block_t  *block, **bp;
+
+    /*
+     * retired blocks are freed once no worker processes of previous
+     * configurations are left; a block in use again is taken off the list
+     */
+
+    exiting = 0;
+
+    for (i = 0; i < ngx_last_process; i++) {
+        if (ngx_processes[i].pid != -1 && ngx_processes[i].exiting) {
+            exiting = 1;
+            break;
+        }
+    }
+
+    bp = &sh->retired;
+
+    while (*bp) {
+        block = *bp;
+
+        if (live && ngx_metrics_block(live) == block) {
+            *bp = block->next;
+            continue;
+        }
+
+        if (exiting) {
+            bp = &block->next;
+            continue;
+        }
+
+        *bp = block->next;
+        ngx_slab_free_locked(shpool, block);
+    }
+}
+
+
+static ngx_uint_t
+ngx_metrics_compatible(ngx_metrics_t *om, ngx_metrics_t *m)
+{
+    ngx_str_t              *os, *s;
+    ngx_uint_t              i, j;
+    ngx_metrics_family_t  **ofp, **fp;
+
+    if (om->worker_size != m->worker_size
+        || om->workers < m->workers
+        || om->families.nelts != m->families.nelts)
+    {
+        return 0;
+    }
+
+    ofp = om->families.elts;
+    fp = m->families.elts;
+
+    for (i = 0; i < m->families.nelts; i++) {
+
+        if (ofp[i]->size != fp[i]->size
+            || ofp[i]->labels.nelts != fp[i]->labels.nelts
+            || ngx_strcmp(ofp[i]->desc->name, fp[i]->desc->name) != 0)
+        {
+            return 0;
+        }
+
+        os = ofp[i]->labels.elts;
+        s = fp[i]->labels.elts;
+
+        for (j = 0; j < fp[i]->labels.nelts; j++) {
+            if (os[j].len != s[j].len
+                || ngx_strncmp(os[j].data, s[j].data, s[j].len) != 0)
+            {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+
+ngx_chain_t *
+ngx_metrics_export(ngx_metrics_t *m, ngx_pool_t *pool)
+{
+    ngx_uint_t              i;
+    ngx_metrics_ctx_t       ctx;
+    ngx_metrics_family_t  **fp;
+
+    ctx.pool = pool;
+    ctx.out = NULL;
+    ctx.last = &ctx.out;
+    ctx.buf = NULL;
+
+    if (ngx_metrics_reserve(&ctx, 0) == NULL) {
+        return NULL;
+    }
+
+    if (m->data == NULL) {
+        return ctx.out;
+    }
+
+    fp = m->families.elts;
+
+    for (i = 0; i < m->families.nelts; i++) {
+        if (ngx_metrics_export_family(&ctx, m, fp[i]) != NGX_OK) {
+            return NULL;
+        }
+    }
+
+    return ctx.out;
+}
+
+
+static ngx_int_t
+ngx_metrics_export_family(ngx_metrics_ctx_t *ctx, ngx_metrics_t *m,
+    ngx_metrics_family_t *f)
+{
+    u_char              *p, *entry;
+    size_t               len;
+    uint64_t             value, total, upper;
+    ngx_str_t           *labels;
+    ngx_uint_t           i, j, w, max;
+    ngx_metrics_desc_t  *d;
+    ngx_metrics_hist_t   hist, *h;
+
+    labels = f->labels.elts;
+
+    for (d = f->desc; d->name; d++) {
+
+        if (f->labels.nelts == 0) {
+            break;
+        }
+
+        if (d == f->desc || ngx_strcmp(d->name, d[-1].name) != 0) {
+            len = 2 * ngx_strlen(d->name) + ngx_strlen(d->help)
+                  + sizeof("# HELP  \n# TYPE  histogram\n") - 1;
+
+            p = ngx_metrics_reserve(ctx, len);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            p = ngx_sprintf(p, "# HELP %s %s\n# TYPE %s %s\n",
+                            d->name, d->help, d->name,
+                            d->type == NGX_METRICS_HISTOGRAM
+                            ? "histogram" : "counter");
+
+            ctx->buf->last = p;
+        }
+
+        for (i = 0; i < f->labels.nelts; i++) {
+
+            len = ngx_strlen(d->name) + sizeof("_bucket{,,le=\"\"} \n") - 1
+                  + labels[i].len + (d->label ? ngx_strlen(d->label) : 0)
+                  + 2 * NGX_INT64_LEN;
+
+            if (d->type == NGX_METRICS_COUNTER) {
+
+                value = 0;
+
+                for (w = 0; w < m->workers; w++) {
+                    entry = m->data + w * m->worker_size + f->offset
+                            + i * f->size;
+                    value += *(uint64_t *) (entry + d->offset);
+                }
+
+                p = ngx_metrics_reserve(ctx, len);
+                if (p == NULL) {
+                    return NGX_ERROR;
+                }
+
+                p = ngx_metrics_name(p, d, "", &labels[i]);
+                p = ngx_sprintf(p, "} %uL\n", value);
+
+                ctx->buf->last = p;
+
+                continue;
+            }
+
+            ngx_memzero(&hist, sizeof(ngx_metrics_hist_t));
+
+            for (w = 0; w < m->workers; w++) {
+                entry = m->data + w * m->worker_size + f->offset
+                        + i * f->size;
+                h = (ngx_metrics_hist_t *) (entry + d->offset);
+
+                hist.count += h->count;
+                hist.sum += h->sum;
+
+                for (j = 0; j < NGX_METRICS_BUCKETS; j++) {
+                    hist.bucket[j] += h->bucket[j];
+                }
+            }
+
+            /*
+             * buckets are exported up to the highest one used, so the set
+             * of buckets of a histogram only grows between scrapes
+             */
+
+            max = 0;
+
+            for (j = 0; j < NGX_METRICS_BUCKETS; j++) {
+                if (hist.bucket[j]) {
+                    max = j + 1;
+                }
+            }
+
+            /* the last bucket also counts larger values, it is only "+Inf" */
+
+            max = ngx_min(max, NGX_METRICS_BUCKETS - 1);
+
+            p = ngx_metrics_reserve(ctx, (max + 3) * len);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            total = 0;
+
+            for (j = 0; j < max; j++) {
+
+                if (j < 2) {
+                    upper = j;
+
+                } else {
+                    upper = ((uint64_t) (3 + (j & 1)) << (j / 2 - 1)) - 1;
+                }
+
+                total += hist.bucket[j];
+
+                p = ngx_metrics_name(p, d, "_bucket", &labels[i]);
+                p = ngx_metrics_separator(p);
+                p = ngx_cpymem(p, "le=\"", sizeof("le=\"") - 1);
+                p = ngx_metrics_value(p, upper, d->unit);
+                p = ngx_sprintf(p, "\"} %uL\n", total);
+            }
+
+            p = ngx_metrics_name(p, d, "_bucket", &labels[i]);
+            p = ngx_metrics_separator(p);
+            p = ngx_sprintf(p, "le=\"+Inf\"} %uL\n", hist.count);
+
+            p = ngx_metrics_name(p, d, "_sum", &labels[i]);
+            p = ngx_cpymem(p, "} ", 2);
+            p = ngx_metrics_value(p, hist.sum, d->unit);
+            *p++ = LF;
+
+            p = ngx_metrics_name(p, d, "_count", &labels[i]);
+            p = ngx_sprintf(p, "} %uL\n", hist.count);
+
+            ctx->buf->last = p;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static u_char *
+ngx_metrics_reserve(ngx_metrics_ctx_t *ctx, size_t len)
+{
+    size_t        size;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    b = ctx->buf;
+
+    if (b && (size_t) (b->end - b->last) >= len) {
+        return b->last;
+    }
+
+    size = ngx_max(len, NGX_METRICS_BUFFER_SIZE);
+
+    b = ngx_create_temp_buf(ctx->pool, size);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    cl = ngx_alloc_chain_link(ctx->pool);
+    if (cl == NULL) {
+        return NULL;
+    }
+
+    cl->buf = b;
+    cl->next = NULL;
+
+    *ctx->last = cl;
+    ctx->last = &cl->next;
+    ctx->buf = b;
+
+    return b->last;
+}
+
+
+static u_char *
+ngx_metrics_name(u_char *p, ngx_metrics_desc_t *d, char *suffix,
+    ngx_str_t *labels)
+{
+    p = ngx_sprintf(p, "%s%s{%V", d->name, suffix, labels);
+
+    if (d->label) {
+        p = ngx_metrics_separator(p);
+        p = ngx_sprintf(p, "%s", d->label);
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_metrics_separator(u_char *p)
+{
+    /* an entry of a family may have no labels */
+
+    if (p[-1] != '{') {
+        *p++ = ',';
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_metrics_value(u_char *p, uint64_t value, ngx_uint_t unit)
+{
+    switch (unit) {
+
+    case NGX_METRICS_MSEC:
+        return ngx_sprintf(p, "%uL.%03uL", value / 1000, value % 1000);
+
+    case NGX_METRICS_USEC:
+        return ngx_sprintf(p, "%uL.%06uL", value / 1000000, value % 1000000);
+    }
+
+    return ngx_sprintf(p, "%uL", value);
+}
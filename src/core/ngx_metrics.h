@@ -0,0 +1,133 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_METRICS_H_INCLUDED_
+#define _NGX_METRICS_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_METRICS_BUCKETS    64
+
+#define NGX_METRICS_COUNTER    0
+#define NGX_METRICS_HISTOGRAM  1
+
+/* units of histogram values exported in seconds */
+#define NGX_METRICS_MSEC       1
+#define NGX_METRICS_USEC       2
+
+
+/*
+ * log-linear histogram: values 0 and 1 have their own buckets,
+ * each further power of two is split into two buckets, and values
+ * starting from 2^32 are counted in the last bucket
+ */
+
+typedef struct {
+    uint64_t                   count;
+    uint64_t                   sum;
+    uint64_t                   bucket[NGX_METRICS_BUCKETS];
+} ngx_metrics_hist_t;
+
+
+typedef struct {
+    char                      *name;
+    char                      *help;
+    char                      *label;      /* constant label, e.g. code="2xx" */
+    ngx_uint_t                 type;
+    ngx_uint_t                 unit;
+    size_t                     offset;
+} ngx_metrics_desc_t;
+
+
+typedef struct {
+    ngx_metrics_desc_t        *desc;       /* terminated by a null name */
+    size_t                     size;
+    size_t                     offset;     /* in a worker block */
+    ngx_array_t                labels;     /* of ngx_str_t */
+} ngx_metrics_family_t;
+
+
+typedef struct {
+    u_char                    *data;
+    size_t                     worker_size;
+    ngx_uint_t                 workers;
+
+    ngx_array_t                families;   /* of ngx_metrics_family_t * */
+
+    ngx_str_t                  name;
+    ngx_slab_pool_t           *shpool;
+    ngx_cycle_t               *cycle;
+} ngx_metrics_t;
+
+
+/* per-worker blocks are only written by their own worker, without atomics */
+
+#define ngx_metrics_entry(m, f, i)                                            \
+    ((m)->data + ngx_worker * (m)->worker_size + (f)->offset                  \
+     + (i) * (f)->size)
+
+
+ngx_metrics_t *ngx_metrics_add(ngx_conf_t *cf, ngx_str_t *name, size_t size);
+ngx_metrics_family_t *ngx_metrics_add_family(ngx_conf_t *cf, ngx_metrics_t *m,
+    ngx_metrics_desc_t *desc, size_t size);
+ngx_int_t ngx_metrics_add_entry(ngx_conf_t *cf, ngx_metrics_family_t *f,
+    ngx_keyval_t *labels, ngx_uint_t n);
+ngx_chain_t *ngx_metrics_export(ngx_metrics_t *m, ngx_pool_t *pool);
+
+
+static ngx_inline void
+ngx_metrics_observe(ngx_metrics_hist_t *h, uint64_t value)
+{
+    uint64_t    v, n;
+    ngx_uint_t  e;
+
+    h->count++;
+    h->sum += value;
+
+    if (value < 2) {
+        h->bucket[value]++;
+        return;
+    }
+
+    v = (value < 0xffffffff) ? value : 0xffffffff;
+
+    /* e is the index of the most significant bit */
+
+    n = v;
+    e = 0;
+
+    if (n >> 16) {
+        n >>= 16;
+        e += 16;
+    }
+
+    if (n >> 8) {
+        n >>= 8;
+        e += 8;
+    }
+
+    if (n >> 4) {
+        n >>= 4;
+        e += 4;
+    }
+
+    if (n >> 2) {
+        n >>= 2;
+        e += 2;
+    }
+
+    if (n >> 1) {
+        e += 1;
+    }
+
+    h->bucket[2 * e + ((v >> (e - 1)) & 1)]++;
+}
+
+
+#endif /* _NGX_METRICS_H_INCLUDED_ */
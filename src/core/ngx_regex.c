@@ -27,6 +27,13 @@ static void ngx_libc_cdecl ngx_regex_free(void *p);
 #endif
 static void ngx_regex_cleanup(void *data);
 
+#if (NGX_PCRE2)
+static ngx_int_t ngx_regex_set_pattern(ngx_str_t *pattern, u_char **dst);
+static ngx_int_t ngx_regex_compile_set_part(ngx_regex_set_t *set,
+    ngx_pool_t *pool, ngx_regex_set_elt_t *elts, ngx_uint_t lo,
+    ngx_uint_t hi);
+#endif
+
 static ngx_int_t ngx_regex_module_init(ngx_cycle_t *cycle);
 
 static void *ngx_regex_create_conf(ngx_cycle_t *cycle);
@@ -495,6 +502,441 @@ ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log)
 }
 
 
+ngx_regex_set_t *
+ngx_regex_compile_set(ngx_pool_t *pool, ngx_regex_set_elt_t *elts,
+    ngx_uint_t n)
+{
+    ngx_uint_t             i, last;
+    ngx_regex_set_t       *set;
+    ngx_regex_set_part_t  *part;
+
+    set = ngx_palloc(pool, sizeof(ngx_regex_set_t));
+    if (set == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&set->parts, pool, 4, sizeof(ngx_regex_set_part_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    for (i = 0; i < n; i = last) {
+
+#if (NGX_PCRE2)
+
+        for (last = i; last < n; last++) {
+            if (ngx_regex_set_pattern(&elts[last].pattern, NULL) != NGX_OK) {
+                break;
+            }
+        }
+
+        if (last - i > 1) {
+            if (ngx_regex_compile_set_part(set, pool, elts, i, last) != NGX_OK)
+            {
+                return NULL;
+            }
+
+            continue;
+        }
+
+#endif
+
+        last = i + 1;
+
+        part = ngx_array_push(&set->parts);
+        if (part == NULL) {
+            return NULL;
+        }
+
+        part->regex = elts[i].regex;
+        part->index = i;
+    }
+
+    return set;
+}
+
+
+ngx_int_t
+ngx_regex_exec_set(ngx_regex_set_t *set, ngx_str_t *s)
+{
+    ngx_int_t              rc;
+    ngx_uint_t             i;
+    ngx_regex_set_part_t  *part;
+#if (NGX_PCRE2)
+    PCRE2_SPTR             mark;
+#endif
+
+    part = set->parts.elts;
+
+    for (i = 0; i < set->parts.nelts; i++) {
+
+        if (part[i].index >= 0) {
+            rc = ngx_regex_exec(part[i].regex, s, NULL, 0);
+
+            if (rc == NGX_REGEX_NO_MATCHED) {
+                continue;
+            }
+
+            return (rc < 0) ? rc : part[i].index;
+        }
+
+#if (NGX_PCRE2)
+
+        ngx_regex_malloc_init(NULL);
+
+        if (ngx_regex_match_data == NULL) {
+            ngx_regex_match_data_size = 0;
+            ngx_regex_match_data = pcre2_match_data_create(0, NULL);
+
+            if (ngx_regex_match_data == NULL) {
+                ngx_regex_malloc_done();
+                return PCRE2_ERROR_NOMEMORY;
+            }
+        }
+
+        rc = pcre2_match(part[i].regex, s->data, s->len, 0, 0,
+                         ngx_regex_match_data, NULL);
+
+        ngx_regex_malloc_done();
+
+        if (rc == NGX_REGEX_NO_MATCHED) {
+            continue;
+        }
+
+        if (rc < 0) {
+            return rc;
+        }
+
+        mark = pcre2_get_mark(ngx_regex_match_data);
+        if (mark == NULL) {
+            return PCRE2_ERROR_INTERNAL;
+        }
+
+        return ngx_atoi((u_char *) mark, ngx_strlen(mark));
+
+#endif
+    }
+
+    return NGX_REGEX_NO_MATCHED;
+}
+
+
+#if (NGX_PCRE2)
+
+/*
+ * Patterns are combined as "\A(?:(?s:.*?)(?:p0)(*:0)|(?s:.*?)(?:p1)(*:1)...)",
+ * so the first alternative that matches anywhere in the string wins, and
+ * its mark is the pattern index.  Anchored patterns are used without
+ * the leading ".*?".  Captures are not needed to select the pattern, so
+ * groups are copied as non-capturing ones, which keeps backtracking frames
+ * small.  Patterns with backreferences, recursion, conditions, verbs,
+ * comments, or quoting are matched on their own.
+ *
+ * The function only checks the pattern if "dst" is NULL, otherwise it
+ * copies the pattern to *dst, which should have 3 bytes per pattern byte.
+ */
+
+static ngx_int_t
+ngx_regex_set_pattern(ngx_str_t *pattern, u_char **dst)
+{
+    u_char      *p, *q, *d, *last;
+    ngx_uint_t   class;
+
+    p = pattern->data;
+    last = p + pattern->len;
+    d = dst ? *dst : NULL;
+    class = 0;
+
+    while (p < last) {
+
+        if (*p == '\\') {
+            if (last - p < 2) {
+                return NGX_DECLINED;
+            }
+
+            if ((p[1] >= '0' && p[1] <= '9')
+                || p[1] == 'g' || p[1] == 'k' || p[1] == 'Q')
+            {
+                return NGX_DECLINED;
+            }
+
+            q = p + 2;
+            goto copy;
+        }
+
+        if (class) {
+            q = p + 1;
+
+            if (*p == '[' && q < last && *q == ':') {
+
+                /* POSIX class name */
+
+                for (q++; q < last - 1; q++) {
+                    if (q[0] == ':' && q[1] == ']') {
+                        break;
+                    }
+                }
+
+                if (q == last - 1) {
+                    return NGX_DECLINED;
+                }
+
+                q += 2;
+
+            } else if (*p == ']') {
+                class = 0;
+            }
+
+            goto copy;
+        }
+
+        if (*p == '[') {
+            q = p + 1;
+
+            if (q < last && *q == '^') {
+                q++;
+            }
+
+            if (q < last && *q == ']') {
+                q++;
+            }
+
+            class = 1;
+            goto copy;
+        }
+
+        if (*p != '(') {
+            q = p + 1;
+            goto copy;
+        }
+
+        q = p + 1;
+
+        if (q == last || *q == '*') {
+            return NGX_DECLINED;
+        }
+
+        if (*q != '?') {
+
+            /* capturing group */
+
+            p = q;
+            goto group;
+        }
+
+        if (++q == last) {
+            return NGX_DECLINED;
+        }
+
+        switch (*q) {
+
+        case '<':
+            if (last - q > 1 && (q[1] == '=' || q[1] == '!')) {
+                break;
+            }
+
+            goto named;
+
+        case '\'':
+            goto named;
+
+        case 'P':
+            if (last - q > 1 && q[1] == '<') {
+                q++;
+                goto named;
+            }
+
+            return NGX_DECLINED;
+
+        case '#':
+        case '&':
+        case '(':
+        case 'C':
+        case 'R':
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            return NGX_DECLINED;
+
+        case '+':
+        case '-':
+            if (last - q > 1 && q[1] >= '0' && q[1] <= '9') {
+                return NGX_DECLINED;
+            }
+
+            break;
+        }
+
+        /* inline options, extended syntax allows comments */
+
+        for ( /* void */ ; q < last; q++) {
+
+            if (*q == 'x') {
+                return NGX_DECLINED;
+            }
+
+            if (!((*q >= 'a' && *q <= 'z') || (*q >= 'A' && *q <= 'Z')
+                  || *q == '-' || *q == '^'))
+            {
+                break;
+            }
+        }
+
+        q = p + 2;
+        goto copy;
+
+    named:
+
+        for (q++; q < last; q++) {
+            if (*q == '>' || *q == '\'') {
+                break;
+            }
+        }
+
+        if (q == last) {
+            return NGX_DECLINED;
+        }
+
+        p = q + 1;
+
+    group:
+
+        if (d) {
+            d = ngx_cpymem(d, "(?:", 3);
+        }
+
+        continue;
+
+    copy:
+
+        if (d) {
+            d = ngx_cpymem(d, p, q - p);
+        }
+
+        p = q;
+    }
+
+    if (class) {
+        return NGX_DECLINED;
+    }
+
+    if (dst) {
+        *dst = d;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_regex_compile_set_part(ngx_regex_set_t *set, ngx_pool_t *pool,
+    ngx_regex_set_elt_t *elts, ngx_uint_t lo, ngx_uint_t hi)
+{
+    u_char                *p;
+    size_t                 len;
+    uint32_t               options;
+    ngx_uint_t             i, mid;
+    ngx_regex_set_part_t  *part;
+    ngx_regex_compile_t    rc;
+    u_char                 errstr[NGX_MAX_CONF_ERRSTR];
+
+    if (hi - lo == 1) {
+        part = ngx_array_push(&set->parts);
+        if (part == NULL) {
+            return NGX_ERROR;
+        }
+
+        part->regex = elts[lo].regex;
+        part->index = lo;
+
+        return NGX_OK;
+    }
+
+    len = sizeof("\\A(?:)") - 1;
+
+    for (i = lo; i < hi; i++) {
+        len += sizeof("|(?s:.*?)(?im:)(*:)") - 1 + NGX_INT_T_LEN
+               + 3 * elts[i].pattern.len;
+    }
+
+    p = ngx_pnalloc(pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&rc, sizeof(ngx_regex_compile_t));
+
+    rc.pattern.data = p;
+    rc.pool = pool;
+    rc.err.len = NGX_MAX_CONF_ERRSTR;
+    rc.err.data = errstr;
+
+    p = ngx_cpymem(p, "\\A(?:", sizeof("\\A(?:") - 1);
+
+    for (i = lo; i < hi; i++) {
+
+        if (i != lo) {
+            *p++ = '|';
+        }
+
+        if (pcre2_pattern_info(elts[i].regex, PCRE2_INFO_ALLOPTIONS, &options)
+            < 0)
+        {
+            options = 0;
+        }
+
+        if (!(options & PCRE2_ANCHORED)) {
+            p = ngx_cpymem(p, "(?s:.*?)", sizeof("(?s:.*?)") - 1);
+        }
+
+        *p++ = '(';
+        *p++ = '?';
+
+        if (options & PCRE2_CASELESS) {
+            *p++ = 'i';
+        }
+
+        if (options & PCRE2_MULTILINE) {
+            *p++ = 'm';
+        }
+
+        *p++ = ':';
+
+        (void) ngx_regex_set_pattern(&elts[i].pattern, &p);
+
+        p = ngx_sprintf(p, ")(*:%ui)", i);
+    }
+
+    *p++ = ')';
+
+    rc.pattern.len = p - rc.pattern.data;
+
+    if (ngx_regex_compile(&rc) == NGX_OK) {
+        part = ngx_array_push(&set->parts);
+        if (part == NULL) {
+            return NGX_ERROR;
+        }
+
+        part->regex = rc.regex;
+        part->index = -1;
+
+        return NGX_OK;
+    }
+
+    /* the combined pattern may be too large, split it */
+
+    mid = lo + (hi - lo) / 2;
+
+    if (ngx_regex_compile_set_part(set, pool, elts, lo, mid) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return ngx_regex_compile_set_part(set, pool, elts, mid, hi);
+}
+
+#endif
+
+
 #if (NGX_PCRE2)
 
 static void * ngx_libc_cdecl
@@ -60,6 +60,34 @@ typedef struct {
 } ngx_regex_elt_t;
 
 
+/*
+ * A regex set matches a list of compiled patterns against a string and
+ * returns the index of the first pattern that matches, as sequential
+ * ngx_regex_exec() calls over the list would do.  Runs of patterns
+ * are combined into alternations dispatched by marks, so a miss costs
+ * a single match call per combined part.
+ */
+
+#define NGX_REGEX_SET_MIN      4
+
+
+typedef struct {
+    ngx_regex_t  *regex;
+    ngx_str_t     pattern;
+} ngx_regex_set_elt_t;
+
+
+typedef struct {
+    ngx_regex_t  *regex;
+    ngx_int_t     index;         /* -1 for combined parts */
+} ngx_regex_set_part_t;
+
+
+typedef struct {
+    ngx_array_t   parts;
+} ngx_regex_set_t;
+
+
 void ngx_regex_init(void);
 ngx_int_t ngx_regex_compile(ngx_regex_compile_t *rc);
 
@@ -74,5 +102,11 @@ ngx_int_t ngx_regex_exec(ngx_regex_t *re, ngx_str_t *s, int *captures,
 
 ngx_int_t ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log);
 
+ngx_regex_set_t *ngx_regex_compile_set(ngx_pool_t *pool,
+    ngx_regex_set_elt_t *elts, ngx_uint_t n);
+ngx_int_t ngx_regex_exec_set(ngx_regex_set_t *set, ngx_str_t *s);
+
+#define ngx_regex_exec_set_n   "ngx_regex_exec_set()"
+
 
 #endif /* _NGX_REGEX_H_INCLUDED_ */
@@ -15,6 +15,8 @@
 #define NGX_RESOLVER_TCP_RSIZE  (2 + 65535)
 #define NGX_RESOLVER_TCP_WSIZE  8192
 
+#define NGX_RESOLVER_SHARED_POLL  10
+
 
 typedef struct {
     u_char  ident_hi;
@@ -51,8 +53,43 @@ typedef struct {
 } ngx_resolver_an_t;
 
 
+typedef struct {
+    ngx_rbtree_node_t   node;
+    ngx_queue_t         queue;
+
+    time_t              valid;
+    time_t              updating;
+    uint32_t            ttl;
+
+    u_short             nlen;
+    u_short             cnlen;
+    u_short             naddrs;
+    u_short             naddrs6;
+    u_char              family;
+
+    /* IPv4 addresses, IPv6 addresses, name, cname */
+    u_char              data[1];
+} ngx_resolver_shared_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t        rbtree;
+    ngx_rbtree_node_t   sentinel;
+    ngx_queue_t         queue;
+} ngx_resolver_shared_sh_t;
+
+
+typedef struct {
+    ngx_resolver_shared_sh_t  *sh;
+    ngx_slab_pool_t           *shpool;
+} ngx_resolver_shared_t;
+
+
 #define ngx_resolver_node(n)  ngx_rbtree_data(n, ngx_resolver_node_t, node)
 
+#define ngx_resolver_shared_name(sn)                                          \
+    ((sn)->data + (sn)->naddrs * sizeof(in_addr_t) + (sn)->naddrs6 * 16)
+
 
 static ngx_int_t ngx_udp_connect(ngx_resolver_connection_t *rec);
 static ngx_int_t ngx_tcp_connect(ngx_resolver_connection_t *rec);
@@ -62,6 +99,8 @@ static void ngx_resolver_cleanup(void *data);
 static void ngx_resolver_cleanup_tree(ngx_resolver_t *r, ngx_rbtree_t *tree);
 static ngx_int_t ngx_resolve_name_locked(ngx_resolver_t *r,
     ngx_resolver_ctx_t *ctx, ngx_str_t *name);
+static ngx_int_t ngx_resolver_refresh(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
 static void ngx_resolver_expire(ngx_resolver_t *r, ngx_rbtree_t *tree,
     ngx_queue_t *queue);
 static ngx_int_t ngx_resolver_send_query(ngx_resolver_t *r,
@@ -107,6 +146,7 @@ static ngx_int_t ngx_resolver_set_timeout(ngx_resolver_t *r,
     ngx_resolver_ctx_t *ctx);
 static void ngx_resolver_timeout_handler(ngx_event_t *ev);
 static void ngx_resolver_free_node(ngx_resolver_t *r, ngx_resolver_node_t *rn);
+static void ngx_resolver_free_stale(ngx_resolver_t *r, ngx_resolver_node_t *rn);
 static void *ngx_resolver_alloc(ngx_resolver_t *r, size_t size);
 static void *ngx_resolver_calloc(ngx_resolver_t *r, size_t size);
 static void ngx_resolver_free(ngx_resolver_t *r, void *p);
@@ -121,6 +161,28 @@ static void ngx_resolver_resolve_srv_names(ngx_resolver_ctx_t *ctx,
 static void ngx_resolver_srv_names_handler(ngx_resolver_ctx_t *ctx);
 static ngx_int_t ngx_resolver_cmp_srvs(const void *one, const void *two);
 
+static ngx_int_t ngx_resolver_shared_zone(ngx_conf_t *cf, ngx_resolver_t *r,
+    ngx_str_t *value);
+static ngx_int_t ngx_resolver_shared_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_resolver_shared_node_t *ngx_resolver_shared_lookup_node(
+    ngx_resolver_shared_t *rs, ngx_resolver_node_t *rn, ngx_uint_t family);
+static ngx_int_t ngx_resolver_shared_cmp(ngx_uint_t family, u_char *name,
+    size_t len, ngx_resolver_shared_node_t *sn);
+static void ngx_resolver_shared_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_resolver_shared_lookup(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn, time_t valid);
+static ngx_int_t ngx_resolver_shared_copy(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn, ngx_resolver_shared_node_t *sn);
+static void ngx_resolver_shared_store(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static void ngx_resolver_shared_unlock(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static void ngx_resolver_shared_expire(ngx_resolver_shared_t *rs,
+    ngx_uint_t force);
+static void ngx_resolver_shared_handler(ngx_event_t *ev);
+
 #if (NGX_HAVE_INET6)
 static void ngx_resolver_rbtree_insert_addr6_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
@@ -132,6 +194,7 @@ static ngx_resolver_node_t *ngx_resolver_lookup_addr6(ngx_resolver_t *r,
 ngx_resolver_t *
 ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
 {
+    ngx_int_t                   percent;
     ngx_str_t                   s;
     ngx_url_t                   u;
     ngx_uint_t                  i, j;
@@ -176,6 +239,8 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
     ngx_queue_init(&r->srv_expire_queue);
     ngx_queue_init(&r->addr_expire_queue);
 
+    ngx_queue_init(&r->name_shared_queue);
+
 #if (NGX_HAVE_INET6)
     r->ipv6 = 1;
 
@@ -226,6 +291,51 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
             continue;
         }
 
+        if (ngx_strncmp(names[i].data, "prefetch=", 9) == 0) {
+            s.len = names[i].len - 9;
+            s.data = names[i].data + 9;
+
+            if (s.len && s.data[s.len - 1] == '%') {
+                s.len--;
+            }
+
+            percent = ngx_atoi(s.data, s.len);
+
+            if (percent == NGX_ERROR || percent == 0 || percent > 99) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid parameter: %V", &names[i]);
+                return NULL;
+            }
+
+            r->prefetch = percent;
+
+            continue;
+        }
+
+        if (ngx_strncmp(names[i].data, "stale=", 6) == 0) {
+            s.len = names[i].len - 6;
+            s.data = names[i].data + 6;
+
+            r->stale = ngx_parse_time(&s, 1);
+
+            if (r->stale == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid parameter: %V", &names[i]);
+                return NULL;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(names[i].data, "zone=", 5) == 0) {
+
+            if (ngx_resolver_shared_zone(cf, r, &names[i]) != NGX_OK) {
+                return NULL;
+            }
+
+            continue;
+        }
+
 #if (NGX_HAVE_INET6)
         if (ngx_strncmp(names[i].data, "ipv4=", 5) == 0) {
 
@@ -333,6 +443,10 @@ ngx_resolver_cleanup(void *data)
         ngx_del_timer(r->event);
     }
 
+    if (r->shared_event && r->shared_event->timer_set) {
+        ngx_del_timer(r->shared_event);
+    }
+
     rec = r->connections.elts;
 
     for (i = 0; i < r->connections.nelts; i++) {
@@ -640,8 +754,82 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
         /* ctx can be a list after NGX_RESOLVE_CNAME */
         for (last = ctx; last->next; last = last->next);
 
+        if (rn->stale) {
+
+            /* the name is being refreshed */
+
+            if (ngx_time() <= rn->stale_valid + r->stale) {
+
+                ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0,
+                               "resolve stale");
+
+                last->next = rn->waiting;
+                rn->waiting = NULL;
+
+                /* unlock name mutex */
+
+                do {
+                    ctx->state = NGX_OK;
+                    ctx->valid = ngx_max(rn->stale_valid, ngx_time());
+                    ctx->naddrs = rn->nstale;
+                    ctx->addrs = rn->stale;
+
+                    next = ctx->next;
+
+                    ctx->handler(ctx);
+
+                    ctx = next;
+                } while (ctx);
+
+                return NGX_OK;
+            }
+
+            ngx_resolver_free_stale(r, rn);
+
+            if (rn->query) {
+
+                /* wait for the refresh query */
+
+                if (ngx_resolver_set_timeout(r, ctx) != NGX_OK) {
+                    return NGX_ERROR;
+                }
+
+                last->next = rn->waiting;
+                rn->waiting = ctx;
+                ctx->state = NGX_AGAIN;
+                ctx->async = 1;
+
+                do {
+                    ctx->node = rn;
+                    ctx = ctx->next;
+                } while (ctx);
+
+                return NGX_AGAIN;
+            }
+        }
+
         if (rn->valid >= ngx_time()) {
 
+            if (r->prefetch
+                && ctx->service.len == 0
+                && rn->cnlen == 0
+                && ngx_time() >= rn->valid
+                                 - (time_t) (r->valid ? r->valid : rn->ttl)
+                                   * (time_t) (100 - r->prefetch) / 100)
+            {
+                rc = ngx_resolver_refresh(r, rn);
+
+                if (rc == NGX_ERROR) {
+                    return NGX_ERROR;
+                }
+
+                if (rc == NGX_OK) {
+                    return ngx_resolve_name_locked(r, ctx, name);
+                }
+
+                /* NGX_DONE: updated from the shared zone */
+            }
+
             ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0, "resolve cached");
 
             ngx_queue_remove(&rn->queue);
@@ -767,6 +955,20 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
             return NGX_AGAIN;
         }
 
+        if (r->stale
+            && ctx->service.len == 0
+            && rn->valid
+            && rn->query == NULL
+            && rn->cnlen == 0
+            && ngx_time() <= rn->valid + r->stale)
+        {
+            if (ngx_resolver_refresh(r, rn) == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            return ngx_resolve_name_locked(r, ctx, name);
+        }
+
         ngx_queue_remove(&rn->queue);
 
         /* lock alloc mutex */
@@ -824,10 +1026,72 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
 #if (NGX_HAVE_INET6)
         rn->query6 = NULL;
 #endif
+        rn->stale = NULL;
 
         ngx_rbtree_insert(tree, &rn->node);
     }
 
+    if (r->shm_zone && ctx->service.len == 0) {
+
+        rc = ngx_resolver_shared_lookup(r, rn, 0);
+
+        if (rc == NGX_ERROR) {
+            goto failed;
+        }
+
+        if (rc == NGX_OK) {
+
+            /* resolved by another worker */
+
+            rn->expire = ngx_time() + r->expire;
+
+            ngx_queue_insert_head(expire_queue, &rn->queue);
+
+            return ngx_resolve_name_locked(r, ctx, name);
+        }
+
+        if (rc == NGX_BUSY) {
+
+            /* another worker is resolving the name, wait for its answer */
+
+            rn->query = NULL;
+#if (NGX_HAVE_INET6)
+            rn->query6 = NULL;
+            rn->naddrs6 = 0;
+#endif
+            rn->naddrs = 0;
+            rn->nsrvs = 0;
+
+            if (ngx_resolver_set_timeout(r, ctx) != NGX_OK) {
+                goto failed;
+            }
+
+            if (!r->shared_event->timer_set) {
+                ngx_add_timer(r->shared_event, NGX_RESOLVER_SHARED_POLL);
+            }
+
+            ngx_queue_insert_head(&r->name_shared_queue, &rn->queue);
+
+            rn->code = 0;
+            rn->cnlen = 0;
+            rn->valid = 0;
+            rn->ttl = NGX_MAX_UINT32_VALUE;
+            rn->waiting = ctx;
+
+            ctx->state = NGX_AGAIN;
+            ctx->async = 1;
+
+            do {
+                ctx->node = rn;
+                ctx = ctx->next;
+            } while (ctx);
+
+            return NGX_AGAIN;
+        }
+
+        /* NGX_DECLINED: this worker holds the update lock */
+    }
+
     if (ctx->service.len) {
         rc = ngx_resolver_create_srv_query(r, rn, name);
 
@@ -927,6 +1191,139 @@ failed:
 }
 
 
+static ngx_int_t
+ngx_resolver_refresh(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    ngx_int_t   rc;
+    ngx_str_t   name;
+    ngx_uint_t  naddrs;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolver refresh \"%*s\"", (size_t) rn->nlen, rn->name);
+
+    ngx_queue_remove(&rn->queue);
+
+    if (rn->stale == NULL) {
+
+        naddrs = rn->naddrs;
+#if (NGX_HAVE_INET6)
+        naddrs += rn->naddrs6;
+#endif
+
+        rn->stale = ngx_resolver_export(r, rn, 0);
+        if (rn->stale == NULL) {
+            goto failed;
+        }
+
+        rn->nstale = (u_short) naddrs;
+        rn->stale_valid = rn->valid;
+
+        if (rn->naddrs > 1) {
+            ngx_resolver_free(r, rn->u.addrs);
+        }
+
+#if (NGX_HAVE_INET6)
+        if (rn->naddrs6 > 1) {
+            ngx_resolver_free(r, rn->u6.addrs6);
+        }
+
+        rn->naddrs6 = 0;
+#endif
+
+        rn->naddrs = 0;
+    }
+
+    rn->query = NULL;
+#if (NGX_HAVE_INET6)
+    rn->query6 = NULL;
+#endif
+    rn->code = 0;
+    rn->cnlen = 0;
+    rn->valid = 0;
+    rn->ttl = NGX_MAX_UINT32_VALUE;
+    rn->waiting = NULL;
+
+    if (r->shm_zone) {
+
+        rc = ngx_resolver_shared_lookup(r, rn, rn->stale_valid);
+
+        if (rc == NGX_ERROR) {
+            goto failed;
+        }
+
+        if (rc == NGX_OK) {
+            ngx_resolver_free_stale(r, rn);
+
+            rn->expire = ngx_time() + r->expire;
+
+            ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
+
+            return NGX_DONE;
+        }
+
+        if (rc == NGX_BUSY) {
+
+            if (!r->shared_event->timer_set) {
+                ngx_add_timer(r->shared_event, NGX_RESOLVER_SHARED_POLL);
+            }
+
+            ngx_queue_insert_head(&r->name_shared_queue, &rn->queue);
+
+            return NGX_OK;
+        }
+    }
+
+    name.len = rn->nlen;
+    name.data = rn->name;
+
+    if (ngx_resolver_create_name_query(r, rn, &name) != NGX_OK) {
+        goto failed;
+    }
+
+    rn->last_connection = r->last_connection++;
+    if (r->last_connection == r->connections.nelts) {
+        r->last_connection = 0;
+    }
+
+    rn->naddrs = r->ipv4 ? (u_short) -1 : 0;
+    rn->tcp = 0;
+#if (NGX_HAVE_INET6)
+    rn->naddrs6 = r->ipv6 ? (u_short) -1 : 0;
+    rn->tcp6 = 0;
+#endif
+
+    if (ngx_resolver_send_query(r, rn) != NGX_OK) {
+
+        /* immediately retry once on failure */
+
+        rn->last_connection++;
+        if (rn->last_connection == r->connections.nelts) {
+            rn->last_connection = 0;
+        }
+
+        (void) ngx_resolver_send_query(r, rn);
+    }
+
+    if (ngx_resolver_resend_empty(r)) {
+        ngx_add_timer(r->event, (ngx_msec_t) (r->resend_timeout * 1000));
+    }
+
+    rn->expire = ngx_time() + r->resend_timeout;
+
+    ngx_queue_insert_head(&r->name_resend_queue, &rn->queue);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_rbtree_delete(&r->name_rbtree, &rn->node);
+
+    ngx_resolver_free_node(r, rn);
+
+    return NGX_ERROR;
+}
+
+
 ngx_int_t
 ngx_resolve_addr(ngx_resolver_ctx_t *ctx)
 {
@@ -1063,6 +1460,7 @@ ngx_resolve_addr(ngx_resolver_ctx_t *ctx)
 #if (NGX_HAVE_INET6)
         rn->query6 = NULL;
 #endif
+        rn->stale = NULL;
 
         ngx_rbtree_insert(tree, &rn->node);
     }
@@ -1541,7 +1939,7 @@ ngx_resolver_resend(ngx_resolver_t *r, ngx_rbtree_t *tree, ngx_queue_t *queue)
 
         ngx_queue_remove(q);
 
-        if (rn->waiting) {
+        if (rn->waiting || (rn->stale && now <= rn->stale_valid + r->stale)) {
 
             if (++rn->last_connection == r->connections.nelts) {
                 rn->last_connection = 0;
@@ -2026,7 +2424,7 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
 
         ngx_queue_remove(&rn->queue);
 
-        if (rn->waiting == NULL) {
+        if (rn->waiting == NULL && rn->stale == NULL) {
             ngx_rbtree_delete(&r->name_rbtree, &rn->node);
             ngx_resolver_free_node(r, rn);
             goto next;
@@ -2128,14 +2526,46 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
         }
 #endif
 
-        next = rn->waiting;
-        rn->waiting = NULL;
+        if (rn->stale && ngx_time() <= rn->stale_valid + r->stale) {
 
-        ngx_queue_remove(&rn->queue);
+            /* keep serving the previous answer, the query will be resent */
 
-        ngx_rbtree_delete(&r->name_rbtree, &rn->node);
+            ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0,
+                           "resolver refresh failed: %ui", code);
 
-        /* unlock name mutex */
+            if (rn->naddrs > 1 && rn->naddrs != (u_short) -1) {
+                ngx_resolver_free(r, rn->u.addrs);
+            }
+
+            rn->naddrs = r->ipv4 ? (u_short) -1 : 0;
+            rn->tcp = 0;
+
+#if (NGX_HAVE_INET6)
+            if (rn->naddrs6 > 1 && rn->naddrs6 != (u_short) -1) {
+                ngx_resolver_free(r, rn->u6.addrs6);
+            }
+
+            rn->naddrs6 = r->ipv6 ? (u_short) -1 : 0;
+            rn->tcp6 = 0;
+#endif
+
+            rn->code = 0;
+
+            goto next;
+        }
+
+        next = rn->waiting;
+        rn->waiting = NULL;
+
+        ngx_queue_remove(&rn->queue);
+
+        ngx_rbtree_delete(&r->name_rbtree, &rn->node);
+
+        if (r->shm_zone) {
+            ngx_resolver_shared_unlock(r, rn);
+        }
+
+        /* unlock name mutex */
 
         while (next) {
             ctx = next;
@@ -2447,6 +2877,14 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
 
         ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
 
+        if (rn->stale) {
+            ngx_resolver_free_stale(r, rn);
+        }
+
+        if (r->shm_zone) {
+            ngx_resolver_shared_store(r, rn);
+        }
+
         next = rn->waiting;
         rn->waiting = NULL;
 
@@ -2519,6 +2957,14 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
 
         ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
 
+        if (rn->stale) {
+            ngx_resolver_free_stale(r, rn);
+        }
+
+        if (r->shm_zone) {
+            ngx_resolver_shared_store(r, rn);
+        }
+
         ngx_resolver_free(r, rn->query);
         rn->query = NULL;
 #if (NGX_HAVE_INET6)
@@ -4145,12 +4591,27 @@ ngx_resolver_free_node(ngx_resolver_t *r, ngx_resolver_node_t *rn)
         ngx_resolver_free_locked(r, rn->u.srvs);
     }
 
+    if (rn->stale) {
+        ngx_resolver_free_locked(r, rn->stale->sockaddr);
+        ngx_resolver_free_locked(r, rn->stale);
+    }
+
     ngx_resolver_free_locked(r, rn);
 
     /* unlock alloc mutex */
 }
 
 
+static void
+ngx_resolver_free_stale(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    ngx_resolver_free(r, rn->stale->sockaddr);
+    ngx_resolver_free(r, rn->stale);
+
+    rn->stale = NULL;
+}
+
+
 static void *
 ngx_resolver_alloc(ngx_resolver_t *r, size_t size)
 {
@@ -4739,3 +5200,622 @@ ngx_resolver_cmp_srvs(const void *one, const void *two)
 
     return p1 - p2;
 }
+
+
+static ngx_int_t
+ngx_resolver_shared_zone(ngx_conf_t *cf, ngx_resolver_t *r, ngx_str_t *value)
+{
+    u_char                 *p;
+    ssize_t                 size;
+    ngx_str_t               name, s;
+    ngx_resolver_shared_t  *rs;
+
+    name.data = value->data + 5;
+
+    p = (u_char *) ngx_strlchr(name.data, value->data + value->len, ':');
+
+    if (p == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", value);
+        return NGX_ERROR;
+    }
+
+    name.len = p - name.data;
+
+    s.data = p + 1;
+    s.len = value->data + value->len - s.data;
+
+    size = ngx_parse_size(&s);
+
+    if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", value);
+        return NGX_ERROR;
+    }
+
+    if (size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small", value);
+        return NGX_ERROR;
+    }
+
+    r->shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                        (void *) ngx_resolver_shared_zone);
+    if (r->shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (r->shm_zone->data == NULL) {
+        rs = ngx_pcalloc(cf->pool, sizeof(ngx_resolver_shared_t));
+        if (rs == NULL) {
+            return NGX_ERROR;
+        }
+
+        r->shm_zone->init = ngx_resolver_shared_init_zone;
+        r->shm_zone->data = rs;
+    }
+
+    r->shared_event = ngx_pcalloc(cf->pool, sizeof(ngx_event_t));
+    if (r->shared_event == NULL) {
+        return NGX_ERROR;
+    }
+
+    r->shared_event->handler = ngx_resolver_shared_handler;
+    r->shared_event->data = r;
+    r->shared_event->log = &cf->cycle->new_log;
+    r->shared_event->cancelable = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_resolver_shared_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_resolver_shared_t  *ors = data;
+
+    size_t                  len;
+    ngx_resolver_shared_t  *rs;
+
+    rs = shm_zone->data;
+
+    if (ors) {
+        rs->sh = ors->sh;
+        rs->shpool = ors->shpool;
+
+        return NGX_OK;
+    }
+
+    rs->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        rs->sh = rs->shpool->data;
+
+        return NGX_OK;
+    }
+
+    rs->sh = ngx_slab_alloc(rs->shpool, sizeof(ngx_resolver_shared_sh_t));
+    if (rs->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    rs->shpool->data = rs->sh;
+
+    ngx_rbtree_init(&rs->sh->rbtree, &rs->sh->sentinel,
+                    ngx_resolver_shared_rbtree_insert_value);
+
+    ngx_queue_init(&rs->sh->queue);
+
+    len = sizeof(" in resolver zone \"\"") + shm_zone->shm.name.len;
+
+    rs->shpool->log_ctx = ngx_slab_alloc(rs->shpool, len);
+    if (rs->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(rs->shpool->log_ctx, " in resolver zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    rs->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_resolver_shared_node_t *
+ngx_resolver_shared_lookup_node(ngx_resolver_shared_t *rs,
+    ngx_resolver_node_t *rn, ngx_uint_t family)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_resolver_shared_node_t  *sn;
+
+    node = rs->sh->rbtree.root;
+    sentinel = rs->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (rn->node.key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (rn->node.key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* rn->node.key == node->key */
+
+        sn = (ngx_resolver_shared_node_t *) node;
+
+        rc = ngx_resolver_shared_cmp(family, rn->name, rn->nlen, sn);
+
+        if (rc == 0) {
+            return sn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    /* not found */
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_resolver_shared_cmp(ngx_uint_t family, u_char *name, size_t len,
+    ngx_resolver_shared_node_t *sn)
+{
+    if (family != sn->family) {
+        return (family < sn->family) ? -1 : 1;
+    }
+
+    return ngx_memn2cmp(name, ngx_resolver_shared_name(sn), len, sn->nlen);
+}
+
+
+static void
+ngx_resolver_shared_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t          **p;
+    ngx_resolver_shared_node_t  *sn, *snt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            sn = (ngx_resolver_shared_node_t *) node;
+            snt = (ngx_resolver_shared_node_t *) temp;
+
+            p = (ngx_resolver_shared_cmp(sn->family,
+                                         ngx_resolver_shared_name(sn),
+                                         sn->nlen, snt)
+                 < 0) ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_int_t
+ngx_resolver_shared_lookup(ngx_resolver_t *r, ngx_resolver_node_t *rn,
+    time_t valid)
+{
+    time_t                       now;
+    ngx_int_t                    rc;
+    ngx_uint_t                   family;
+    ngx_resolver_shared_t       *rs;
+    ngx_resolver_shared_node_t  *sn;
+
+    rs = r->shm_zone->data;
+
+    now = ngx_time();
+
+    family = r->ipv4;
+#if (NGX_HAVE_INET6)
+    family |= r->ipv6 << 1;
+#endif
+
+    ngx_shmtx_lock(&rs->shpool->mutex);
+
+    sn = ngx_resolver_shared_lookup_node(rs, rn, family);
+
+    if (sn) {
+        ngx_queue_remove(&sn->queue);
+        ngx_queue_insert_head(&rs->sh->queue, &sn->queue);
+
+        if (sn->valid >= now && sn->valid > valid) {
+            rc = ngx_resolver_shared_copy(r, rn, sn);
+
+            ngx_shmtx_unlock(&rs->shpool->mutex);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_CORE, r->log, 0,
+                           "resolve shared \"%*s\"", (size_t) rn->nlen,
+                           rn->name);
+
+            return rc;
+        }
+
+        if (sn->updating >= now) {
+            ngx_shmtx_unlock(&rs->shpool->mutex);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_CORE, r->log, 0,
+                           "resolve shared \"%*s\" busy", (size_t) rn->nlen,
+                           rn->name);
+
+            return NGX_BUSY;
+        }
+
+        sn->updating = now + r->resend_timeout;
+
+        ngx_shmtx_unlock(&rs->shpool->mutex);
+
+        return NGX_DECLINED;
+    }
+
+    ngx_resolver_shared_expire(rs, 1);
+
+    sn = ngx_slab_alloc_locked(rs->shpool,
+                               offsetof(ngx_resolver_shared_node_t, data)
+                               + rn->nlen);
+    if (sn == NULL) {
+        ngx_shmtx_unlock(&rs->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    sn->node.key = rn->node.key;
+    sn->valid = 0;
+    sn->updating = now + r->resend_timeout;
+    sn->ttl = 0;
+    sn->nlen = rn->nlen;
+    sn->cnlen = 0;
+    sn->naddrs = 0;
+    sn->naddrs6 = 0;
+    sn->family = (u_char) family;
+
+    ngx_memcpy(sn->data, rn->name, rn->nlen);
+
+    ngx_rbtree_insert(&rs->sh->rbtree, &sn->node);
+    ngx_queue_insert_head(&rs->sh->queue, &sn->queue);
+
+    ngx_shmtx_unlock(&rs->shpool->mutex);
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_resolver_shared_copy(ngx_resolver_t *r, ngx_resolver_node_t *rn,
+    ngx_resolver_shared_node_t *sn)
+{
+    u_char  *p;
+
+    p = sn->data;
+
+    rn->naddrs = 0;
+    rn->cnlen = 0;
+#if (NGX_HAVE_INET6)
+    rn->naddrs6 = 0;
+#endif
+
+    if (sn->naddrs == 1) {
+        ngx_memcpy(&rn->u.addr, p, sizeof(in_addr_t));
+
+    } else if (sn->naddrs > 1) {
+        rn->u.addrs = ngx_resolver_dup(r, p, sn->naddrs * sizeof(in_addr_t));
+        if (rn->u.addrs == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    rn->naddrs = sn->naddrs;
+
+    p += sn->naddrs * sizeof(in_addr_t);
+
+#if (NGX_HAVE_INET6)
+    if (sn->naddrs6 == 1) {
+        ngx_memcpy(&rn->u6.addr6, p, 16);
+
+    } else if (sn->naddrs6 > 1) {
+        rn->u6.addrs6 = ngx_resolver_dup(r, p, sn->naddrs6 * 16);
+        if (rn->u6.addrs6 == NULL) {
+            goto failed;
+        }
+    }
+
+    rn->naddrs6 = sn->naddrs6;
+#endif
+
+    p += sn->naddrs6 * 16 + sn->nlen;
+
+    if (sn->cnlen) {
+        rn->u.cname = ngx_resolver_dup(r, p, sn->cnlen);
+        if (rn->u.cname == NULL) {
+            goto failed;
+        }
+
+        rn->cnlen = sn->cnlen;
+    }
+
+    rn->query = NULL;
+#if (NGX_HAVE_INET6)
+    rn->query6 = NULL;
+#endif
+    rn->nsrvs = 0;
+    rn->code = 0;
+    rn->ttl = sn->ttl;
+    rn->valid = sn->valid;
+    rn->waiting = NULL;
+
+    return NGX_OK;
+
+failed:
+
+    if (rn->naddrs > 1) {
+        ngx_resolver_free(r, rn->u.addrs);
+    }
+
+    rn->naddrs = 0;
+
+#if (NGX_HAVE_INET6)
+    if (rn->naddrs6 > 1) {
+        ngx_resolver_free(r, rn->u6.addrs6);
+    }
+
+    rn->naddrs6 = 0;
+#endif
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_resolver_shared_store(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    u_char                      *p;
+    size_t                       size;
+    ngx_uint_t                   family, naddrs, naddrs6;
+    ngx_resolver_shared_t       *rs;
+    ngx_resolver_shared_node_t  *sn, *old;
+
+    rs = r->shm_zone->data;
+
+    family = r->ipv4;
+    naddrs = rn->naddrs;
+    naddrs6 = 0;
+
+#if (NGX_HAVE_INET6)
+    family |= r->ipv6 << 1;
+    naddrs6 = rn->naddrs6;
+#endif
+
+    size = offsetof(ngx_resolver_shared_node_t, data)
+           + naddrs * sizeof(in_addr_t) + naddrs6 * 16
+           + rn->nlen + rn->cnlen;
+
+    ngx_shmtx_lock(&rs->shpool->mutex);
+
+    ngx_resolver_shared_expire(rs, 1);
+
+    sn = ngx_slab_alloc_locked(rs->shpool, size);
+
+    if (sn == NULL) {
+        ngx_resolver_shared_expire(rs, 0);
+
+        sn = ngx_slab_alloc_locked(rs->shpool, size);
+    }
+
+    old = ngx_resolver_shared_lookup_node(rs, rn, family);
+
+    if (sn == NULL) {
+        if (old) {
+            old->updating = 0;
+        }
+
+        ngx_shmtx_unlock(&rs->shpool->mutex);
+
+        ngx_log_error(NGX_LOG_ALERT, r->log, 0,
+                      "could not allocate node%s", rs->shpool->log_ctx);
+        return;
+    }
+
+    sn->node.key = rn->node.key;
+    sn->valid = rn->valid;
+    sn->updating = 0;
+    sn->ttl = rn->ttl;
+    sn->nlen = rn->nlen;
+    sn->cnlen = rn->cnlen;
+    sn->naddrs = (u_short) naddrs;
+    sn->naddrs6 = (u_short) naddrs6;
+    sn->family = (u_char) family;
+
+    p = sn->data;
+
+    if (naddrs == 1) {
+        p = ngx_cpymem(p, &rn->u.addr, sizeof(in_addr_t));
+
+    } else {
+        p = ngx_cpymem(p, rn->u.addrs, naddrs * sizeof(in_addr_t));
+    }
+
+#if (NGX_HAVE_INET6)
+    if (naddrs6 == 1) {
+        p = ngx_cpymem(p, &rn->u6.addr6, 16);
+
+    } else {
+        p = ngx_cpymem(p, rn->u6.addrs6, naddrs6 * 16);
+    }
+#endif
+
+    p = ngx_cpymem(p, rn->name, rn->nlen);
+
+    if (rn->cnlen) {
+        ngx_memcpy(p, rn->u.cname, rn->cnlen);
+    }
+
+    if (old) {
+        ngx_queue_remove(&old->queue);
+        ngx_rbtree_delete(&rs->sh->rbtree, &old->node);
+        ngx_slab_free_locked(rs->shpool, old);
+    }
+
+    ngx_rbtree_insert(&rs->sh->rbtree, &sn->node);
+    ngx_queue_insert_head(&rs->sh->queue, &sn->queue);
+
+    ngx_shmtx_unlock(&rs->shpool->mutex);
+}
+
+
+static void
+ngx_resolver_shared_unlock(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    ngx_uint_t                   family;
+    ngx_resolver_shared_t       *rs;
+    ngx_resolver_shared_node_t  *sn;
+
+    rs = r->shm_zone->data;
+
+    family = r->ipv4;
+#if (NGX_HAVE_INET6)
+    family |= r->ipv6 << 1;
+#endif
+
+    ngx_shmtx_lock(&rs->shpool->mutex);
+
+    sn = ngx_resolver_shared_lookup_node(rs, rn, family);
+
+    if (sn) {
+        sn->updating = 0;
+    }
+
+    ngx_shmtx_unlock(&rs->shpool->mutex);
+}
+
+
+static void
+ngx_resolver_shared_expire(ngx_resolver_shared_t *rs, ngx_uint_t force)
+{
+    time_t                       now;
+    ngx_uint_t                   n;
+    ngx_queue_t                 *q;
+    ngx_resolver_shared_node_t  *sn;
+
+    now = ngx_time();
+
+    /*
+     * force == 1 deletes one or two expired entries
+     * force == 0 deletes oldest entry by force
+     *            and one or two expired entries
+     */
+
+    for (n = force; n < 3; n++) {
+
+        if (ngx_queue_empty(&rs->sh->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&rs->sh->queue);
+
+        sn = ngx_queue_data(q, ngx_resolver_shared_node_t, queue);
+
+        if (sn->updating >= now) {
+            return;
+        }
+
+        if (n != 0 && sn->valid >= now) {
+            return;
+        }
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&rs->sh->rbtree, &sn->node);
+        ngx_slab_free_locked(rs->shpool, sn);
+    }
+}
+
+
+static void
+ngx_resolver_shared_handler(ngx_event_t *ev)
+{
+    ngx_str_t             name;
+    ngx_queue_t           queue, *q;
+    ngx_resolver_t       *r;
+    ngx_resolver_ctx_t   *ctx, *next;
+    ngx_resolver_node_t  *rn;
+
+    r = ev->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0, "resolver shared poll");
+
+    if (ngx_queue_empty(&r->name_shared_queue)) {
+        return;
+    }
+
+    /*
+     * names are moved to a local queue as ngx_resolve_name_locked()
+     * may put them back into the shared queue if still being resolved
+     */
+
+    ngx_queue_init(&queue);
+    ngx_queue_add(&queue, &r->name_shared_queue);
+    ngx_queue_init(&r->name_shared_queue);
+
+    while (!ngx_queue_empty(&queue)) {
+
+        q = ngx_queue_head(&queue);
+
+        rn = ngx_queue_data(q, ngx_resolver_node_t, queue);
+
+        ctx = rn->waiting;
+        rn->waiting = NULL;
+
+        if (ctx == NULL) {
+
+            if (rn->stale && ngx_time() <= rn->stale_valid + r->stale) {
+                (void) ngx_resolver_refresh(r, rn);
+                continue;
+            }
+
+            ngx_queue_remove(q);
+            ngx_rbtree_delete(&r->name_rbtree, &rn->node);
+            ngx_resolver_free_node(r, rn);
+            continue;
+        }
+
+        for (next = ctx; next; next = next->next) {
+            next->node = NULL;
+        }
+
+        name.len = rn->nlen;
+        name.data = rn->name;
+
+        /* removes rn from the local queue */
+
+        (void) ngx_resolve_name_locked(r, ctx, &name);
+    }
+
+    if (!ngx_queue_empty(&r->name_shared_queue)) {
+        ngx_add_timer(ev, NGX_RESOLVER_SHARED_POLL);
+    }
+}
@@ -141,6 +141,11 @@ typedef struct {
 
     ngx_uint_t                last_connection;
 
+    /* previous answer served while the name is being refreshed */
+    ngx_resolver_addr_t      *stale;
+    u_short                   nstale;
+    time_t                    stale_valid;
+
     ngx_resolver_ctx_t       *waiting;
 } ngx_resolver_node_t;
 
@@ -175,6 +180,11 @@ struct ngx_resolver_s {
     ngx_queue_t               srv_expire_queue;
     ngx_queue_t               addr_expire_queue;
 
+    /* names being resolved by another worker through the shared zone */
+    ngx_shm_zone_t           *shm_zone;
+    ngx_event_t              *shared_event;
+    ngx_queue_t               name_shared_queue;
+
     unsigned                  ipv4:1;
 
 #if (NGX_HAVE_INET6)
@@ -189,6 +199,8 @@ struct ngx_resolver_s {
     time_t                    tcp_timeout;
     time_t                    expire;
     time_t                    valid;
+    time_t                    stale;
+    ngx_uint_t                prefetch;
 
     ngx_uint_t                log_level;
 };
@@ -0,0 +1,45 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_SDT_H_INCLUDED_
+#define _NGX_SDT_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/*
+ * statically defined tracing probes of the "nginx" provider,
+ * e.g. "usdt:/path/to/nginx:nginx:http__finalize" in bpftrace;
+ * a disabled probe is a single nop instruction, though its arguments
+ * are still computed, so they should be plain fields and pointers
+ */
+
+#if (NGX_HAVE_SDT)
+
+#include <sys/sdt.h>
+
+#define ngx_sdt_probe1(name, a1)                                              \
+    DTRACE_PROBE1(nginx, name, a1)
+#define ngx_sdt_probe2(name, a1, a2)                                          \
+    DTRACE_PROBE2(nginx, name, a1, a2)
+#define ngx_sdt_probe3(name, a1, a2, a3)                                      \
+    DTRACE_PROBE3(nginx, name, a1, a2, a3)
+#define ngx_sdt_probe4(name, a1, a2, a3, a4)                                  \
+    DTRACE_PROBE4(nginx, name, a1, a2, a3, a4)
+
+#else
+
+#define ngx_sdt_probe1(name, a1)
+#define ngx_sdt_probe2(name, a1, a2)
+#define ngx_sdt_probe3(name, a1, a2, a3)
+#define ngx_sdt_probe4(name, a1, a2, a3, a4)
+
+#endif
+
+
+#endif /* _NGX_SDT_H_INCLUDED_ */
@@ -506,7 +506,7 @@ ngx_devpoll_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
             } else {
                 instance = rev->instance;
 
-                rev->handler(rev);
+                ngx_event_call(rev);
 
                 if (c->fd == -1 || rev->instance != instance) {
                     continue;
@@ -523,7 +523,7 @@ ngx_devpoll_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
                 ngx_post_event(wev, &ngx_posted_events);
 
             } else {
-                wev->handler(wev);
+                ngx_event_call(wev);
             }
         }
     }
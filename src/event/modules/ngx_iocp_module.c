@@ -342,7 +342,7 @@ ngx_iocp_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
                    "iocp event handler: %p", ev->handler);
 
-    ev->handler(ev);
+    ngx_event_call(ev);
 
     return NGX_OK;
 }
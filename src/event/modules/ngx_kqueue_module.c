@@ -675,7 +675,7 @@ ngx_kqueue_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
             continue;
         }
 
-        ev->handler(ev);
+        ngx_event_call(ev);
     }
 
     return NGX_OK;
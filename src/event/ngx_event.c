@@ -155,6 +155,20 @@ static ngx_command_t  ngx_event_core_commands[] = {
       offsetof(ngx_event_conf_t, accept_mutex_delay),
       NULL },
 
+    { ngx_string("stall_threshold"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      0,
+      offsetof(ngx_event_conf_t, stall_threshold),
+      NULL },
+
+    { ngx_string("stall_metrics"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_event_stall_metrics,
+      0,
+      0,
+      NULL },
+
     { ngx_string("debug_connection"),
       NGX_EVENT_CONF|NGX_CONF_TAKE1,
       ngx_event_debug_connection,
@@ -261,6 +275,10 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)
     ngx_event_expire_timers();
 
     ngx_event_process_posted(cycle, &ngx_posted_events);
+
+    if (ngx_event_timed) {
+        ngx_event_stall_iteration(cycle);
+    }
 }
 
 
@@ -676,6 +694,10 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         return NGX_ERROR;
     }
 
+    if (ngx_event_stall_init(cycle) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
     for (m = 0; cycle->modules[m]; m++) {
         if (cycle->modules[m]->type != NGX_EVENT_MODULE) {
             continue;
@@ -1270,6 +1292,9 @@ ngx_event_core_create_conf(ngx_cycle_t *cycle)
     ecf->accept_mutex = NGX_CONF_UNSET;
     ecf->accept_mutex_delay = NGX_CONF_UNSET_MSEC;
     ecf->name = (void *) NGX_CONF_UNSET;
+    ecf->stall_threshold = NGX_CONF_UNSET_MSEC;
+    ecf->stall_metrics = NGX_CONF_UNSET_PTR;
+    ecf->stall_family = NULL;
 
 #if (NGX_DEBUG)
 
@@ -1368,6 +1393,8 @@ ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_value(ecf->multi_accept, 0);
     ngx_conf_init_value(ecf->accept_mutex, 0);
     ngx_conf_init_msec_value(ecf->accept_mutex_delay, 500);
+    ngx_conf_init_msec_value(ecf->stall_threshold, 0);
+    ngx_conf_init_ptr_value(ecf->stall_metrics, NULL);
 
     return NGX_CONF_OK;
 }
@@ -427,18 +427,22 @@ extern ngx_os_io_t  ngx_io;
 
 
 typedef struct {
-    ngx_uint_t    connections;
-    ngx_uint_t    use;
+    ngx_uint_t             connections;
+    ngx_uint_t             use;
 
-    ngx_flag_t    multi_accept;
-    ngx_flag_t    accept_mutex;
+    ngx_flag_t             multi_accept;
+    ngx_flag_t             accept_mutex;
 
-    ngx_msec_t    accept_mutex_delay;
+    ngx_msec_t             accept_mutex_delay;
 
-    u_char       *name;
+    u_char                *name;
+
+    ngx_msec_t             stall_threshold;
+    ngx_metrics_t         *stall_metrics;
+    ngx_metrics_family_t  *stall_family;
 
 #if (NGX_DEBUG)
-    ngx_array_t   debug_connection;
+    ngx_array_t            debug_connection;
 #endif
 } ngx_event_conf_t;
 
@@ -494,6 +498,7 @@ extern ngx_module_t           ngx_event_core_module;
 
 
 void ngx_event_accept(ngx_event_t *ev);
+void ngx_event_handoff(ngx_cycle_t *cycle, ngx_socket_t s);
 ngx_int_t ngx_trylock_accept_mutex(ngx_cycle_t *cycle);
 ngx_int_t ngx_enable_accept_events(ngx_cycle_t *cycle);
 u_char *ngx_accept_log_error(ngx_log_t *log, u_char *buf, size_t len);
@@ -523,6 +528,7 @@ ngx_int_t ngx_send_lowat(ngx_connection_t *c, size_t lowat);
 
 #include <ngx_event_timer.h>
 #include <ngx_event_posted.h>
+#include <ngx_event_stall.h>
 #include <ngx_event_udp.h>
 
 #if (NGX_WIN32)
@@ -340,6 +340,195 @@ ngx_event_accept(ngx_event_t *ev)
 #endif
 }
 
+void
+ngx_event_handoff(ngx_cycle_t *cycle, ngx_socket_t s)
+{
+    socklen_t          socklen, local_socklen;
+    ngx_log_t         *log;
+    ngx_uint_t         i;
+    ngx_event_t       *rev, *wev;
+    ngx_sockaddr_t     sa, local_sa;
+    ngx_listening_t   *ls;
+    ngx_connection_t  *c;
+
+    /*
+     * a keepalive connection passed by a worker process of the previous
+     * generation; it is set up as if it was just accepted on the listening
+     * socket with the same local address
+     */
+
+    local_socklen = sizeof(ngx_sockaddr_t);
+
+    if (getsockname(s, &local_sa.sockaddr, &local_socklen) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      "getsockname() of handed off connection failed");
+        goto failed;
+    }
+
+    socklen = sizeof(ngx_sockaddr_t);
+
+    if (getpeername(s, &sa.sockaddr, &socklen) == -1) {
+        ngx_log_error(NGX_LOG_INFO, cycle->log, ngx_socket_errno,
+                      "getpeername() of handed off connection failed");
+        goto failed;
+    }
+
+    if (local_socklen > (socklen_t) sizeof(ngx_sockaddr_t)) {
+        local_socklen = sizeof(ngx_sockaddr_t);
+    }
+
+    if (socklen > (socklen_t) sizeof(ngx_sockaddr_t)) {
+        socklen = sizeof(ngx_sockaddr_t);
+    }
+
+    ls = cycle->listening.elts;
+
+    for (i = 0; i < cycle->listening.nelts; i++) {
+
+        if (ls[i].connection == NULL || ls[i].type != SOCK_STREAM) {
+            continue;
+        }
+
+        if (ngx_cmp_sockaddr(ls[i].sockaddr, ls[i].socklen,
+                             &local_sa.sockaddr, local_socklen, 1)
+            == NGX_OK)
+        {
+            break;
+        }
+
+        if (ls[i].sockaddr->sa_family == local_sa.sockaddr.sa_family
+            && ngx_inet_wildcard(ls[i].sockaddr)
+            && ngx_inet_get_port(ls[i].sockaddr)
+               == ngx_inet_get_port(&local_sa.sockaddr))
+        {
+            break;
+        }
+    }
+
+    if (i == cycle->listening.nelts) {
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "no listening socket for handed off connection fd:%d",
+                       s);
+        goto failed;
+    }
+
+    ls = &ls[i];
+
+    c = ngx_get_connection(s, cycle->log);
+
+    if (c == NULL) {
+        goto failed;
+    }
+
+    c->type = SOCK_STREAM;
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_active, 1);
+#endif
+
+    c->pool = ngx_create_pool(ls->pool_size, cycle->log);
+    if (c->pool == NULL) {
+        ngx_close_accepted_connection(c);
+        return;
+    }
+
+    c->sockaddr = ngx_palloc(c->pool, socklen);
+    if (c->sockaddr == NULL) {
+        ngx_close_accepted_connection(c);
+        return;
+    }
+
+    ngx_memcpy(c->sockaddr, &sa, socklen);
+
+    log = ngx_palloc(c->pool, sizeof(ngx_log_t));
+    if (log == NULL) {
+        ngx_close_accepted_connection(c);
+        return;
+    }
+
+    /* the socket was made non-blocking by the previous worker process */
+
+    *log = ls->log;
+
+    c->recv = ngx_recv;
+    c->send = ngx_send;
+    c->recv_chain = ngx_recv_chain;
+    c->send_chain = ngx_send_chain;
+
+    c->log = log;
+    c->pool->log = log;
+
+    c->socklen = socklen;
+    c->listening = ls;
+    c->local_sockaddr = ls->sockaddr;
+    c->local_socklen = ls->socklen;
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    if (c->sockaddr->sa_family == AF_UNIX) {
+        c->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+        c->tcp_nodelay = NGX_TCP_NODELAY_DISABLED;
+#if (NGX_SOLARIS)
+        c->sendfile = 0;
+#endif
+    }
+#endif
+
+    rev = c->read;
+    wev = c->write;
+
+    /* a request may have been sent while the connection was in transit */
+
+    rev->ready = 1;
+    wev->ready = 1;
+
+    rev->log = log;
+    wev->log = log;
+
+    c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+
+    c->start_time = ngx_current_msec;
+
+    if (ls->addr_ntop) {
+        c->addr_text.data = ngx_pnalloc(c->pool, ls->addr_text_max_len);
+        if (c->addr_text.data == NULL) {
+            ngx_close_accepted_connection(c);
+            return;
+        }
+
+        c->addr_text.len = ngx_sock_ntop(c->sockaddr, c->socklen,
+                                         c->addr_text.data,
+                                         ls->addr_text_max_len, 0);
+        if (c->addr_text.len == 0) {
+            ngx_close_accepted_connection(c);
+            return;
+        }
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "*%uA handoff on %V fd:%d", c->number, &ls->addr_text, s);
+
+    if (ngx_add_conn && (ngx_event_flags & NGX_USE_EPOLL_EVENT) == 0) {
+        if (ngx_add_conn(c) == NGX_ERROR) {
+            ngx_close_accepted_connection(c);
+            return;
+        }
+    }
+
+    log->data = NULL;
+    log->handler = NULL;
+
+    ls->handler(c);
+
+    return;
+
+failed:
+
+    if (ngx_close_socket(s) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      ngx_close_socket_n " failed");
+    }
+}
+
 
 ngx_int_t
 ngx_trylock_accept_mutex(ngx_cycle_t *cycle)
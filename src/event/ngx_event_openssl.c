@@ -2158,6 +2158,9 @@ ngx_ssl_handshake(ngx_connection_t *c)
         }
 
         c->ssl->handshaked = 1;
+        c->ssl->handshake_time = ngx_current_msec - c->start_time;
+
+        ngx_sdt_probe2(ssl__handshake, c, c->ssl->handshake_time);
 
         return NGX_OK;
     }
@@ -2303,6 +2306,9 @@ ngx_ssl_try_early_data(ngx_connection_t *c)
         }
 
         c->ssl->handshaked = 1;
+        c->ssl->handshake_time = ngx_current_msec - c->start_time;
+
+        ngx_sdt_probe2(ssl__handshake, c, c->ssl->handshake_time);
 
         return NGX_OK;
     }
@@ -128,7 +128,10 @@ struct ngx_ssl_connection_s {
 
     u_char                      early_buf;
 
+    ngx_msec_t                  handshake_time;
+
     unsigned                    handshaked:1;
+    unsigned                    handshake_reported:1;
     unsigned                    handshake_rejected:1;
     unsigned                    renegotiation:1;
     unsigned                    buffer:1;
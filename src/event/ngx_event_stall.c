@@ -0,0 +1,295 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+static uint64_t ngx_event_stall_usec(void);
+static ngx_connection_t *ngx_event_stall_connection(ngx_cycle_t *cycle,
+    ngx_event_t *ev);
+
+
+ngx_uint_t                      ngx_event_timed;
+
+static uint64_t                 ngx_event_stall_threshold;
+static time_t                   ngx_event_stall_logged;
+
+static ngx_event_stall_stat_t   ngx_event_stall_local;
+static ngx_event_stall_stat_t  *ngx_event_stall_stat;
+
+/* the current loop iteration */
+
+static ngx_uint_t               ngx_event_stall_depth;
+static ngx_uint_t               ngx_event_stall_events;
+static uint64_t                 ngx_event_stall_busy;
+static uint64_t                 ngx_event_stall_slowest;
+static ngx_event_handler_pt     ngx_event_stall_handler;
+static ngx_uint_t               ngx_event_stall_reported;
+
+
+static ngx_metrics_desc_t  ngx_event_stall_desc[] = {
+
+    { "nginx_event_loop_iterations_total",
+      "Event loop iterations which called event handlers.", NULL,
+      NGX_METRICS_COUNTER, 0,
+      offsetof(ngx_event_stall_stat_t, iterations) },
+
+    { "nginx_event_handlers_total",
+      "Event handler invocations.", NULL,
+      NGX_METRICS_COUNTER, 0,
+      offsetof(ngx_event_stall_stat_t, handlers) },
+
+    { "nginx_event_loop_stalls_total",
+      "Event loop iterations which exceeded the stall threshold.", NULL,
+      NGX_METRICS_COUNTER, 0,
+      offsetof(ngx_event_stall_stat_t, stalls) },
+
+    { "nginx_event_loop_lag_seconds",
+      "Time spent in event handlers per event loop iteration.", NULL,
+      NGX_METRICS_HISTOGRAM, NGX_METRICS_USEC,
+      offsetof(ngx_event_stall_stat_t, iteration_time) },
+
+    { "nginx_event_handler_seconds",
+      "Time spent in an event handler invocation.", NULL,
+      NGX_METRICS_HISTOGRAM, NGX_METRICS_USEC,
+      offsetof(ngx_event_stall_stat_t, handler_time) },
+
+    { NULL, NULL, NULL, 0, 0, 0 }
+};
+
+
+ngx_int_t
+ngx_event_stall_init(ngx_cycle_t *cycle)
+{
+    ngx_event_conf_t  *ecf;
+
+    ecf = ngx_event_get_conf(cycle->conf_ctx, ngx_event_core_module);
+
+    ngx_event_timed = 0;
+
+    /* cache manager and loader processes share ngx_worker with a worker */
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    if (ecf->stall_threshold == 0 && ecf->stall_metrics == NULL) {
+        return NGX_OK;
+    }
+
+    ngx_event_stall_threshold = (uint64_t) ecf->stall_threshold * 1000;
+
+    if (ecf->stall_metrics) {
+        ngx_event_stall_stat = (ngx_event_stall_stat_t *)
+                      ngx_metrics_entry(ecf->stall_metrics, ecf->stall_family, 0);
+
+    } else {
+        ngx_event_stall_stat = &ngx_event_stall_local;
+    }
+
+    ngx_event_timed = 1;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_event_stall_call(ngx_event_t *ev)
+{
+    uint64_t               start, elapsed;
+    ngx_log_t             *log;
+    ngx_cycle_t           *cycle;
+    ngx_connection_t      *c;
+    ngx_atomic_uint_t      number;
+    ngx_event_handler_pt   handler;
+
+    if (ngx_event_stall_depth) {
+
+        /* a handler running another one is accounted as a whole */
+
+        ev->handler(ev);
+        return;
+    }
+
+    /*
+     * the event may be freed by its handler, so everything needed
+     * to report a stall is saved beforehand
+     */
+
+    cycle = (ngx_cycle_t *) ngx_cycle;
+    handler = ev->handler;
+
+    c = ngx_event_stall_connection(cycle, ev);
+    number = c ? c->number : 0;
+
+    ngx_event_stall_depth = 1;
+
+    start = ngx_event_stall_usec();
+
+    handler(ev);
+
+    elapsed = ngx_event_stall_usec() - start;
+
+    ngx_event_stall_depth = 0;
+
+    ngx_event_stall_events++;
+    ngx_event_stall_busy += elapsed;
+
+    ngx_event_stall_stat->handlers++;
+    ngx_metrics_observe(&ngx_event_stall_stat->handler_time, elapsed);
+
+    if (elapsed > ngx_event_stall_slowest) {
+        ngx_event_stall_slowest = elapsed;
+        ngx_event_stall_handler = handler;
+    }
+
+    if (ngx_event_stall_threshold == 0
+        || elapsed < ngx_event_stall_threshold)
+    {
+        return;
+    }
+
+    ngx_event_stall_reported = 1;
+
+    if (ngx_event_stall_logged == ngx_time()) {
+        return;
+    }
+
+    ngx_event_stall_logged = ngx_time();
+
+    /*
+     * the log of a connection which is still open carries the context,
+     * e.g. the client address and the request line
+     */
+
+    if (c && c->fd != (ngx_socket_t) -1 && c->number == number) {
+        log = c->log;
+
+    } else {
+        log = cycle->log;
+    }
+
+    ngx_log_error(NGX_LOG_WARN, log, 0,
+                  "event loop blocked for %uL.%03uL ms "
+                  "by event handler %p",
+                  elapsed / 1000, elapsed % 1000, handler);
+}
+
+
+void
+ngx_event_stall_iteration(ngx_cycle_t *cycle)
+{
+    uint64_t  busy;
+
+    if (ngx_event_stall_events == 0) {
+        return;
+    }
+
+    busy = ngx_event_stall_busy;
+
+    ngx_event_stall_stat->iterations++;
+    ngx_metrics_observe(&ngx_event_stall_stat->iteration_time, busy);
+
+    if (ngx_event_stall_threshold && busy >= ngx_event_stall_threshold) {
+        ngx_event_stall_stat->stalls++;
+
+        if (!ngx_event_stall_reported
+            && ngx_event_stall_logged != ngx_time())
+        {
+            ngx_event_stall_logged = ngx_time();
+
+            ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                          "event loop blocked for %uL.%03uL ms "
+                          "by %ui event handlers, the slowest %p "
+                          "took %uL.%03uL ms",
+                          busy / 1000, busy % 1000, ngx_event_stall_events,
+                          ngx_event_stall_handler,
+                          ngx_event_stall_slowest / 1000,
+                          ngx_event_stall_slowest % 1000);
+        }
+    }
+
+    ngx_event_stall_events = 0;
+    ngx_event_stall_busy = 0;
+    ngx_event_stall_slowest = 0;
+    ngx_event_stall_handler = NULL;
+    ngx_event_stall_reported = 0;
+}
+
+
+char *
+ngx_event_stall_metrics(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_event_conf_t  *ecf = conf;
+
+    ngx_str_t  *value;
+
+    if (ecf->stall_metrics != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    ecf->stall_metrics = ngx_metrics_add(cf, &value[1], 0);
+    if (ecf->stall_metrics == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ecf->stall_family = ngx_metrics_add_family(cf, ecf->stall_metrics,
+                                               ngx_event_stall_desc,
+                                               sizeof(ngx_event_stall_stat_t));
+    if (ecf->stall_family == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_metrics_add_entry(cf, ecf->stall_family, NULL, 0) == NGX_ERROR) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static uint64_t
+ngx_event_stall_usec(void)
+{
+#if (NGX_HAVE_CLOCK_MONOTONIC)
+    struct timespec  ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    struct timeval   tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+
+static ngx_connection_t *
+ngx_event_stall_connection(ngx_cycle_t *cycle, ngx_event_t *ev)
+{
+    if (ev >= cycle->read_events
+        && ev < cycle->read_events + cycle->connection_n)
+    {
+        return &cycle->connections[ev - cycle->read_events];
+    }
+
+    if (ev >= cycle->write_events
+        && ev < cycle->write_events + cycle->connection_n)
+    {
+        return &cycle->connections[ev - cycle->write_events];
+    }
+
+    return NULL;
+}
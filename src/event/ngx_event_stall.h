@@ -0,0 +1,44 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_EVENT_STALL_H_INCLUDED_
+#define _NGX_EVENT_STALL_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+typedef struct {
+    uint64_t                 iterations;
+    uint64_t                 handlers;
+    uint64_t                 stalls;
+    ngx_metrics_hist_t       iteration_time;     /* usec */
+    ngx_metrics_hist_t       handler_time;       /* usec */
+} ngx_event_stall_stat_t;
+
+
+#define ngx_event_call(ev)                                                    \
+                                                                              \
+    if (ngx_event_timed) {                                                    \
+        ngx_event_stall_call(ev);                                             \
+                                                                              \
+    } else {                                                                  \
+        (ev)->handler(ev);                                                    \
+    }
+
+
+ngx_int_t ngx_event_stall_init(ngx_cycle_t *cycle);
+void ngx_event_stall_call(ngx_event_t *ev);
+void ngx_event_stall_iteration(ngx_cycle_t *cycle);
+char *ngx_event_stall_metrics(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+
+
+extern ngx_uint_t  ngx_event_timed;
+
+
+#endif /* _NGX_EVENT_STALL_H_INCLUDED_ */
@@ -12,6 +12,37 @@
 
 #if !(NGX_WIN32)
 
+#if (NGX_HAVE_RECVMMSG)
+typedef struct mmsghdr  ngx_mmsghdr_t;
+#else
+typedef struct {
+    struct msghdr       msg_hdr;
+    unsigned int        msg_len;
+} ngx_mmsghdr_t;
+#endif
+
+
+#if (NGX_HAVE_ADDRINFO_CMSG && NGX_HAVE_UDP_GRO)
+#define NGX_UDP_RECV_CONTROL  (CMSG_SPACE(sizeof(ngx_addrinfo_t))            \
+                               + CMSG_SPACE(sizeof(int)))
+#elif (NGX_HAVE_ADDRINFO_CMSG)
+#define NGX_UDP_RECV_CONTROL  CMSG_SPACE(sizeof(ngx_addrinfo_t))
+#elif (NGX_HAVE_UDP_GRO)
+#define NGX_UDP_RECV_CONTROL  CMSG_SPACE(sizeof(int))
+#endif
+
+
+#if (NGX_HAVE_ADDRINFO_CMSG || NGX_HAVE_UDP_GRO)
+
+typedef union {
+    struct cmsghdr      cmsg;
+    u_char              data[NGX_UDP_RECV_CONTROL];
+} ngx_udp_recv_control_t;
+
+#endif
+
+
+static ngx_int_t ngx_udp_recv_batch(ngx_connection_t *lc, ngx_log_t *log);
 static void ngx_close_accepted_udp_connection(ngx_connection_t *c);
 static ssize_t ngx_udp_shared_recv(ngx_connection_t *c, u_char *buf,
     size_t size);
@@ -21,27 +52,37 @@ static ngx_connection_t *ngx_lookup_udp_connection(ngx_listening_t *ls,
     struct sockaddr *local_sockaddr, socklen_t local_socklen);
 
 
+/*
+ * datagrams are dispatched synchronously, so the batch buffers
+ * are shared by all UDP listening sockets of a process
+ */
+
+static ngx_mmsghdr_t            ngx_udp_recv_msgs[NGX_UDP_RECV_BATCH];
+static struct iovec             ngx_udp_recv_iovs[NGX_UDP_RECV_BATCH];
+static ngx_sockaddr_t           ngx_udp_recv_sockaddrs[NGX_UDP_RECV_BATCH];
+static u_char                   ngx_udp_recv_buffers[NGX_UDP_RECV_BATCH][65535];
+
+#if (NGX_HAVE_ADDRINFO_CMSG || NGX_HAVE_UDP_GRO)
+static ngx_udp_recv_control_t   ngx_udp_recv_control[NGX_UDP_RECV_BATCH];
+#endif
+
+
 void
 ngx_event_recvmsg(ngx_event_t *ev)
 {
     ssize_t            n;
+    u_char            *buffer;
     ngx_buf_t          buf;
     ngx_log_t         *log;
-    ngx_err_t          err;
     socklen_t          socklen, local_socklen;
     ngx_event_t       *rev, *wev;
-    struct iovec       iov[1];
-    struct msghdr      msg;
-    ngx_sockaddr_t     sa, lsa;
+    struct msghdr     *msg;
+    ngx_sockaddr_t     lsa;
+    ngx_udp_recv_t     rv;
     struct sockaddr   *sockaddr, *local_sockaddr;
     ngx_listening_t   *ls;
     ngx_event_conf_t  *ecf;
     ngx_connection_t  *c, *lc;
-    static u_char      buffer[65535];
-
-#if (NGX_HAVE_ADDRINFO_CMSG)
-    u_char             msg_control[CMSG_SPACE(sizeof(ngx_addrinfo_t))];
-#endif
 
     if (ev->timedout) {
         if (ngx_enable_accept_events((ngx_cycle_t *) ngx_cycle) != NGX_OK) {
@@ -64,52 +105,23 @@ ngx_event_recvmsg(ngx_event_t *ev)
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                    "recvmsg on %V, ready: %d", &ls->addr_text, ev->available);
 
-    do {
-        ngx_memzero(&msg, sizeof(struct msghdr));
-
-        iov[0].iov_base = (void *) buffer;
-        iov[0].iov_len = sizeof(buffer);
-
-        msg.msg_name = &sa;
-        msg.msg_namelen = sizeof(ngx_sockaddr_t);
-        msg.msg_iov = iov;
-        msg.msg_iovlen = 1;
-
-#if (NGX_HAVE_ADDRINFO_CMSG)
-        if (ls->wildcard) {
-            msg.msg_control = &msg_control;
-            msg.msg_controllen = sizeof(msg_control);
-
-            ngx_memzero(&msg_control, sizeof(msg_control));
-        }
-#endif
-
-        n = recvmsg(lc->fd, &msg, 0);
+    ngx_memzero(&rv, sizeof(ngx_udp_recv_t));
 
-        if (n == -1) {
-            err = ngx_socket_errno;
-
-            if (err == NGX_EAGAIN) {
-                ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, err,
-                               "recvmsg() not ready");
-                return;
-            }
-
-            ngx_log_error(NGX_LOG_ALERT, ev->log, err, "recvmsg() failed");
+    do {
+        n = ngx_udp_recvmsg(lc, &rv, &buffer, ev->log);
 
+        if (n == NGX_AGAIN || n == NGX_ERROR) {
             return;
         }
 
-#if (NGX_HAVE_ADDRINFO_CMSG)
-        if (msg.msg_flags & (MSG_TRUNC|MSG_CTRUNC)) {
-            ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
-                          "recvmsg() truncated data");
+        if (n == NGX_DECLINED) {
             continue;
         }
-#endif
 
-        sockaddr = msg.msg_name;
-        socklen = msg.msg_namelen;
+        msg = rv.msg;
+
+        sockaddr = msg->msg_name;
+        socklen = msg->msg_namelen;
 
         if (socklen > (socklen_t) sizeof(ngx_sockaddr_t)) {
             socklen = sizeof(ngx_sockaddr_t);
@@ -123,8 +135,8 @@ ngx_event_recvmsg(ngx_event_t *ev)
              */
 
             socklen = sizeof(struct sockaddr);
-            ngx_memzero(&sa, sizeof(struct sockaddr));
-            sa.sockaddr.sa_family = ls->sockaddr->sa_family;
+            ngx_memzero(sockaddr, sizeof(struct sockaddr));
+            sockaddr->sa_family = ls->sockaddr->sa_family;
         }
 
         local_sockaddr = ls->sockaddr;
@@ -138,9 +150,9 @@ ngx_event_recvmsg(ngx_event_t *ev)
             ngx_memcpy(&lsa, local_sockaddr, local_socklen);
             local_sockaddr = &lsa.sockaddr;
 
-            for (cmsg = CMSG_FIRSTHDR(&msg);
+            for (cmsg = CMSG_FIRSTHDR(msg);
                  cmsg != NULL;
-                 cmsg = CMSG_NXTHDR(&msg, cmsg))
+                 cmsg = CMSG_NXTHDR(msg, cmsg))
             {
                 if (ngx_get_srcaddr_cmsg(cmsg, local_sockaddr) == NGX_OK) {
                     break;
@@ -181,7 +193,7 @@ ngx_event_recvmsg(ngx_event_t *ev)
             rev->ready = 1;
             rev->active = 0;
 
-            rev->handler(rev);
+            ngx_event_call(rev);
 
             if (c->udp) {
                 c->udp->buffer = NULL;
@@ -200,9 +212,14 @@ ngx_event_recvmsg(ngx_event_t *ev)
         ngx_accept_disabled = ngx_cycle->connection_n / 8
                               - ngx_cycle->free_connection_n;
 
+        /*
+         * a failure only drops this datagram, the rest of the batch
+         * may belong to existing connections
+         */
+
         c = ngx_get_connection(lc->fd, ev->log);
         if (c == NULL) {
-            return;
+            goto next;
         }
 
         c->shared = 1;
@@ -216,13 +233,13 @@ ngx_event_recvmsg(ngx_event_t *ev)
         c->pool = ngx_create_pool(ls->pool_size, ev->log);
         if (c->pool == NULL) {
             ngx_close_accepted_udp_connection(c);
-            return;
+            goto next;
         }
 
         c->sockaddr = ngx_palloc(c->pool, socklen);
         if (c->sockaddr == NULL) {
             ngx_close_accepted_udp_connection(c);
-            return;
+            goto next;
         }
 
         ngx_memcpy(c->sockaddr, sockaddr, socklen);
@@ -230,7 +247,7 @@ ngx_event_recvmsg(ngx_event_t *ev)
         log = ngx_palloc(c->pool, sizeof(ngx_log_t));
         if (log == NULL) {
             ngx_close_accepted_udp_connection(c);
-            return;
+            goto next;
         }
 
         *log = ls->log;
@@ -249,7 +266,7 @@ ngx_event_recvmsg(ngx_event_t *ev)
             local_sockaddr = ngx_palloc(c->pool, local_socklen);
             if (local_sockaddr == NULL) {
                 ngx_close_accepted_udp_connection(c);
-                return;
+                goto next;
             }
 
             ngx_memcpy(local_sockaddr, &lsa, local_socklen);
@@ -261,7 +278,7 @@ ngx_event_recvmsg(ngx_event_t *ev)
         c->buffer = ngx_create_temp_buf(c->pool, n);
         if (c->buffer == NULL) {
             ngx_close_accepted_udp_connection(c);
-            return;
+            goto next;
         }
 
         c->buffer->last = ngx_cpymem(c->buffer->last, buffer, n);
@@ -296,7 +313,7 @@ ngx_event_recvmsg(ngx_event_t *ev)
             c->addr_text.data = ngx_pnalloc(c->pool, ls->addr_text_max_len);
             if (c->addr_text.data == NULL) {
                 ngx_close_accepted_udp_connection(c);
-                return;
+                goto next;
             }
 
             c->addr_text.len = ngx_sock_ntop(c->sockaddr, c->socklen,
@@ -304,7 +321,7 @@ ngx_event_recvmsg(ngx_event_t *ev)
                                              ls->addr_text_max_len, 0);
             if (c->addr_text.len == 0) {
                 ngx_close_accepted_udp_connection(c);
-                return;
+                goto next;
             }
         }
 
@@ -330,7 +347,7 @@ ngx_event_recvmsg(ngx_event_t *ev)
 
         if (ngx_insert_udp_connection(c) != NGX_OK) {
             ngx_close_accepted_udp_connection(c);
-            return;
+            goto next;
         }
 
         log->data = NULL;
@@ -344,7 +361,160 @@ ngx_event_recvmsg(ngx_event_t *ev)
             ev->available -= n;
         }
 
-    } while (ev->available);
+    } while (ev->available || ngx_udp_recv_pending(&rv));
+}
+
+
+ssize_t
+ngx_udp_recvmsg(ngx_connection_t *lc, ngx_udp_recv_t *rv, u_char **buf,
+    ngx_log_t *log)
+{
+    ssize_t          n;
+    ngx_int_t        rc;
+    ngx_uint_t       i;
+    struct msghdr   *msg;
+#if (NGX_HAVE_UDP_GRO)
+    struct cmsghdr  *cmsg;
+#endif
+
+    if (rv->pos < rv->last) {
+        goto segment;
+    }
+
+    if (rv->next == rv->count) {
+        rv->next = 0;
+        rv->count = 0;
+
+        rc = ngx_udp_recv_batch(lc, log);
+
+        if (rc == NGX_AGAIN || rc == NGX_ERROR) {
+            return rc;
+        }
+
+        rv->count = rc;
+    }
+
+    i = rv->next++;
+
+    msg = &ngx_udp_recv_msgs[i].msg_hdr;
+    n = ngx_udp_recv_msgs[i].msg_len;
+
+    rv->msg = msg;
+
+#if (NGX_HAVE_ADDRINFO_CMSG)
+    if (msg->msg_flags & (MSG_TRUNC|MSG_CTRUNC)) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0, "recvmsg() truncated data");
+        return NGX_DECLINED;
+    }
+#endif
+
+    *buf = ngx_udp_recv_buffers[i];
+
+    if (n == 0) {
+        return 0;
+    }
+
+    rv->pos = *buf;
+    rv->last = *buf + n;
+    rv->segment = n;
+
+#if (NGX_HAVE_UDP_GRO)
+
+    /* datagrams coalesced by the kernel are split back at gso_size */
+
+    for (cmsg = CMSG_FIRSTHDR(msg);
+         cmsg != NULL;
+         cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            rv->segment = *(int *) CMSG_DATA(cmsg);
+
+            if (rv->segment == 0) {
+                rv->segment = n;
+            }
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                           "recvmsg: gro n:%z segment:%uz", n, rv->segment);
+            break;
+        }
+    }
+
+#endif
+
+segment:
+
+    *buf = rv->pos;
+
+    n = ngx_min((size_t) (rv->last - rv->pos), rv->segment);
+
+    rv->pos += n;
+
+    return n;
+}
+
+
+static ngx_int_t
+ngx_udp_recv_batch(ngx_connection_t *lc, ngx_log_t *log)
+{
+    int             n;
+    ngx_err_t       err;
+    ngx_uint_t      i;
+    struct msghdr  *msg;
+
+    for (i = 0; i < NGX_UDP_RECV_BATCH; i++) {
+        msg = &ngx_udp_recv_msgs[i].msg_hdr;
+
+        ngx_memzero(msg, sizeof(struct msghdr));
+
+        ngx_udp_recv_iovs[i].iov_base = (void *) ngx_udp_recv_buffers[i];
+        ngx_udp_recv_iovs[i].iov_len = sizeof(ngx_udp_recv_buffers[i]);
+
+        msg->msg_name = &ngx_udp_recv_sockaddrs[i];
+        msg->msg_namelen = sizeof(ngx_sockaddr_t);
+        msg->msg_iov = &ngx_udp_recv_iovs[i];
+        msg->msg_iovlen = 1;
+
+#if (NGX_HAVE_ADDRINFO_CMSG || NGX_HAVE_UDP_GRO)
+        msg->msg_control = ngx_udp_recv_control[i].data;
+        msg->msg_controllen = NGX_UDP_RECV_CONTROL;
+
+        ngx_memzero(ngx_udp_recv_control[i].data, NGX_UDP_RECV_CONTROL);
+#endif
+    }
+
+#if (NGX_HAVE_RECVMMSG)
+
+    n = recvmmsg(lc->fd, ngx_udp_recv_msgs, NGX_UDP_RECV_BATCH, 0, NULL);
+
+#else
+
+    n = recvmsg(lc->fd, &ngx_udp_recv_msgs[0].msg_hdr, 0);
+
+    if (n != -1) {
+        ngx_udp_recv_msgs[0].msg_len = n;
+        n = 1;
+    }
+
+#endif
+
+    if (n == -1) {
+        err = ngx_socket_errno;
+
+        if (err == NGX_EAGAIN) {
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, log, err,
+                           "recvmsg() not ready");
+            return NGX_AGAIN;
+        }
+
+        ngx_log_error(NGX_LOG_ALERT, log, err, "recvmsg() failed");
+
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "recvmsg: %d datagrams", n);
+
+    return n;
 }
 
 
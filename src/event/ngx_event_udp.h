@@ -23,6 +23,32 @@
 #endif
 
 
+#if (NGX_HAVE_RECVMMSG)
+#define NGX_UDP_RECV_BATCH  16
+#else
+#define NGX_UDP_RECV_BATCH  1
+#endif
+
+
+/*
+ * the state of a batch of datagrams read with recvmmsg(),
+ * coalesced UDP_GRO datagrams are returned segment by segment
+ */
+
+typedef struct {
+    struct msghdr      *msg;
+    u_char             *pos;
+    u_char             *last;
+    size_t              segment;
+    ngx_uint_t          next;
+    ngx_uint_t          count;
+} ngx_udp_recv_t;
+
+
+#define ngx_udp_recv_pending(rv)                                              \
+    ((rv)->pos < (rv)->last || (rv)->next < (rv)->count)
+
+
 struct ngx_udp_connection_s {
     ngx_rbtree_node_t   node;
     ngx_connection_t   *connection;
@@ -55,6 +81,8 @@ ngx_int_t ngx_get_srcaddr_cmsg(struct cmsghdr *cmsg,
 #endif
 
 void ngx_event_recvmsg(ngx_event_t *ev);
+ssize_t ngx_udp_recvmsg(ngx_connection_t *lc, ngx_udp_recv_t *rv,
+    u_char **buf, ngx_log_t *log);
 ssize_t ngx_sendmsg(ngx_connection_t *c, struct msghdr *msg, int flags);
 void ngx_udp_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
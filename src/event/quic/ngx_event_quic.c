@@ -233,6 +233,7 @@ ngx_quic_new_connection(ngx_connection_t *c, ngx_quic_conf_t *conf,
 {
     ngx_uint_t              i;
     ngx_quic_tp_t          *ctp;
+    ngx_pool_cleanup_t     *cln;
     ngx_quic_connection_t  *qc;
 
     qc = ngx_pcalloc(c->pool, sizeof(ngx_quic_connection_t));
@@ -240,6 +241,16 @@ ngx_quic_new_connection(ngx_connection_t *c, ngx_quic_conf_t *conf,
         return NULL;
     }
 
+    cln = ngx_pool_cleanup_add(c->pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    ngx_queue_init(&qc->blocks);
+
+    cln->handler = ngx_quic_cache_cleanup;
+    cln->data = qc;
+
     qc->keys = ngx_pcalloc(c->pool, sizeof(ngx_quic_keys_t));
     if (qc->keys == NULL) {
         return NULL;
@@ -264,8 +275,6 @@ ngx_quic_new_connection(ngx_connection_t *c, ngx_quic_conf_t *conf,
     qc->send_ctx[1].level = NGX_QUIC_ENCRYPTION_HANDSHAKE;
     qc->send_ctx[2].level = NGX_QUIC_ENCRYPTION_APPLICATION;
 
-    ngx_queue_init(&qc->free_frames);
-
     ngx_quic_init_rtt(qc);
 
     qc->pto.log = c->log;
@@ -311,12 +320,7 @@ ngx_quic_new_connection(ngx_connection_t *c, ngx_quic_conf_t *conf,
     qc->streams.client_max_streams_uni = qc->tp.initial_max_streams_uni;
     qc->streams.client_max_streams_bidi = qc->tp.initial_max_streams_bidi;
 
-    qc->congestion.window = ngx_min(10 * NGX_QUIC_MIN_INITIAL_SIZE,
-                                    ngx_max(2 * NGX_QUIC_MIN_INITIAL_SIZE,
-                                            14720));
-    qc->congestion.ssthresh = (size_t) -1;
-    qc->congestion.mtu = NGX_QUIC_MIN_INITIAL_SIZE;
-    qc->congestion.recovery_start = ngx_current_msec - 1;
+    ngx_quic_init_congestion(qc);
 
     qc->max_frames = (conf->max_concurrent_streams_uni
                       + conf->max_concurrent_streams_bidi)
@@ -38,6 +38,9 @@
 
 #define NGX_QUIC_SR_TOKEN_LEN                16
 
+#define NGX_QUIC_CC_CUBIC                    0
+#define NGX_QUIC_CC_BBR                      1
+
 #define NGX_QUIC_MIN_INITIAL_SIZE            1200
 
 #define NGX_QUIC_STREAM_SERVER_INITIATED     0x01
@@ -82,6 +85,8 @@ typedef struct {
 
     ngx_flag_t                     retry;
     ngx_flag_t                     gso_enabled;
+    ngx_flag_t                     pacing;
+    ngx_flag_t                     idle_compact;
     ngx_flag_t                     disable_active_migration;
     ngx_msec_t                     handshake_timeout;
     ngx_msec_t                     idle_timeout;
@@ -93,6 +98,7 @@ typedef struct {
     ngx_int_t                      stream_close_code;
     ngx_int_t                      stream_reject_code_uni;
     ngx_int_t                      stream_reject_code_bidi;
+    ngx_uint_t                     congestion_control;
 
     ngx_quic_init_pt               init;
     ngx_quic_shutdown_pt           shutdown;
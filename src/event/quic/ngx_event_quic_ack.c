@@ -24,6 +24,13 @@
 #define NGX_QUIC_CUBIC_BETA                  7
 #define NGX_QUIC_CUBIC_C                     4
 
+/* RFC 9002, 7.7. Pacing: N x100, in slow start and afterwards */
+#define NGX_QUIC_PACING_SS_GAIN              200
+#define NGX_QUIC_PACING_GAIN                 125
+/* bursts allowed by pacing, packets and at least rate x time */
+#define NGX_QUIC_PACING_BURST                10
+#define NGX_QUIC_PACING_QUANTUM              2 /* ms */
+
 
 /* send time of ACK'ed packets */
 typedef struct {
@@ -40,7 +47,10 @@ static void ngx_quic_rtt_sample(ngx_connection_t *c, ngx_quic_ack_frame_t *ack,
 static ngx_int_t ngx_quic_handle_ack_frame_range(ngx_connection_t *c,
     ngx_quic_send_ctx_t *ctx, uint64_t min, uint64_t max,
     ngx_quic_ack_stat_t *st);
+static void ngx_quic_cubic_ack(ngx_connection_t *c, ngx_quic_frame_t *f);
 static size_t ngx_quic_congestion_cubic(ngx_connection_t *c);
+static void ngx_quic_cubic_idle(ngx_connection_t *c, ngx_uint_t idle);
+static uint64_t ngx_quic_pacing_rate(ngx_connection_t *c);
 static void ngx_quic_drop_ack_ranges(ngx_connection_t *c,
     ngx_quic_send_ctx_t *ctx, uint64_t pn);
 static ngx_int_t ngx_quic_detect_lost(ngx_connection_t *c,
@@ -48,12 +58,24 @@ static ngx_int_t ngx_quic_detect_lost(ngx_connection_t *c,
 static ngx_msec_t ngx_quic_congestion_cubic_time(ngx_connection_t *c);
 static ngx_msec_t ngx_quic_pcg_duration(ngx_connection_t *c);
 static void ngx_quic_persistent_congestion(ngx_connection_t *c);
+static void ngx_quic_cubic_persistent(ngx_connection_t *c);
 static ngx_msec_t ngx_quic_oldest_sent_packet(ngx_connection_t *c);
 static void ngx_quic_congestion_lost(ngx_connection_t *c,
     ngx_quic_frame_t *frame);
+static void ngx_quic_cubic_lost(ngx_connection_t *c, ngx_quic_frame_t *f);
 static void ngx_quic_lost_handler(ngx_event_t *ev);
 
 
+static ngx_quic_congestion_ops_t  ngx_quic_cubic = {
+    NULL,                                  /* init */
+    NULL,                                  /* sent */
+    ngx_quic_cubic_ack,                    /* ack */
+    ngx_quic_cubic_lost,                   /* lost */
+    ngx_quic_cubic_persistent,             /* persistent */
+    ngx_quic_cubic_idle                    /* idle */
+};
+
+
 /* RFC 9002, 6.1.2. Time Threshold: kTimeThreshold, kGranularity */
 static ngx_inline ngx_msec_t
 ngx_quic_time_threshold(ngx_quic_connection_t *qc)
@@ -96,6 +118,7 @@ ngx_quic_handle_ack_frame(ngx_connection_t *c, ngx_quic_header_t *pkt,
 {
     ssize_t                 n;
     u_char                 *pos, *end;
+    size_t                  in_flight;
     uint64_t                min, max, gap, range;
     ngx_uint_t              i;
     ngx_quic_ack_stat_t     send_time;
@@ -129,6 +152,8 @@ ngx_quic_handle_ack_frame(ngx_connection_t *c, ngx_quic_header_t *pkt,
     min = ack->largest - ack->first_range;
     max = ack->largest;
 
+    in_flight = qc->congestion.in_flight;
+
     send_time.oldest = NGX_TIMER_INFINITE;
     send_time.newest = NGX_TIMER_INFINITE;
 
@@ -201,7 +226,19 @@ ngx_quic_handle_ack_frame(ngx_connection_t *c, ngx_quic_header_t *pkt,
         }
     }
 
-    return ngx_quic_detect_lost(c, &send_time);
+    if (ngx_quic_detect_lost(c, &send_time) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (qc->conf->idle_compact
+        && in_flight
+        && qc->congestion.in_flight == 0)
+    {
+        /* everything sent is acknowledged, connection goes idle */
+        ngx_quic_compact_streams(c);
+    }
+
+    return NGX_OK;
 }
 
 
@@ -341,12 +378,59 @@ ngx_quic_handle_ack_frame_range(ngx_connection_t *c, ngx_quic_send_ctx_t *ctx,
 }
 
 
+void
+ngx_quic_init_congestion(ngx_quic_connection_t *qc)
+{
+    ngx_quic_congestion_t  *cg;
+
+    cg = &qc->congestion;
+
+    ngx_memzero(cg, sizeof(ngx_quic_congestion_t));
+
+    cg->window = ngx_min(10 * NGX_QUIC_MIN_INITIAL_SIZE,
+                         ngx_max(2 * NGX_QUIC_MIN_INITIAL_SIZE, 14720));
+    cg->ssthresh = (size_t) -1;
+    cg->mtu = NGX_QUIC_MIN_INITIAL_SIZE;
+    cg->recovery_start = ngx_current_msec - 1;
+
+    switch (qc->conf->congestion_control) {
+
+    case NGX_QUIC_CC_BBR:
+        cg->ops = &ngx_quic_bbr;
+        break;
+
+    default: /* NGX_QUIC_CC_CUBIC */
+        cg->ops = &ngx_quic_cubic;
+    }
+
+    if (cg->ops->init) {
+        cg->ops->init(qc);
+    }
+}
+
+
+void
+ngx_quic_congestion_sent(ngx_connection_t *c, ngx_quic_frame_t *f)
+{
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+
+    if (cg->ops->sent) {
+        cg->ops->sent(c, f);
+    }
+
+    cg->in_flight += f->plen;
+    cg->pacing_budget -= ngx_min(cg->pacing_budget, f->plen);
+}
+
+
 void
 ngx_quic_congestion_ack(ngx_connection_t *c, ngx_quic_frame_t *f)
 {
-    size_t                  w_cubic;
     ngx_uint_t              blocked;
-    ngx_msec_t              now, timer;
     ngx_quic_congestion_t  *cg;
     ngx_quic_connection_t  *qc;
 
@@ -361,12 +445,31 @@ ngx_quic_congestion_ack(ngx_connection_t *c, ngx_quic_frame_t *f)
         return;
     }
 
-    now = ngx_current_msec;
-
     blocked = (cg->in_flight >= cg->window) ? 1 : 0;
 
     cg->in_flight -= f->plen;
 
+    cg->ops->ack(c, f);
+
+    if (blocked && cg->in_flight < cg->window) {
+        ngx_post_event(&qc->push, &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_quic_cubic_ack(ngx_connection_t *c, ngx_quic_frame_t *f)
+{
+    size_t                  w_cubic;
+    ngx_msec_t              now, timer;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+
+    now = ngx_current_msec;
+
     /* prevent recovery_start from wrapping */
 
     timer = now - cg->recovery_start;
@@ -382,7 +485,7 @@ ngx_quic_congestion_ack(ngx_connection_t *c, ngx_quic_frame_t *f)
                        "quic congestion ack rec t:%M win:%uz if:%uz",
                        now, cg->window, cg->in_flight);
 
-        goto done;
+        return;
     }
 
     if (cg->idle) {
@@ -390,7 +493,7 @@ ngx_quic_congestion_ack(ngx_connection_t *c, ngx_quic_frame_t *f)
                        "quic congestion ack idle t:%M win:%uz if:%uz",
                        now, cg->window, cg->in_flight);
 
-        goto done;
+        return;
     }
 
     if (cg->window < cg->ssthresh) {
@@ -442,12 +545,6 @@ ngx_quic_congestion_ack(ngx_connection_t *c, ngx_quic_frame_t *f)
                            now, cg->window, w_cubic, cg->in_flight);
         }
     }
-
-done:
-
-    if (blocked && cg->in_flight < cg->window) {
-        ngx_post_event(&qc->push, &ngx_posted_events);
-    }
 }
 
 
@@ -462,7 +559,7 @@ ngx_quic_congestion_cubic(ngx_connection_t *c)
     qc = ngx_quic_get_connection(c);
     cg = &qc->congestion;
 
-    ngx_quic_congestion_idle(c, cg->idle);
+    ngx_quic_cubic_idle(c, cg->idle);
 
     now = ngx_current_msec;
     t = (ngx_msec_int_t) (now - cg->k);
@@ -506,16 +603,27 @@ done:
 void
 ngx_quic_congestion_idle(ngx_connection_t *c, ngx_uint_t idle)
 {
-    ngx_msec_t              now;
-    ngx_quic_congestion_t  *cg;
     ngx_quic_connection_t  *qc;
 
     qc = ngx_quic_get_connection(c);
-    cg = &qc->congestion;
 
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
                    "quic congestion idle:%ui", idle);
 
+    qc->congestion.ops->idle(c, idle);
+}
+
+
+static void
+ngx_quic_cubic_idle(ngx_connection_t *c, ngx_uint_t idle)
+{
+    ngx_msec_t              now;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+
     if (cg->window >= cg->ssthresh) {
         /* RFC 9438, 5.8. Behavior for Application-Limited Flows */
 
@@ -532,6 +640,96 @@ ngx_quic_congestion_idle(ngx_connection_t *c, ngx_uint_t idle)
 }
 
 
+size_t
+ngx_quic_pacing_budget(ngx_connection_t *c)
+{
+    size_t                  burst;
+    uint64_t                rate, bytes;
+    ngx_msec_t              now, elapsed;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+
+    if (!qc->conf->pacing) {
+        return NGX_MAX_SIZE_T_VALUE;
+    }
+
+    rate = ngx_quic_pacing_rate(c);
+
+    if (rate == 0) {
+        return NGX_MAX_SIZE_T_VALUE;
+    }
+
+    burst = ngx_max(NGX_QUIC_PACING_BURST * qc->path->mtu,
+                    rate * NGX_QUIC_PACING_QUANTUM / 1000);
+
+    now = ngx_current_msec;
+    elapsed = ngx_min(now - cg->pacing_stamp, 1000);
+
+    bytes = rate * elapsed / 1000;
+
+    if (bytes) {
+        cg->pacing_budget = ngx_min(cg->pacing_budget + bytes, burst);
+        cg->pacing_stamp = now;
+    }
+
+    return ngx_min(cg->pacing_budget, burst);
+}
+
+
+ngx_msec_t
+ngx_quic_pacing_delay(ngx_connection_t *c)
+{
+    size_t                  budget;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+
+    budget = ngx_quic_pacing_budget(c);
+
+    if (budget >= qc->path->mtu) {
+        return 0;
+    }
+
+    return (qc->path->mtu - budget) * 1000 / ngx_quic_pacing_rate(c) + 1;
+}
+
+
+static uint64_t
+ngx_quic_pacing_rate(ngx_connection_t *c)
+{
+    ngx_uint_t              gain;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+
+    if (cg->pacing_rate) {
+        /* set by a rate-based controller */
+        return cg->pacing_rate;
+    }
+
+    if (qc->min_rtt == NGX_TIMER_INFINITE) {
+        /* the initial window is sent unpaced */
+        return 0;
+    }
+
+    /*
+     * RFC 9002, 7.7.  Pacing
+     *
+     *   rate = N * congestion_window / smoothed_rtt
+     */
+
+    gain = (cg->window < cg->ssthresh) ? NGX_QUIC_PACING_SS_GAIN
+                                       : NGX_QUIC_PACING_GAIN;
+
+    return (uint64_t) cg->window * 1000 / ngx_max(qc->avg_rtt, 1) * gain / 100;
+}
+
+
 static void
 ngx_quic_drop_ack_ranges(ngx_connection_t *c, ngx_quic_send_ctx_t *ctx,
     uint64_t pn)
@@ -707,6 +905,17 @@ ngx_quic_pcg_duration(ngx_connection_t *c)
 
 static void
 ngx_quic_persistent_congestion(ngx_connection_t *c)
+{
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+
+    qc->congestion.ops->persistent(c);
+}
+
+
+static void
+ngx_quic_cubic_persistent(ngx_connection_t *c)
 {
     ngx_quic_congestion_t  *cg;
     ngx_quic_connection_t  *qc;
@@ -816,8 +1025,7 @@ ngx_quic_resend_frames(ngx_connection_t *c, ngx_quic_send_ctx_t *ctx)
             break;
 
         case NGX_QUIC_FT_MAX_STREAM_DATA:
-            qs = ngx_quic_find_stream(&qc->streams.tree,
-                                      f->u.max_stream_data.id);
+            qs = ngx_quic_find_stream(qc, f->u.max_stream_data.id);
             if (qs == NULL) {
                 ngx_quic_free_frame(c, f);
                 break;
@@ -828,7 +1036,7 @@ ngx_quic_resend_frames(ngx_connection_t *c, ngx_quic_send_ctx_t *ctx)
             break;
 
         case NGX_QUIC_FT_STREAM:
-            qs = ngx_quic_find_stream(&qc->streams.tree, f->u.stream.stream_id);
+            qs = ngx_quic_find_stream(qc, f->u.stream.stream_id);
 
             if (qs == NULL
                 || qs->send_state == NGX_QUIC_STREAM_SEND_RESET_SENT
@@ -858,7 +1066,6 @@ static void
 ngx_quic_congestion_lost(ngx_connection_t *c, ngx_quic_frame_t *f)
 {
     ngx_uint_t              blocked;
-    ngx_msec_t              now, timer;
     ngx_quic_congestion_t  *cg;
     ngx_quic_connection_t  *qc;
 
@@ -876,8 +1083,27 @@ ngx_quic_congestion_lost(ngx_connection_t *c, ngx_quic_frame_t *f)
     blocked = (cg->in_flight >= cg->window) ? 1 : 0;
 
     cg->in_flight -= f->plen;
+
+    cg->ops->lost(c, f);
+
     f->plen = 0;
 
+    if (blocked && cg->in_flight < cg->window) {
+        ngx_post_event(&qc->push, &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_quic_cubic_lost(ngx_connection_t *c, ngx_quic_frame_t *f)
+{
+    ngx_msec_t              now, timer;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+
     timer = f->send_time - cg->recovery_start;
 
     now = ngx_current_msec;
@@ -887,7 +1113,7 @@ ngx_quic_congestion_lost(ngx_connection_t *c, ngx_quic_frame_t *f)
                        "quic congestion lost rec t:%M win:%uz if:%uz",
                        now, cg->window, cg->in_flight);
 
-        goto done;
+        return;
     }
 
     if (f->ignore_loss) {
@@ -895,7 +1121,7 @@ ngx_quic_congestion_lost(ngx_connection_t *c, ngx_quic_frame_t *f)
                        "quic congestion lost ignore t:%M win:%uz if:%uz",
                        now, cg->window, cg->in_flight);
 
-        goto done;
+        return;
     }
 
     /* RFC 9438, 4.6. Multiplicative Decrease */
@@ -915,12 +1141,6 @@ ngx_quic_congestion_lost(ngx_connection_t *c, ngx_quic_frame_t *f)
     ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
                    "quic congestion lost t:%M win:%uz if:%uz",
                    now, cg->window, cg->in_flight);
-
-done:
-
-    if (blocked && cg->in_flight < cg->window) {
-        ngx_post_event(&qc->push, &ngx_posted_events);
-    }
 }
 
 
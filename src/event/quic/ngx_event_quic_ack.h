@@ -15,9 +15,13 @@
 ngx_int_t ngx_quic_handle_ack_frame(ngx_connection_t *c,
     ngx_quic_header_t *pkt, ngx_quic_frame_t *f);
 
+void ngx_quic_init_congestion(ngx_quic_connection_t *qc);
+void ngx_quic_congestion_sent(ngx_connection_t *c, ngx_quic_frame_t *frame);
 void ngx_quic_congestion_ack(ngx_connection_t *c,
     ngx_quic_frame_t *frame);
 void ngx_quic_congestion_idle(ngx_connection_t *c, ngx_uint_t idle);
+size_t ngx_quic_pacing_budget(ngx_connection_t *c);
+ngx_msec_t ngx_quic_pacing_delay(ngx_connection_t *c);
 void ngx_quic_resend_frames(ngx_connection_t *c, ngx_quic_send_ctx_t *ctx);
 void ngx_quic_set_lost_timer(ngx_connection_t *c);
 void ngx_quic_pto_handler(ngx_event_t *ev);
@@ -0,0 +1,545 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_event_quic_connection.h>
+
+
+/*
+ * BBR congestion control, draft-ietf-ccwg-bbr
+ *
+ * The model is the bottleneck bandwidth, a windowed maximum of delivery
+ * rate samples, and the minimum round-trip time.  The window is kept at
+ * a multiple of their product; as in BBRv2 and later, loss rate above
+ * a threshold within a round trip bounds the volume of data in flight.
+ * Gains are in percent.
+ */
+
+#define NGX_QUIC_BBR_STARTUP                 0
+#define NGX_QUIC_BBR_DRAIN                   1
+#define NGX_QUIC_BBR_PROBE_BW                2
+#define NGX_QUIC_BBR_PROBE_RTT               3
+
+#define NGX_QUIC_BBR_STARTUP_GAIN            277
+#define NGX_QUIC_BBR_DRAIN_GAIN              35
+#define NGX_QUIC_BBR_WINDOW_GAIN             200
+#define NGX_QUIC_BBR_PROBE_RTT_GAIN          50
+
+/* the bandwidth filter covers 5 to 10 round trips */
+#define NGX_QUIC_BBR_BW_ROUNDS               5
+
+#define NGX_QUIC_BBR_FULL_BW_GAIN            125
+#define NGX_QUIC_BBR_FULL_BW_ROUNDS          3
+
+#define NGX_QUIC_BBR_MIN_RTT_WINDOW          10000 /* ms */
+#define NGX_QUIC_BBR_PROBE_RTT_TIME          200   /* ms */
+
+/* loss rate in a round trip, percent, and the minimum lost packets */
+#define NGX_QUIC_BBR_LOSS_THR                2
+#define NGX_QUIC_BBR_LOSS_MIN                3
+
+/* multiplicative decrease of the inflight bound */
+#define NGX_QUIC_BBR_BETA                    70
+
+#define NGX_QUIC_BBR_MIN_WINDOW              4     /* packets */
+#define NGX_QUIC_BBR_QUANTA                  3     /* packets */
+
+
+static void ngx_quic_bbr_init(ngx_quic_connection_t *qc);
+static void ngx_quic_bbr_sent(ngx_connection_t *c, ngx_quic_frame_t *f);
+static void ngx_quic_bbr_ack(ngx_connection_t *c, ngx_quic_frame_t *f);
+static void ngx_quic_bbr_lost(ngx_connection_t *c, ngx_quic_frame_t *f);
+static void ngx_quic_bbr_persistent(ngx_connection_t *c);
+static void ngx_quic_bbr_idle(ngx_connection_t *c, ngx_uint_t idle);
+static void ngx_quic_bbr_update_rtt(ngx_quic_congestion_t *cg,
+    ngx_msec_t rtt);
+static void ngx_quic_bbr_update_bw(ngx_quic_bbr_t *bbr, uint64_t bw,
+    ngx_quic_frame_t *f);
+static void ngx_quic_bbr_update_state(ngx_connection_t *c,
+    ngx_quic_frame_t *f);
+static void ngx_quic_bbr_enter_probe_bw(ngx_quic_bbr_t *bbr);
+static void ngx_quic_bbr_set_window(ngx_connection_t *c, size_t acked);
+static size_t ngx_quic_bbr_bdp(ngx_quic_bbr_t *bbr, ngx_uint_t gain);
+static ngx_uint_t ngx_quic_bbr_pacing_gain(ngx_quic_bbr_t *bbr);
+
+
+ngx_quic_congestion_ops_t  ngx_quic_bbr = {
+    ngx_quic_bbr_init,
+    ngx_quic_bbr_sent,
+    ngx_quic_bbr_ack,
+    ngx_quic_bbr_lost,
+    ngx_quic_bbr_persistent,
+    ngx_quic_bbr_idle
+};
+
+
+static ngx_uint_t  ngx_quic_bbr_cycle[] = {
+    125, 75, 100, 100, 100, 100, 100, 100
+};
+
+
+static void
+ngx_quic_bbr_init(ngx_quic_connection_t *qc)
+{
+    ngx_quic_bbr_t  *bbr;
+
+    bbr = &qc->congestion.bbr;
+
+    bbr->state = NGX_QUIC_BBR_STARTUP;
+    bbr->min_rtt = NGX_TIMER_INFINITE;
+    bbr->min_rtt_stamp = ngx_current_msec;
+    bbr->inflight_hi = (size_t) -1;
+}
+
+
+static void
+ngx_quic_bbr_sent(ngx_connection_t *c, ngx_quic_frame_t *f)
+{
+    ngx_quic_bbr_t         *bbr;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+    bbr = &cg->bbr;
+
+    if (cg->in_flight == 0) {
+        bbr->first_sent_time = f->send_time;
+        bbr->delivered_time = f->send_time;
+    }
+
+    f->delivered = bbr->delivered;
+    f->delivered_time = bbr->delivered_time;
+    f->first_sent_time = bbr->first_sent_time;
+    f->app_limited = bbr->app_limited ? 1 : 0;
+}
+
+
+static void
+ngx_quic_bbr_ack(ngx_connection_t *c, ngx_quic_frame_t *f)
+{
+    uint64_t                bw;
+    ngx_msec_t              now, interval, ack_elapsed;
+    ngx_quic_bbr_t         *bbr;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+    bbr = &cg->bbr;
+
+    now = ngx_current_msec;
+
+    bbr->delivered += f->plen;
+    bbr->delivered_time = now;
+
+    if (bbr->app_limited && bbr->delivered > bbr->app_limited) {
+        bbr->app_limited = 0;
+    }
+
+    bbr->round_start = 0;
+
+    if (f->delivered >= bbr->next_round_delivered) {
+        bbr->next_round_delivered = bbr->delivered;
+        bbr->round_count++;
+        bbr->round_start = 1;
+
+        bbr->round_delivered = bbr->delivered;
+        bbr->round_lost = bbr->lost;
+        bbr->loss_in_round = 0;
+    }
+
+    /*
+     * delivery rate sample, the interval is the longer of the send
+     * and the ack phases to avoid overestimation due to ack compression
+     */
+
+    interval = f->send_time - f->first_sent_time;
+    ack_elapsed = now - f->delivered_time;
+
+    if ((ngx_msec_int_t) ack_elapsed > (ngx_msec_int_t) interval) {
+        interval = ack_elapsed;
+    }
+
+    if ((ngx_msec_int_t) interval <= 0) {
+        interval = 1;
+    }
+
+    bbr->first_sent_time = f->send_time;
+
+    bw = (bbr->delivered - f->delivered) * 1000 / interval;
+
+    ngx_quic_bbr_update_rtt(cg, now - f->send_time);
+    ngx_quic_bbr_update_bw(bbr, bw, f);
+    ngx_quic_bbr_update_state(c, f);
+    ngx_quic_bbr_set_window(c, f->plen);
+
+    ngx_log_debug8(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic bbr ack t:%M state:%ui bw:%uL max:%uL rtt:%M "
+                   "win:%uz hi:%uz if:%uz",
+                   now, bbr->state, bw, bbr->max_bw, bbr->min_rtt,
+                   cg->window, bbr->inflight_hi, cg->in_flight);
+}
+
+
+static void
+ngx_quic_bbr_lost(ngx_connection_t *c, ngx_quic_frame_t *f)
+{
+    size_t                  min, hi;
+    uint64_t                lost, delivered;
+    ngx_quic_bbr_t         *bbr;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+    bbr = &cg->bbr;
+
+    bbr->lost += f->plen;
+
+    if (f->ignore_loss || bbr->loss_in_round) {
+        return;
+    }
+
+    lost = bbr->lost - bbr->round_lost;
+    delivered = bbr->delivered - bbr->round_delivered;
+
+    if (lost < NGX_QUIC_BBR_LOSS_MIN * f->plen
+        || lost * 100 <= (lost + delivered) * NGX_QUIC_BBR_LOSS_THR)
+    {
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "quic bbr lost t:%M win:%uz if:%uz",
+                       ngx_current_msec, cg->window, cg->in_flight);
+        return;
+    }
+
+    /* the loss rate is too high, bound the volume of data in flight */
+
+    bbr->loss_in_round = 1;
+
+    min = NGX_QUIC_BBR_MIN_WINDOW * qc->path->mtu;
+
+    hi = cg->window * NGX_QUIC_BBR_BETA / 100;
+    hi = ngx_max(hi, ngx_quic_bbr_bdp(bbr, 100));
+
+    bbr->inflight_hi = ngx_max(hi, min);
+    cg->window = ngx_min(cg->window, bbr->inflight_hi);
+
+    if (bbr->state == NGX_QUIC_BBR_STARTUP) {
+        bbr->full_bw_reached = 1;
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic bbr lost high t:%M win:%uz hi:%uz if:%uz",
+                   ngx_current_msec, cg->window, bbr->inflight_hi,
+                   cg->in_flight);
+}
+
+
+static void
+ngx_quic_bbr_persistent(ngx_connection_t *c)
+{
+    ngx_quic_bbr_t         *bbr;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+    bbr = &cg->bbr;
+
+    bbr->prior_window = ngx_max(bbr->prior_window, cg->window);
+    cg->window = NGX_QUIC_BBR_MIN_WINDOW * qc->path->mtu;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic bbr persistent t:%M win:%uz",
+                   ngx_current_msec, cg->window);
+}
+
+
+static void
+ngx_quic_bbr_idle(ngx_connection_t *c, ngx_uint_t idle)
+{
+    ngx_quic_bbr_t         *bbr;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+    bbr = &cg->bbr;
+
+    cg->idle = idle;
+
+    if (idle) {
+        /* samples of packets sent until then are application-limited */
+        bbr->app_limited = ngx_max(bbr->delivered + cg->in_flight, 1);
+    }
+}
+
+
+static void
+ngx_quic_bbr_update_rtt(ngx_quic_congestion_t *cg, ngx_msec_t rtt)
+{
+    ngx_msec_t       now;
+    ngx_uint_t       expired;
+    ngx_quic_bbr_t  *bbr;
+
+    bbr = &cg->bbr;
+    now = ngx_current_msec;
+
+    expired = (now - bbr->min_rtt_stamp > NGX_QUIC_BBR_MIN_RTT_WINDOW);
+
+    if (rtt < bbr->min_rtt || expired) {
+        bbr->min_rtt = rtt;
+        bbr->min_rtt_stamp = now;
+    }
+
+    if (expired && !cg->idle && bbr->state != NGX_QUIC_BBR_PROBE_RTT) {
+        bbr->state = NGX_QUIC_BBR_PROBE_RTT;
+        bbr->prior_window = ngx_max(bbr->prior_window, cg->window);
+        bbr->probe_rtt_done = 0;
+        bbr->probe_rtt_round_done = 0;
+    }
+}
+
+
+static void
+ngx_quic_bbr_update_bw(ngx_quic_bbr_t *bbr, uint64_t bw, ngx_quic_frame_t *f)
+{
+    if (bbr->round_count >= bbr->bw_round + NGX_QUIC_BBR_BW_ROUNDS) {
+        bbr->bw[1] = bbr->bw[0];
+        bbr->bw[0] = 0;
+        bbr->bw_round = bbr->round_count;
+    }
+
+    if (!f->app_limited || bw >= bbr->max_bw) {
+        bbr->bw[0] = ngx_max(bbr->bw[0], bw);
+    }
+
+    bbr->max_bw = ngx_max(bbr->bw[0], bbr->bw[1]);
+
+    /* startup ends when bandwidth stops growing for several rounds */
+
+    if (bbr->full_bw_reached || !bbr->round_start || f->app_limited) {
+        return;
+    }
+
+    if (bbr->max_bw * 100 >= bbr->full_bw * NGX_QUIC_BBR_FULL_BW_GAIN) {
+        bbr->full_bw = bbr->max_bw;
+        bbr->full_bw_count = 0;
+        return;
+    }
+
+    if (++bbr->full_bw_count >= NGX_QUIC_BBR_FULL_BW_ROUNDS) {
+        bbr->full_bw_reached = 1;
+    }
+}
+
+
+static void
+ngx_quic_bbr_update_state(ngx_connection_t *c, ngx_quic_frame_t *f)
+{
+    size_t                  in_flight;
+    ngx_msec_t              now, elapsed;
+    ngx_uint_t              gain, next;
+    ngx_quic_bbr_t         *bbr;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+    bbr = &cg->bbr;
+
+    now = ngx_current_msec;
+    in_flight = cg->in_flight;
+
+    switch (bbr->state) {
+
+    case NGX_QUIC_BBR_STARTUP:
+
+        if (bbr->full_bw_reached) {
+            bbr->state = NGX_QUIC_BBR_DRAIN;
+        }
+
+        break;
+
+    case NGX_QUIC_BBR_DRAIN:
+
+        if (in_flight <= ngx_quic_bbr_bdp(bbr, 100)) {
+            ngx_quic_bbr_enter_probe_bw(bbr);
+        }
+
+        break;
+
+    case NGX_QUIC_BBR_PROBE_BW:
+
+        elapsed = now - bbr->cycle_stamp;
+        gain = ngx_quic_bbr_cycle[bbr->cycle_index];
+
+        if (elapsed > bbr->min_rtt) {
+            next = (gain != 125
+                    || bbr->loss_in_round
+                    || in_flight + f->plen >= ngx_quic_bbr_bdp(bbr, 125));
+
+        } else {
+            next = (gain == 75 && in_flight <= ngx_quic_bbr_bdp(bbr, 100));
+        }
+
+        if (next) {
+            bbr->cycle_index = (bbr->cycle_index + 1)
+                               % (sizeof(ngx_quic_bbr_cycle)
+                                  / sizeof(ngx_uint_t));
+            bbr->cycle_stamp = now;
+        }
+
+        /* probing up also raises the inflight bound */
+
+        if (gain == 125
+            && !bbr->loss_in_round
+            && bbr->inflight_hi != (size_t) -1
+            && in_flight + f->plen + qc->path->mtu >= bbr->inflight_hi)
+        {
+            bbr->inflight_hi += f->plen;
+        }
+
+        break;
+
+    default: /* NGX_QUIC_BBR_PROBE_RTT */
+
+        if (bbr->probe_rtt_done == 0) {
+
+            if (in_flight <= ngx_max(ngx_quic_bbr_bdp(bbr,
+                                                  NGX_QUIC_BBR_PROBE_RTT_GAIN),
+                                     NGX_QUIC_BBR_MIN_WINDOW
+                                     * qc->path->mtu))
+            {
+                bbr->probe_rtt_done = now + NGX_QUIC_BBR_PROBE_RTT_TIME;
+                bbr->probe_rtt_round_done = 0;
+                bbr->next_round_delivered = bbr->delivered;
+            }
+
+            break;
+        }
+
+        if (bbr->round_start) {
+            bbr->probe_rtt_round_done = 1;
+        }
+
+        if (bbr->probe_rtt_round_done
+            && (ngx_msec_int_t) (now - bbr->probe_rtt_done) >= 0)
+        {
+            bbr->min_rtt_stamp = now;
+            cg->window = ngx_max(cg->window, bbr->prior_window);
+            bbr->prior_window = 0;
+
+            if (bbr->full_bw_reached) {
+                ngx_quic_bbr_enter_probe_bw(bbr);
+
+            } else {
+                bbr->state = NGX_QUIC_BBR_STARTUP;
+            }
+        }
+    }
+
+    /* until the first bandwidth sample, pacing follows the window */
+
+    cg->pacing_rate = bbr->max_bw * ngx_quic_bbr_pacing_gain(bbr) / 100;
+}
+
+
+static void
+ngx_quic_bbr_enter_probe_bw(ngx_quic_bbr_t *bbr)
+{
+    ngx_uint_t  n;
+
+    bbr->state = NGX_QUIC_BBR_PROBE_BW;
+    bbr->cycle_stamp = ngx_current_msec;
+
+    /* start at a random phase other than draining */
+
+    n = ngx_random() % (sizeof(ngx_quic_bbr_cycle) / sizeof(ngx_uint_t) - 1);
+
+    bbr->cycle_index = (n == 0) ? 0 : n + 1;
+}
+
+
+static void
+ngx_quic_bbr_set_window(ngx_connection_t *c, size_t acked)
+{
+    size_t                  target, min;
+    ngx_quic_bbr_t         *bbr;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+    bbr = &cg->bbr;
+
+    min = NGX_QUIC_BBR_MIN_WINDOW * qc->path->mtu;
+
+    if (bbr->max_bw == 0 || bbr->min_rtt == NGX_TIMER_INFINITE) {
+        cg->window += acked;
+        return;
+    }
+
+    target = ngx_quic_bbr_bdp(bbr, NGX_QUIC_BBR_WINDOW_GAIN)
+             + NGX_QUIC_BBR_QUANTA * qc->path->mtu;
+
+    if (bbr->full_bw_reached) {
+        cg->window = ngx_min(cg->window + acked, target);
+
+    } else if (cg->window < target || bbr->delivered < cg->window) {
+        cg->window += acked;
+    }
+
+    cg->window = ngx_max(cg->window, min);
+
+    if (bbr->inflight_hi != (size_t) -1) {
+        cg->window = ngx_min(cg->window, ngx_max(bbr->inflight_hi, min));
+    }
+
+    if (bbr->state == NGX_QUIC_BBR_PROBE_RTT) {
+        target = ngx_quic_bbr_bdp(bbr, NGX_QUIC_BBR_PROBE_RTT_GAIN);
+        cg->window = ngx_min(cg->window, ngx_max(target, min));
+    }
+}
+
+
+static size_t
+ngx_quic_bbr_bdp(ngx_quic_bbr_t *bbr, ngx_uint_t gain)
+{
+    ngx_msec_t  rtt;
+
+    if (bbr->min_rtt == NGX_TIMER_INFINITE) {
+        return 0;
+    }
+
+    /* millisecond timer resolution */
+    rtt = ngx_max(bbr->min_rtt, 1);
+
+    return bbr->max_bw * rtt / 1000 * gain / 100;
+}
+
+
+static ngx_uint_t
+ngx_quic_bbr_pacing_gain(ngx_quic_bbr_t *bbr)
+{
+    switch (bbr->state) {
+
+    case NGX_QUIC_BBR_STARTUP:
+        return NGX_QUIC_BBR_STARTUP_GAIN;
+
+    case NGX_QUIC_BBR_DRAIN:
+        return NGX_QUIC_BBR_DRAIN_GAIN;
+
+    case NGX_QUIC_BBR_PROBE_BW:
+        return ngx_quic_bbr_cycle[bbr->cycle_index];
+
+    default: /* NGX_QUIC_BBR_PROBE_RTT */
+        return 100;
+    }
+}
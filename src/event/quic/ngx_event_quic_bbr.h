@@ -0,0 +1,55 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_EVENT_QUIC_BBR_H_INCLUDED_
+#define _NGX_EVENT_QUIC_BBR_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+typedef struct {
+    ngx_uint_t                        state;
+    ngx_uint_t                        cycle_index;
+    ngx_msec_t                        cycle_stamp;
+
+    /* delivery rate estimation */
+    uint64_t                          delivered;
+    ngx_msec_t                        delivered_time;
+    ngx_msec_t                        first_sent_time;
+    uint64_t                          app_limited;
+    uint64_t                          lost;
+
+    uint64_t                          round_count;
+    uint64_t                          next_round_delivered;
+    uint64_t                          round_delivered;
+    uint64_t                          round_lost;
+
+    uint64_t                          bw[2];        /* bytes per second */
+    uint64_t                          bw_round;
+    uint64_t                          max_bw;
+    uint64_t                          full_bw;
+    ngx_uint_t                        full_bw_count;
+
+    ngx_msec_t                        min_rtt;
+    ngx_msec_t                        min_rtt_stamp;
+    ngx_msec_t                        probe_rtt_done;
+
+    size_t                            inflight_hi;
+    size_t                            prior_window;
+
+    unsigned                          round_start:1;
+    unsigned                          full_bw_reached:1;
+    unsigned                          loss_in_round:1;
+    unsigned                          probe_rtt_round_done:1;
+} ngx_quic_bbr_t;
+
+
+extern ngx_quic_congestion_ops_t  ngx_quic_bbr;
+
+
+#endif /* _NGX_EVENT_QUIC_BBR_H_INCLUDED_ */
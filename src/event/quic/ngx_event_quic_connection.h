@@ -26,13 +26,14 @@
 #define NGX_QUIC_SEND_CTX_LAST               (NGX_QUIC_ENCRYPTION_LAST - 1)
 
 
-typedef struct ngx_quic_connection_s  ngx_quic_connection_t;
-typedef struct ngx_quic_server_id_s   ngx_quic_server_id_t;
-typedef struct ngx_quic_client_id_s   ngx_quic_client_id_t;
-typedef struct ngx_quic_send_ctx_s    ngx_quic_send_ctx_t;
-typedef struct ngx_quic_socket_s      ngx_quic_socket_t;
-typedef struct ngx_quic_path_s        ngx_quic_path_t;
-typedef struct ngx_quic_keys_s        ngx_quic_keys_t;
+typedef struct ngx_quic_connection_s      ngx_quic_connection_t;
+typedef struct ngx_quic_server_id_s       ngx_quic_server_id_t;
+typedef struct ngx_quic_client_id_s       ngx_quic_client_id_t;
+typedef struct ngx_quic_send_ctx_s        ngx_quic_send_ctx_t;
+typedef struct ngx_quic_socket_s          ngx_quic_socket_t;
+typedef struct ngx_quic_path_s            ngx_quic_path_t;
+typedef struct ngx_quic_keys_s            ngx_quic_keys_t;
+typedef struct ngx_quic_congestion_ops_s  ngx_quic_congestion_ops_t;
 
 #if (NGX_QUIC_OPENSSL_COMPAT)
 #include <ngx_event_quic_openssl_compat.h>
@@ -46,6 +47,7 @@ typedef struct ngx_quic_keys_s        ngx_quic_keys_t;
 #include <ngx_event_quic_ssl.h>
 #include <ngx_event_quic_tokens.h>
 #include <ngx_event_quic_ack.h>
+#include <ngx_event_quic_bbr.h>
 #include <ngx_event_quic_output.h>
 #include <ngx_event_quic_socket.h>
 
@@ -145,6 +147,10 @@ typedef struct {
     ngx_rbtree_t                      tree;
     ngx_rbtree_node_t                 sentinel;
 
+    ngx_quic_stream_t               **hash;        /* indexed by stream id */
+    ngx_uint_t                        hash_mask;
+    ngx_uint_t                        hash_count;
+
     ngx_queue_t                       uninitialized;
     ngx_queue_t                       free;
 
@@ -171,6 +177,16 @@ typedef struct {
 } ngx_quic_streams_t;
 
 
+struct ngx_quic_congestion_ops_s {
+    void  (*init)(ngx_quic_connection_t *qc);
+    void  (*sent)(ngx_connection_t *c, ngx_quic_frame_t *f);
+    void  (*ack)(ngx_connection_t *c, ngx_quic_frame_t *f);
+    void  (*lost)(ngx_connection_t *c, ngx_quic_frame_t *f);
+    void  (*persistent)(ngx_connection_t *c);
+    void  (*idle)(ngx_connection_t *c, ngx_uint_t idle);
+};
+
+
 typedef struct {
     size_t                            in_flight;
     size_t                            window;
@@ -183,6 +199,13 @@ typedef struct {
     ngx_msec_t                        idle_start;
     ngx_msec_t                        k;
     ngx_uint_t                        idle; /* unsigned  idle:1; */
+
+    uint64_t                          pacing_rate;  /* bytes per second */
+    size_t                            pacing_budget;
+    ngx_msec_t                        pacing_stamp;
+
+    ngx_quic_congestion_ops_t        *ops;
+    ngx_quic_bbr_t                    bbr;
 } ngx_quic_congestion_t;
 
 
@@ -263,8 +286,7 @@ struct ngx_quic_connection_s {
 
     ngx_uint_t                        pto_count;
 
-    ngx_queue_t                       free_frames;
-    ngx_buf_t                        *free_bufs;
+    ngx_queue_t                       blocks;
     ngx_buf_t                        *free_shadow_bufs;
 
     ngx_uint_t                        nframes;
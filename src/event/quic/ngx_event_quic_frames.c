@@ -17,7 +17,33 @@
 #define ngx_quic_buf_dec_refs(b)     ngx_quic_buf_refs(b)--
 #define ngx_quic_buf_set_refs(b, v)  ngx_quic_buf_refs(b) = v
 
+#define NGX_QUIC_CACHE_FRAME         0
+#define NGX_QUIC_CACHE_BUFFER        1
 
+
+/*
+ * Frames and buffer memory are taken from per-worker caches, one for
+ * each size class.  Every block in use is linked into the connection
+ * list, so that the connection returns all of them on pool cleanup.
+ */
+
+typedef struct {
+    size_t                   size;
+    ngx_uint_t               max;
+    ngx_uint_t               nfree;
+    ngx_queue_t              free;
+} ngx_quic_cache_t;
+
+
+typedef struct {
+    ngx_queue_t              queue;
+    ngx_quic_cache_t        *cache;
+} ngx_quic_block_t;
+
+
+static void *ngx_quic_cache_alloc(ngx_connection_t *c, ngx_uint_t type);
+static void ngx_quic_cache_free(void *p);
+static void ngx_quic_cache_release(ngx_quic_block_t *block);
 static ngx_buf_t *ngx_quic_alloc_buf(ngx_connection_t *c);
 static void ngx_quic_free_buf(ngx_connection_t *c, ngx_buf_t *b);
 static ngx_buf_t *ngx_quic_clone_buf(ngx_connection_t *c, ngx_buf_t *b);
@@ -25,6 +51,98 @@ static ngx_int_t ngx_quic_split_chain(ngx_connection_t *c, ngx_chain_t *cl,
     off_t offset);
 
 
+static ngx_quic_cache_t  ngx_quic_caches[] = {
+    { sizeof(ngx_quic_frame_t), 4096, 0, { NULL, NULL } },
+    { NGX_QUIC_BUFFER_SIZE, 256, 0, { NULL, NULL } }
+};
+
+
+static void *
+ngx_quic_cache_alloc(ngx_connection_t *c, ngx_uint_t type)
+{
+    ngx_queue_t            *q;
+    ngx_quic_cache_t       *cache;
+    ngx_quic_block_t       *block;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+
+    cache = &ngx_quic_caches[type];
+
+    if (cache->nfree) {
+        q = ngx_queue_head(&cache->free);
+        ngx_queue_remove(q);
+        cache->nfree--;
+
+        block = ngx_queue_data(q, ngx_quic_block_t, queue);
+
+    } else {
+        block = ngx_alloc(sizeof(ngx_quic_block_t) + cache->size, c->log);
+        if (block == NULL) {
+            return NULL;
+        }
+
+        block->cache = cache;
+    }
+
+    ngx_queue_insert_tail(&qc->blocks, &block->queue);
+
+    return (u_char *) block + sizeof(ngx_quic_block_t);
+}
+
+
+static void
+ngx_quic_cache_free(void *p)
+{
+    ngx_quic_block_t  *block;
+
+    block = (ngx_quic_block_t *) ((u_char *) p - sizeof(ngx_quic_block_t));
+
+    ngx_queue_remove(&block->queue);
+
+    ngx_quic_cache_release(block);
+}
+
+
+static void
+ngx_quic_cache_release(ngx_quic_block_t *block)
+{
+    ngx_quic_cache_t  *cache;
+
+    cache = block->cache;
+
+    if (cache->nfree == cache->max) {
+        ngx_free(block);
+        return;
+    }
+
+    if (cache->nfree == 0) {
+        ngx_queue_init(&cache->free);
+    }
+
+    ngx_queue_insert_head(&cache->free, &block->queue);
+    cache->nfree++;
+}
+
+
+void
+ngx_quic_cache_cleanup(void *data)
+{
+    ngx_quic_connection_t *qc = data;
+
+    ngx_queue_t       *q;
+    ngx_quic_block_t  *block;
+
+    while (!ngx_queue_empty(&qc->blocks)) {
+        q = ngx_queue_head(&qc->blocks);
+        ngx_queue_remove(q);
+
+        block = ngx_queue_data(q, ngx_quic_block_t, queue);
+        ngx_quic_cache_release(block);
+    }
+}
+
+
 static ngx_buf_t *
 ngx_quic_alloc_buf(ngx_connection_t *c)
 {
@@ -34,40 +152,32 @@ ngx_quic_alloc_buf(ngx_connection_t *c)
 
     qc = ngx_quic_get_connection(c);
 
-    b = qc->free_bufs;
+    b = qc->free_shadow_bufs;
 
     if (b) {
-        qc->free_bufs = b->shadow;
-        p = b->start;
-
-    } else {
-        b = qc->free_shadow_bufs;
-
-        if (b) {
-            qc->free_shadow_bufs = b->shadow;
+        qc->free_shadow_bufs = b->shadow;
 
 #ifdef NGX_QUIC_DEBUG_ALLOC
-            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                           "quic use shadow buffer n:%ui %ui",
-                           ++qc->nbufs, --qc->nshadowbufs);
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "quic use shadow buffer n:%ui %ui",
+                       ++qc->nbufs, --qc->nshadowbufs);
 #endif
 
-        } else {
-            b = ngx_palloc(c->pool, sizeof(ngx_buf_t));
-            if (b == NULL) {
-                return NULL;
-            }
+    } else {
+        b = ngx_palloc(c->pool, sizeof(ngx_buf_t));
+        if (b == NULL) {
+            return NULL;
+        }
 
 #ifdef NGX_QUIC_DEBUG_ALLOC
-            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                           "quic new buffer n:%ui", ++qc->nbufs);
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "quic new buffer n:%ui", ++qc->nbufs);
 #endif
-        }
+    }
 
-        p = ngx_pnalloc(c->pool, NGX_QUIC_BUFFER_SIZE);
-        if (p == NULL) {
-            return NULL;
-        }
+    p = ngx_quic_cache_alloc(c, NGX_QUIC_CACHE_BUFFER);
+    if (p == NULL) {
+        return NULL;
     }
 
 #ifdef NGX_QUIC_DEBUG_ALLOC
@@ -110,8 +220,10 @@ ngx_quic_free_buf(ngx_connection_t *c, ngx_buf_t *b)
     shadow = b->shadow;
 
     if (ngx_quic_buf_refs(b) == 0) {
-        shadow->shadow = qc->free_bufs;
-        qc->free_bufs = shadow;
+        ngx_quic_cache_free(shadow->start);
+
+        shadow->shadow = qc->free_shadow_bufs;
+        qc->free_shadow_bufs = shadow;
     }
 
     if (b != shadow) {
@@ -196,42 +308,28 @@ ngx_quic_split_chain(ngx_connection_t *c, ngx_chain_t *cl, off_t offset)
 ngx_quic_frame_t *
 ngx_quic_alloc_frame(ngx_connection_t *c)
 {
-    ngx_queue_t            *q;
     ngx_quic_frame_t       *frame;
     ngx_quic_connection_t  *qc;
 
     qc = ngx_quic_get_connection(c);
 
-    if (!ngx_queue_empty(&qc->free_frames)) {
-
-        q = ngx_queue_head(&qc->free_frames);
-        frame = ngx_queue_data(q, ngx_quic_frame_t, queue);
-
-        ngx_queue_remove(&frame->queue);
-
-#ifdef NGX_QUIC_DEBUG_ALLOC
-        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                       "quic reuse frame n:%ui", qc->nframes);
-#endif
+    if (qc->nframes >= qc->max_frames) {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0, "quic flood detected");
+        return NULL;
+    }
 
-    } else if (qc->nframes < qc->max_frames) {
-        frame = ngx_palloc(c->pool, sizeof(ngx_quic_frame_t));
-        if (frame == NULL) {
-            return NULL;
-        }
+    frame = ngx_quic_cache_alloc(c, NGX_QUIC_CACHE_FRAME);
+    if (frame == NULL) {
+        return NULL;
+    }
 
-        ++qc->nframes;
+    ++qc->nframes;
 
 #ifdef NGX_QUIC_DEBUG_ALLOC
-        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                       "quic alloc frame n:%ui", qc->nframes);
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic alloc frame n:%ui", qc->nframes);
 #endif
 
-    } else {
-        ngx_log_error(NGX_LOG_INFO, c->log, 0, "quic flood detected");
-        return NULL;
-    }
-
     ngx_memzero(frame, sizeof(ngx_quic_frame_t));
 
     return frame;
@@ -249,7 +347,9 @@ ngx_quic_free_frame(ngx_connection_t *c, ngx_quic_frame_t *frame)
         ngx_quic_free_chain(c, frame->data);
     }
 
-    ngx_queue_insert_head(&qc->free_frames, &frame->queue);
+    ngx_quic_cache_free(frame);
+
+    --qc->nframes;
 
 #ifdef NGX_QUIC_DEBUG_ALLOC
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
@@ -652,6 +752,23 @@ ngx_quic_free_buffer(ngx_connection_t *c, ngx_quic_buffer_t *qb)
 }
 
 
+void
+ngx_quic_compact_buffer(ngx_connection_t *c, ngx_quic_buffer_t *qb)
+{
+    ngx_chain_t  *cl;
+
+    /* holes are allocated anew on the next write */
+
+    for (cl = qb->chain; cl; cl = cl->next) {
+        if (!cl->buf->sync) {
+            return;
+        }
+    }
+
+    ngx_quic_free_buffer(c, qb);
+}
+
+
 #if (NGX_DEBUG)
 
 void
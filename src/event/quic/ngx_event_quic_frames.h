@@ -35,6 +35,8 @@ ngx_chain_t *ngx_quic_write_buffer(ngx_connection_t *c, ngx_quic_buffer_t *qb,
 void ngx_quic_skip_buffer(ngx_connection_t *c, ngx_quic_buffer_t *qb,
     uint64_t offset);
 void ngx_quic_free_buffer(ngx_connection_t *c, ngx_quic_buffer_t *qb);
+void ngx_quic_compact_buffer(ngx_connection_t *c, ngx_quic_buffer_t *qb);
+void ngx_quic_cache_cleanup(void *data);
 
 #if (NGX_DEBUG)
 void ngx_quic_log_frame(ngx_log_t *log, ngx_quic_frame_t *f, ngx_uint_t tx);
@@ -180,14 +180,7 @@ valid:
         ctx = ngx_quic_get_send_ctx(qc, NGX_QUIC_ENCRYPTION_APPLICATION);
         qc->rst_pnum = ctx->pnum;
 
-        ngx_memzero(&qc->congestion, sizeof(ngx_quic_congestion_t));
-
-        qc->congestion.window = ngx_min(10 * NGX_QUIC_MIN_INITIAL_SIZE,
-                                   ngx_max(2 * NGX_QUIC_MIN_INITIAL_SIZE,
-                                           14720));
-        qc->congestion.ssthresh = (size_t) -1;
-        qc->congestion.mtu = NGX_QUIC_MIN_INITIAL_SIZE;
-        qc->congestion.recovery_start = ngx_current_msec - 1;
+        ngx_quic_init_congestion(qc);
 
         ngx_quic_init_rtt(qc);
     }
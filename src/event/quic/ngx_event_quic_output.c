@@ -48,6 +48,7 @@ static ngx_int_t ngx_quic_create_datagrams(ngx_connection_t *c);
 static void ngx_quic_commit_send(ngx_connection_t *c);
 static void ngx_quic_revert_send(ngx_connection_t *c,
     uint64_t preserved_pnum[NGX_QUIC_SEND_CTX_LAST]);
+static void ngx_quic_set_pacing_timer(ngx_connection_t *c);
 #if ((NGX_HAVE_UDP_SEGMENT) && (NGX_HAVE_MSGHDR_MSG_CONTROL))
 static ngx_uint_t ngx_quic_allow_segmentation(ngx_connection_t *c);
 static ngx_int_t ngx_quic_create_segments(ngx_connection_t *c);
@@ -94,6 +95,10 @@ ngx_quic_output(ngx_connection_t *c)
         return NGX_ERROR;
     }
 
+    if (!qc->closing) {
+        ngx_quic_set_pacing_timer(c);
+    }
+
     if (in_flight == cg->in_flight || qc->closing) {
         /* no ack-eliciting data was sent or we are done */
         return NGX_OK;
@@ -159,7 +164,8 @@ ngx_quic_create_datagrams(ngx_connection_t *c)
             }
 
             n = ngx_quic_output_packet(c, ctx, p, len, min,
-                                       cg->in_flight >= cg->window);
+                                       cg->in_flight >= cg->window
+                                       || ngx_quic_pacing_delay(c));
             if (n == NGX_ERROR) {
                 return NGX_ERROR;
             }
@@ -189,7 +195,7 @@ ngx_quic_create_datagrams(ngx_connection_t *c)
 
         path->sent += len;
 
-    } while (cg->in_flight < cg->window);
+    } while (cg->in_flight < cg->window && ngx_quic_pacing_delay(c) == 0);
 
     return NGX_OK;
 }
@@ -227,7 +233,7 @@ ngx_quic_commit_send(ngx_connection_t *c)
             if (f->pkt_need_ack && !qc->closing) {
                 ngx_queue_insert_tail(&ctx->sent, q);
 
-                cg->in_flight += f->plen;
+                ngx_quic_congestion_sent(c, f);
 
             } else {
                 ngx_quic_free_frame(c, f);
@@ -272,6 +278,44 @@ ngx_quic_revert_send(ngx_connection_t *c, uint64_t pnum[NGX_QUIC_SEND_CTX_LAST])
 }
 
 
+static void
+ngx_quic_set_pacing_timer(ngx_connection_t *c)
+{
+    ngx_msec_t              delay;
+    ngx_quic_send_ctx_t    *ctx;
+    ngx_quic_congestion_t  *cg;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+    cg = &qc->congestion;
+
+    ctx = ngx_quic_get_send_ctx(qc, NGX_QUIC_ENCRYPTION_APPLICATION);
+
+    if (ngx_queue_empty(&ctx->frames) || cg->in_flight >= cg->window) {
+        /* acknowledgments will trigger sending */
+        return;
+    }
+
+    delay = ngx_quic_pacing_delay(c);
+
+    if (delay == 0) {
+        return;
+    }
+
+    if (qc->push.timer_set
+        && (ngx_msec_int_t) (qc->push.timer.key - ngx_current_msec)
+           <= (ngx_msec_int_t) delay)
+    {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic pacing delay:%M", delay);
+
+    ngx_add_timer(&qc->push, delay);
+}
+
+
 #if ((NGX_HAVE_UDP_SEGMENT) && (NGX_HAVE_MSGHDR_MSG_CONTROL))
 
 static ngx_uint_t
@@ -309,6 +353,10 @@ ngx_quic_allow_segmentation(ngx_connection_t *c)
     bytes = 0;
     len = ngx_min(qc->path->mtu, NGX_QUIC_MAX_UDP_SEGMENT_BUF);
 
+    if (ngx_quic_pacing_budget(c) < len * 3) {
+        return 0;
+    }
+
     for (q = ngx_queue_head(&ctx->frames);
          q != ngx_queue_sentinel(&ctx->frames);
          q = ngx_queue_next(q))
@@ -361,6 +409,9 @@ ngx_quic_create_segments(ngx_connection_t *c)
 
     nseg = 0;
 
+    /* header protection is applied to all segments at once */
+    ngx_quic_hp_batch_start(dst, sizeof(dst));
+
     level = ctx - qc->send_ctx;
     preserved_pnum[level] = ctx->pnum;
 
@@ -368,7 +419,10 @@ ngx_quic_create_segments(ngx_connection_t *c)
 
         len = ngx_min(segsize, (size_t) (end - p));
 
-        if (len && cg->in_flight + (p - dst) < cg->window) {
+        if (len
+            && cg->in_flight + (p - dst) < cg->window
+            && (p - dst) + len <= ngx_quic_pacing_budget(c))
+        {
 
             n = ngx_quic_output_packet(c, ctx, p, len, len, 0);
             if (n == NGX_ERROR) {
@@ -389,6 +443,11 @@ ngx_quic_create_segments(ngx_connection_t *c)
         }
 
         if (n == 0 || nseg == NGX_QUIC_MAX_SEGMENTS) {
+
+            if (ngx_quic_hp_batch_flush(c->log) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
             n = ngx_quic_send_segments(c, dst, p - dst, path->sockaddr,
                                        path->socklen, segsize);
             if (n == NGX_ERROR) {
@@ -1310,7 +1369,7 @@ ngx_quic_frame_sendto(ngx_connection_t *c, ngx_quic_frame_t *frame,
     if (frame->need_ack && !qc->closing) {
         ngx_queue_insert_tail(&ctx->sent, &frame->queue);
 
-        cg->in_flight += frame->plen;
+        ngx_quic_congestion_sent(c, frame);
 
     } else {
         ngx_quic_free_frame(c, frame);
@@ -19,6 +19,12 @@
 /* RFC 9001, 5.4.1.  Header Protection Application: 5-byte mask */
 #define NGX_QUIC_HP_LEN               5
 
+/* RFC 9001, 5.4.2.  Header Protection Sample: 16 bytes */
+#define NGX_QUIC_HP_SAMPLE_LEN        16
+
+/* header protection masks computed in one pass */
+#define NGX_QUIC_HP_BATCH             64
+
 #define NGX_QUIC_AES_128_KEY_LEN      16
 
 #define NGX_QUIC_INITIAL_CIPHER       TLS1_3_CK_AES_128_GCM_SHA256
@@ -27,6 +33,27 @@
 #define ngx_quic_md(str)     { sizeof(str) - 1, str }
 
 
+typedef struct {
+    ngx_quic_secret_t        *secret;
+    u_char                   *flags;
+    u_char                   *pnp;
+    u_char                    mask;
+    u_char                    num_len;
+} ngx_quic_hp_item_t;
+
+
+typedef struct {
+    u_char                   *start;
+    u_char                   *end;
+    ngx_uint_t                n;
+    ngx_quic_hp_item_t        items[NGX_QUIC_HP_BATCH];
+    u_char                    samples[NGX_QUIC_HP_BATCH
+                                      * NGX_QUIC_HP_SAMPLE_LEN];
+    u_char                    masks[NGX_QUIC_HP_BATCH
+                                    * NGX_QUIC_HP_SAMPLE_LEN];
+} ngx_quic_hp_batch_t;
+
+
 static ngx_int_t ngx_hkdf_expand(u_char *out_key, size_t out_len,
     const EVP_MD *digest, const u_char *prk, size_t prk_len,
     const u_char *info, size_t info_len);
@@ -47,7 +74,7 @@ static ngx_int_t ngx_quic_crypto_common(ngx_quic_secret_t *s, ngx_str_t *out,
 static ngx_int_t ngx_quic_crypto_hp_init(const EVP_CIPHER *cipher,
     ngx_quic_secret_t *s, ngx_log_t *log);
 static ngx_int_t ngx_quic_crypto_hp(ngx_quic_secret_t *s,
-    u_char *out, u_char *in, ngx_log_t *log);
+    u_char *out, u_char *in, ngx_uint_t n, ngx_log_t *log);
 static void ngx_quic_crypto_hp_cleanup(ngx_quic_secret_t *s);
 
 static ngx_int_t ngx_quic_create_packet(ngx_quic_header_t *pkt,
@@ -56,6 +83,9 @@ static ngx_int_t ngx_quic_create_retry_packet(ngx_quic_header_t *pkt,
     ngx_str_t *res);
 
 
+static ngx_quic_hp_batch_t  ngx_quic_hp_batch;
+
+
 ngx_int_t
 ngx_quic_ciphers(ngx_uint_t id, ngx_quic_ciphers_t *ciphers)
 {
@@ -69,7 +99,7 @@ ngx_quic_ciphers(ngx_uint_t id, ngx_quic_ciphers_t *ciphers)
 #else
         ciphers->c = EVP_aes_128_gcm();
 #endif
-        ciphers->hp = EVP_aes_128_ctr();
+        ciphers->hp = EVP_aes_128_ecb();
         ciphers->d = EVP_sha256();
         len = 16;
         break;
@@ -80,7 +110,7 @@ ngx_quic_ciphers(ngx_uint_t id, ngx_quic_ciphers_t *ciphers)
 #else
         ciphers->c = EVP_aes_256_gcm();
 #endif
-        ciphers->hp = EVP_aes_256_ctr();
+        ciphers->hp = EVP_aes_256_ecb();
         ciphers->d = EVP_sha384();
         len = 32;
         break;
@@ -103,7 +133,7 @@ ngx_quic_ciphers(ngx_uint_t id, ngx_quic_ciphers_t *ciphers)
 #if !(NGX_QUIC_BORINGSSL_EVP_API)
     case TLS1_3_CK_AES_128_CCM_SHA256:
         ciphers->c = EVP_aes_128_ccm();
-        ciphers->hp = EVP_aes_128_ctr();
+        ciphers->hp = EVP_aes_128_ecb();
         ciphers->d = EVP_sha256();
         len = 16;
         break;
@@ -605,6 +635,13 @@ ngx_quic_crypto_hp_init(const EVP_CIPHER *cipher, ngx_quic_secret_t *s,
         return NGX_ERROR;
     }
 
+    if (EVP_CIPHER_CTX_set_padding(ctx, 0) != 1) {
+        EVP_CIPHER_CTX_free(ctx);
+        ngx_ssl_error(NGX_LOG_INFO, log, 0,
+                      "EVP_CIPHER_CTX_set_padding() failed");
+        return NGX_ERROR;
+    }
+
     s->hp_ctx = ctx;
     return NGX_OK;
 }
@@ -612,38 +649,74 @@ ngx_quic_crypto_hp_init(const EVP_CIPHER *cipher, ngx_quic_secret_t *s,
 
 static ngx_int_t
 ngx_quic_crypto_hp(ngx_quic_secret_t *s, u_char *out, u_char *in,
-    ngx_log_t *log)
+    ngx_uint_t n, ngx_log_t *log)
 {
     int              outlen;
+    ngx_uint_t       i;
     EVP_CIPHER_CTX  *ctx;
 
     static const u_char zero[NGX_QUIC_HP_LEN];
 
+    /* n samples in, n masks out, NGX_QUIC_HP_SAMPLE_LEN bytes apart */
+
     ctx = s->hp_ctx;
 
 #if (NGX_QUIC_BORINGSSL_EVP_API)
     uint32_t         cnt;
 
     if (ctx == NULL) {
-        ngx_memcpy(&cnt, in, sizeof(uint32_t));
-        CRYPTO_chacha_20(out, zero, NGX_QUIC_HP_LEN, s->hp.data, &in[4], cnt);
+        for (i = 0; i < n; i++) {
+            ngx_memcpy(&cnt, in, sizeof(uint32_t));
+            CRYPTO_chacha_20(out, zero, NGX_QUIC_HP_LEN, s->hp.data, &in[4],
+                             cnt);
+
+            in += NGX_QUIC_HP_SAMPLE_LEN;
+            out += NGX_QUIC_HP_SAMPLE_LEN;
+        }
+
         return NGX_OK;
     }
 #endif
 
-    if (EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, in) != 1) {
-        ngx_ssl_error(NGX_LOG_INFO, log, 0, "EVP_EncryptInit_ex() failed");
-        return NGX_ERROR;
-    }
+    if (EVP_CIPHER_CTX_mode(ctx) == EVP_CIPH_ECB_MODE) {
 
-    if (!EVP_EncryptUpdate(ctx, out, &outlen, zero, NGX_QUIC_HP_LEN)) {
-        ngx_ssl_error(NGX_LOG_INFO, log, 0, "EVP_EncryptUpdate() failed");
-        return NGX_ERROR;
+        /*
+         * RFC 9001, 5.4.3.  AES-Based Header Protection
+         *
+         * the mask is a single AES block of the sample, so that all
+         * samples are encrypted in one call without key setup
+         */
+
+        if (!EVP_EncryptUpdate(ctx, out, &outlen, in,
+                               n * NGX_QUIC_HP_SAMPLE_LEN))
+        {
+            ngx_ssl_error(NGX_LOG_INFO, log, 0, "EVP_EncryptUpdate() failed");
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
     }
 
-    if (!EVP_EncryptFinal_ex(ctx, out + NGX_QUIC_HP_LEN, &outlen)) {
-        ngx_ssl_error(NGX_LOG_INFO, log, 0, "EVP_EncryptFinal_Ex() failed");
-        return NGX_ERROR;
+    for (i = 0; i < n; i++) {
+
+        if (EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, in) != 1) {
+            ngx_ssl_error(NGX_LOG_INFO, log, 0, "EVP_EncryptInit_ex() failed");
+            return NGX_ERROR;
+        }
+
+        if (!EVP_EncryptUpdate(ctx, out, &outlen, zero, NGX_QUIC_HP_LEN)) {
+            ngx_ssl_error(NGX_LOG_INFO, log, 0, "EVP_EncryptUpdate() failed");
+            return NGX_ERROR;
+        }
+
+        if (!EVP_EncryptFinal_ex(ctx, out + NGX_QUIC_HP_LEN, &outlen)) {
+            ngx_ssl_error(NGX_LOG_INFO, log, 0,
+                          "EVP_EncryptFinal_Ex() failed");
+            return NGX_ERROR;
+        }
+
+        in += NGX_QUIC_HP_SAMPLE_LEN;
+        out += NGX_QUIC_HP_SAMPLE_LEN;
     }
 
     return NGX_OK;
@@ -907,11 +980,14 @@ ngx_quic_keys_cleanup(ngx_quic_keys_t *keys)
 static ngx_int_t
 ngx_quic_create_packet(ngx_quic_header_t *pkt, ngx_str_t *res)
 {
-    u_char             *pnp, *sample;
-    ngx_str_t           ad, out;
-    ngx_uint_t          i;
-    ngx_quic_secret_t  *secret;
-    u_char              nonce[NGX_QUIC_IV_LEN], mask[NGX_QUIC_HP_LEN];
+    u_char               *pnp, *sample;
+    ngx_str_t             ad, out;
+    ngx_uint_t            i;
+    ngx_quic_secret_t    *secret;
+    ngx_quic_hp_item_t   *item;
+    ngx_quic_hp_batch_t  *hb;
+    u_char                nonce[NGX_QUIC_IV_LEN];
+    u_char                mask[NGX_QUIC_HP_SAMPLE_LEN];
 
     ad.data = res->data;
     ad.len = ngx_quic_create_header(pkt, ad.data, &pnp);
@@ -935,8 +1011,34 @@ ngx_quic_create_packet(ngx_quic_header_t *pkt, ngx_str_t *res)
         return NGX_ERROR;
     }
 
+    res->len = ad.len + out.len;
+
     sample = &out.data[4 - pkt->num_len];
-    if (ngx_quic_crypto_hp(secret, mask, sample, pkt->log) != NGX_OK) {
+
+    hb = &ngx_quic_hp_batch;
+
+    if (res->data >= hb->start && res->data < hb->end
+        && hb->n < NGX_QUIC_HP_BATCH)
+    {
+        /* header protection is applied by ngx_quic_hp_batch_flush() */
+
+        item = &hb->items[hb->n];
+
+        item->secret = secret;
+        item->flags = ad.data;
+        item->pnp = pnp;
+        item->mask = ngx_quic_pkt_hp_mask(pkt->flags);
+        item->num_len = pkt->num_len;
+
+        ngx_memcpy(&hb->samples[hb->n * NGX_QUIC_HP_SAMPLE_LEN], sample,
+                   NGX_QUIC_HP_SAMPLE_LEN);
+
+        hb->n++;
+
+        return NGX_OK;
+    }
+
+    if (ngx_quic_crypto_hp(secret, mask, sample, 1, pkt->log) != NGX_OK) {
         return NGX_ERROR;
     }
 
@@ -947,7 +1049,64 @@ ngx_quic_create_packet(ngx_quic_header_t *pkt, ngx_str_t *res)
         pnp[i] ^= mask[i + 1];
     }
 
-    res->len = ad.len + out.len;
+    return NGX_OK;
+}
+
+
+void
+ngx_quic_hp_batch_start(u_char *buf, size_t size)
+{
+    ngx_quic_hp_batch.start = buf;
+    ngx_quic_hp_batch.end = buf + size;
+    ngx_quic_hp_batch.n = 0;
+}
+
+
+ngx_int_t
+ngx_quic_hp_batch_flush(ngx_log_t *log)
+{
+    u_char               *mask;
+    ngx_uint_t            i, j, k, n;
+    ngx_quic_hp_item_t   *item;
+    ngx_quic_hp_batch_t  *hb;
+
+    hb = &ngx_quic_hp_batch;
+
+    n = hb->n;
+    hb->n = 0;
+
+    /* masks for consecutive packets protected with the same key */
+
+    for (i = 0; i < n; i = j) {
+
+        for (j = i + 1; j < n; j++) {
+            if (hb->items[j].secret != hb->items[i].secret) {
+                break;
+            }
+        }
+
+        if (ngx_quic_crypto_hp(hb->items[i].secret,
+                               &hb->masks[i * NGX_QUIC_HP_SAMPLE_LEN],
+                               &hb->samples[i * NGX_QUIC_HP_SAMPLE_LEN],
+                               j - i, log)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    /* RFC 9001, 5.4.1.  Header Protection Application */
+
+    for (i = 0; i < n; i++) {
+        item = &hb->items[i];
+        mask = &hb->masks[i * NGX_QUIC_HP_SAMPLE_LEN];
+
+        item->flags[0] ^= mask[0] & item->mask;
+
+        for (k = 0; k < item->num_len; k++) {
+            item->pnp[k] ^= mask[k + 1];
+        }
+    }
 
     return NGX_OK;
 }
@@ -1135,7 +1294,7 @@ ngx_quic_decrypt(ngx_quic_header_t *pkt, uint64_t *largest_pn)
     ngx_str_t           in, ad;
     ngx_uint_t          key_phase;
     ngx_quic_secret_t  *secret;
-    uint8_t             nonce[NGX_QUIC_IV_LEN], mask[NGX_QUIC_HP_LEN];
+    uint8_t             nonce[NGX_QUIC_IV_LEN], mask[NGX_QUIC_HP_SAMPLE_LEN];
 
     secret = &pkt->keys->secrets[pkt->level].client;
 
@@ -1159,7 +1318,7 @@ ngx_quic_decrypt(ngx_quic_header_t *pkt, uint64_t *largest_pn)
 
     /* header protection */
 
-    if (ngx_quic_crypto_hp(secret, mask, sample, pkt->log) != NGX_OK) {
+    if (ngx_quic_crypto_hp(secret, mask, sample, 1, pkt->log) != NGX_OK) {
         return NGX_DECLINED;
     }
 
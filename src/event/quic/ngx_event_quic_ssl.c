@@ -741,6 +741,9 @@ ngx_quic_handshake(ngx_connection_t *c)
 #endif
 
     c->ssl->handshaked = 1;
+    c->ssl->handshake_time = ngx_current_msec - c->start_time;
+
+    ngx_sdt_probe2(ssl__handshake, c, c->ssl->handshake_time);
 
     frame = ngx_quic_alloc_frame(c);
     if (frame == NULL) {
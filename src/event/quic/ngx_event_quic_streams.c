@@ -10,7 +10,12 @@
 #include <ngx_event_quic_connection.h>
 
 
-#define NGX_QUIC_STREAM_GONE     (void *) -1
+#define NGX_QUIC_STREAM_GONE       (void *) -1
+
+/* fits stream state of HTTP/3 uni and request streams */
+#define NGX_QUIC_STREAM_POOL_SIZE  2048
+
+#define NGX_QUIC_STREAMS_HASH_SIZE  16
 
 
 static ngx_int_t ngx_quic_do_reset_stream(ngx_quic_stream_t *qs,
@@ -24,6 +29,11 @@ static void ngx_quic_init_streams_handler(ngx_connection_t *c);
 static ngx_int_t ngx_quic_do_init_streams(ngx_connection_t *c);
 static ngx_quic_stream_t *ngx_quic_create_stream(ngx_connection_t *c,
     uint64_t id);
+static ngx_int_t ngx_quic_grow_streams_hash(ngx_connection_t *c);
+static void ngx_quic_hash_stream(ngx_quic_streams_t *streams,
+    ngx_quic_stream_t *qs);
+static void ngx_quic_unhash_stream(ngx_quic_streams_t *streams,
+    ngx_quic_stream_t *qs);
 static void ngx_quic_empty_handler(ngx_event_t *ev);
 static ssize_t ngx_quic_stream_recv(ngx_connection_t *c, u_char *buf,
     size_t size);
@@ -148,25 +158,124 @@ ngx_quic_rbtree_insert_stream(ngx_rbtree_node_t *temp,
 
 
 ngx_quic_stream_t *
-ngx_quic_find_stream(ngx_rbtree_t *rbtree, uint64_t id)
+ngx_quic_find_stream(ngx_quic_connection_t *qc, uint64_t id)
 {
-    ngx_rbtree_node_t  *node, *sentinel;
-    ngx_quic_stream_t  *qn;
+    ngx_uint_t           i;
+    ngx_quic_stream_t   *qs;
+    ngx_quic_streams_t  *streams;
 
-    node = rbtree->root;
-    sentinel = rbtree->sentinel;
+    streams = &qc->streams;
 
-    while (node != sentinel) {
-        qn = (ngx_quic_stream_t *) node;
+    if (streams->hash == NULL) {
+        return NULL;
+    }
+
+    /*
+     * stream ids are dense for each of the four stream types,
+     * and the type is in the low bits, so ids are used as is
+     */
+
+    for (i = id & streams->hash_mask; /* void */ ;
+         i = (i + 1) & streams->hash_mask)
+    {
+        qs = streams->hash[i];
+
+        if (qs == NULL) {
+            return NULL;
+        }
+
+        if (qs->id == id) {
+            return qs;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_quic_grow_streams_hash(ngx_connection_t *c)
+{
+    ngx_uint_t              i, n, size;
+    ngx_quic_stream_t     **hash, **old;
+    ngx_quic_streams_t     *streams;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+
+    streams = &qc->streams;
+
+    old = streams->hash;
+    n = old ? streams->hash_mask + 1 : 0;
+    size = n ? 2 * n : NGX_QUIC_STREAMS_HASH_SIZE;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "quic streams hash size:%ui", size);
+
+    hash = ngx_pcalloc(c->pool, size * sizeof(ngx_quic_stream_t *));
+    if (hash == NULL) {
+        return NGX_ERROR;
+    }
+
+    streams->hash = hash;
+    streams->hash_mask = size - 1;
+    streams->hash_count = 0;
 
-        if (id == qn->id) {
-            return qn;
+    for (i = 0; i < n; i++) {
+        if (old[i]) {
+            ngx_quic_hash_stream(streams, old[i]);
         }
+    }
+
+    if (old) {
+        ngx_pfree(c->pool, old);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_quic_hash_stream(ngx_quic_streams_t *streams, ngx_quic_stream_t *qs)
+{
+    ngx_uint_t  i, mask;
+
+    mask = streams->hash_mask;
 
-        node = (id < qn->id) ? node->left : node->right;
+    for (i = qs->id & mask; streams->hash[i]; i = (i + 1) & mask) {
+        /* void */
     }
 
-    return NULL;
+    streams->hash[i] = qs;
+    streams->hash_count++;
+}
+
+
+static void
+ngx_quic_unhash_stream(ngx_quic_streams_t *streams, ngx_quic_stream_t *qs)
+{
+    ngx_uint_t  i, j, k, mask;
+
+    mask = streams->hash_mask;
+
+    for (i = qs->id & mask; streams->hash[i] != qs; i = (i + 1) & mask) {
+        /* void */
+    }
+
+    /*
+     * close the gap: move back the following entries of the cluster
+     * unless their home slot lies cyclically within (i, j]
+     */
+
+    for (j = (i + 1) & mask; streams->hash[j]; j = (j + 1) & mask) {
+        k = streams->hash[j]->id & mask;
+
+        if ((i < j) ? (k <= i || k > j) : (k <= i && k > j)) {
+            streams->hash[i] = streams->hash[j];
+            i = j;
+        }
+    }
+
+    streams->hash[i] = NULL;
+    streams->hash_count--;
 }
 
 
@@ -241,6 +350,36 @@ ngx_quic_close_streams(ngx_connection_t *c, ngx_quic_connection_t *qc)
 }
 
 
+void
+ngx_quic_compact_streams(ngx_connection_t *c)
+{
+    ngx_rbtree_t           *tree;
+    ngx_rbtree_node_t      *node;
+    ngx_quic_stream_t      *qs;
+    ngx_quic_connection_t  *qc;
+
+    qc = ngx_quic_get_connection(c);
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0, "quic compact streams");
+
+    tree = &qc->streams.tree;
+
+    if (tree->root == tree->sentinel) {
+        return;
+    }
+
+    for (node = ngx_rbtree_min(tree->root, tree->sentinel);
+         node;
+         node = ngx_rbtree_next(tree, node))
+    {
+        qs = (ngx_quic_stream_t *) node;
+
+        ngx_quic_compact_buffer(c, &qs->send);
+        ngx_quic_compact_buffer(c, &qs->recv);
+    }
+}
+
+
 ngx_int_t
 ngx_quic_reset_stream(ngx_connection_t *c, ngx_uint_t err)
 {
@@ -388,7 +527,7 @@ ngx_quic_get_stream(ngx_connection_t *c, uint64_t id)
 
     qc = ngx_quic_get_connection(c);
 
-    qs = ngx_quic_find_stream(&qc->streams.tree, id);
+    qs = ngx_quic_find_stream(qc, id);
 
     if (qs) {
         return qs;
@@ -665,6 +804,14 @@ ngx_quic_create_stream(ngx_connection_t *c, uint64_t id)
 
     qc = ngx_quic_get_connection(c);
 
+    /* the hash is kept at most half full */
+
+    if (2 * (qc->streams.hash_count + 1) > qc->streams.hash_mask + 1) {
+        if (ngx_quic_grow_streams_hash(c) != NGX_OK) {
+            return NULL;
+        }
+    }
+
     if (!ngx_queue_empty(&qc->streams.free)) {
         q = ngx_queue_head(&qc->streams.free);
         qs = ngx_queue_data(q, ngx_quic_stream_t, queue);
@@ -690,7 +837,7 @@ ngx_quic_create_stream(ngx_connection_t *c, uint64_t id)
     qs->send_final_size = (uint64_t) -1;
     qs->recv_final_size = (uint64_t) -1;
 
-    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, c->log);
+    pool = ngx_create_pool(NGX_QUIC_STREAM_POOL_SIZE, c->log);
     if (pool == NULL) {
         ngx_queue_insert_tail(&qc->streams.free, &qs->queue);
         return NULL;
@@ -812,6 +959,7 @@ ngx_quic_create_stream(ngx_connection_t *c, uint64_t id)
     cln->data = sc;
 
     ngx_rbtree_insert(&qc->streams.tree, &qs->node);
+    ngx_quic_hash_stream(&qc->streams, qs);
 
     return qs;
 }
@@ -1157,6 +1305,7 @@ ngx_quic_close_stream(ngx_quic_stream_t *qs)
     ngx_quic_free_buffer(pc, &qs->recv);
 
     ngx_rbtree_delete(&qc->streams.tree, &qs->node);
+    ngx_quic_unhash_stream(&qc->streams, qs);
     ngx_queue_insert_tail(&qc->streams.free, &qs->queue);
 
     if (qc->closing) {
@@ -1600,7 +1749,7 @@ ngx_quic_handle_stream_ack(ngx_connection_t *c, ngx_quic_frame_t *f)
 
     case NGX_QUIC_FT_RESET_STREAM:
 
-        qs = ngx_quic_find_stream(&qc->streams.tree, f->u.reset_stream.id);
+        qs = ngx_quic_find_stream(qc, f->u.reset_stream.id);
         if (qs == NULL) {
             return;
         }
@@ -1615,7 +1764,7 @@ ngx_quic_handle_stream_ack(ngx_connection_t *c, ngx_quic_frame_t *f)
 
     case NGX_QUIC_FT_STREAM:
 
-        qs = ngx_quic_find_stream(&qc->streams.tree, f->u.stream.stream_id);
+        qs = ngx_quic_find_stream(qc, f->u.stream.stream_id);
         if (qs == NULL) {
             return;
         }
@@ -36,9 +36,10 @@ ngx_int_t ngx_quic_handle_max_streams_frame(ngx_connection_t *c,
 ngx_int_t ngx_quic_init_streams(ngx_connection_t *c);
 void ngx_quic_rbtree_insert_stream(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
-ngx_quic_stream_t *ngx_quic_find_stream(ngx_rbtree_t *rbtree,
+ngx_quic_stream_t *ngx_quic_find_stream(ngx_quic_connection_t *qc,
     uint64_t id);
 ngx_int_t ngx_quic_close_streams(ngx_connection_t *c,
     ngx_quic_connection_t *qc);
+void ngx_quic_compact_streams(ngx_connection_t *c);
 
 #endif /* _NGX_EVENT_QUIC_STREAMS_H_INCLUDED_ */
@@ -268,10 +268,17 @@ struct ngx_quic_frame_s {
     size_t                                      plen;
     ngx_msec_t                                  send_time;
     ssize_t                                     len;
+
+    /* delivery rate sample state, see ngx_quic_bbr_sent() */
+    uint64_t                                    delivered;
+    ngx_msec_t                                  delivered_time;
+    ngx_msec_t                                  first_sent_time;
+
     unsigned                                    need_ack:1;
     unsigned                                    pkt_need_ack:1;
     unsigned                                    ignore_congestion:1;
     unsigned                                    ignore_loss:1;
+    unsigned                                    app_limited:1;
 
     ngx_chain_t                                *data;
     union {
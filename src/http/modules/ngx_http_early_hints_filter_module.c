@@ -0,0 +1,893 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_EARLY_HINTS_MAX_LEN  2048
+
+
+typedef struct {
+    u_char                       color;
+    u_char                       dummy;
+    u_short                      len;
+    ngx_queue_t                  queue;
+    u_short                      links_len;
+    u_char                       data[1];
+} ngx_http_early_hints_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                  rbtree;
+    ngx_rbtree_node_t             sentinel;
+    ngx_queue_t                   queue;
+} ngx_http_early_hints_shctx_t;
+
+
+typedef struct {
+    ngx_http_early_hints_shctx_t  *sh;
+    ngx_slab_pool_t               *shpool;
+    ngx_http_complex_value_t       key;
+} ngx_http_early_hints_ctx_t;
+
+
+typedef struct {
+    ngx_shm_zone_t               *shm_zone;
+} ngx_http_early_hints_conf_t;
+
+
+static ngx_int_t ngx_http_early_hints_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_early_hints_header_filter(ngx_http_request_t *r);
+static ngx_int_t ngx_http_early_hints_key(ngx_http_request_t *r,
+    ngx_http_early_hints_ctx_t *ctx, ngx_str_t *key);
+static ngx_int_t ngx_http_early_hints_links(ngx_http_request_t *r,
+    ngx_str_t *links);
+static ngx_uint_t ngx_http_early_hints_preload(u_char *p, u_char *last);
+static ngx_http_early_hints_node_t *ngx_http_early_hints_lookup(
+    ngx_http_early_hints_ctx_t *ctx, ngx_uint_t hash, ngx_str_t *key);
+static void ngx_http_early_hints_update(ngx_http_early_hints_ctx_t *ctx,
+    ngx_uint_t hash, ngx_str_t *key, ngx_str_t *links);
+static void ngx_http_early_hints_delete(ngx_http_early_hints_ctx_t *ctx,
+    ngx_http_early_hints_node_t *eh);
+
+static ngx_int_t ngx_http_early_hints_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static void *ngx_http_early_hints_create_conf(ngx_conf_t *cf);
+static char *ngx_http_early_hints_merge_conf(ngx_conf_t *cf, void *parent,
+    void *child);
+static char *ngx_http_early_hints_learn_zone(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_early_hints_learn(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_early_hints_init(ngx_conf_t *cf);
+
+
+static ngx_command_t  ngx_http_early_hints_commands[] = {
+
+    { ngx_string("early_hints_learn_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2,
+      ngx_http_early_hints_learn_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("early_hints_learn"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_early_hints_learn,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_early_hints_filter_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_early_hints_init,             /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    ngx_http_early_hints_create_conf,      /* create location configuration */
+    ngx_http_early_hints_merge_conf        /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_early_hints_filter_module = {
+    NGX_MODULE_V1,
+    &ngx_http_early_hints_filter_module_ctx, /* module context */
+    ngx_http_early_hints_commands,         /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
+
+
+static ngx_int_t
+ngx_http_early_hints_handler(ngx_http_request_t *r)
+{
+    u_char                       *p;
+    uint32_t                      hash;
+    ngx_int_t                     rc;
+    ngx_str_t                     key, links;
+    ngx_table_elt_t              *h;
+    ngx_http_early_hints_ctx_t   *ctx;
+    ngx_http_early_hints_node_t  *eh;
+    ngx_http_early_hints_conf_t  *ehcf;
+
+    ehcf = ngx_http_get_module_loc_conf(r, ngx_http_early_hints_filter_module);
+
+    if (ehcf->shm_zone == NULL
+        || r != r->main
+        || r->header_sent
+        || !(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD)))
+    {
+        return NGX_DECLINED;
+    }
+
+    ctx = ehcf->shm_zone->data;
+
+    rc = ngx_http_early_hints_key(r, ctx, &key);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    hash = ngx_crc32_short(key.data, key.len);
+
+    links.len = 0;
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    eh = ngx_http_early_hints_lookup(ctx, hash, &key);
+
+    if (eh) {
+        p = ngx_pnalloc(r->pool, eh->links_len);
+
+        if (p) {
+            ngx_memcpy(p, eh->data + eh->len, eh->links_len);
+
+            links.len = eh->links_len;
+            links.data = p;
+        }
+    }
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    if (links.len == 0) {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "early hints learned for \"%V\": \"%V\"", &key, &links);
+
+    h = ngx_list_push(&r->headers_out.headers);
+    if (h == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    h->hash = 1;
+    h->next = NULL;
+    ngx_str_set(&h->key, "Link");
+    h->value = links;
+
+    rc = ngx_http_send_early_hints(r);
+
+    /* the header only belongs to the early hints */
+    h->hash = 0;
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_http_early_hints_header_filter(ngx_http_request_t *r)
+{
+    uint32_t                      hash;
+    ngx_str_t                     key, links;
+    ngx_http_early_hints_ctx_t   *ctx;
+    ngx_http_early_hints_conf_t  *ehcf;
+
+    ehcf = ngx_http_get_module_loc_conf(r, ngx_http_early_hints_filter_module);
+
+    if (ehcf->shm_zone == NULL
+        || r != r->main
+        || r->headers_out.status != NGX_HTTP_OK
+        || !(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD)))
+    {
+        return ngx_http_next_header_filter(r);
+    }
+
+    ctx = ehcf->shm_zone->data;
+
+    if (ngx_http_early_hints_key(r, ctx, &key) != NGX_OK) {
+        return ngx_http_next_header_filter(r);
+    }
+
+    if (ngx_http_early_hints_links(r, &links) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    hash = ngx_crc32_short(key.data, key.len);
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    ngx_http_early_hints_update(ctx, hash, &key, &links);
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    return ngx_http_next_header_filter(r);
+}
+
+
+static ngx_int_t
+ngx_http_early_hints_key(ngx_http_request_t *r,
+    ngx_http_early_hints_ctx_t *ctx, ngx_str_t *key)
+{
+    if (ngx_http_complex_value(r, &ctx->key, key) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (key->len == 0) {
+        return NGX_DECLINED;
+    }
+
+    if (key->len > 65535) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "the value of the \"%V\" key "
+                      "is more than 65535 bytes: \"%V\"",
+                      &ctx->key.value, key);
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_early_hints_links(ngx_http_request_t *r, ngx_str_t *links)
+{
+    u_char           *p, *last, *start, *end, *params;
+    size_t            len;
+    ngx_uint_t        i, quoted;
+    ngx_list_part_t  *part;
+    ngx_table_elt_t  *header;
+
+    links->len = 0;
+    links->data = NULL;
+
+    part = &r->headers_out.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].hash == 0
+            || header[i].key.len != sizeof("Link") - 1
+            || ngx_strncasecmp(header[i].key.data, (u_char *) "Link",
+                               sizeof("Link") - 1)
+               != 0)
+        {
+            continue;
+        }
+
+        p = header[i].value.data;
+        last = p + header[i].value.len;
+
+        /* split the header into link-values, keep the preload ones */
+
+        while (p < last) {
+
+            while (p < last && (*p == ' ' || *p == '\t' || *p == ',')) {
+                p++;
+            }
+
+            start = p;
+            params = NULL;
+            quoted = 0;
+
+            for ( /* void */ ; p < last; p++) {
+
+                if (*p == '"') {
+                    quoted = !quoted;
+                    continue;
+                }
+
+                if (quoted) {
+                    continue;
+                }
+
+                if (*p == '<' && params == NULL) {
+                    p = ngx_strlchr(p, last, '>');
+                    if (p == NULL) {
+                        p = last;
+                        break;
+                    }
+
+                    params = p + 1;
+                    continue;
+                }
+
+                if (*p == ',') {
+                    break;
+                }
+            }
+
+            end = p;
+
+            if (params == NULL || !ngx_http_early_hints_preload(params, end)) {
+                continue;
+            }
+
+            len = end - start;
+
+            if (links->len + len + sizeof(", ") - 1
+                > NGX_HTTP_EARLY_HINTS_MAX_LEN)
+            {
+                continue;
+            }
+
+            if (links->data == NULL) {
+                links->data = ngx_pnalloc(r->pool,
+                                          NGX_HTTP_EARLY_HINTS_MAX_LEN);
+                if (links->data == NULL) {
+                    return NGX_ERROR;
+                }
+            }
+
+            if (links->len) {
+                links->data[links->len++] = ',';
+                links->data[links->len++] = ' ';
+            }
+
+            ngx_memcpy(links->data + links->len, start, len);
+            links->len += len;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_early_hints_preload(u_char *p, u_char *last)
+{
+    u_char  *name, *name_end, *value, *value_end, *token;
+
+    /*
+     * link-params: *( OWS ";" OWS param-name [ OWS "=" OWS param-value ] ),
+     * "preload" must be a whole relation type in the "rel" parameter
+     */
+
+    while (p < last) {
+
+        while (p < last && *p != ';') {
+            p++;
+        }
+
+        if (p == last) {
+            break;
+        }
+
+        p++;
+
+        while (p < last && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+
+        name = p;
+
+        while (p < last && *p != '=' && *p != ';' && *p != ' ' && *p != '\t')
+        {
+            p++;
+        }
+
+        name_end = p;
+
+        while (p < last && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+
+        value = p;
+        value_end = p;
+
+        if (p < last && *p == '=') {
+            p++;
+
+            while (p < last && (*p == ' ' || *p == '\t')) {
+                p++;
+            }
+
+            if (p < last && *p == '"') {
+                value = ++p;
+
+                while (p < last && *p != '"') {
+                    if (*p == '\\' && p + 1 < last) {
+                        p++;
+                    }
+
+                    p++;
+                }
+
+                value_end = p;
+
+                if (p < last) {
+                    p++;
+                }
+
+            } else {
+                value = p;
+
+                while (p < last && *p != ';' && *p != ' ' && *p != '\t') {
+                    p++;
+                }
+
+                value_end = p;
+            }
+        }
+
+        if (name_end - name != sizeof("rel") - 1
+            || ngx_strncasecmp(name, (u_char *) "rel", sizeof("rel") - 1) != 0)
+        {
+            continue;
+        }
+
+        /* only the first "rel" parameter is used, see RFC 8288 */
+
+        for (p = value; p < value_end; /* void */) {
+
+            while (p < value_end && (*p == ' ' || *p == '\t')) {
+                p++;
+            }
+
+            token = p;
+
+            while (p < value_end && *p != ' ' && *p != '\t') {
+                p++;
+            }
+
+            if (p - token == sizeof("preload") - 1
+                && ngx_strncasecmp(token, (u_char *) "preload",
+                                   sizeof("preload") - 1)
+                   == 0)
+            {
+                return 1;
+            }
+        }
+
+        return 0;
+    }
+
+    return 0;
+}
+
+
+static ngx_http_early_hints_node_t *
+ngx_http_early_hints_lookup(ngx_http_early_hints_ctx_t *ctx, ngx_uint_t hash,
+    ngx_str_t *key)
+{
+    ngx_int_t                     rc;
+    ngx_rbtree_node_t            *node, *sentinel;
+    ngx_http_early_hints_node_t  *eh;
+
+    node = ctx->sh->rbtree.root;
+    sentinel = ctx->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        eh = (ngx_http_early_hints_node_t *) &node->color;
+
+        rc = ngx_memn2cmp(key->data, eh->data, key->len, (size_t) eh->len);
+
+        if (rc == 0) {
+            ngx_queue_remove(&eh->queue);
+            ngx_queue_insert_head(&ctx->sh->queue, &eh->queue);
+
+            return eh;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_early_hints_update(ngx_http_early_hints_ctx_t *ctx, ngx_uint_t hash,
+    ngx_str_t *key, ngx_str_t *links)
+{
+    size_t                        size;
+    ngx_uint_t                    n;
+    ngx_queue_t                  *q;
+    ngx_rbtree_node_t            *node;
+    ngx_http_early_hints_node_t  *eh;
+
+    eh = ngx_http_early_hints_lookup(ctx, hash, key);
+
+    if (eh) {
+        if (eh->links_len == links->len
+            && ngx_memcmp(eh->data + eh->len, links->data, links->len) == 0)
+        {
+            return;
+        }
+
+        ngx_http_early_hints_delete(ctx, eh);
+    }
+
+    if (links->len == 0) {
+        return;
+    }
+
+    size = offsetof(ngx_rbtree_node_t, color)
+           + offsetof(ngx_http_early_hints_node_t, data)
+           + key->len
+           + links->len;
+
+    for (n = 0; /* void */; n++) {
+
+        node = ngx_slab_alloc_locked(ctx->shpool, size);
+
+        if (node) {
+            break;
+        }
+
+        /* evict least recently used entries */
+
+        if (n == 4 || ngx_queue_empty(&ctx->sh->queue)) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                          "could not allocate node%s", ctx->shpool->log_ctx);
+            return;
+        }
+
+        q = ngx_queue_last(&ctx->sh->queue);
+        eh = ngx_queue_data(q, ngx_http_early_hints_node_t, queue);
+
+        ngx_http_early_hints_delete(ctx, eh);
+    }
+
+    node->key = hash;
+
+    eh = (ngx_http_early_hints_node_t *) &node->color;
+
+    eh->len = (u_short) key->len;
+    eh->links_len = (u_short) links->len;
+
+    ngx_memcpy(ngx_cpymem(eh->data, key->data, key->len),
+               links->data, links->len);
+
+    ngx_rbtree_insert(&ctx->sh->rbtree, node);
+
+    ngx_queue_insert_head(&ctx->sh->queue, &eh->queue);
+}
+
+
+static void
+ngx_http_early_hints_delete(ngx_http_early_hints_ctx_t *ctx,
+    ngx_http_early_hints_node_t *eh)
+{
+    ngx_rbtree_node_t  *node;
+
+    ngx_queue_remove(&eh->queue);
+
+    node = (ngx_rbtree_node_t *)
+               ((u_char *) eh - offsetof(ngx_rbtree_node_t, color));
+
+    ngx_rbtree_delete(&ctx->sh->rbtree, node);
+
+    ngx_slab_free_locked(ctx->shpool, node);
+}
+
+
+static void
+ngx_http_early_hints_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t            **p;
+    ngx_http_early_hints_node_t   *ehn, *ehnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            ehn = (ngx_http_early_hints_node_t *) &node->color;
+            ehnt = (ngx_http_early_hints_node_t *) &temp->color;
+
+            p = (ngx_memn2cmp(ehn->data, ehnt->data, ehn->len, ehnt->len) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_int_t
+ngx_http_early_hints_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_early_hints_ctx_t  *octx = data;
+
+    size_t                       len;
+    ngx_http_early_hints_ctx_t  *ctx;
+
+    ctx = shm_zone->data;
+
+    if (octx) {
+        if (ctx->key.value.len != octx->key.value.len
+            || ngx_strncmp(ctx->key.value.data, octx->key.value.data,
+                           ctx->key.value.len)
+               != 0)
+        {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "early_hints_learn \"%V\" uses the \"%V\" key "
+                          "while previously it used the \"%V\" key",
+                          &shm_zone->shm.name, &ctx->key.value,
+                          &octx->key.value);
+            return NGX_ERROR;
+        }
+
+        ctx->sh = octx->sh;
+        ctx->shpool = octx->shpool;
+
+        return NGX_OK;
+    }
+
+    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        ctx->sh = ctx->shpool->data;
+
+        return NGX_OK;
+    }
+
+    ctx->sh = ngx_slab_alloc(ctx->shpool,
+                             sizeof(ngx_http_early_hints_shctx_t));
+    if (ctx->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->shpool->data = ctx->sh;
+
+    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
+                    ngx_http_early_hints_rbtree_insert_value);
+
+    ngx_queue_init(&ctx->sh->queue);
+
+    len = sizeof(" in early_hints_learn zone \"\"") + shm_zone->shm.name.len;
+
+    ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
+    if (ctx->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(ctx->shpool->log_ctx, " in early_hints_learn zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    ctx->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_early_hints_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_early_hints_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_early_hints_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->shm_zone = NGX_CONF_UNSET_PTR;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_early_hints_merge_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_early_hints_conf_t *prev = parent;
+    ngx_http_early_hints_conf_t *conf = child;
+
+    ngx_conf_merge_ptr_value(conf->shm_zone, prev->shm_zone, NULL);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_early_hints_learn_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    u_char                            *p;
+    ssize_t                            size;
+    ngx_str_t                         *value, name, s;
+    ngx_shm_zone_t                    *shm_zone;
+    ngx_http_early_hints_ctx_t        *ctx;
+    ngx_http_compile_complex_value_t   ccv;
+
+    value = cf->args->elts;
+
+    ctx = ngx_pcalloc(cf->pool, sizeof(ngx_http_early_hints_ctx_t));
+    if (ctx == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &value[1];
+    ccv.complex_value = &ctx->key;
+
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_strncmp(value[2].data, "zone=", 5) != 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    name.data = value[2].data + 5;
+
+    p = (u_char *) ngx_strchr(name.data, ':');
+
+    if (p == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    name.len = p - name.data;
+
+    s.data = p + 1;
+    s.len = value[2].data + value[2].len - s.data;
+
+    size = ngx_parse_size(&s);
+
+    if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_early_hints_filter_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data) {
+        ctx = shm_zone->data;
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "%V \"%V\" is already bound to key \"%V\"",
+                           &cmd->name, &name, &ctx->key.value);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone->init = ngx_http_early_hints_init_zone;
+    shm_zone->data = ctx;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_early_hints_learn(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_early_hints_conf_t  *ehcf = conf;
+
+    ngx_str_t  *value;
+
+    if (ehcf->shm_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        ehcf->shm_zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    ehcf->shm_zone = ngx_shared_memory_add(cf, &value[1], 0,
+                                           &ngx_http_early_hints_filter_module);
+    if (ehcf->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_early_hints_init(ngx_conf_t *cf)
+{
+    ngx_http_handler_pt        *h;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_PRECONTENT_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_early_hints_handler;
+
+    ngx_http_next_header_filter = ngx_http_top_header_filter;
+    ngx_http_top_header_filter = ngx_http_early_hints_header_filter;
+
+    return NGX_OK;
+}
@@ -13,6 +13,10 @@
 #include <zlib.h>
 #endif
 
+#if (NGX_ZSTD)
+#include <zstd.h>
+#endif
+
 
 typedef struct ngx_http_log_op_s  ngx_http_log_op_t;
 
@@ -35,6 +39,7 @@ typedef struct {
     ngx_str_t                   name;
     ngx_array_t                *flushes;
     ngx_array_t                *ops;        /* array of ngx_http_log_op_t */
+    ngx_str_t                   schema;     /* binary formats only */
 } ngx_http_log_fmt_t;
 
 
@@ -44,6 +49,29 @@ typedef struct {
 } ngx_http_log_main_conf_t;
 
 
+#if (NGX_THREADS)
+
+typedef struct ngx_http_log_thread_ctx_s  ngx_http_log_thread_ctx_t;
+
+struct ngx_http_log_thread_ctx_s {
+    ngx_thread_task_t           task;
+    ngx_open_file_t            *file;
+    ngx_fd_t                    fd;
+    u_char                     *data;
+    size_t                      len;
+    ssize_t                     n;
+    ngx_err_t                   err;
+#if (NGX_ZSTD)
+    ZSTD_CCtx                  *cctx;
+#endif
+    ngx_http_log_thread_ctx_t  *next;
+};
+
+#define NGX_HTTP_LOG_THREAD_TASKS  16
+
+#endif
+
+
 typedef struct {
     u_char                     *start;
     u_char                     *pos;
@@ -52,6 +80,13 @@ typedef struct {
     ngx_event_t                *event;
     ngx_msec_t                  flush;
     ngx_int_t                   gzip;
+    ngx_int_t                   zstd;
+
+#if (NGX_THREADS)
+    ngx_thread_pool_t          *thread_pool;
+    ngx_http_log_thread_ctx_t  *free;
+    ngx_uint_t                  busy;
+#endif
 } ngx_http_log_buf_t;
 
 
@@ -61,6 +96,38 @@ typedef struct {
 } ngx_http_log_script_t;
 
 
+typedef struct {
+    ngx_uint_t                  requests;
+    ngx_uint_t                  errors;
+} ngx_http_log_tail_slot_t;
+
+
+typedef struct {
+    time_t                      sec;
+    uint32_t                    size;       /* including the header */
+    uint32_t                    len;        /* 0 for padding */
+} ngx_http_log_tail_rec_t;
+
+
+typedef struct {
+    u_char                     *start;
+    size_t                      size;
+
+    size_t                      head;
+    size_t                      tail;
+
+    time_t                      window;
+    ngx_uint_t                  trigger;    /* in millionths */
+
+    ngx_http_log_tail_slot_t   *slots;
+    time_t                      last;
+    ngx_uint_t                  requests;
+    ngx_uint_t                  errors;
+
+    ngx_uint_t                  active;     /* unsigned  active:1; */
+} ngx_http_log_tail_t;
+
+
 typedef struct {
     ngx_open_file_t            *file;
     ngx_http_log_script_t      *script;
@@ -69,6 +136,10 @@ typedef struct {
     ngx_syslog_peer_t          *syslog_peer;
     ngx_http_log_fmt_t         *format;
     ngx_http_complex_value_t   *filter;
+    ngx_log_ring_t             *ring;
+    ngx_uint_t                  sample;     /* in millionths */
+    ngx_http_complex_value_t   *always;
+    ngx_http_log_tail_t        *tail;
 } ngx_http_log_t;
 
 
@@ -95,6 +166,28 @@ typedef struct {
 #define NGX_HTTP_LOG_ESCAPE_NONE     2
 
 
+/*
+ * A binary record is the length of the rest of the record and the schema
+ * identifier, both 4 bytes in network byte order, followed by the fields.
+ * A field is a varint with the value length plus one, and the value;
+ * a missing value is a single zero byte.  A schema record has zero
+ * in place of the identifier, followed by the identifier, the format name
+ * and the variable names, encoded as fields.
+ */
+
+#define NGX_HTTP_LOG_BINARY_HEADER_LEN  8
+#define NGX_HTTP_LOG_VARINT_LEN         10
+
+
+static ngx_int_t ngx_http_log_always(ngx_http_request_t *r,
+    ngx_http_log_t *log);
+static void ngx_http_log_tail_count(ngx_http_request_t *r,
+    ngx_http_log_t *log);
+static u_char *ngx_http_log_tail_alloc(ngx_http_log_tail_t *tail, size_t len);
+static void ngx_http_log_tail_evict(ngx_http_log_tail_t *tail);
+static void ngx_http_log_tail_flush(ngx_http_request_t *r,
+    ngx_http_log_t *log);
+
 static void ngx_http_log_write(ngx_http_request_t *r, ngx_http_log_t *log,
     u_char *buf, size_t len);
 static ssize_t ngx_http_log_script_write(ngx_http_request_t *r,
@@ -108,9 +201,24 @@ static void *ngx_http_log_gzip_alloc(void *opaque, u_int items, u_int size);
 static void ngx_http_log_gzip_free(void *opaque, void *address);
 #endif
 
+#if (NGX_ZSTD)
+static ssize_t ngx_http_log_zstd(ngx_fd_t fd, u_char *buf, size_t len,
+    ngx_int_t level, ZSTD_CCtx **cctx, ngx_log_t *log);
+#endif
+
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_log_thread_write(ngx_open_file_t *file, u_char *buf,
+    size_t len, ngx_log_t *log);
+static void ngx_http_log_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_log_thread_event_handler(ngx_event_t *ev);
+#endif
+
 static void ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log);
 static void ngx_http_log_flush_handler(ngx_event_t *ev);
 
+static u_char *ngx_http_log_end(ngx_http_log_fmt_t *fmt, u_char *start,
+    u_char *p);
+
 static u_char *ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static u_char *ngx_http_log_time(ngx_http_request_t *r, u_char *buf,
@@ -145,6 +253,13 @@ static size_t ngx_http_log_unescaped_variable_getlen(ngx_http_request_t *r,
     uintptr_t data);
 static u_char *ngx_http_log_unescaped_variable(ngx_http_request_t *r,
     u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_header(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static size_t ngx_http_log_binary_variable_getlen(ngx_http_request_t *r,
+    uintptr_t data);
+static u_char *ngx_http_log_binary_variable(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_field(u_char *p, u_char *data, size_t len);
 
 
 static void *ngx_http_log_create_main_conf(ngx_conf_t *cf);
@@ -155,8 +270,14 @@ static char *ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static ngx_int_t ngx_http_log_parse_rate(ngx_str_t *s);
 static char *ngx_http_log_compile_format(ngx_conf_t *cf,
     ngx_array_t *flushes, ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s);
+static char *ngx_http_log_compile_binary_format(ngx_conf_t *cf,
+    ngx_http_log_fmt_t *fmt, ngx_array_t *args, ngx_uint_t s);
+static ngx_int_t ngx_http_log_add_schema(ngx_conf_t *cf,
+    ngx_open_file_t *file, ngx_str_t *schema);
+static ngx_int_t ngx_http_log_init_headers(ngx_conf_t *cf);
 static char *ngx_http_log_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_log_init(ngx_conf_t *cf);
@@ -223,6 +344,10 @@ ngx_module_t  ngx_http_log_module = {
 
 static ngx_str_t  ngx_http_access_log = ngx_string(NGX_HTTP_LOG_PATH);
 
+#if (NGX_ZSTD)
+static ZSTD_CCtx  *ngx_http_log_zstd_cctx;
+#endif
+
 
 static ngx_str_t  ngx_http_combined_fmt =
     ngx_string("$remote_addr - $remote_user [$time_local] "
@@ -256,6 +381,7 @@ ngx_http_log_handler(ngx_http_request_t *r)
     u_char                   *line, *p;
     size_t                    len, size;
     ssize_t                   n;
+    ngx_int_t                 rc;
     ngx_str_t                 val;
     ngx_uint_t                i, l;
     ngx_http_log_t           *log;
@@ -285,6 +411,28 @@ ngx_http_log_handler(ngx_http_request_t *r)
             }
         }
 
+        if (log[l].tail) {
+            ngx_http_log_tail_count(r, &log[l]);
+        }
+
+        /* NGX_DECLINED here means that "always_if" is not evaluated yet */
+
+        rc = NGX_DECLINED;
+
+        if (log[l].sample
+            && (ngx_uint_t) ngx_random() % 1000000 >= log[l].sample)
+        {
+            rc = ngx_http_log_always(r, &log[l]);
+
+            if (rc == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            if (rc == NGX_DECLINED) {
+                continue;
+            }
+        }
+
         if (ngx_time() == log[l].disk_full_time) {
 
             /*
@@ -321,6 +469,55 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
         len += NGX_LINEFEED_SIZE;
 
+        if (log[l].tail && !log[l].tail->active) {
+
+            if (rc == NGX_DECLINED) {
+                rc = ngx_http_log_always(r, &log[l]);
+
+                if (rc == NGX_ERROR) {
+                    return NGX_ERROR;
+                }
+            }
+
+            line = (rc == NGX_DECLINED)
+                   ? ngx_http_log_tail_alloc(log[l].tail, len) : NULL;
+
+            if (line) {
+                p = line;
+
+                for (i = 0; i < log[l].format->ops->nelts; i++) {
+                    p = op[i].run(r, p, &op[i]);
+                }
+
+                p = ngx_http_log_end(log[l].format, line, p);
+
+                ((ngx_http_log_tail_rec_t *) line - 1)->len = p - line;
+
+                continue;
+            }
+        }
+
+        if (log[l].ring && ngx_process == NGX_PROCESS_WORKER && !ngx_exiting) {
+
+            line = ngx_log_ring_alloc(log[l].ring, len);
+            if (line == NULL) {
+                /* the ring is full, the record is counted as dropped */
+                continue;
+            }
+
+            p = line;
+
+            for (i = 0; i < log[l].format->ops->nelts; i++) {
+                p = op[i].run(r, p, &op[i]);
+            }
+
+            p = ngx_http_log_end(log[l].format, line, p);
+
+            ngx_log_ring_commit(line, p - line);
+
+            continue;
+        }
+
         buffer = log[l].file ? log[l].file->data : NULL;
 
         if (buffer) {
@@ -345,7 +542,7 @@ ngx_http_log_handler(ngx_http_request_t *r)
                     p = op[i].run(r, p, &op[i]);
                 }
 
-                ngx_linefeed(p);
+                p = ngx_http_log_end(log[l].format, buffer->pos, p);
 
                 buffer->pos = p;
 
@@ -393,7 +590,7 @@ ngx_http_log_handler(ngx_http_request_t *r)
             continue;
         }
 
-        ngx_linefeed(p);
+        p = ngx_http_log_end(log[l].format, line, p);
 
         ngx_http_log_write(r, &log[l], line, p - line);
     }
@@ -402,6 +599,227 @@ ngx_http_log_handler(ngx_http_request_t *r)
 }
 
 
+static ngx_int_t
+ngx_http_log_always(ngx_http_request_t *r, ngx_http_log_t *log)
+{
+    ngx_str_t  val;
+
+    if (log->always == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_http_complex_value(r, log->always, &val) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (val.len == 0 || (val.len == 1 && val.data[0] == '0')) {
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_log_tail_count(ngx_http_request_t *r, ngx_http_log_t *log)
+{
+    time_t                     now, t;
+    uint64_t                   requests, errors;
+    ngx_uint_t                 status;
+    ngx_http_log_tail_t       *tail;
+    ngx_http_log_tail_rec_t   *rec;
+    ngx_http_log_tail_slot_t  *slot;
+
+    tail = log->tail;
+    now = ngx_time();
+
+    /* requests and errors are counted in one second slots over the window */
+
+    if (now != tail->last) {
+
+        if (now - tail->last >= tail->window) {
+            ngx_memzero(tail->slots,
+                        tail->window * sizeof(ngx_http_log_tail_slot_t));
+            tail->requests = 0;
+            tail->errors = 0;
+
+        } else {
+            for (t = tail->last + 1; t <= now; t++) {
+                slot = &tail->slots[t % tail->window];
+
+                tail->requests -= slot->requests;
+                tail->errors -= slot->errors;
+
+                slot->requests = 0;
+                slot->errors = 0;
+            }
+        }
+
+        tail->last = now;
+
+        while (tail->head != tail->tail) {
+
+            if (tail->size - tail->head % tail->size
+                >= sizeof(ngx_http_log_tail_rec_t))
+            {
+                rec = (ngx_http_log_tail_rec_t *)
+                          (tail->start + tail->head % tail->size);
+
+                if (rec->len && rec->sec > now - tail->window) {
+                    break;
+                }
+            }
+
+            ngx_http_log_tail_evict(tail);
+        }
+    }
+
+    if (r->err_status) {
+        status = r->err_status;
+
+    } else {
+        status = r->headers_out.status;
+    }
+
+    slot = &tail->slots[now % tail->window];
+
+    slot->requests++;
+    tail->requests++;
+
+    if (status >= NGX_HTTP_INTERNAL_SERVER_ERROR) {
+        slot->errors++;
+        tail->errors++;
+    }
+
+    /*
+     * the trigger fires when the share of errors reaches the configured
+     * rate and there are enough requests for the rate to be meaningful
+     */
+
+    requests = (uint64_t) tail->requests * tail->trigger;
+    errors = (uint64_t) tail->errors * 1000000;
+
+    if (errors >= requests && requests >= 1000000) {
+
+        if (!tail->active) {
+            ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                          "access_log \"%V\" error rate trigger fired: "
+                          "%ui errors in %ui requests",
+                          &log->file->name, tail->errors, tail->requests);
+
+            ngx_http_log_tail_flush(r, log);
+            tail->active = 1;
+        }
+
+    } else {
+        tail->active = 0;
+    }
+}
+
+
+static u_char *
+ngx_http_log_tail_alloc(ngx_http_log_tail_t *tail, size_t len)
+{
+    size_t                    need, skip, off;
+    ngx_http_log_tail_rec_t  *rec;
+
+    need = ngx_align(sizeof(ngx_http_log_tail_rec_t) + len, sizeof(time_t));
+
+    if (need > tail->size / 2) {
+        return NULL;
+    }
+
+    off = tail->tail % tail->size;
+    skip = (tail->size - off < need) ? tail->size - off : 0;
+
+    while (tail->tail + skip + need - tail->head > tail->size) {
+        ngx_http_log_tail_evict(tail);
+    }
+
+    if (skip) {
+        if (skip >= sizeof(ngx_http_log_tail_rec_t)) {
+            rec = (ngx_http_log_tail_rec_t *) (tail->start + off);
+            rec->size = skip;
+            rec->len = 0;
+        }
+
+        tail->tail += skip;
+    }
+
+    rec = (ngx_http_log_tail_rec_t *) (tail->start + tail->tail % tail->size);
+
+    rec->sec = ngx_time();
+    rec->size = need;
+    rec->len = 0;
+
+    tail->tail += need;
+
+    return (u_char *) (rec + 1);
+}
+
+
+static void
+ngx_http_log_tail_evict(ngx_http_log_tail_t *tail)
+{
+    size_t                    off;
+    ngx_http_log_tail_rec_t  *rec;
+
+    off = tail->head % tail->size;
+
+    if (tail->size - off < sizeof(ngx_http_log_tail_rec_t)) {
+        tail->head += tail->size - off;
+
+    } else {
+        rec = (ngx_http_log_tail_rec_t *) (tail->start + off);
+        tail->head += rec->size;
+    }
+
+    if (tail->head >= tail->size) {
+        tail->head -= tail->size;
+        tail->tail -= tail->size;
+    }
+}
+
+
+static void
+ngx_http_log_tail_flush(ngx_http_request_t *r, ngx_http_log_t *log)
+{
+    u_char                   *buf, *p;
+    size_t                    off;
+    ngx_http_log_tail_t      *tail;
+    ngx_http_log_tail_rec_t  *rec;
+
+    tail = log->tail;
+
+    if (tail->head == tail->tail) {
+        return;
+    }
+
+    buf = ngx_alloc(tail->tail - tail->head, r->connection->log);
+
+    p = buf;
+
+    while (tail->head != tail->tail) {
+        off = tail->head % tail->size;
+
+        if (buf && tail->size - off >= sizeof(ngx_http_log_tail_rec_t)) {
+            rec = (ngx_http_log_tail_rec_t *) (tail->start + off);
+            p = ngx_cpymem(p, rec + 1, rec->len);
+        }
+
+        ngx_http_log_tail_evict(tail);
+    }
+
+    if (buf) {
+        ngx_http_log_write(r, log, buf, p - buf);
+        ngx_free(buf);
+    }
+
+    tail->head = 0;
+    tail->tail = 0;
+}
+
+
 static void
 ngx_http_log_write(ngx_http_request_t *r, ngx_http_log_t *log, u_char *buf,
     size_t len)
@@ -410,25 +828,40 @@ ngx_http_log_write(ngx_http_request_t *r, ngx_http_log_t *log, u_char *buf,
     time_t               now;
     ssize_t              n;
     ngx_err_t            err;
-#if (NGX_ZLIB)
+#if (NGX_ZLIB || NGX_ZSTD)
     ngx_http_log_buf_t  *buffer;
 #endif
 
     if (log->script == NULL) {
         name = log->file->name.data;
 
-#if (NGX_ZLIB)
+#if (NGX_THREADS)
+        if (ngx_http_log_thread_write(log->file, buf, len, r->connection->log)
+            == NGX_OK)
+        {
+            return;
+        }
+#endif
+
+#if (NGX_ZLIB || NGX_ZSTD)
         buffer = log->file->data;
+#endif
 
+#if (NGX_ZLIB)
         if (buffer && buffer->gzip) {
             n = ngx_http_log_gzip(log->file->fd, buf, len, buffer->gzip,
                                   r->connection->log);
-        } else {
+        } else
+#endif
+#if (NGX_ZSTD)
+        if (buffer && buffer->zstd) {
+            n = ngx_http_log_zstd(log->file->fd, buf, len, buffer->zstd,
+                                  &ngx_http_log_zstd_cctx, r->connection->log);
+        } else
+#endif
+        {
             n = ngx_write_fd(log->file->fd, buf, len);
         }
-#else
-        n = ngx_write_fd(log->file->fd, buf, len);
-#endif
 
     } else {
         name = NULL;
@@ -715,48 +1148,277 @@ ngx_http_log_gzip_free(void *opaque, void *address)
 #endif
 
 
-static void
-ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
+#if (NGX_ZSTD)
+
+static ssize_t
+ngx_http_log_zstd(ngx_fd_t fd, u_char *buf, size_t len, ngx_int_t level,
+    ZSTD_CCtx **cctx, ngx_log_t *log)
 {
-    size_t               len;
-    ssize_t              n;
-    ngx_http_log_buf_t  *buffer;
+    u_char     *out;
+    size_t      size;
+    ssize_t     n;
+    ngx_err_t   err;
 
-    buffer = file->data;
+    /* the context is kept to avoid reallocating its tables on each flush */
 
-    len = buffer->pos - buffer->start;
+    if (*cctx == NULL) {
+        *cctx = ZSTD_createCCtx();
+        if (*cctx == NULL) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0, "ZSTD_createCCtx() failed");
 
-    if (len == 0) {
-        return;
+            /* simulate successful logging */
+            return len;
+        }
     }
 
-#if (NGX_ZLIB)
-    if (buffer->gzip) {
-        n = ngx_http_log_gzip(file->fd, buffer->start, len, buffer->gzip, log);
-    } else {
-        n = ngx_write_fd(file->fd, buffer->start, len);
+    size = ZSTD_compressBound(len);
+
+    out = ngx_alloc(size, log);
+    if (out == NULL) {
+        /* simulate successful logging */
+        return len;
     }
-#else
-    n = ngx_write_fd(file->fd, buffer->start, len);
-#endif
 
-    if (n == -1) {
-        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
-                      ngx_write_fd_n " to \"%s\" failed",
-                      file->name.data);
+    /* each flush is a complete frame, concatenated frames are a valid stream */
 
-    } else if ((size_t) n != len) {
+    size = ZSTD_compressCCtx(*cctx, out, size, buf, len, (int) level);
+
+    if (ZSTD_isError(size)) {
         ngx_log_error(NGX_LOG_ALERT, log, 0,
-                      ngx_write_fd_n " to \"%s\" was incomplete: %z of %uz",
-                      file->name.data, n, len);
+                      "ZSTD_compressCCtx() failed: %s",
+                      ZSTD_getErrorName(size));
+        goto done;
     }
 
-    buffer->pos = buffer->start;
-
-    if (buffer->event && buffer->event->timer_set) {
-        ngx_del_timer(buffer->event);
-    }
-}
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "zstd in:%uz out:%uz", len, size);
+
+    n = ngx_write_fd(fd, out, size);
+
+    if (n != (ssize_t) size) {
+        err = (n == -1) ? ngx_errno : 0;
+
+        ngx_free(out);
+
+        ngx_set_errno(err);
+        return -1;
+    }
+
+done:
+
+    ngx_free(out);
+
+    /* simulate successful logging */
+    return len;
+}
+
+#endif
+
+
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_log_thread_write(ngx_open_file_t *file, u_char *buf, size_t len,
+    ngx_log_t *log)
+{
+    ngx_fd_t                    fd;
+    ngx_http_log_buf_t         *buffer;
+    ngx_http_log_thread_ctx_t  *ctx;
+
+    buffer = file->data;
+
+    if (buffer == NULL
+        || buffer->thread_pool == NULL
+        || len > (size_t) (buffer->last - buffer->start)
+        || (ngx_process != NGX_PROCESS_WORKER
+            && ngx_process != NGX_PROCESS_SINGLE))
+    {
+        return NGX_DECLINED;
+    }
+
+    if (buffer->busy == NGX_HTTP_LOG_THREAD_TASKS) {
+        /* the disk does not keep up, compress and write in place */
+        return NGX_DECLINED;
+    }
+
+    ctx = buffer->free;
+
+    if (ctx) {
+        buffer->free = ctx->next;
+
+    } else {
+        ctx = ngx_calloc(sizeof(ngx_http_log_thread_ctx_t)
+                         + (buffer->last - buffer->start), log);
+        if (ctx == NULL) {
+            return NGX_DECLINED;
+        }
+
+        ctx->data = (u_char *) ctx + sizeof(ngx_http_log_thread_ctx_t);
+        ctx->file = file;
+
+        ctx->task.ctx = ctx;
+        ctx->task.handler = ngx_http_log_thread_handler;
+        ctx->task.event.data = ctx;
+        ctx->task.event.handler = ngx_http_log_thread_event_handler;
+    }
+
+    /*
+     * the task writes to its own descriptor,
+     * so the file may be reopened while the task is running
+     */
+
+    fd = dup(file->fd);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "dup(\"%s\") failed", file->name.data);
+        goto failed;
+    }
+
+    ctx->fd = fd;
+    ctx->len = len;
+    ctx->task.event.log = log;
+
+    ngx_memcpy(ctx->data, buf, len);
+
+    if (ngx_thread_task_post(buffer->thread_pool, &ctx->task) != NGX_OK) {
+        (void) ngx_close_file(fd);
+        goto failed;
+    }
+
+    buffer->busy++;
+
+    return NGX_OK;
+
+failed:
+
+    ctx->next = buffer->free;
+    buffer->free = ctx;
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_http_log_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_log_thread_ctx_t *ctx = data;
+
+    ngx_http_log_buf_t  *buffer;
+
+    buffer = ctx->file->data;
+
+#if (NGX_ZLIB)
+    if (buffer->gzip) {
+        ctx->n = ngx_http_log_gzip(ctx->fd, ctx->data, ctx->len, buffer->gzip,
+                                   log);
+    } else
+#endif
+#if (NGX_ZSTD)
+    if (buffer->zstd) {
+        ctx->n = ngx_http_log_zstd(ctx->fd, ctx->data, ctx->len, buffer->zstd,
+                                   &ctx->cctx, log);
+    } else
+#endif
+    {
+        ctx->n = ngx_write_fd(ctx->fd, ctx->data, ctx->len);
+    }
+
+    ctx->err = (ctx->n == -1) ? ngx_errno : 0;
+
+    (void) ngx_close_file(ctx->fd);
+}
+
+
+static void
+ngx_http_log_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_http_log_thread_ctx_t *ctx = ev->data;
+
+    ngx_http_log_buf_t  *buffer;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http log thread write: %z of %uz", ctx->n, ctx->len);
+
+    if (ctx->n == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, ctx->err,
+                      ngx_write_fd_n " to \"%s\" failed",
+                      ctx->file->name.data);
+
+    } else if ((size_t) ctx->n != ctx->len) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
+                      ngx_write_fd_n " to \"%s\" was incomplete: %z of %uz",
+                      ctx->file->name.data, ctx->n, ctx->len);
+    }
+
+    buffer = ctx->file->data;
+
+    buffer->busy--;
+
+    ctx->next = buffer->free;
+    buffer->free = ctx;
+}
+
+#endif
+
+
+static void
+ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
+{
+    size_t               len;
+    ssize_t              n;
+    ngx_http_log_buf_t  *buffer;
+
+    buffer = file->data;
+
+    len = buffer->pos - buffer->start;
+
+    if (len == 0) {
+        return;
+    }
+
+#if (NGX_THREADS)
+    if (ngx_http_log_thread_write(file, buffer->start, len, log) == NGX_OK) {
+        goto done;
+    }
+#endif
+
+#if (NGX_ZLIB)
+    if (buffer->gzip) {
+        n = ngx_http_log_gzip(file->fd, buffer->start, len, buffer->gzip, log);
+    } else
+#endif
+#if (NGX_ZSTD)
+    if (buffer->zstd) {
+        n = ngx_http_log_zstd(file->fd, buffer->start, len, buffer->zstd,
+                              &ngx_http_log_zstd_cctx, log);
+    } else
+#endif
+    {
+        n = ngx_write_fd(file->fd, buffer->start, len);
+    }
+
+    if (n == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_write_fd_n " to \"%s\" failed",
+                      file->name.data);
+
+    } else if ((size_t) n != len) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      ngx_write_fd_n " to \"%s\" was incomplete: %z of %uz",
+                      file->name.data, n, len);
+    }
+
+#if (NGX_THREADS)
+done:
+#endif
+
+    buffer->pos = buffer->start;
+
+    if (buffer->event && buffer->event->timer_set) {
+        ngx_del_timer(buffer->event);
+    }
+}
 
 
 static void
@@ -769,6 +1431,27 @@ ngx_http_log_flush_handler(ngx_event_t *ev)
 }
 
 
+static u_char *
+ngx_http_log_end(ngx_http_log_fmt_t *fmt, u_char *start, u_char *p)
+{
+    size_t  len;
+
+    if (fmt->schema.len == 0) {
+        ngx_linefeed(p);
+        return p;
+    }
+
+    len = p - start - 4;
+
+    start[0] = (u_char) (len >> 24);
+    start[1] = (u_char) (len >> 16);
+    start[2] = (u_char) (len >> 8);
+    start[3] = (u_char) len;
+
+    return p;
+}
+
+
 static u_char *
 ngx_http_log_copy_short(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op)
@@ -1122,6 +1805,73 @@ ngx_http_log_unescaped_variable(ngx_http_request_t *r, u_char *buf,
 }
 
 
+static u_char *
+ngx_http_log_binary_header(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    /* the record length is set by ngx_http_log_end() */
+
+    buf += 4;
+
+    *buf++ = (u_char) (op->data >> 24);
+    *buf++ = (u_char) (op->data >> 16);
+    *buf++ = (u_char) (op->data >> 8);
+    *buf++ = (u_char) op->data;
+
+    return buf;
+}
+
+
+static size_t
+ngx_http_log_binary_variable_getlen(ngx_http_request_t *r, uintptr_t data)
+{
+    ngx_http_variable_value_t  *value;
+
+    value = ngx_http_get_indexed_variable(r, data);
+
+    if (value == NULL || value->not_found) {
+        return 1;
+    }
+
+    return NGX_HTTP_LOG_VARINT_LEN + value->len;
+}
+
+
+static u_char *
+ngx_http_log_binary_variable(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_http_variable_value_t  *value;
+
+    value = ngx_http_get_indexed_variable(r, op->data);
+
+    if (value == NULL || value->not_found) {
+        *buf = 0;
+        return buf + 1;
+    }
+
+    return ngx_http_log_binary_field(buf, value->data, value->len);
+}
+
+
+static u_char *
+ngx_http_log_binary_field(u_char *p, u_char *data, size_t len)
+{
+    size_t  n;
+
+    n = len + 1;
+
+    while (n >= 0x80) {
+        *p++ = (u_char) (n | 0x80);
+        n >>= 7;
+    }
+
+    *p++ = (u_char) n;
+
+    return ngx_cpymem(p, data, len);
+}
+
+
 static void *
 ngx_http_log_create_main_conf(ngx_conf_t *cf)
 {
@@ -1146,6 +1896,7 @@ ngx_http_log_create_main_conf(ngx_conf_t *cf)
     }
 
     ngx_str_set(&fmt->name, "combined");
+    ngx_str_null(&fmt->schema);
 
     fmt->flushes = NULL;
 
@@ -1239,9 +1990,13 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_log_loc_conf_t *llcf = conf;
 
-    ssize_t                            size;
-    ngx_int_t                          gzip;
+    time_t                             window;
+    ssize_t                            size, ring, tail_size;
+    ngx_int_t                          gzip, zstd, sample, trigger;
     ngx_uint_t                         i, n;
+#if (NGX_THREADS)
+    ngx_thread_pool_t                 *tp;
+#endif
     ngx_msec_t                         flush;
     ngx_str_t                         *value, name, s;
     ngx_http_log_t                    *log;
@@ -1361,9 +2116,35 @@ process_formats:
         return NGX_CONF_ERROR;
     }
 
+    if (log->format->schema.len) {
+
+        if (log->file == NULL) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "binary log format \"%V\" can only be used "
+                               "with a log file without variables in name",
+                               &name);
+            return NGX_CONF_ERROR;
+        }
+
+        if (ngx_http_log_add_schema(cf, log->file, &log->format->schema)
+            != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+    }
+
     size = 0;
+    ring = 0;
     flush = 0;
     gzip = 0;
+    zstd = 0;
+    sample = 0;
+    window = 0;
+    tail_size = 0;
+    trigger = 0;
+#if (NGX_THREADS)
+    tp = NULL;
+#endif
 
     for (i = 3; i < cf->args->nelts; i++) {
 
@@ -1382,6 +2163,21 @@ process_formats:
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "ring=", 5) == 0) {
+            s.len = value[i].len - 5;
+            s.data = value[i].data + 5;
+
+            ring = ngx_parse_size(&s);
+
+            if (ring == NGX_ERROR || ring == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid ring size \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "flush=", 6) == 0) {
             s.len = value[i].len - 6;
             s.data = value[i].data + 6;
@@ -1430,32 +2226,269 @@ process_formats:
 #endif
         }
 
-        if (ngx_strncmp(value[i].data, "if=", 3) == 0) {
-            s.len = value[i].len - 3;
-            s.data = value[i].data + 3;
-
-            ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+        if (ngx_strncmp(value[i].data, "zstd", 4) == 0
+            && (value[i].len == 4 || value[i].data[4] == '='))
+        {
+#if (NGX_ZSTD)
+            if (size == 0) {
+                size = 64 * 1024;
+            }
 
-            ccv.cf = cf;
-            ccv.value = &s;
-            ccv.complex_value = ngx_palloc(cf->pool,
-                                           sizeof(ngx_http_complex_value_t));
-            if (ccv.complex_value == NULL) {
-                return NGX_CONF_ERROR;
+            if (value[i].len == 4) {
+                zstd = 1;
+                continue;
             }
 
-            if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+            s.len = value[i].len - 5;
+            s.data = value[i].data + 5;
+
+            zstd = ngx_atoi(s.data, s.len);
+
+            if (zstd < 1 || zstd > ZSTD_maxCLevel()) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid compression level \"%V\"", &s);
                 return NGX_CONF_ERROR;
             }
 
-            log->filter = ccv.complex_value;
-
             continue;
-        }
 
-        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                           "invalid parameter \"%V\"", &value[i]);
-        return NGX_CONF_ERROR;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "nginx was built without zstd support");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        if (ngx_strncmp(value[i].data, "threads", 7) == 0
+            && (value[i].len == 7 || value[i].data[7] == '='))
+        {
+#if (NGX_THREADS)
+            if (value[i].len >= 8) {
+                s.len = value[i].len - 8;
+                s.data = value[i].data + 8;
+
+                tp = ngx_thread_pool_add(cf, &s);
+
+            } else {
+                tp = ngx_thread_pool_add(cf, NULL);
+            }
+
+            if (tp == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"threads\" is unsupported on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        if (ngx_strncmp(value[i].data, "if=", 3) == 0) {
+            s.len = value[i].len - 3;
+            s.data = value[i].data + 3;
+
+            ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+            ccv.cf = cf;
+            ccv.value = &s;
+            ccv.complex_value = ngx_palloc(cf->pool,
+                                           sizeof(ngx_http_complex_value_t));
+            if (ccv.complex_value == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            log->filter = ccv.complex_value;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "sample=", 7) == 0) {
+            s.len = value[i].len - 7;
+            s.data = value[i].data + 7;
+
+            sample = ngx_http_log_parse_rate(&s);
+
+            if (sample == NGX_ERROR || sample == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid sample rate \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "always_if=", 10) == 0) {
+            s.len = value[i].len - 10;
+            s.data = value[i].data + 10;
+
+            ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+            ccv.cf = cf;
+            ccv.value = &s;
+            ccv.complex_value = ngx_palloc(cf->pool,
+                                           sizeof(ngx_http_complex_value_t));
+            if (ccv.complex_value == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            log->always = ccv.complex_value;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "tail=", 5) == 0) {
+            s.len = value[i].len - 5;
+            s.data = value[i].data + 5;
+
+            window = ngx_parse_time(&s, 1);
+
+            if (window == (time_t) NGX_ERROR || window == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid tail time \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "tail_size=", 10) == 0) {
+            s.len = value[i].len - 10;
+            s.data = value[i].data + 10;
+
+            tail_size = ngx_parse_size(&s);
+
+            if (tail_size == NGX_ERROR || tail_size < 4096) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid tail size \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "tail_trigger=", 13) == 0) {
+            s.len = value[i].len - 13;
+            s.data = value[i].data + 13;
+
+            trigger = ngx_http_log_parse_rate(&s);
+
+            if (trigger == NGX_ERROR || trigger == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid tail trigger \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    log->sample = sample;
+
+    if (log->always && sample == 0 && window == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"always_if\" requires \"sample\" or \"tail\" "
+                           "for access_log \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if ((tail_size || trigger) && window == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no tail is defined for access_log \"%V\"",
+                           &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (window) {
+
+        if (ring) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "access_log \"%V\" cannot both keep a tail "
+                               "and use a ring", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+        if (log->script) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "logs with a tail cannot have variables "
+                               "in name");
+            return NGX_CONF_ERROR;
+        }
+
+        if (log->syslog_peer) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "logs to syslog cannot keep a tail");
+            return NGX_CONF_ERROR;
+        }
+
+        log->tail = ngx_pcalloc(cf->pool, sizeof(ngx_http_log_tail_t));
+        if (log->tail == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        log->tail->size = tail_size ? tail_size : 1024 * 1024;
+        log->tail->window = window;
+        log->tail->trigger = trigger ? trigger : 50000;
+
+        log->tail->start = ngx_palloc(cf->pool, log->tail->size);
+        if (log->tail->start == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        log->tail->slots = ngx_pcalloc(cf->pool,
+                                   window * sizeof(ngx_http_log_tail_slot_t));
+        if (log->tail->slots == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    if (ring) {
+
+        if (size) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "access_log \"%V\" cannot be both buffered "
+                               "and use a ring", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+        if (log->script) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "logs with a ring cannot have variables "
+                               "in name");
+            return NGX_CONF_ERROR;
+        }
+
+        if (log->syslog_peer) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "logs to syslog cannot use a ring");
+            return NGX_CONF_ERROR;
+        }
+
+        log->ring = ngx_log_ring_add(cf, log->file, ring);
+        if (log->ring == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    if (gzip && zstd) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "access_log \"%V\" cannot use both gzip and zstd",
+                           &value[1]);
+        return NGX_CONF_ERROR;
     }
 
     if (flush && size == 0) {
@@ -1465,6 +2498,15 @@ process_formats:
         return NGX_CONF_ERROR;
     }
 
+#if (NGX_THREADS)
+    if (tp && size == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no buffer is defined for access_log \"%V\"",
+                           &value[1]);
+        return NGX_CONF_ERROR;
+    }
+#endif
+
     if (size) {
 
         if (log->script) {
@@ -1484,7 +2526,11 @@ process_formats:
 
             if (buffer->last - buffer->start != size
                 || buffer->flush != flush
-                || buffer->gzip != gzip)
+#if (NGX_THREADS)
+                || buffer->thread_pool != tp
+#endif
+                || buffer->gzip != gzip
+                || buffer->zstd != zstd)
             {
                 ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                                    "access_log \"%V\" already defined "
@@ -1524,6 +2570,11 @@ process_formats:
         }
 
         buffer->gzip = gzip;
+        buffer->zstd = zstd;
+
+#if (NGX_THREADS)
+        buffer->thread_pool = tp;
+#endif
 
         log->file->flush = ngx_http_log_flush;
         log->file->data = buffer;
@@ -1533,6 +2584,28 @@ process_formats:
 }
 
 
+static ngx_int_t
+ngx_http_log_parse_rate(ngx_str_t *s)
+{
+    ngx_int_t  rate;
+
+    /* a fraction such as "0.01" or a percentage such as "1%", in millionths */
+
+    if (s->len && s->data[s->len - 1] == '%') {
+        rate = ngx_atofp(s->data, s->len - 1, 4);
+
+    } else {
+        rate = ngx_atofp(s->data, s->len, 6);
+    }
+
+    if (rate == NGX_ERROR || rate > 1000000) {
+        return NGX_ERROR;
+    }
+
+    return rate;
+}
+
+
 static char *
 ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -1562,6 +2635,7 @@ ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     fmt->name = value[1];
+    ngx_str_null(&fmt->schema);
 
     fmt->flushes = ngx_array_create(cf->pool, 4, sizeof(ngx_int_t));
     if (fmt->flushes == NULL) {
@@ -1573,6 +2647,10 @@ ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (cf->args->nelts > 2 && ngx_strcmp(value[2].data, "binary") == 0) {
+        return ngx_http_log_compile_binary_format(cf, fmt, cf->args, 3);
+    }
+
     return ngx_http_log_compile_format(cf, fmt->flushes, fmt->ops, cf->args, 2);
 }
 
@@ -1756,6 +2834,177 @@ invalid:
 }
 
 
+static char *
+ngx_http_log_compile_binary_format(ngx_conf_t *cf, ngx_http_log_fmt_t *fmt,
+    ngx_array_t *args, ngx_uint_t s)
+{
+    u_char             *p, *fields;
+    size_t              len;
+    uint32_t            id;
+    ngx_str_t          *value, var;
+    ngx_int_t           index, *flush;
+    ngx_uint_t          i;
+    ngx_http_log_op_t  *op, *header;
+
+    value = args->elts;
+
+    if (s == args->nelts) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no variables in binary log format \"%V\"",
+                           &fmt->name);
+        return NGX_CONF_ERROR;
+    }
+
+    len = NGX_HTTP_LOG_BINARY_HEADER_LEN + 4
+          + NGX_HTTP_LOG_VARINT_LEN + fmt->name.len;
+
+    for (i = s; i < args->nelts; i++) {
+        len += NGX_HTTP_LOG_VARINT_LEN + value[i].len;
+    }
+
+    p = ngx_pnalloc(cf->pool, len);
+    if (p == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    fields = p + NGX_HTTP_LOG_BINARY_HEADER_LEN + 4;
+
+    fmt->schema.data = p;
+    p = ngx_http_log_binary_field(fields, fmt->name.data, fmt->name.len);
+
+    header = ngx_array_push(fmt->ops);
+    if (header == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    header->len = NGX_HTTP_LOG_BINARY_HEADER_LEN;
+    header->getlen = NULL;
+    header->run = ngx_http_log_binary_header;
+
+    /* each argument is a single variable which becomes a field */
+
+    for (i = s; i < args->nelts; i++) {
+
+        var = value[i];
+
+        if (var.len < 2 || var.data[0] != '$') {
+            goto invalid;
+        }
+
+        var.len--;
+        var.data++;
+
+        if (var.data[0] == '{') {
+            if (var.len < 3 || var.data[var.len - 1] != '}') {
+                goto invalid;
+            }
+
+            var.len -= 2;
+            var.data++;
+        }
+
+        index = ngx_http_get_variable_index(cf, &var);
+        if (index == NGX_ERROR) {
+            return NGX_CONF_ERROR;
+        }
+
+        op = ngx_array_push(fmt->ops);
+        if (op == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        op->len = 0;
+        op->getlen = ngx_http_log_binary_variable_getlen;
+        op->run = ngx_http_log_binary_variable;
+        op->data = index;
+
+        flush = ngx_array_push(fmt->flushes);
+        if (flush == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *flush = index;
+
+        p = ngx_http_log_binary_field(p, var.data, var.len);
+    }
+
+    id = ngx_crc32_short(fields, p - fields);
+
+    if (id == 0) {
+        id = 1;
+    }
+
+    header->data = id;
+
+    fmt->schema.len = p - fmt->schema.data;
+
+    p = fmt->schema.data;
+    len = fmt->schema.len - 4;
+
+    *p++ = (u_char) (len >> 24);
+    *p++ = (u_char) (len >> 16);
+    *p++ = (u_char) (len >> 8);
+    *p++ = (u_char) len;
+
+    *p++ = 0;
+    *p++ = 0;
+    *p++ = 0;
+    *p++ = 0;
+
+    *p++ = (u_char) (id >> 24);
+    *p++ = (u_char) (id >> 16);
+    *p++ = (u_char) (id >> 8);
+    *p = (u_char) id;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid variable \"%V\" in binary log format",
+                       &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_log_add_schema(ngx_conf_t *cf, ngx_open_file_t *file,
+    ngx_str_t *schema)
+{
+    u_char  *p, *last;
+    size_t   len;
+
+    /* the schema records of all binary formats written to the file */
+
+    p = file->header.data;
+    last = p + file->header.len;
+
+    while (p < last) {
+        len = 4 + ((size_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]);
+
+        if (len == schema->len && ngx_memcmp(p, schema->data, len) == 0) {
+            return NGX_OK;
+        }
+
+        p += len;
+    }
+
+    p = ngx_pnalloc(cf->pool, file->header.len + schema->len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(p, file->header.data, file->header.len);
+    ngx_memcpy(p + file->header.len, schema->data, schema->len);
+
+    file->header.data = p;
+    file->header.len += schema->len;
+
+    return NGX_OK;
+}
+
+
 static char *
 ngx_http_log_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -1896,6 +3145,10 @@ ngx_http_log_init(ngx_conf_t *cf)
         }
     }
 
+    if (ngx_http_log_init_headers(cf) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
     cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
 
     h = ngx_array_push(&cmcf->phases[NGX_HTTP_LOG_PHASE].handlers);
@@ -1907,3 +3160,73 @@ ngx_http_log_init(ngx_conf_t *cf)
 
     return NGX_OK;
 }
+
+
+static ngx_int_t
+ngx_http_log_init_headers(ngx_conf_t *cf)
+{
+    ngx_uint_t           i;
+    ngx_list_part_t     *part;
+    ngx_open_file_t     *file;
+    ngx_http_log_buf_t  *buffer;
+#if (NGX_ZSTD)
+    u_char              *p;
+    size_t               size;
+#endif
+
+    /* schema records of compressed logs are compressed as well */
+
+    part = &cf->cycle->open_files.part;
+    file = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            file = part->elts;
+            i = 0;
+        }
+
+        if (file[i].header.len == 0 || file[i].flush != ngx_http_log_flush) {
+            continue;
+        }
+
+        buffer = file[i].data;
+
+        if (buffer->gzip) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "binary log formats cannot be used with gzip "
+                          "in access_log \"%V\"", &file[i].name);
+            return NGX_ERROR;
+        }
+
+#if (NGX_ZSTD)
+        if (buffer->zstd) {
+            size = ZSTD_compressBound(file[i].header.len);
+
+            p = ngx_pnalloc(cf->pool, size);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            size = ZSTD_compress(p, size, file[i].header.data,
+                                 file[i].header.len, (int) buffer->zstd);
+
+            if (ZSTD_isError(size)) {
+                ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                              "ZSTD_compress() failed: %s",
+                              ZSTD_getErrorName(size));
+                return NGX_ERROR;
+            }
+
+            file[i].header.data = p;
+            file[i].header.len = size;
+        }
+#endif
+    }
+
+    return NGX_OK;
+}
@@ -0,0 +1,940 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+typedef struct {
+    uint64_t                        requests[6];
+#if (NGX_HTTP_CACHE)
+    uint64_t                        cache[7];
+#endif
+    uint64_t                        received;
+    uint64_t                        sent;
+    ngx_metrics_hist_t              request_time;
+    ngx_metrics_hist_t              response_size;
+    ngx_metrics_hist_t              upstream_connect_time;
+    ngx_metrics_hist_t              upstream_header_time;
+    ngx_metrics_hist_t              upstream_response_time;
+} ngx_http_metrics_location_t;
+
+
+typedef struct {
+    uint64_t                        responses[6];
+    uint64_t                        received;
+    uint64_t                        sent;
+    ngx_metrics_hist_t              connect_time;
+    ngx_metrics_hist_t              header_time;
+    ngx_metrics_hist_t              response_time;
+} ngx_http_metrics_peer_t;
+
+
+typedef struct {
+    ngx_metrics_hist_t              handshake_time;
+} ngx_http_metrics_server_t;
+
+
+typedef struct {
+    ngx_metrics_t                  *metrics;
+    ngx_metrics_family_t           *location;
+    ngx_metrics_family_t           *peer;
+    ngx_metrics_family_t           *server;
+} ngx_http_metrics_zone_t;
+
+
+typedef struct {
+    ngx_http_upstream_srv_conf_t   *upstream;
+    ngx_str_t                       name;
+    ngx_uint_t                      hash;
+    ngx_uint_t                      index;
+} ngx_http_metrics_peer_key_t;
+
+
+typedef struct {
+    ngx_array_t                     zones;   /* ngx_http_metrics_zone_t * */
+
+    /* open addressing table of upstream servers, the same in all zones */
+    ngx_http_metrics_peer_key_t    *peers;
+    ngx_uint_t                      peers_mask;
+} ngx_http_metrics_main_conf_t;
+
+
+typedef struct {
+    ngx_http_metrics_zone_t        *zone;
+    ngx_uint_t                      index;
+    ngx_uint_t                      server;
+    ngx_http_metrics_zone_t        *export;
+} ngx_http_metrics_loc_conf_t;
+
+
+static ngx_int_t ngx_http_metrics_handler(ngx_http_request_t *r);
+static void ngx_http_metrics_upstream(ngx_http_request_t *r,
+    ngx_http_metrics_zone_t *zone, ngx_http_metrics_location_t *loc);
+static ngx_int_t ngx_http_metrics_find_peer(ngx_http_metrics_main_conf_t *mmcf,
+    ngx_http_upstream_srv_conf_t *us, ngx_str_t *name);
+static ngx_int_t ngx_http_metrics_export_handler(ngx_http_request_t *r);
+
+static ngx_http_metrics_zone_t *ngx_http_metrics_add_zone(ngx_conf_t *cf,
+    ngx_str_t *name, size_t size);
+static ngx_int_t ngx_http_metrics_add_peers(ngx_conf_t *cf,
+    ngx_http_metrics_main_conf_t *mmcf);
+static ngx_int_t ngx_http_metrics_add_peer(ngx_conf_t *cf,
+    ngx_http_metrics_main_conf_t *mmcf, ngx_http_upstream_srv_conf_t *us,
+    ngx_str_t *name);
+static void *ngx_http_metrics_create_main_conf(ngx_conf_t *cf);
+static void *ngx_http_metrics_create_loc_conf(ngx_conf_t *cf);
+static char *ngx_http_metrics_merge_loc_conf(ngx_conf_t *cf, void *parent,
+    void *child);
+static char *ngx_http_metrics_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_metrics(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_http_metrics_export(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_metrics_init(ngx_conf_t *cf);
+
+
+static ngx_command_t  ngx_http_metrics_commands[] = {
+
+    { ngx_string("metrics_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2,
+      ngx_http_metrics_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("metrics"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_metrics,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("metrics_export"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_metrics_export,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_metrics_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_metrics_init,                 /* postconfiguration */
+
+    ngx_http_metrics_create_main_conf,     /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    ngx_http_metrics_create_loc_conf,      /* create location configuration */
+    ngx_http_metrics_merge_loc_conf        /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_metrics_module = {
+    NGX_MODULE_V1,
+    &ngx_http_metrics_module_ctx,          /* module context */
+    ngx_http_metrics_commands,             /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+#define ngx_http_metrics_counter(name, help, label, type, field)              \
+    { name, help, label, NGX_METRICS_COUNTER, 0, offsetof(type, field) }
+
+#define ngx_http_metrics_histogram(name, help, msec, type, field)             \
+    { name, help, NULL, NGX_METRICS_HISTOGRAM, msec, offsetof(type, field) }
+
+
+static ngx_metrics_desc_t  ngx_http_metrics_location_desc[] = {
+
+#define ngx_http_metrics_requests(label, n)                                   \
+    ngx_http_metrics_counter("nginx_http_requests_total",                     \
+        "Requests by response status class.", label,                         \
+        ngx_http_metrics_location_t, requests[n])
+
+    ngx_http_metrics_requests("code=\"1xx\"", 0),
+    ngx_http_metrics_requests("code=\"2xx\"", 1),
+    ngx_http_metrics_requests("code=\"3xx\"", 2),
+    ngx_http_metrics_requests("code=\"4xx\"", 3),
+    ngx_http_metrics_requests("code=\"5xx\"", 4),
+    ngx_http_metrics_requests("code=\"other\"", 5),
+
+#if (NGX_HTTP_CACHE)
+
+#define ngx_http_metrics_cache(label, n)                                      \
+    ngx_http_metrics_counter("nginx_http_cache_responses_total",              \
+        "Responses by cache status.", label,                                  \
+        ngx_http_metrics_location_t, cache[n])
+
+    ngx_http_metrics_cache("cache=\"MISS\"", 0),
+    ngx_http_metrics_cache("cache=\"BYPASS\"", 1),
+    ngx_http_metrics_cache("cache=\"EXPIRED\"", 2),
+    ngx_http_metrics_cache("cache=\"STALE\"", 3),
+    ngx_http_metrics_cache("cache=\"UPDATING\"", 4),
+    ngx_http_metrics_cache("cache=\"REVALIDATED\"", 5),
+    ngx_http_metrics_cache("cache=\"HIT\"", 6),
+
+#endif
+
+    ngx_http_metrics_counter("nginx_http_received_bytes_total",
+        "Bytes received from clients.", NULL,
+        ngx_http_metrics_location_t, received),
+
+    ngx_http_metrics_counter("nginx_http_sent_bytes_total",
+        "Bytes sent to clients.", NULL,
+        ngx_http_metrics_location_t, sent),
+
+    ngx_http_metrics_histogram("nginx_http_request_duration_seconds",
+        "Request processing time.", 1,
+        ngx_http_metrics_location_t, request_time),
+
+    ngx_http_metrics_histogram("nginx_http_response_size_bytes",
+        "Bytes sent to a client per request.", 0,
+        ngx_http_metrics_location_t, response_size),
+
+    ngx_http_metrics_histogram("nginx_http_upstream_connect_seconds",
+        "Time to establish a connection with an upstream server.", 1,
+        ngx_http_metrics_location_t, upstream_connect_time),
+
+    ngx_http_metrics_histogram("nginx_http_upstream_header_seconds",
+        "Time to receive the response header from an upstream server.", 1,
+        ngx_http_metrics_location_t, upstream_header_time),
+
+    ngx_http_metrics_histogram("nginx_http_upstream_response_seconds",
+        "Time to receive the response from an upstream server.", 1,
+        ngx_http_metrics_location_t, upstream_response_time),
+
+    { NULL, NULL, NULL, 0, 0, 0 }
+};
+
+
+static ngx_metrics_desc_t  ngx_http_metrics_peer_desc[] = {
+
+#define ngx_http_metrics_responses(label, n)                                  \
+    ngx_http_metrics_counter("nginx_http_upstream_responses_total",           \
+        "Upstream responses by status class.", label,                         \
+        ngx_http_metrics_peer_t, responses[n])
+
+    ngx_http_metrics_responses("code=\"1xx\"", 0),
+    ngx_http_metrics_responses("code=\"2xx\"", 1),
+    ngx_http_metrics_responses("code=\"3xx\"", 2),
+    ngx_http_metrics_responses("code=\"4xx\"", 3),
+    ngx_http_metrics_responses("code=\"5xx\"", 4),
+    ngx_http_metrics_responses("code=\"other\"", 5),
+
+    ngx_http_metrics_counter("nginx_http_upstream_received_bytes_total",
+        "Bytes received from an upstream server.", NULL,
+        ngx_http_metrics_peer_t, received),
+
+    ngx_http_metrics_counter("nginx_http_upstream_sent_bytes_total",
+        "Bytes sent to an upstream server.", NULL,
+        ngx_http_metrics_peer_t, sent),
+
+    ngx_http_metrics_histogram("nginx_http_upstream_peer_connect_seconds",
+        "Time to establish a connection with the server.", 1,
+        ngx_http_metrics_peer_t, connect_time),
+
+    ngx_http_metrics_histogram("nginx_http_upstream_peer_header_seconds",
+        "Time to receive the response header from the server.", 1,
+        ngx_http_metrics_peer_t, header_time),
+
+    ngx_http_metrics_histogram("nginx_http_upstream_peer_response_seconds",
+        "Time to receive the response from the server.", 1,
+        ngx_http_metrics_peer_t, response_time),
+
+    { NULL, NULL, NULL, 0, 0, 0 }
+};
+
+
+static ngx_metrics_desc_t  ngx_http_metrics_server_desc[] = {
+
+    ngx_http_metrics_histogram("nginx_http_ssl_handshake_seconds",
+        "Time from accepting a connection to completing the SSL handshake.",
+        1, ngx_http_metrics_server_t, handshake_time),
+
+    { NULL, NULL, NULL, 0, 0, 0 }
+};
+
+
+static ngx_str_t  ngx_http_metrics_server_label = ngx_string("server");
+static ngx_str_t  ngx_http_metrics_location_label = ngx_string("location");
+static ngx_str_t  ngx_http_metrics_upstream_label = ngx_string("upstream");
+static ngx_str_t  ngx_http_metrics_peer_label = ngx_string("peer");
+
+
+#define ngx_http_metrics_class(status)                                        \
+    (((status) >= 100 && (status) < 600) ? (status) / 100 - 1 : 5)
+
+
+static ngx_int_t
+ngx_http_metrics_handler(ngx_http_request_t *r)
+{
+    ngx_uint_t                    status;
+    ngx_time_t                   *tp;
+    ngx_msec_int_t                ms;
+    ngx_connection_t             *c;
+    ngx_http_metrics_zone_t      *zone;
+    ngx_http_metrics_location_t  *loc;
+    ngx_http_metrics_loc_conf_t  *mlcf;
+#if (NGX_HTTP_SSL)
+    ngx_http_metrics_server_t    *srv;
+#endif
+
+    mlcf = ngx_http_get_module_loc_conf(r, ngx_http_metrics_module);
+
+    zone = mlcf->zone;
+
+    if (zone == NULL) {
+        return NGX_OK;
+    }
+
+    c = r->connection;
+
+    loc = (ngx_http_metrics_location_t *)
+              ngx_metrics_entry(zone->metrics, zone->location, mlcf->index);
+
+    if (r->err_status) {
+        status = r->err_status;
+
+    } else {
+        status = r->headers_out.status;
+    }
+
+    loc->requests[ngx_http_metrics_class(status)]++;
+
+    tp = ngx_timeofday();
+
+    ms = (ngx_msec_int_t)
+             ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
+
+    ngx_metrics_observe(&loc->request_time, ngx_max(ms, 0));
+    ngx_metrics_observe(&loc->response_size, c->sent);
+
+    loc->received += r->request_length;
+    loc->sent += c->sent;
+
+    if (r->upstream_states) {
+        ngx_http_metrics_upstream(r, zone, loc);
+    }
+
+#if (NGX_HTTP_CACHE)
+
+    if (r->upstream && r->upstream->cache_status) {
+        loc->cache[r->upstream->cache_status - 1]++;
+    }
+
+#endif
+
+#if (NGX_HTTP_SSL)
+
+    /* a handshake is accounted with the first request on a connection */
+
+    if (c->ssl && c->ssl->handshaked && !c->ssl->handshake_reported) {
+        c->ssl->handshake_reported = 1;
+
+        srv = (ngx_http_metrics_server_t *)
+                  ngx_metrics_entry(zone->metrics, zone->server, mlcf->server);
+
+        ngx_metrics_observe(&srv->handshake_time, c->ssl->handshake_time);
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_metrics_upstream(ngx_http_request_t *r, ngx_http_metrics_zone_t *zone,
+    ngx_http_metrics_location_t *loc)
+{
+    ngx_int_t                      n;
+    ngx_uint_t                     i, first;
+    ngx_http_metrics_peer_t       *peer;
+    ngx_http_upstream_state_t     *state;
+    ngx_http_upstream_srv_conf_t  *us;
+    ngx_http_metrics_main_conf_t  *mmcf;
+
+    mmcf = ngx_http_get_module_main_conf(r, ngx_http_metrics_module);
+
+    state = r->upstream_states->elts;
+
+    /*
+     * states of upstreams used before internal redirects are separated
+     * by empty ones, only the last upstream is known to account peers
+     */
+
+    for (first = r->upstream_states->nelts; first > 0; first--) {
+        if (state[first - 1].peer == NULL) {
+            break;
+        }
+    }
+
+    us = r->upstream ? r->upstream->upstream : NULL;
+
+    for (i = 0; i < r->upstream_states->nelts; i++) {
+
+        if (state[i].peer == NULL) {
+            continue;
+        }
+
+        if (state[i].connect_time != (ngx_msec_t) -1) {
+            ngx_metrics_observe(&loc->upstream_connect_time,
+                                state[i].connect_time);
+        }
+
+        if (state[i].header_time != (ngx_msec_t) -1) {
+            ngx_metrics_observe(&loc->upstream_header_time,
+                                state[i].header_time);
+        }
+
+        if (state[i].response_time != (ngx_msec_t) -1) {
+            ngx_metrics_observe(&loc->upstream_response_time,
+                                state[i].response_time);
+        }
+
+        if (i < first || us == NULL) {
+            continue;
+        }
+
+        n = ngx_http_metrics_find_peer(mmcf, us, state[i].peer);
+
+        if (n == NGX_DECLINED) {
+            continue;
+        }
+
+        peer = (ngx_http_metrics_peer_t *)
+                   ngx_metrics_entry(zone->metrics, zone->peer, n);
+
+        peer->responses[ngx_http_metrics_class(state[i].status)]++;
+        peer->received += state[i].bytes_received;
+        peer->sent += state[i].bytes_sent;
+
+        if (state[i].connect_time != (ngx_msec_t) -1) {
+            ngx_metrics_observe(&peer->connect_time, state[i].connect_time);
+        }
+
+        if (state[i].header_time != (ngx_msec_t) -1) {
+            ngx_metrics_observe(&peer->header_time, state[i].header_time);
+        }
+
+        if (state[i].response_time != (ngx_msec_t) -1) {
+            ngx_metrics_observe(&peer->response_time, state[i].response_time);
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_metrics_find_peer(ngx_http_metrics_main_conf_t *mmcf,
+    ngx_http_upstream_srv_conf_t *us, ngx_str_t *name)
+{
+    ngx_uint_t                    i, hash;
+    ngx_http_metrics_peer_key_t  *key;
+
+    if (mmcf->peers == NULL) {
+        return NGX_DECLINED;
+    }
+
+    hash = ngx_hash_key(name->data, name->len) ^ ((uintptr_t) us >> 4);
+
+    for (i = hash & mmcf->peers_mask;
+         mmcf->peers[i].upstream;
+         i = (i + 1) & mmcf->peers_mask)
+    {
+        key = &mmcf->peers[i];
+
+        if (key->upstream == us
+            && key->hash == hash
+            && key->name.len == name->len
+            && ngx_strncmp(key->name.data, name->data, name->len) == 0)
+        {
+            return key->index;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_http_metrics_export_handler(ngx_http_request_t *r)
+{
+    off_t                         len;
+    ngx_int_t                     rc;
+    ngx_chain_t                  *out, *cl;
+    ngx_http_metrics_loc_conf_t  *mlcf;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    mlcf = ngx_http_get_module_loc_conf(r, ngx_http_metrics_module);
+
+    out = ngx_metrics_export(mlcf->export->metrics, r->pool);
+    if (out == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ngx_str_set(&r->headers_out.content_type,
+                "text/plain; version=0.0.4; charset=utf-8");
+    r->headers_out.content_type_len = sizeof("text/plain") - 1;
+    r->headers_out.content_type_lowcase = NULL;
+
+    len = 0;
+
+    for (cl = out; cl; cl = cl->next) {
+        len += cl->buf->last - cl->buf->pos;
+
+        if (cl->next == NULL) {
+            cl->buf->last_buf = (r == r->main) ? 1 : 0;
+            cl->buf->last_in_chain = 1;
+        }
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = len;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, out);
+}
+
+
+static ngx_http_metrics_zone_t *
+ngx_http_metrics_add_zone(ngx_conf_t *cf, ngx_str_t *name, size_t size)
+{
+    ngx_uint_t                     i;
+    ngx_metrics_t                 *metrics;
+    ngx_http_metrics_zone_t       *zone, **zp;
+    ngx_http_metrics_main_conf_t  *mmcf;
+
+    mmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_metrics_module);
+
+    metrics = ngx_metrics_add(cf, name, size);
+    if (metrics == NULL) {
+        return NULL;
+    }
+
+    zp = mmcf->zones.elts;
+
+    for (i = 0; i < mmcf->zones.nelts; i++) {
+        if (zp[i]->metrics == metrics) {
+            return zp[i];
+        }
+    }
+
+    zone = ngx_pcalloc(cf->pool, sizeof(ngx_http_metrics_zone_t));
+    if (zone == NULL) {
+        return NULL;
+    }
+
+    zone->metrics = metrics;
+
+    zone->location = ngx_metrics_add_family(cf, metrics,
+                                        ngx_http_metrics_location_desc,
+                                        sizeof(ngx_http_metrics_location_t));
+    if (zone->location == NULL) {
+        return NULL;
+    }
+
+    zone->peer = ngx_metrics_add_family(cf, metrics,
+                                        ngx_http_metrics_peer_desc,
+                                        sizeof(ngx_http_metrics_peer_t));
+    if (zone->peer == NULL) {
+        return NULL;
+    }
+
+    zone->server = ngx_metrics_add_family(cf, metrics,
+                                        ngx_http_metrics_server_desc,
+                                        sizeof(ngx_http_metrics_server_t));
+    if (zone->server == NULL) {
+        return NULL;
+    }
+
+    zp = ngx_array_push(&mmcf->zones);
+    if (zp == NULL) {
+        return NULL;
+    }
+
+    *zp = zone;
+
+    return zone;
+}
+
+
+static ngx_int_t
+ngx_http_metrics_add_peers(ngx_conf_t *cf, ngx_http_metrics_main_conf_t *mmcf)
+{
+    ngx_uint_t                       i, j, k, n;
+    ngx_http_upstream_server_t      *server;
+    ngx_http_upstream_rr_peer_t     *peer;
+    ngx_http_upstream_rr_peers_t    *peers;
+    ngx_http_upstream_srv_conf_t   **uscfp;
+    ngx_http_upstream_main_conf_t   *umcf;
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    n = 0;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->servers) {
+            server = uscfp[i]->servers->elts;
+
+            for (j = 0; j < uscfp[i]->servers->nelts; j++) {
+                n += server[j].naddrs;
+            }
+
+            continue;
+        }
+
+        for (peers = uscfp[i]->peer.data; peers; peers = peers->next) {
+            n += peers->number;
+        }
+    }
+
+    if (n == 0) {
+        return NGX_OK;
+    }
+
+    for (k = 2; k < 2 * n; k <<= 1) { /* void */ }
+
+    mmcf->peers = ngx_pcalloc(cf->pool,
+                              k * sizeof(ngx_http_metrics_peer_key_t));
+    if (mmcf->peers == NULL) {
+        return NGX_ERROR;
+    }
+
+    mmcf->peers_mask = k - 1;
+
+    /*
+     * servers are resolved on configuration, those added at run time
+     * are only accounted in locations
+     */
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->servers) {
+            server = uscfp[i]->servers->elts;
+
+            for (j = 0; j < uscfp[i]->servers->nelts; j++) {
+                for (k = 0; k < server[j].naddrs; k++) {
+                    if (ngx_http_metrics_add_peer(cf, mmcf, uscfp[i],
+                                                  &server[j].addrs[k].name)
+                        != NGX_OK)
+                    {
+                        return NGX_ERROR;
+                    }
+                }
+            }
+
+            continue;
+        }
+
+        /* implicit upstreams, such as "proxy_pass http://host:port" */
+
+        for (peers = uscfp[i]->peer.data; peers; peers = peers->next) {
+            for (peer = peers->peer; peer; peer = peer->next) {
+                if (ngx_http_metrics_add_peer(cf, mmcf, uscfp[i], &peer->name)
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_metrics_add_peer(ngx_conf_t *cf, ngx_http_metrics_main_conf_t *mmcf,
+    ngx_http_upstream_srv_conf_t *us, ngx_str_t *name)
+{
+    ngx_int_t                     n;
+    ngx_uint_t                    i, hash;
+    ngx_keyval_t                  labels[2];
+    ngx_http_metrics_zone_t     **zp;
+    ngx_http_metrics_peer_key_t  *key;
+
+    if (ngx_http_metrics_find_peer(mmcf, us, name) != NGX_DECLINED) {
+        return NGX_OK;
+    }
+
+    labels[0].key = ngx_http_metrics_upstream_label;
+    labels[0].value = us->host;
+    labels[1].key = ngx_http_metrics_peer_label;
+    labels[1].value = *name;
+
+    /* entries are added in the same order, so indices match in all zones */
+
+    n = NGX_ERROR;
+    zp = mmcf->zones.elts;
+
+    for (i = 0; i < mmcf->zones.nelts; i++) {
+        n = ngx_metrics_add_entry(cf, zp[i]->peer, labels, 2);
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
+    hash = ngx_hash_key(name->data, name->len) ^ ((uintptr_t) us >> 4);
+
+    for (i = hash & mmcf->peers_mask;
+         mmcf->peers[i].upstream;
+         i = (i + 1) & mmcf->peers_mask)
+    {
+        /* void */
+    }
+
+    key = &mmcf->peers[i];
+
+    key->upstream = us;
+    key->name = *name;
+    key->hash = hash;
+    key->index = n;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_metrics_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_metrics_main_conf_t  *mmcf;
+
+    mmcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_metrics_main_conf_t));
+    if (mmcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     mmcf->peers = NULL;
+     *     mmcf->peers_mask = 0;
+     */
+
+    if (ngx_array_init(&mmcf->zones, cf->pool, 1,
+                       sizeof(ngx_http_metrics_zone_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return mmcf;
+}
+
+
+static void *
+ngx_http_metrics_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_metrics_loc_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_metrics_loc_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->index = 0;
+     *     conf->server = 0;
+     *     conf->export = NULL;
+     */
+
+    conf->zone = NGX_CONF_UNSET_PTR;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_metrics_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_metrics_loc_conf_t *prev = parent;
+    ngx_http_metrics_loc_conf_t *conf = child;
+
+    ngx_int_t                  n;
+    ngx_keyval_t               labels[2];
+    ngx_http_core_loc_conf_t  *clcf;
+    ngx_http_core_srv_conf_t  *cscf;
+
+    ngx_conf_merge_ptr_value(conf->zone, prev->zone, NULL);
+
+    if (conf->zone == NULL) {
+        return NGX_CONF_OK;
+    }
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    cscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_core_module);
+
+    /* "if" and "limit_except" blocks are accounted in their location */
+
+    if (clcf->noname && conf->zone == prev->zone) {
+        conf->index = prev->index;
+        conf->server = prev->server;
+        return NGX_CONF_OK;
+    }
+
+    labels[0].key = ngx_http_metrics_server_label;
+    labels[0].value = cscf->server_name;
+    labels[1].key = ngx_http_metrics_location_label;
+    labels[1].value = clcf->name;
+
+    n = ngx_metrics_add_entry(cf, conf->zone->location, labels, 2);
+    if (n == NGX_ERROR) {
+        return NGX_CONF_ERROR;
+    }
+
+    conf->index = n;
+
+    n = ngx_metrics_add_entry(cf, conf->zone->server, labels, 1);
+    if (n == NGX_ERROR) {
+        return NGX_CONF_ERROR;
+    }
+
+    conf->server = n;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_metrics_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ssize_t     size;
+    ngx_str_t  *value;
+
+    value = cf->args->elts;
+
+    size = ngx_parse_size(&value[2]);
+
+    if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_metrics_add_zone(cf, &value[1], size) == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_metrics(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_metrics_loc_conf_t *mlcf = conf;
+
+    ngx_str_t  *value;
+
+    if (mlcf->zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        mlcf->zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    mlcf->zone = ngx_http_metrics_add_zone(cf, &value[1], 0);
+    if (mlcf->zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_metrics_export(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_metrics_loc_conf_t *mlcf = conf;
+
+    ngx_str_t                 *value;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    if (mlcf->export) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    mlcf->export = ngx_http_metrics_add_zone(cf, &value[1], 0);
+    if (mlcf->export == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_metrics_export_handler;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_metrics_init(ngx_conf_t *cf)
+{
+    ngx_http_handler_pt           *h;
+    ngx_http_core_main_conf_t     *cmcf;
+    ngx_http_metrics_main_conf_t  *mmcf;
+
+    mmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_metrics_module);
+
+    if (mmcf->zones.nelts == 0) {
+        return NGX_OK;
+    }
+
+    if (ngx_http_metrics_add_peers(cf, mmcf) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_LOG_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_metrics_handler;
+
+    return NGX_OK;
+}
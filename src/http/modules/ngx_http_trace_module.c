@@ -0,0 +1,1392 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_TRACE_INTERNAL  1
+#define NGX_HTTP_TRACE_SERVER    2
+#define NGX_HTTP_TRACE_CLIENT    3
+
+#define NGX_HTTP_TRACE_MAX_ATTRS  8
+
+
+typedef struct {
+    ngx_addr_t                 *addr;
+    ngx_str_t                   host;
+    ngx_str_t                   uri;
+    ngx_str_t                   prefix;    /* body up to the spans array */
+    size_t                      reserve;   /* request header and prefix */
+    size_t                      size;
+    ngx_msec_t                  flush;
+    ngx_msec_t                  timeout;
+} ngx_http_trace_exporter_t;
+
+
+typedef struct {
+    ngx_http_trace_exporter_t  *exporter;
+} ngx_http_trace_main_conf_t;
+
+
+typedef struct {
+    ngx_flag_t                  enable;
+    ngx_int_t                   sample;    /* in millionths */
+} ngx_http_trace_loc_conf_t;
+
+
+typedef struct {
+    u_char                      trace_id[16];
+    u_char                      span_id[8];
+    u_char                      parent_id[8];
+    unsigned                    parent:1;
+    unsigned                    sampled:1;
+} ngx_http_trace_ctx_t;
+
+
+typedef struct {
+    ngx_str_t                   key;
+    ngx_str_t                  *str;       /* an integer value if NULL */
+    uint64_t                    num;
+} ngx_http_trace_attr_t;
+
+
+typedef struct {
+    u_char                     *span_id;
+    u_char                     *parent_id;
+    ngx_str_t                   name[2];   /* joined with a space */
+    ngx_uint_t                  kind;
+    uint64_t                    start;     /* msec since the epoch */
+    uint64_t                    end;
+    ngx_uint_t                  error;
+    ngx_uint_t                  nattrs;
+    ngx_http_trace_attr_t       attrs[NGX_HTTP_TRACE_MAX_ATTRS];
+} ngx_http_trace_span_t;
+
+
+/*
+ * each worker collects spans into one of two buffers, while the
+ * other one is being sent to the collector
+ */
+
+typedef struct {
+    ngx_http_trace_exporter_t  *exporter;
+
+    u_char                     *buffer[2];
+    ngx_uint_t                  active;
+
+    u_char                     *start;
+    u_char                     *pos;
+    u_char                     *end;
+    ngx_uint_t                  spans;
+    ngx_uint_t                  dropped;
+
+    u_char                     *out;
+    u_char                     *last;
+
+    u_char                      status[sizeof("HTTP/1.1 200") - 1];
+    size_t                      received;
+
+    ngx_peer_connection_t       peer;
+    ngx_event_t                 event;
+    ngx_log_t                  *log;
+} ngx_http_trace_worker_t;
+
+
+static ngx_http_trace_ctx_t *ngx_http_trace_get_ctx(ngx_http_request_t *r);
+static void ngx_http_trace_cleanup(void *data);
+static ngx_int_t ngx_http_trace_parse_parent(ngx_http_trace_ctx_t *ctx,
+    ngx_str_t *value);
+static void ngx_http_trace_random(u_char *p, size_t len);
+static ngx_int_t ngx_http_trace_log_handler(ngx_http_request_t *r);
+static void ngx_http_trace_upstream(ngx_http_request_t *r,
+    ngx_http_trace_ctx_t *ctx, u_char *parent_id, uint64_t now);
+static void ngx_http_trace_add_attr(ngx_http_trace_span_t *span, char *key,
+    ngx_str_t *str, uint64_t num);
+static void ngx_http_trace_write(ngx_http_trace_ctx_t *ctx,
+    ngx_http_trace_span_t *span);
+static u_char *ngx_http_trace_write_string(u_char *p, ngx_str_t *s);
+
+static void ngx_http_trace_flush_handler(ngx_event_t *ev);
+static void ngx_http_trace_flush(ngx_http_trace_worker_t *w);
+static void ngx_http_trace_write_handler(ngx_event_t *wev);
+static void ngx_http_trace_read_handler(ngx_event_t *rev);
+static void ngx_http_trace_dummy_handler(ngx_event_t *ev);
+static void ngx_http_trace_close(ngx_http_trace_worker_t *w);
+
+static ngx_int_t ngx_http_trace_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_trace_add_variables(ngx_conf_t *cf);
+static void *ngx_http_trace_create_main_conf(ngx_conf_t *cf);
+static void *ngx_http_trace_create_loc_conf(ngx_conf_t *cf);
+static char *ngx_http_trace_merge_loc_conf(ngx_conf_t *cf, void *parent,
+    void *child);
+static char *ngx_http_trace_exporter(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_trace_sample(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_trace_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_trace_init_process(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_http_trace_commands[] = {
+
+    { ngx_string("trace_exporter"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_1MORE,
+      ngx_http_trace_exporter,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("trace"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_trace_loc_conf_t, enable),
+      NULL },
+
+    { ngx_string("trace_sample"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_trace_sample,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_trace_module_ctx = {
+    ngx_http_trace_add_variables,          /* preconfiguration */
+    ngx_http_trace_init,                   /* postconfiguration */
+
+    ngx_http_trace_create_main_conf,       /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    ngx_http_trace_create_loc_conf,        /* create location configuration */
+    ngx_http_trace_merge_loc_conf          /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_trace_module = {
+    NGX_MODULE_V1,
+    &ngx_http_trace_module_ctx,            /* module context */
+    ngx_http_trace_commands,               /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_trace_init_process,           /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_http_variable_t  ngx_http_trace_vars[] = {
+
+    { ngx_string("trace_id"), NULL, ngx_http_trace_variable, 0, 0, 0 },
+
+    { ngx_string("trace_span_id"), NULL, ngx_http_trace_variable, 1, 0, 0 },
+
+    { ngx_string("trace_parent"), NULL, ngx_http_trace_variable, 2, 0, 0 },
+
+      ngx_http_null_variable
+};
+
+
+static ngx_str_t  ngx_http_trace_suffix = ngx_string("]}]}]}");
+
+static ngx_http_trace_worker_t  *ngx_http_trace_worker;
+
+
+static ngx_http_trace_ctx_t *
+ngx_http_trace_get_ctx(ngx_http_request_t *r)
+{
+    ngx_uint_t                  i;
+    ngx_list_part_t            *part;
+    ngx_table_elt_t            *h;
+    ngx_pool_cleanup_t         *cln;
+    ngx_http_trace_ctx_t       *ctx;
+    ngx_http_trace_loc_conf_t  *tlcf;
+
+    /* subrequests are a part of the trace of the main request */
+
+    r = r->main;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_trace_module);
+    if (ctx) {
+        return ctx;
+    }
+
+    if (r->internal || r->filter_finalize) {
+
+        /*
+         * module context is reset by internal redirects, the trace
+         * already propagated upstream is found in the cleanup handler
+         */
+
+        for (cln = r->pool->cleanup; cln; cln = cln->next) {
+            if (cln->handler == ngx_http_trace_cleanup) {
+                ctx = cln->data;
+                ngx_http_set_ctx(r, ctx, ngx_http_trace_module);
+                return ctx;
+            }
+        }
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_http_trace_ctx_t));
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    cln->handler = ngx_http_trace_cleanup;
+
+    ctx = cln->data;
+    ngx_memzero(ctx, sizeof(ngx_http_trace_ctx_t));
+
+    part = &r->headers_in.headers.part;
+    h = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            h = part->elts;
+            i = 0;
+        }
+
+        if (h[i].key.len == sizeof("traceparent") - 1
+            && ngx_strncasecmp(h[i].key.data, (u_char *) "traceparent",
+                               sizeof("traceparent") - 1)
+               == 0)
+        {
+            if (ngx_http_trace_parse_parent(ctx, &h[i].value) == NGX_OK) {
+                ctx->parent = 1;
+
+            } else {
+                ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                              "client sent invalid \"traceparent\" header: "
+                              "\"%V\"", &h[i].value);
+            }
+
+            break;
+        }
+    }
+
+    if (!ctx->parent) {
+        tlcf = ngx_http_get_module_loc_conf(r, ngx_http_trace_module);
+
+        ngx_http_trace_random(ctx->trace_id, 16);
+
+        ctx->sampled = (ngx_random() % 1000000 < tlcf->sample);
+    }
+
+    ngx_http_trace_random(ctx->span_id, 8);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http trace: %*xs, sampled:%d",
+                   (size_t) 16, ctx->trace_id, ctx->sampled);
+
+    ngx_http_set_ctx(r, ctx, ngx_http_trace_module);
+
+    return ctx;
+}
+
+
+static void
+ngx_http_trace_cleanup(void *data)
+{
+    /* only marks the context of the request, see ngx_http_trace_get_ctx() */
+}
+
+
+static ngx_int_t
+ngx_http_trace_parse_parent(ngx_http_trace_ctx_t *ctx, ngx_str_t *value)
+{
+    u_char      *p, *dst, ch;
+    ngx_int_t    n;
+    ngx_uint_t   i, nonzero;
+
+    /*
+     * "00-<trace-id>-<parent-id>-<flags>", future versions
+     * may append fields after another dash
+     */
+
+    if (value->len < 55 || (value->len > 55 && value->data[55] != '-')) {
+        return NGX_ERROR;
+    }
+
+    p = value->data;
+
+    if (p[2] != '-' || p[35] != '-' || p[52] != '-') {
+        return NGX_ERROR;
+    }
+
+    if (ngx_hextoi(p, 2) == NGX_ERROR || (p[0] == 'f' && p[1] == 'f')) {
+        return NGX_ERROR;
+    }
+
+    if (p[0] == '0' && p[1] == '0' && value->len != 55) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < 55; i++) {
+        ch = p[i];
+
+        if (ch >= 'A' && ch <= 'F') {
+            return NGX_ERROR;
+        }
+    }
+
+    nonzero = 0;
+    dst = ctx->trace_id;
+
+    for (i = 0; i < 16; i++) {
+        n = ngx_hextoi(&p[3 + 2 * i], 2);
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        nonzero |= n;
+        *dst++ = (u_char) n;
+    }
+
+    if (!nonzero) {
+        return NGX_ERROR;
+    }
+
+    nonzero = 0;
+    dst = ctx->parent_id;
+
+    for (i = 0; i < 8; i++) {
+        n = ngx_hextoi(&p[36 + 2 * i], 2);
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        nonzero |= n;
+        *dst++ = (u_char) n;
+    }
+
+    if (!nonzero) {
+        return NGX_ERROR;
+    }
+
+    n = ngx_hextoi(&p[53], 2);
+    if (n == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    /* the sampling decision of the caller is respected */
+
+    ctx->sampled = n & 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_trace_random(u_char *p, size_t len)
+{
+    uint32_t  n;
+
+    /* random() returns 31 bits */
+
+    while (len) {
+        n = (uint32_t) ngx_random();
+
+        *p++ = (u_char) n;
+        len--;
+
+        if (len) {
+            *p++ = (u_char) (n >> 8);
+            len--;
+        }
+
+        if (len) {
+            *p++ = (u_char) (n >> 16);
+            len--;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_trace_log_handler(ngx_http_request_t *r)
+{
+    u_char                     *span_id, sub_id[8];
+    uint64_t                    now;
+    ngx_time_t                 *tp;
+    ngx_http_trace_ctx_t       *ctx;
+    ngx_http_trace_span_t       span;
+    ngx_http_core_loc_conf_t   *clcf;
+    ngx_http_trace_loc_conf_t  *tlcf;
+
+    if (ngx_http_trace_worker == NULL) {
+        return NGX_OK;
+    }
+
+    tlcf = ngx_http_get_module_loc_conf(r, ngx_http_trace_module);
+
+    if (!tlcf->enable) {
+        return NGX_OK;
+    }
+
+    ctx = ngx_http_trace_get_ctx(r);
+
+    if (ctx == NULL || !ctx->sampled) {
+        return NGX_OK;
+    }
+
+    tp = ngx_timeofday();
+    now = (uint64_t) tp->sec * 1000 + tp->msec;
+
+    ngx_memzero(&span, offsetof(ngx_http_trace_span_t, attrs));
+
+    if (r == r->main) {
+        span_id = ctx->span_id;
+
+        span.parent_id = ctx->parent ? ctx->parent_id : NULL;
+        span.kind = NGX_HTTP_TRACE_SERVER;
+
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+        span.name[0] = r->method_name;
+        span.name[1] = clcf->name;
+
+    } else {
+        ngx_http_trace_random(sub_id, 8);
+        span_id = sub_id;
+
+        span.parent_id = ctx->span_id;
+        span.kind = NGX_HTTP_TRACE_INTERNAL;
+
+        ngx_str_set(&span.name[0], "subrequest");
+        span.name[1] = r->uri;
+    }
+
+    span.span_id = span_id;
+    span.start = (uint64_t) r->start_sec * 1000 + r->start_msec;
+    span.end = now;
+    span.error = (r->headers_out.status >= NGX_HTTP_INTERNAL_SERVER_ERROR);
+
+    ngx_http_trace_add_attr(&span, "http.request.method", &r->method_name, 0);
+    ngx_http_trace_add_attr(&span, "url.path", &r->uri, 0);
+    ngx_http_trace_add_attr(&span, "http.response.status_code", NULL,
+                            r->headers_out.status);
+
+    if (r == r->main) {
+        ngx_http_trace_add_attr(&span, "client.address",
+                                &r->connection->addr_text, 0);
+    }
+
+    ngx_http_trace_write(ctx, &span);
+
+    ngx_http_trace_upstream(r, ctx, span_id, now);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_trace_upstream(ngx_http_request_t *r, ngx_http_trace_ctx_t *ctx,
+    u_char *parent_id, uint64_t now)
+{
+    u_char                      span_id[8];
+    ngx_uint_t                  i;
+    ngx_msec_t                  elapsed;
+    ngx_http_trace_span_t       span;
+    ngx_http_upstream_state_t  *state;
+
+    if (r->upstream_states == NULL) {
+        return;
+    }
+
+    state = r->upstream_states->elts;
+
+    /* every attempt, including ones made after ngx_http_upstream_next() */
+
+    for (i = 0; i < r->upstream_states->nelts; i++) {
+
+        if (state[i].peer == NULL) {
+            continue;
+        }
+
+        ngx_memzero(&span, offsetof(ngx_http_trace_span_t, attrs));
+
+        ngx_http_trace_random(span_id, 8);
+
+        span.span_id = span_id;
+        span.parent_id = parent_id;
+        span.kind = NGX_HTTP_TRACE_CLIENT;
+
+        ngx_str_set(&span.name[0], "upstream");
+
+        /* the monotonic start time is converted to the wall clock */
+
+        elapsed = ngx_current_msec - state[i].start_time;
+
+        span.start = now - elapsed;
+
+        if (state[i].response_time != (ngx_msec_t) -1) {
+            span.end = span.start + state[i].response_time;
+
+        } else {
+            span.end = now;
+        }
+
+        span.error = (state[i].status == 0
+                      || state[i].status >= NGX_HTTP_INTERNAL_SERVER_ERROR);
+
+        ngx_http_trace_add_attr(&span, "server.address", state[i].peer, 0);
+
+        if (state[i].status) {
+            ngx_http_trace_add_attr(&span, "http.response.status_code", NULL,
+                                    state[i].status);
+        }
+
+        if (state[i].connect_time != (ngx_msec_t) -1) {
+            ngx_http_trace_add_attr(&span, "nginx.upstream.connect_time_ms",
+                                    NULL, state[i].connect_time);
+        }
+
+        if (state[i].header_time != (ngx_msec_t) -1) {
+            ngx_http_trace_add_attr(&span, "nginx.upstream.header_time_ms",
+                                    NULL, state[i].header_time);
+        }
+
+        ngx_http_trace_write(ctx, &span);
+    }
+}
+
+
+static void
+ngx_http_trace_add_attr(ngx_http_trace_span_t *span, char *key,
+    ngx_str_t *str, uint64_t num)
+{
+    ngx_http_trace_attr_t  *attr;
+
+    if (span->nattrs == NGX_HTTP_TRACE_MAX_ATTRS) {
+        return;
+    }
+
+    attr = &span->attrs[span->nattrs++];
+
+    attr->key.len = ngx_strlen(key);
+    attr->key.data = (u_char *) key;
+    attr->str = str;
+    attr->num = num;
+}
+
+
+static void
+ngx_http_trace_write(ngx_http_trace_ctx_t *ctx, ngx_http_trace_span_t *span)
+{
+    u_char                   *p;
+    size_t                    len;
+    ngx_uint_t                i;
+    ngx_http_trace_attr_t    *attr;
+    ngx_http_trace_worker_t  *w;
+
+    w = ngx_http_trace_worker;
+
+    len = sizeof(",{\"traceId\":\"\",\"spanId\":\"\",\"parentSpanId\":\"\","
+                 "\"name\":\" \",\"kind\":0,"
+                 "\"startTimeUnixNano\":\"000000\","
+                 "\"endTimeUnixNano\":\"000000\","
+                 "\"attributes\":[],\"status\":{\"code\":0}}") - 1
+          + 32 + 16 + 16 + 2 * NGX_INT64_LEN
+          + span->name[0].len + ngx_escape_json(NULL, span->name[0].data,
+                                                span->name[0].len)
+          + span->name[1].len + ngx_escape_json(NULL, span->name[1].data,
+                                                span->name[1].len);
+
+    attr = span->attrs;
+
+    for (i = 0; i < span->nattrs; i++) {
+        len += sizeof(",{\"key\":\"\",\"value\":{\"stringValue\":\"\"}}") - 1
+               + attr[i].key.len;
+
+        if (attr[i].str) {
+            len += attr[i].str->len
+                   + ngx_escape_json(NULL, attr[i].str->data,
+                                     attr[i].str->len);
+
+        } else {
+            len += NGX_INT64_LEN;
+        }
+    }
+
+    if (len > (size_t) (w->end - w->pos)) {
+
+        /* the buffer could not be sent while an export was in progress */
+
+        ngx_http_trace_flush(w);
+
+        if (len > (size_t) (w->end - w->pos)) {
+            w->dropped++;
+            return;
+        }
+    }
+
+    p = w->pos;
+
+    if (w->spans) {
+        *p++ = ',';
+    }
+
+    p = ngx_cpymem(p, "{\"traceId\":\"", sizeof("{\"traceId\":\"") - 1);
+    p = ngx_hex_dump(p, ctx->trace_id, 16);
+    p = ngx_cpymem(p, "\",\"spanId\":\"", sizeof("\",\"spanId\":\"") - 1);
+    p = ngx_hex_dump(p, span->span_id, 8);
+
+    if (span->parent_id) {
+        p = ngx_cpymem(p, "\",\"parentSpanId\":\"",
+                       sizeof("\",\"parentSpanId\":\"") - 1);
+        p = ngx_hex_dump(p, span->parent_id, 8);
+    }
+
+    p = ngx_cpymem(p, "\",\"name\":\"", sizeof("\",\"name\":\"") - 1);
+    p = (u_char *) ngx_escape_json(p, span->name[0].data, span->name[0].len);
+
+    if (span->name[1].len) {
+        *p++ = ' ';
+        p = (u_char *) ngx_escape_json(p, span->name[1].data,
+                                       span->name[1].len);
+    }
+
+    p = ngx_sprintf(p, "\",\"kind\":%ui,"
+                       "\"startTimeUnixNano\":\"%uL000000\","
+                       "\"endTimeUnixNano\":\"%uL000000\","
+                       "\"attributes\":[",
+                    span->kind, span->start, span->end);
+
+    for (i = 0; i < span->nattrs; i++) {
+
+        if (i) {
+            *p++ = ',';
+        }
+
+        p = ngx_sprintf(p, "{\"key\":\"%V\",\"value\":{", &attr[i].key);
+
+        if (attr[i].str) {
+            p = ngx_cpymem(p, "\"stringValue\":",
+                           sizeof("\"stringValue\":") - 1);
+            p = ngx_http_trace_write_string(p, attr[i].str);
+
+        } else {
+            /* 64-bit integers are strings in the JSON encoding of OTLP */
+            p = ngx_sprintf(p, "\"intValue\":\"%uL\"", attr[i].num);
+        }
+
+        *p++ = '}';
+        *p++ = '}';
+    }
+
+    p = ngx_sprintf(p, "],\"status\":{\"code\":%d}}", span->error ? 2 : 0);
+
+    w->pos = p;
+    w->spans++;
+
+    if ((size_t) (w->pos - w->start) >= w->exporter->size / 2) {
+        ngx_http_trace_flush(w);
+    }
+}
+
+
+static u_char *
+ngx_http_trace_write_string(u_char *p, ngx_str_t *s)
+{
+    *p++ = '"';
+    p = (u_char *) ngx_escape_json(p, s->data, s->len);
+    *p++ = '"';
+
+    return p;
+}
+
+
+static void
+ngx_http_trace_flush_handler(ngx_event_t *ev)
+{
+    ngx_http_trace_worker_t  *w;
+
+    w = ev->data;
+
+    if (w->dropped) {
+        ngx_log_error(NGX_LOG_WARN, w->log, 0,
+                      "trace buffer is full, %ui spans dropped", w->dropped);
+        w->dropped = 0;
+    }
+
+    ngx_http_trace_flush(w);
+
+    ngx_add_timer(ev, w->exporter->flush);
+}
+
+
+static void
+ngx_http_trace_flush(ngx_http_trace_worker_t *w)
+{
+    u_char                     *p, *out;
+    size_t                      n;
+    ngx_int_t                   rc;
+    ngx_http_trace_exporter_t  *exporter;
+
+    if (w->spans == 0 || w->peer.connection) {
+        return;
+    }
+
+    exporter = w->exporter;
+
+    /*
+     * the request header and the body prefix are placed right before
+     * the spans, in the space reserved at the start of the buffer
+     */
+
+    out = w->buffer[w->active];
+
+    p = ngx_sprintf(out, "POST %V HTTP/1.1" CRLF
+                         "Host: %V" CRLF
+                         "Content-Type: application/json" CRLF
+                         "Content-Length: %uz" CRLF
+                         "Connection: close" CRLF CRLF
+                         "%V",
+                    &exporter->uri, &exporter->host,
+                    exporter->prefix.len + (w->pos - w->start)
+                    + ngx_http_trace_suffix.len,
+                    &exporter->prefix);
+
+    n = p - out;
+
+    w->out = ngx_movemem(w->start - n, out, n) - n;
+    w->last = ngx_cpymem(w->pos, ngx_http_trace_suffix.data,
+                         ngx_http_trace_suffix.len);
+    w->received = 0;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, w->log, 0,
+                   "http trace export: %ui spans, %uz bytes",
+                   w->spans, (size_t) (w->last - w->out));
+
+    /* further spans go to the other buffer */
+
+    w->active ^= 1;
+    w->start = w->buffer[w->active] + exporter->reserve;
+    w->pos = w->start;
+    w->end = w->start + exporter->size;
+    w->spans = 0;
+
+    ngx_memzero(&w->peer, sizeof(ngx_peer_connection_t));
+
+    w->peer.sockaddr = exporter->addr->sockaddr;
+    w->peer.socklen = exporter->addr->socklen;
+    w->peer.name = &exporter->addr->name;
+    w->peer.get = ngx_event_get_peer;
+    w->peer.log = w->log;
+    w->peer.log_error = NGX_ERROR_ERR;
+
+    rc = ngx_event_connect_peer(&w->peer);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_log_error(NGX_LOG_ERR, w->log, 0,
+                      "trace export to %V failed", w->peer.name);
+
+        if (w->peer.connection) {
+            ngx_http_trace_close(w);
+        }
+
+        return;
+    }
+
+    w->peer.connection->data = w;
+    w->peer.connection->read->handler = ngx_http_trace_read_handler;
+    w->peer.connection->write->handler = ngx_http_trace_write_handler;
+
+    ngx_add_timer(w->peer.connection->read, exporter->timeout);
+    ngx_add_timer(w->peer.connection->write, exporter->timeout);
+
+    if (rc == NGX_OK) {
+        ngx_http_trace_write_handler(w->peer.connection->write);
+    }
+}
+
+
+static void
+ngx_http_trace_write_handler(ngx_event_t *wev)
+{
+    ssize_t                   n, size;
+    ngx_connection_t         *c;
+    ngx_http_trace_worker_t  *w;
+
+    c = wev->data;
+    w = c->data;
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, wev->log, NGX_ETIMEDOUT,
+                      "trace collector timed out");
+        ngx_http_trace_close(w);
+        return;
+    }
+
+    size = w->last - w->out;
+
+    n = ngx_send(c, w->out, size);
+
+    if (n == NGX_ERROR) {
+        ngx_http_trace_close(w);
+        return;
+    }
+
+    if (n > 0) {
+        w->out += n;
+
+        if (n == size) {
+            wev->handler = ngx_http_trace_dummy_handler;
+
+            if (wev->timer_set) {
+                ngx_del_timer(wev);
+            }
+
+            if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+                ngx_http_trace_close(w);
+            }
+
+            return;
+        }
+    }
+
+    if (!wev->timer_set) {
+        ngx_add_timer(wev, w->exporter->timeout);
+    }
+}
+
+
+static void
+ngx_http_trace_read_handler(ngx_event_t *rev)
+{
+    u_char                    buf[512];
+    ssize_t                   n;
+    ngx_int_t                 status;
+    ngx_connection_t         *c;
+    ngx_http_trace_worker_t  *w;
+
+    c = rev->data;
+    w = c->data;
+
+    if (rev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, rev->log, NGX_ETIMEDOUT,
+                      "trace collector timed out");
+        ngx_http_trace_close(w);
+        return;
+    }
+
+    /*
+     * only the status code of the response is of interest, the rest
+     * is read till the collector closes the connection
+     */
+
+    for ( ;; ) {
+
+        if (w->received < sizeof(w->status)) {
+            n = ngx_recv(c, w->status + w->received,
+                         sizeof(w->status) - w->received);
+
+        } else {
+            n = ngx_recv(c, buf, sizeof(buf));
+        }
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+                ngx_http_trace_close(w);
+            }
+
+            return;
+        }
+
+        if (n == NGX_ERROR || n == 0) {
+            break;
+        }
+
+        if (w->received < sizeof(w->status)) {
+            w->received += n;
+        }
+    }
+
+    status = NGX_ERROR;
+
+    if (w->received == sizeof(w->status)
+        && ngx_strncmp(w->status, "HTTP/1.", sizeof("HTTP/1.") - 1) == 0)
+    {
+        status = ngx_atoi(&w->status[9], 3);
+    }
+
+    if (status == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, rev->log, 0,
+                      "trace collector sent invalid response");
+
+    } else if (status < 200 || status > 299) {
+        ngx_log_error(NGX_LOG_ERR, rev->log, 0,
+                      "trace collector responded with status %i", status);
+    }
+
+    ngx_http_trace_close(w);
+}
+
+
+static void
+ngx_http_trace_dummy_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http trace dummy handler");
+}
+
+
+static void
+ngx_http_trace_close(ngx_http_trace_worker_t *w)
+{
+    ngx_close_connection(w->peer.connection);
+    w->peer.connection = NULL;
+}
+
+
+static ngx_int_t
+ngx_http_trace_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char                *p;
+    ngx_http_trace_ctx_t  *ctx;
+
+    ctx = ngx_http_trace_get_ctx(r);
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_pnalloc(r->pool, sizeof("00--") - 1 + 32 + 16 + 3);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->data = p;
+
+    switch (data) {
+
+    case 0:
+        p = ngx_hex_dump(p, ctx->trace_id, 16);
+        break;
+
+    case 1:
+        p = ngx_hex_dump(p, ctx->span_id, 8);
+        break;
+
+    default: /* 2 */
+
+        /* the span of the main request is the parent for upstreams */
+
+        p = ngx_cpymem(p, "00-", 3);
+        p = ngx_hex_dump(p, ctx->trace_id, 16);
+        *p++ = '-';
+        p = ngx_hex_dump(p, ctx->span_id, 8);
+        p = ngx_cpymem(p, ctx->sampled ? "-01" : "-00", 3);
+    }
+
+    v->len = p - v->data;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_trace_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_trace_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_trace_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_trace_main_conf_t  *tmcf;
+
+    tmcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_trace_main_conf_t));
+    if (tmcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     tmcf->exporter = NULL;
+     */
+
+    return tmcf;
+}
+
+
+static void *
+ngx_http_trace_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_trace_loc_conf_t  *conf;
+
+    conf = ngx_palloc(cf->pool, sizeof(ngx_http_trace_loc_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->enable = NGX_CONF_UNSET;
+    conf->sample = NGX_CONF_UNSET;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_trace_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_trace_loc_conf_t *prev = parent;
+    ngx_http_trace_loc_conf_t *conf = child;
+
+    ngx_http_trace_main_conf_t  *tmcf;
+
+    ngx_conf_merge_value(conf->enable, prev->enable, 0);
+    ngx_conf_merge_value(conf->sample, prev->sample, 1000000);
+
+    if (conf->enable) {
+        tmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_trace_module);
+
+        if (tmcf->exporter == NULL) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"trace\" requires \"trace_exporter\"");
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_trace_exporter(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_trace_main_conf_t *tmcf = conf;
+
+    u_char                     *p;
+    size_t                      len;
+    ngx_str_t                  *value, s, service;
+    ngx_url_t                   u;
+    ngx_int_t                   n;
+    ngx_uint_t                  i;
+    ngx_http_trace_exporter_t  *exporter;
+
+    if (tmcf->exporter) {
+        return "is duplicate";
+    }
+
+    exporter = ngx_pcalloc(cf->pool, sizeof(ngx_http_trace_exporter_t));
+    if (exporter == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    exporter->size = 64 * 1024;
+    exporter->flush = 1000;
+    exporter->timeout = 5000;
+
+    ngx_str_set(&service, "nginx");
+
+    value = cf->args->elts;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "buffer=", 7) == 0) {
+
+            s.len = value[i].len - 7;
+            s.data = value[i].data + 7;
+
+            n = ngx_parse_size(&s);
+
+            if (n == NGX_ERROR || n < 4096) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid buffer size \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            exporter->size = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "flush=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            n = ngx_parse_time(&s, 0);
+
+            if (n == NGX_ERROR || n == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid flush time \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            exporter->flush = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = value[i].data + 8;
+
+            n = ngx_parse_time(&s, 0);
+
+            if (n == NGX_ERROR || n == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid timeout \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            exporter->timeout = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "service=", 8) == 0) {
+
+            service.len = value[i].len - 8;
+            service.data = value[i].data + 8;
+
+            if (service.len == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    if (ngx_strncasecmp(value[1].data, (u_char *) "http://", 7) != 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid URL prefix in \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&u, sizeof(ngx_url_t));
+
+    u.url.len = value[1].len - 7;
+    u.url.data = value[1].data + 7;
+    u.default_port = 80;
+    u.uri_part = 1;
+
+    if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
+        if (u.err) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "%s in \"%V\"", u.err, &value[1]);
+        }
+
+        return NGX_CONF_ERROR;
+    }
+
+    exporter->addr = &u.addrs[0];
+
+    exporter->host.len = u.url.len - u.uri.len;
+    exporter->host.data = u.url.data;
+
+    if (u.uri.len) {
+        exporter->uri = u.uri;
+
+    } else {
+        ngx_str_set(&exporter->uri, "/v1/traces");
+    }
+
+    /* OTLP/HTTP with the JSON encoding */
+
+    len = sizeof("{\"resourceSpans\":[{\"resource\":{\"attributes\":["
+                 "{\"key\":\"service.name\",\"value\":{\"stringValue\":\"\"}}"
+                 "]},\"scopeSpans\":[{\"scope\":{\"name\":\"nginx\"},"
+                 "\"spans\":[") - 1
+          + service.len + ngx_escape_json(NULL, service.data, service.len);
+
+    p = ngx_pnalloc(cf->pool, len);
+    if (p == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    exporter->prefix.data = p;
+
+    p = ngx_cpymem(p, "{\"resourceSpans\":[{\"resource\":{\"attributes\":["
+                      "{\"key\":\"service.name\",\"value\":{\"stringValue\":\"",
+                   sizeof("{\"resourceSpans\":[{\"resource\":{\"attributes\":["
+                          "{\"key\":\"service.name\","
+                          "\"value\":{\"stringValue\":\"") - 1);
+    p = (u_char *) ngx_escape_json(p, service.data, service.len);
+    p = ngx_cpymem(p, "\"}}]},\"scopeSpans\":[{\"scope\":{\"name\":\"nginx\"},"
+                      "\"spans\":[",
+                   sizeof("\"}}]},\"scopeSpans\":[{\"scope\":"
+                          "{\"name\":\"nginx\"},\"spans\":[") - 1);
+
+    exporter->prefix.len = p - exporter->prefix.data;
+
+    exporter->reserve = sizeof("POST  HTTP/1.1" CRLF
+                               "Host: " CRLF
+                               "Content-Type: application/json" CRLF
+                               "Content-Length: " CRLF
+                               "Connection: close" CRLF CRLF) - 1
+                        + exporter->uri.len + exporter->host.len
+                        + NGX_SIZE_T_LEN + exporter->prefix.len;
+
+    tmcf->exporter = exporter;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static char *
+ngx_http_trace_sample(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_trace_loc_conf_t *tlcf = conf;
+
+    ngx_str_t  *value;
+
+    if (tlcf->sample != NGX_CONF_UNSET) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    /* a fraction such as "0.01" or a percentage such as "1%" */
+
+    if (value[1].len && value[1].data[value[1].len - 1] == '%') {
+        tlcf->sample = ngx_atofp(value[1].data, value[1].len - 1, 4);
+
+    } else {
+        tlcf->sample = ngx_atofp(value[1].data, value[1].len, 6);
+    }
+
+    if (tlcf->sample == NGX_ERROR || tlcf->sample > 1000000) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid sample rate \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_trace_init(ngx_conf_t *cf)
+{
+    ngx_http_handler_pt         *h;
+    ngx_http_core_main_conf_t   *cmcf;
+    ngx_http_trace_main_conf_t  *tmcf;
+
+    tmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_trace_module);
+
+    if (tmcf->exporter == NULL) {
+        return NGX_OK;
+    }
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_LOG_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_trace_log_handler;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_trace_init_process(ngx_cycle_t *cycle)
+{
+    size_t                       size;
+    ngx_uint_t                   i;
+    ngx_http_trace_worker_t     *w;
+    ngx_http_trace_exporter_t   *exporter;
+    ngx_http_trace_main_conf_t  *tmcf;
+
+    ngx_http_trace_worker = NULL;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    tmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_trace_module);
+
+    if (tmcf == NULL || tmcf->exporter == NULL) {
+        return NGX_OK;
+    }
+
+    exporter = tmcf->exporter;
+
+    w = ngx_pcalloc(cycle->pool, sizeof(ngx_http_trace_worker_t));
+    if (w == NULL) {
+        return NGX_ERROR;
+    }
+
+    size = exporter->reserve + exporter->size + ngx_http_trace_suffix.len;
+
+    for (i = 0; i < 2; i++) {
+        w->buffer[i] = ngx_palloc(cycle->pool, size);
+        if (w->buffer[i] == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    w->exporter = exporter;
+    w->log = cycle->log;
+
+    w->start = w->buffer[0] + exporter->reserve;
+    w->pos = w->start;
+    w->end = w->start + exporter->size;
+
+    w->event.handler = ngx_http_trace_flush_handler;
+    w->event.data = w;
+    w->event.log = cycle->log;
+    w->event.cancelable = 1;
+
+    ngx_add_timer(&w->event, exporter->flush);
+
+    ngx_http_trace_worker = w;
+
+    return NGX_OK;
+}
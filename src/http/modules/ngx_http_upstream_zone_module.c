@@ -10,6 +10,23 @@
 #include <ngx_http.h>
 
 
+typedef struct {
+    ngx_http_upstream_rr_peers_t    *peers;
+    ngx_http_upstream_rr_peers_t    *src;
+    ngx_http_upstream_rr_peer_t    **match;
+    u_char                          *added;
+} ngx_http_upstream_zone_list_t;
+
+
+typedef struct {
+    ngx_http_upstream_srv_conf_t    *uscf;
+    ngx_http_upstream_rr_peers_t    *peers;
+    ngx_http_upstream_rr_peers_t    *backup;
+    ngx_http_upstream_zone_list_t    list[2];
+    ngx_uint_t                       applied;  /* unsigned  applied:1; */
+} ngx_http_upstream_zone_update_t;
+
+
 static char *ngx_http_upstream_zone(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone,
@@ -17,6 +34,15 @@ static ngx_int_t ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone,
 static ngx_http_upstream_rr_peers_t *ngx_http_upstream_zone_copy_peers(
     ngx_slab_pool_t *shpool, ngx_http_upstream_srv_conf_t *uscf,
     ngx_http_upstream_srv_conf_t *ouscf);
+static ngx_int_t ngx_http_upstream_zone_prepare_update(
+    ngx_http_upstream_main_conf_t *umcf, ngx_http_upstream_srv_conf_t *uscf,
+    ngx_http_upstream_rr_peers_t *peers, ngx_log_t *log);
+static ngx_int_t ngx_http_upstream_zone_prepare_list(
+    ngx_http_upstream_zone_list_t *list, ngx_pool_t *pool);
+static ngx_int_t ngx_http_upstream_zone_init_module(ngx_cycle_t *cycle);
+static void ngx_http_upstream_zone_apply_list(
+    ngx_http_upstream_zone_list_t *list);
+static void ngx_http_upstream_zone_cleanup_updates(void *data);
 static ngx_http_upstream_rr_peer_t *ngx_http_upstream_zone_copy_peer(
     ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *src);
 static ngx_int_t ngx_http_upstream_zone_preresolve(
@@ -67,7 +93,7 @@ ngx_module_t  ngx_http_upstream_zone_module = {
     ngx_http_upstream_zone_commands,       /* module directives */
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
-    NULL,                                  /* init module */
+    ngx_http_upstream_zone_init_module,    /* init module */
     ngx_http_upstream_zone_init_worker,    /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
@@ -161,6 +187,50 @@ ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone, void *data)
         return NGX_OK;
     }
 
+    if (shpool->data) {
+
+        /*
+         * the zone is reused by an incremental reconfiguration,
+         * the new server lists are prepared here, and applied in place
+         * by ngx_http_upstream_zone_init_module() once the new cycle
+         * is committed
+         */
+
+        peers = shpool->data;
+
+        for (i = 0; i < umcf->upstreams.nelts; i++) {
+            uscf = uscfp[i];
+
+            if (uscf->shm_zone != shm_zone) {
+                continue;
+            }
+
+            if (peers == NULL
+                || peers->name->len != uscf->host.len
+                || ngx_strncmp(peers->name->data, uscf->host.data,
+                               uscf->host.len)
+                   != 0)
+            {
+                ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                              "upstream \"%V\" cannot be updated "
+                              "in zone \"%V\"",
+                              &uscf->host, &shm_zone->shm.name);
+                return NGX_ERROR;
+            }
+
+            if (ngx_http_upstream_zone_prepare_update(umcf, uscf, peers,
+                                                      shm_zone->shm.log)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            peers = peers->zone_next;
+        }
+
+        return NGX_OK;
+    }
+
     len = sizeof(" in upstream zone \"\"") + shm_zone->shm.name.len;
 
     shpool->log_ctx = ngx_slab_alloc(shpool, len);
@@ -367,6 +437,357 @@ done:
 }
 
 
+static ngx_int_t
+ngx_http_upstream_zone_prepare_update(ngx_http_upstream_main_conf_t *umcf,
+    ngx_http_upstream_srv_conf_t *uscf, ngx_http_upstream_rr_peers_t *peers,
+    ngx_log_t *log)
+{
+    ngx_pool_t                       *pool;
+    ngx_pool_cleanup_t               *cln;
+    ngx_http_upstream_rr_peers_t     *src, *backup;
+    ngx_http_upstream_zone_update_t  *update;
+
+    pool = umcf->upstreams.pool;
+
+    if (umcf->zone_updates == NULL) {
+        umcf->zone_updates = ngx_array_create(pool, 4,
+                                       sizeof(ngx_http_upstream_zone_update_t));
+        if (umcf->zone_updates == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln = ngx_pool_cleanup_add(pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_http_upstream_zone_cleanup_updates;
+        cln->data = umcf->zone_updates;
+    }
+
+    update = ngx_array_push(umcf->zone_updates);
+    if (update == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(update, sizeof(ngx_http_upstream_zone_update_t));
+
+    src = uscf->peer.data;
+
+    update->uscf = uscf;
+    update->peers = peers;
+
+    update->list[0].peers = peers;
+    update->list[0].src = src;
+
+    if (peers->next == NULL && src->next) {
+
+        backup = ngx_slab_calloc(peers->shpool,
+                                 sizeof(ngx_http_upstream_rr_peers_t));
+        if (backup == NULL) {
+            goto nomem;
+        }
+
+        backup->shpool = peers->shpool;
+        backup->config = peers->config;
+        backup->name = peers->name;
+
+        update->backup = backup;
+
+    } else {
+        backup = peers->next;
+    }
+
+    if (ngx_http_upstream_zone_prepare_list(&update->list[0], pool)
+        != NGX_OK)
+    {
+        goto nomem;
+    }
+
+    if (backup) {
+        update->list[1].peers = backup;
+        update->list[1].src = src->next;
+
+        if (ngx_http_upstream_zone_prepare_list(&update->list[1], pool)
+            != NGX_OK)
+        {
+            goto nomem;
+        }
+    }
+
+    return NGX_OK;
+
+nomem:
+
+    ngx_log_error(NGX_LOG_EMERG, log, 0,
+                  "cannot update upstream \"%V\", memory exhausted",
+                  peers->name);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_prepare_list(ngx_http_upstream_zone_list_t *list,
+    ngx_pool_t *pool)
+{
+    ngx_uint_t                     i, n;
+    ngx_http_upstream_rr_peer_t   *peer, *p;
+    ngx_http_upstream_rr_peers_t  *peers, *src;
+
+    peers = list->peers;
+    src = list->src;
+
+    n = src ? src->number : 0;
+
+    if (n == 0) {
+        return NGX_OK;
+    }
+
+    list->match = ngx_pcalloc(pool, n * sizeof(ngx_http_upstream_rr_peer_t *));
+    if (list->match == NULL) {
+        return NGX_ERROR;
+    }
+
+    list->added = ngx_pcalloc(pool, n);
+    if (list->added == NULL) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * servers without a name to resolve are only changed by the master
+     * process, so the matches stay valid until the update is applied
+     */
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+
+    for (peer = peers->peer; peer; peer = peer->next) {
+
+        if (peer->host) {
+
+            /* resolved by a worker process */
+
+            continue;
+        }
+
+        for (p = src->peer, i = 0; p; p = p->next, i++) {
+
+            if (list->match[i]
+                || p->server.len != peer->server.len
+                || ngx_strncmp(p->server.data, peer->server.data,
+                               p->server.len)
+                   != 0)
+            {
+                continue;
+            }
+
+            if (ngx_cmp_sockaddr(p->sockaddr, p->socklen,
+                                 peer->sockaddr, peer->socklen, 1)
+                == NGX_OK)
+            {
+                list->match[i] = peer;
+                break;
+            }
+        }
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    /* new servers are copied aside, and linked when the update is applied */
+
+    for (p = src->peer, i = 0; p; p = p->next, i++) {
+
+        if (list->match[i]) {
+            continue;
+        }
+
+        ngx_shmtx_lock(&peers->shpool->mutex);
+        peer = ngx_http_upstream_zone_copy_peer(peers, p);
+        ngx_shmtx_unlock(&peers->shpool->mutex);
+
+        if (peer == NULL) {
+            return NGX_ERROR;
+        }
+
+        peer->next = NULL;
+
+        list->match[i] = peer;
+        list->added[i] = 1;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_init_module(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                        i;
+    ngx_http_upstream_rr_peers_t     *peers;
+    ngx_http_upstream_main_conf_t    *umcf;
+    ngx_http_upstream_zone_update_t  *update;
+
+    /*
+     * the peers prepared by an incremental reconfiguration are made visible
+     * to the running worker processes only when the new cycle is committed
+     */
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    if (umcf == NULL || umcf->zone_updates == NULL) {
+        return NGX_OK;
+    }
+
+    update = umcf->zone_updates->elts;
+
+    for (i = 0; i < umcf->zone_updates->nelts; i++) {
+        peers = update[i].peers;
+
+        if (update[i].backup) {
+            ngx_http_upstream_rr_peers_wlock(peers);
+            peers->next = update[i].backup;
+            ngx_http_upstream_rr_peers_unlock(peers);
+        }
+
+        ngx_http_upstream_zone_apply_list(&update[i].list[0]);
+
+        if (update[i].list[1].peers) {
+            ngx_http_upstream_zone_apply_list(&update[i].list[1]);
+        }
+
+        update[i].applied = 1;
+
+        update[i].uscf->peer.data = peers;
+
+        ngx_http_upstream_zone_set_single(update[i].uscf);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_zone_apply_list(ngx_http_upstream_zone_list_t *list)
+{
+    ngx_uint_t                     i;
+    ngx_http_upstream_rr_peer_t   *peer, *p, **peerp;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    peers = list->peers;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    for (peerp = &peers->peer; *peerp; /* void */ ) {
+        peer = *peerp;
+
+        if (peer->host) {
+            peerp = &peer->next;
+            continue;
+        }
+
+        for (p = list->src ? list->src->peer : NULL, i = 0;
+             p;
+             p = p->next, i++)
+        {
+            if (list->match[i] == peer && !list->added[i]) {
+                break;
+            }
+        }
+
+        if (p == NULL) {
+            *peerp = peer->next;
+            ngx_http_upstream_zone_remove_peer_locked(peers, peer);
+            continue;
+        }
+
+        /* the state of a kept server, e.g. its failures, is preserved */
+
+        if (peer->weight != p->weight) {
+            peers->total_weight = peers->total_weight - peer->weight
+                                  + p->weight;
+
+            peer->weight = p->weight;
+            peer->effective_weight = p->weight;
+            peer->current_weight = 0;
+        }
+
+        if (peer->down != p->down) {
+            peers->tries = peers->tries + (p->down == 0) - (peer->down == 0);
+            peer->down = p->down;
+        }
+
+        peer->max_conns = p->max_conns;
+        peer->max_fails = p->max_fails;
+        peer->fail_timeout = p->fail_timeout;
+        peer->slow_start = p->slow_start;
+
+        peerp = &peer->next;
+    }
+
+    for (p = list->src ? list->src->peer : NULL, i = 0; p; p = p->next, i++) {
+
+        if (!list->added[i]) {
+            continue;
+        }
+
+        peer = list->match[i];
+
+        *peerp = peer;
+        peerp = &peer->next;
+
+        peers->number++;
+        peers->tries += (peer->down == 0);
+        peers->total_weight += peer->weight;
+    }
+
+    peers->weighted = (peers->total_weight != peers->number);
+    (*peers->config)++;
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+}
+
+
+static void
+ngx_http_upstream_zone_cleanup_updates(void *data)
+{
+    ngx_array_t *updates = data;
+
+    ngx_uint_t                        i, k, n;
+    ngx_http_upstream_zone_list_t    *list;
+    ngx_http_upstream_zone_update_t  *update;
+
+    /* the new cycle was not committed, free the peers copied aside */
+
+    update = updates->elts;
+
+    for (i = 0; i < updates->nelts; i++) {
+
+        if (update[i].applied) {
+            continue;
+        }
+
+        for (k = 0; k < 2; k++) {
+            list = &update[i].list[k];
+
+            if (list->added == NULL) {
+                continue;
+            }
+
+            for (n = 0; n < list->src->number; n++) {
+                if (list->added[n]) {
+                    ngx_http_upstream_rr_peer_free(list->peers,
+                                                   list->match[n]);
+                }
+            }
+        }
+
+        if (update[i].backup) {
+            ngx_slab_free(update[i].peers->shpool, update[i].backup);
+        }
+    }
+}
+
+
 static ngx_http_upstream_rr_peer_t *
 ngx_http_upstream_zone_copy_peer(ngx_http_upstream_rr_peers_t *peers,
     ngx_http_upstream_rr_peer_t *src)
@@ -10,6 +10,13 @@
 #include <ngx_http.h>
 
 
+typedef struct {
+    ngx_http_location_tree_node_t  *nodes;
+    ngx_uint_t                      next;
+    u_char                         *data;
+} ngx_http_location_tree_ctx_t;
+
+
 static char *ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static ngx_int_t ngx_http_init_phases(ngx_conf_t *cf,
     ngx_http_core_main_conf_t *cmcf);
@@ -43,11 +50,13 @@ static ngx_int_t ngx_http_cmp_locations(const ngx_queue_t *one,
     const ngx_queue_t *two);
 static ngx_int_t ngx_http_join_exact_locations(ngx_conf_t *cf,
     ngx_queue_t *locations);
-static void ngx_http_create_locations_list(ngx_queue_t *locations,
-    ngx_queue_t *q);
+static int ngx_libc_cdecl ngx_http_cmp_location_names(const void *one,
+    const void *two);
 static ngx_http_location_tree_node_t *
-    ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_queue_t *locations,
-    size_t prefix);
+    ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_queue_t *locations);
+static void ngx_http_fill_locations_tree(ngx_http_location_tree_ctx_t *ctx,
+    ngx_http_location_tree_node_t *node, ngx_http_location_queue_t **lqs,
+    ngx_uint_t n, size_t depth);
 
 static ngx_int_t ngx_http_optimize_servers(ngx_conf_t *cf,
     ngx_http_core_main_conf_t *cmcf, ngx_array_t *ports);
@@ -677,8 +686,9 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
     ngx_http_location_queue_t   *lq;
     ngx_http_core_loc_conf_t   **clcfp;
 #if (NGX_PCRE)
-    ngx_uint_t                   r;
+    ngx_uint_t                   r, i;
     ngx_queue_t                 *regex;
+    ngx_regex_set_elt_t         *elts;
 #endif
 
     locations = pclcf->locations;
@@ -788,6 +798,23 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
         *clcfp = NULL;
 
         ngx_queue_split(locations, regex, &tail);
+
+        if (r >= NGX_REGEX_SET_MIN) {
+            elts = ngx_palloc(cf->temp_pool, r * sizeof(ngx_regex_set_elt_t));
+            if (elts == NULL) {
+                return NGX_ERROR;
+            }
+
+            for (i = 0; i < r; i++) {
+                elts[i].regex = pclcf->regex_locations[i]->regex->regex;
+                elts[i].pattern = pclcf->regex_locations[i]->regex->name;
+            }
+
+            pclcf->regex_set = ngx_regex_compile_set(cf->pool, elts, r);
+            if (pclcf->regex_set == NULL) {
+                return NGX_ERROR;
+            }
+        }
     }
 
 #endif
@@ -831,9 +858,7 @@ ngx_http_init_static_location_trees(ngx_conf_t *cf,
         return NGX_ERROR;
     }
 
-    ngx_http_create_locations_list(locations, ngx_queue_head(locations));
-
-    pclcf->static_locations = ngx_http_create_locations_tree(cf, locations, 0);
+    pclcf->static_locations = ngx_http_create_locations_tree(cf, locations);
     if (pclcf->static_locations == NULL) {
         return NGX_ERROR;
     }
@@ -881,8 +906,6 @@ ngx_http_add_location(ngx_conf_t *cf, ngx_queue_t **locations,
     lq->file_name = cf->conf_file->file.name.data;
     lq->line = cf->conf_file->line;
 
-    ngx_queue_init(&lq->list);
-
     ngx_queue_insert_tail(*locations, &lq->queue);
 
     if (ngx_http_escape_location_name(cf, clcf) != NGX_OK) {
@@ -1038,140 +1061,181 @@ ngx_http_join_exact_locations(ngx_conf_t *cf, ngx_queue_t *locations)
 }
 
 
-static void
-ngx_http_create_locations_list(ngx_queue_t *locations, ngx_queue_t *q)
+static int ngx_libc_cdecl
+ngx_http_cmp_location_names(const void *one, const void *two)
 {
-    u_char                     *name;
-    size_t                      len;
-    ngx_queue_t                *x, tail;
-    ngx_http_location_queue_t  *lq, *lx;
+    ngx_int_t                   rc;
+    ngx_str_t                  *first, *second;
 
-    if (q == ngx_queue_last(locations)) {
-        return;
-    }
+    first = (*(ngx_http_location_queue_t **) one)->name;
+    second = (*(ngx_http_location_queue_t **) two)->name;
 
-    lq = (ngx_http_location_queue_t *) q;
+    rc = ngx_http_location_cmp(first->data, second->data,
+                               ngx_min(first->len, second->len));
 
-    if (lq->inclusive == NULL) {
-        ngx_http_create_locations_list(locations, ngx_queue_next(q));
-        return;
+    if (rc != 0) {
+        return (int) rc;
     }
 
-    len = lq->name->len;
-    name = lq->name->data;
+    return (int) first->len - (int) second->len;
+}
+
+
+static ngx_http_location_tree_node_t *
+ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_queue_t *locations)
+{
+    size_t                        size;
+    ngx_uint_t                    n;
+    ngx_queue_t                  *q;
+    ngx_http_location_queue_t   **lqs;
+    ngx_http_location_tree_ctx_t  ctx;
 
-    for (x = ngx_queue_next(q);
-         x != ngx_queue_sentinel(locations);
-         x = ngx_queue_next(x))
+    n = 0;
+    size = 0;
+
+    for (q = ngx_queue_head(locations);
+         q != ngx_queue_sentinel(locations);
+         q = ngx_queue_next(q))
     {
-        lx = (ngx_http_location_queue_t *) x;
+        n++;
+        size += ((ngx_http_location_queue_t *) q)->name->len;
+    }
 
-        if (len > lx->name->len
-            || ngx_filename_cmp(name, lx->name->data, len) != 0)
-        {
-            break;
-        }
+    lqs = ngx_palloc(cf->temp_pool, n * sizeof(ngx_http_location_queue_t *));
+    if (lqs == NULL) {
+        return NULL;
     }
 
-    q = ngx_queue_next(q);
+    n = 0;
 
-    if (q == x) {
-        ngx_http_create_locations_list(locations, x);
-        return;
+    for (q = ngx_queue_head(locations);
+         q != ngx_queue_sentinel(locations);
+         q = ngx_queue_next(q))
+    {
+        lqs[n++] = (ngx_http_location_queue_t *) q;
     }
 
-    ngx_queue_split(locations, q, &tail);
-    ngx_queue_add(&lq->list, &tail);
+    ngx_qsort(lqs, n, sizeof(ngx_http_location_queue_t *),
+              ngx_http_cmp_location_names);
 
-    if (x == ngx_queue_sentinel(locations)) {
-        ngx_http_create_locations_list(&lq->list, ngx_queue_head(&lq->list));
-        return;
+    /*
+     * a radix tree of n names has at most 2 * n nodes besides the root;
+     * labels take at most the names length, and keys take a byte per node
+     */
+
+    ctx.nodes = ngx_pcalloc(cf->pool,
+                            (2 * n + 1) * sizeof(ngx_http_location_tree_node_t));
+    if (ctx.nodes == NULL) {
+        return NULL;
     }
 
-    ngx_queue_split(&lq->list, x, &tail);
-    ngx_queue_add(locations, &tail);
+    ctx.data = ngx_pnalloc(cf->pool, size + 2 * n);
+    if (ctx.data == NULL) {
+        return NULL;
+    }
+
+    ctx.next = 1;
 
-    ngx_http_create_locations_list(&lq->list, ngx_queue_head(&lq->list));
+    ngx_http_fill_locations_tree(&ctx, &ctx.nodes[0], lqs, n, 0);
 
-    ngx_http_create_locations_list(locations, x);
+    return &ctx.nodes[0];
 }
 
 
 /*
- * to keep cache locality for left leaf nodes, allocate nodes in following
- * order: node, left subtree, right subtree, inclusive subtree
+ * to keep cache locality, children of a node are allocated together,
+ * and labels and keys are allocated from the same memory block
  */
 
-static ngx_http_location_tree_node_t *
-ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_queue_t *locations,
-    size_t prefix)
+static void
+ngx_http_fill_locations_tree(ngx_http_location_tree_ctx_t *ctx,
+    ngx_http_location_tree_node_t *node, ngx_http_location_queue_t **lqs,
+    ngx_uint_t n, size_t depth)
 {
+    u_char                         *p, *first, *last, c;
     size_t                          len;
-    ngx_queue_t                    *q, tail;
-    ngx_http_location_queue_t      *lq;
-    ngx_http_location_tree_node_t  *node;
+    ngx_uint_t                      i, j, k, m;
+    ngx_http_location_tree_node_t  *child;
 
-    q = ngx_queue_middle(locations);
+    i = 0;
 
-    lq = (ngx_http_location_queue_t *) q;
-    len = lq->name->len - prefix;
+    if (n && lqs[0]->name->len == depth) {
+        node->exact = lqs[0]->exact;
+        node->inclusive = lqs[0]->inclusive;
 
-    node = ngx_palloc(cf->pool,
-                      offsetof(ngx_http_location_tree_node_t, name) + len);
-    if (node == NULL) {
-        return NULL;
+        node->auto_redirect = (u_char) ((node->exact
+                                         && node->exact->auto_redirect)
+                                        || (node->inclusive
+                                            && node->inclusive->auto_redirect));
+        i = 1;
     }
 
-    node->left = NULL;
-    node->right = NULL;
-    node->tree = NULL;
-    node->exact = lq->exact;
-    node->inclusive = lq->inclusive;
-
-    node->auto_redirect = (u_char) ((lq->exact && lq->exact->auto_redirect)
-                           || (lq->inclusive && lq->inclusive->auto_redirect));
+    m = 0;
 
-    node->len = (u_short) len;
-    ngx_memcpy(node->name, &lq->name->data[prefix], len);
+    for (j = i; j < n; j = k) {
+        c = ngx_http_location_char(lqs[j]->name->data[depth]);
 
-    ngx_queue_split(locations, q, &tail);
+        for (k = j + 1; k < n; k++) {
+            if (ngx_http_location_char(lqs[k]->name->data[depth]) != c) {
+                break;
+            }
+        }
 
-    if (ngx_queue_empty(locations)) {
-        /*
-         * ngx_queue_split() insures that if left part is empty,
-         * then right one is empty too
-         */
-        goto inclusive;
+        m++;
     }
 
-    node->left = ngx_http_create_locations_tree(cf, locations, prefix);
-    if (node->left == NULL) {
-        return NULL;
+    if (m == 0) {
+        return;
     }
 
-    ngx_queue_remove(q);
+    node->nchildren = (u_short) m;
+    node->children = &ctx->nodes[ctx->next];
+    node->keys = ctx->data;
 
-    if (ngx_queue_empty(&tail)) {
-        goto inclusive;
-    }
+    ctx->next += m;
+    ctx->data += m;
 
-    node->right = ngx_http_create_locations_tree(cf, &tail, prefix);
-    if (node->right == NULL) {
-        return NULL;
-    }
+    m = 0;
 
-inclusive:
+    for (j = i; j < n; j = k) {
+        c = ngx_http_location_char(lqs[j]->name->data[depth]);
 
-    if (ngx_queue_empty(&lq->list)) {
-        return node;
-    }
+        for (k = j + 1; k < n; k++) {
+            if (ngx_http_location_char(lqs[k]->name->data[depth]) != c) {
+                break;
+            }
+        }
 
-    node->tree = ngx_http_create_locations_tree(cf, &lq->list, prefix + len);
-    if (node->tree == NULL) {
-        return NULL;
-    }
+        /* names are sorted, so the first and the last ones give the label */
+
+        first = lqs[j]->name->data;
+        last = lqs[k - 1]->name->data;
 
-    return node;
+        len = ngx_min(lqs[j]->name->len, lqs[k - 1]->name->len);
+
+        for (p = first + depth + 1; (size_t) (p - first) < len; p++) {
+            if (ngx_http_location_char(*p)
+                != ngx_http_location_char(last[p - first]))
+            {
+                break;
+            }
+        }
+
+        len = p - first;
+
+        node->keys[m] = c;
+
+        child = &node->children[m++];
+
+        child->name = ctx->data;
+        child->len = (u_short) (len - depth);
+
+        for (p = first + depth; p < first + len; p++) {
+            *ctx->data++ = ngx_http_location_char(*p);
+        }
+
+        ngx_http_fill_locations_tree(ctx, child, &lqs[j], k - j, len);
+    }
 }
 
 
@@ -118,6 +118,8 @@ void ngx_http_split_args(ngx_http_request_t *r, ngx_str_t *uri,
     ngx_str_t *args);
 ngx_int_t ngx_http_parse_chunked(ngx_http_request_t *r, ngx_buf_t *b,
     ngx_http_chunked_t *ctx, ngx_uint_t keep_trailers);
+ngx_int_t ngx_http_parse_priority(ngx_str_t *value, ngx_uint_t *urgency,
+    ngx_uint_t *incremental);
 
 
 ngx_http_request_t *ngx_http_create_request(ngx_connection_t *c);
@@ -886,6 +886,9 @@ ngx_http_core_run_phases(ngx_http_request_t *r)
 
     while (ph[r->phase_handler].checker) {
 
+        ngx_sdt_probe3(http__phase, r, r->phase_handler,
+                       ph[r->phase_handler].handler);
+
         rc = ph[r->phase_handler].checker(r, &ph[r->phase_handler]);
 
         if (rc == NGX_OK) {
@@ -1446,7 +1449,28 @@ ngx_http_core_find_location(ngx_http_request_t *r)
 
     if (noregex == 0 && pclcf->regex_locations) {
 
-        for (clcfp = pclcf->regex_locations; *clcfp; clcfp++) {
+        clcfp = pclcf->regex_locations;
+
+        if (pclcf->regex_set) {
+            n = ngx_regex_exec_set(pclcf->regex_set, &r->uri);
+
+            if (n == NGX_REGEX_NO_MATCHED) {
+                return rc;
+            }
+
+            if (n < 0) {
+                ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                              ngx_regex_exec_set_n " failed: %i on \"%V\"",
+                              n, &r->uri);
+                return NGX_ERROR;
+            }
+
+            /* skip to the first matching location */
+
+            clcfp += n;
+        }
+
+        for ( /* void */ ; *clcfp; clcfp++) {
 
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                            "test location: ~ \"%V\"", &(*clcfp)->name);
@@ -1487,78 +1511,107 @@ static ngx_int_t
 ngx_http_core_find_static_location(ngx_http_request_t *r,
     ngx_http_location_tree_node_t *node)
 {
-    u_char     *uri;
-    size_t      len, n;
-    ngx_int_t   rc, rv;
+    u_char      *uri, *keys, c;
+    size_t       len;
+    ngx_int_t    rv;
+    ngx_uint_t   i, lo, hi;
 
     len = r->uri.len;
     uri = r->uri.data;
 
     rv = NGX_DECLINED;
 
-    for ( ;; ) {
+    if (node == NULL) {
+        return rv;
+    }
 
-        if (node == NULL) {
-            return rv;
-        }
+    for ( ;; ) {
 
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "test location: \"%*s\"",
-                       (size_t) node->len, node->name);
+        if (len == 0) {
 
-        n = (len <= (size_t) node->len) ? len : node->len;
+            if (node->exact) {
+                r->loc_conf = node->exact->loc_conf;
+                return NGX_OK;
+            }
 
-        rc = ngx_filename_cmp(uri, node->name, n);
+            if (node->inclusive) {
+                r->loc_conf = node->inclusive->loc_conf;
+                return NGX_AGAIN;
+            }
 
-        if (rc != 0) {
-            node = (rc < 0) ? node->left : node->right;
+            /* look for a location "uri/" to redirect to */
 
-            continue;
-        }
+            c = '/';
 
-        if (len > (size_t) node->len) {
+        } else {
 
             if (node->inclusive) {
-
                 r->loc_conf = node->inclusive->loc_conf;
                 rv = NGX_AGAIN;
+            }
 
-                node = node->tree;
-                uri += n;
-                len -= n;
+            c = ngx_http_location_char(*uri);
+        }
 
-                continue;
-            }
+        keys = node->keys;
 
-            /* exact only */
+        if (node->nchildren <= 8) {
 
-            node = node->right;
+            for (i = 0; i < node->nchildren; i++) {
+                if (keys[i] >= c) {
+                    break;
+                }
+            }
 
-            continue;
-        }
+        } else {
 
-        if (len == (size_t) node->len) {
+            lo = 0;
+            hi = node->nchildren;
 
-            if (node->exact) {
-                r->loc_conf = node->exact->loc_conf;
-                return NGX_OK;
+            while (lo < hi) {
+                i = (lo + hi) / 2;
 
-            } else {
-                r->loc_conf = node->inclusive->loc_conf;
-                return NGX_AGAIN;
+                if (keys[i] < c) {
+                    lo = i + 1;
+
+                } else {
+                    hi = i;
+                }
             }
+
+            i = lo;
+        }
+
+        if (i == node->nchildren || keys[i] != c) {
+            return rv;
         }
 
-        /* len < node->len */
+        node = &node->children[i];
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "test location: \"%*s\"",
+                       (size_t) node->len, node->name);
 
-        if (len + 1 == (size_t) node->len && node->auto_redirect) {
+        if (len < (size_t) node->len) {
 
-            r->loc_conf = (node->exact) ? node->exact->loc_conf:
-                                          node->inclusive->loc_conf;
-            rv = NGX_DONE;
+            if (len + 1 == (size_t) node->len
+                && node->auto_redirect
+                && ngx_http_location_cmp(uri, node->name, len) == 0)
+            {
+                r->loc_conf = (node->exact) ? node->exact->loc_conf:
+                                              node->inclusive->loc_conf;
+                return NGX_DONE;
+            }
+
+            return rv;
+        }
+
+        if (ngx_http_location_cmp(uri, node->name, node->len) != 0) {
+            return rv;
         }
 
-        node = node->left;
+        uri += node->len;
+        len -= node->len;
     }
 }
 
@@ -330,6 +330,7 @@ struct ngx_http_core_loc_conf_s {
     ngx_http_location_tree_node_t   *static_locations;
 #if (NGX_PCRE)
     ngx_http_core_loc_conf_t       **regex_locations;
+    ngx_regex_set_t                 *regex_set;
 #endif
 
     /* pointer to the modules' loc_conf */
@@ -463,24 +464,38 @@ typedef struct {
     ngx_str_t                       *name;
     u_char                          *file_name;
     ngx_uint_t                       line;
-    ngx_queue_t                      list;
 } ngx_http_location_queue_t;
 
 
-struct ngx_http_location_tree_node_s {
-    ngx_http_location_tree_node_t   *left;
-    ngx_http_location_tree_node_t   *right;
-    ngx_http_location_tree_node_t   *tree;
+/*
+ * Static locations are kept in a radix tree: each node is reached by
+ * the "name" label, and its children are stored contiguously, with their
+ * first label bytes in the sorted "keys" array.
+ */
 
+struct ngx_http_location_tree_node_s {
     ngx_http_core_loc_conf_t        *exact;
     ngx_http_core_loc_conf_t        *inclusive;
 
+    ngx_http_location_tree_node_t   *children;
+    u_char                          *keys;
+    u_char                          *name;
+
     u_short                          len;
+    u_short                          nchildren;
     u_char                           auto_redirect;
-    u_char                           name[1];
 };
 
 
+#if (NGX_HAVE_CASELESS_FILESYSTEM)
+#define ngx_http_location_char(c)          ngx_tolower(c)
+#define ngx_http_location_cmp(s1, s2, n)   ngx_strncasecmp(s1, s2, n)
+#else
+#define ngx_http_location_char(c)          (c)
+#define ngx_http_location_cmp(s1, s2, n)   ngx_memcmp(s1, s2, n)
+#endif
+
+
 void ngx_http_core_run_phases(ngx_http_request_t *r);
 ngx_int_t ngx_http_core_generic_phase(ngx_http_request_t *r,
     ngx_http_phase_handler_t *ph);
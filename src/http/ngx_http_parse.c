@@ -2456,3 +2456,131 @@ invalid:
 
     return NGX_ERROR;
 }
+
+
+/*
+ * RFC 9218 Priority field: an RFC 8941 dictionary, of which only
+ * "u" (urgency, an integer 0..7) and "i" (incremental, a boolean) are used;
+ * unknown keys, parameters, and values out of range are ignored
+ */
+
+ngx_int_t
+ngx_http_parse_priority(ngx_str_t *value, ngx_uint_t *urgency,
+    ngx_uint_t *incremental)
+{
+    u_char      *p, *last, *key, *item, *end, ch;
+    size_t       len;
+    ngx_uint_t   u, i, quoted;
+
+    u = *urgency;
+    i = *incremental;
+
+    p = value->data;
+    last = p + value->len;
+
+    for ( ;; ) {
+
+        while (p < last && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+
+        if (p == last) {
+            break;
+        }
+
+        key = p;
+
+        if ((*p < 'a' || *p > 'z') && *p != '*') {
+            return NGX_DECLINED;
+        }
+
+        while (p < last) {
+            ch = *p;
+
+            if ((ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9')
+                || ch == '_' || ch == '-' || ch == '.' || ch == '*')
+            {
+                p++;
+                continue;
+            }
+
+            break;
+        }
+
+        len = p - key;
+        item = NULL;
+
+        if (p < last && *p == '=') {
+            item = ++p;
+        }
+
+        /* skip the rest of the member, including parameters */
+
+        quoted = 0;
+
+        for ( /* void */ ; p < last; p++) {
+            ch = *p;
+
+            if (quoted) {
+                if (ch == '\\' && p + 1 < last) {
+                    p++;
+
+                } else if (ch == '"') {
+                    quoted = 0;
+                }
+
+                continue;
+            }
+
+            if (ch == '"') {
+                quoted = 1;
+                continue;
+            }
+
+            if (ch == ',') {
+                break;
+            }
+        }
+
+        if (quoted) {
+            return NGX_DECLINED;
+        }
+
+        end = p;
+
+        if (len == 1 && key[0] == 'u') {
+
+            if (item && end - item >= 1
+                && item[0] >= '0' && item[0] <= '0' + NGX_HTTP_MAX_URGENCY
+                && (end - item == 1 || item[1] == ';'
+                    || item[1] == ' ' || item[1] == '\t'))
+            {
+                u = item[0] - '0';
+            }
+
+        } else if (len == 1 && key[0] == 'i') {
+
+            if (item == NULL) {
+                i = 1;
+
+            } else if (end - item >= 2
+                       && item[0] == '?' && (item[1] == '0' || item[1] == '1')
+                       && (end - item == 2 || item[2] == ';'
+                           || item[2] == ' ' || item[2] == '\t'))
+            {
+                i = item[1] - '0';
+            }
+        }
+
+        if (p == last) {
+            break;
+        }
+
+        p++;
+    }
+
+    *urgency = u;
+    *incremental = i;
+
+    return NGX_OK;
+}
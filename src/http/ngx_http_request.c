@@ -139,6 +139,10 @@ ngx_http_header_t  ngx_http_headers_in[] = {
                  offsetof(ngx_http_headers_in_t, upgrade),
                  ngx_http_process_header_line },
 
+    { ngx_string("Priority"),
+                 offsetof(ngx_http_headers_in_t, priority),
+                 ngx_http_process_header_line },
+
 #if (NGX_HTTP_GZIP || NGX_HTTP_HEADERS)
     { ngx_string("Accept-Encoding"),
                  offsetof(ngx_http_headers_in_t, accept_encoding),
@@ -1148,6 +1152,9 @@ ngx_http_process_request_line(ngx_event_t *rev)
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
                            "http request line: \"%V\"", &r->request_line);
 
+            ngx_sdt_probe3(http__request__line, r, r->request_line.data,
+                           r->request_line.len);
+
             r->method_name.len = r->method_end - r->request_start + 1;
             r->method_name.data = r->request_line.data;
 
@@ -2548,6 +2555,8 @@ ngx_http_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
                    "http finalize request: %i, \"%V?%V\" a:%d, c:%d",
                    rc, &r->uri, &r->args, r == c->data, r->main->count);
 
+    ngx_sdt_probe3(http__finalize, r, rc, r->headers_out.status);
+
     if (rc == NGX_DONE) {
         ngx_http_finalize_connection(r);
         return;
@@ -3347,6 +3356,19 @@ ngx_http_set_keepalive(ngx_http_request_t *r)
     r->http_state = NGX_HTTP_KEEPALIVE_STATE;
 #endif
 
+    /*
+     * an idle plain text connection may be passed to a worker process
+     * of the new generation on reload, see worker_shutdown_handoff
+     */
+
+    c->handoff = (c->proxy_protocol == NULL);
+
+#if (NGX_HTTP_SSL)
+    if (c->ssl) {
+        c->handoff = 0;
+    }
+#endif
+
     if (clcf->keepalive_min_timeout == 0) {
         c->idle = 1;
         ngx_reusable_connection(c, 1);
@@ -3500,6 +3522,7 @@ ngx_http_keepalive_handler(ngx_event_t *rev)
     c->log->action = "reading client request line";
 
     c->idle = 0;
+    c->handoff = 0;
     ngx_reusable_connection(c, 0);
 
     c->data = ngx_http_create_request(c);
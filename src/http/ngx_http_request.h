@@ -20,6 +20,11 @@
 #define NGX_HTTP_LINGERING_BUFFER_SIZE     4096
 
 
+/* RFC 9218 */
+#define NGX_HTTP_DEFAULT_URGENCY           3
+#define NGX_HTTP_MAX_URGENCY               7
+
+
 #define NGX_HTTP_VERSION_9                 9
 #define NGX_HTTP_VERSION_10                1000
 #define NGX_HTTP_VERSION_11                1001
@@ -203,6 +208,7 @@ typedef struct {
     ngx_table_elt_t                  *te;
     ngx_table_elt_t                  *expect;
     ngx_table_elt_t                  *upgrade;
+    ngx_table_elt_t                  *priority;
 
 #if (NGX_HTTP_GZIP || NGX_HTTP_HEADERS)
     ngx_table_elt_t                  *accept_encoding;
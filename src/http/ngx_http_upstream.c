@@ -344,7 +344,7 @@ static ngx_command_t  ngx_http_upstream_commands[] = {
       NULL },
 
     { ngx_string("server"),
-      NGX_HTTP_UPS_CONF|NGX_CONF_1MORE,
+      NGX_HTTP_UPS_CONF|NGX_CONF_1MORE|NGX_CONF_DYNAMIC,
       ngx_http_upstream_server,
       NGX_HTTP_SRV_CONF_OFFSET,
       0,
@@ -932,6 +932,8 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http upstream cache: %i", rc);
 
+    ngx_sdt_probe2(http__cache__lookup, r, rc);
+
     switch (rc) {
 
     case NGX_HTTP_CACHE_STALE:
@@ -1577,6 +1579,7 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     u->start_time = ngx_current_msec;
 
+    u->state->start_time = u->start_time;
     u->state->response_time = (ngx_msec_t) -1;
     u->state->connect_time = (ngx_msec_t) -1;
     u->state->header_time = (ngx_msec_t) -1;
@@ -1586,6 +1589,10 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http upstream connect: %i", rc);
 
+    ngx_sdt_probe4(http__upstream__connect, r, rc,
+                   u->peer.name ? u->peer.name->data : NULL,
+                   u->peer.name ? u->peer.name->len : 0);
+
     if (rc == NGX_ERROR) {
         ngx_http_upstream_finalize_request(r, u,
                                            NGX_HTTP_INTERNAL_SERVER_ERROR);
@@ -2146,6 +2153,11 @@ ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u,
         return;
     }
 
+    if (!u->request_sent) {
+        ngx_sdt_probe2(http__upstream__connected, r,
+                       u->state->connect_time);
+    }
+
     c->log->action = "sending request to upstream";
 
     rc = ngx_http_upstream_send_request_body(r, u, do_write);
@@ -2224,6 +2236,9 @@ ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u,
     if (!u->request_body_sent) {
         u->request_body_sent = 1;
 
+        ngx_sdt_probe2(http__upstream__sent, r,
+                       ngx_current_msec - u->start_time);
+
         if (u->header_sent) {
             return;
         }
@@ -2511,6 +2526,11 @@ ngx_http_upstream_process_header(ngx_http_request_t *r, ngx_http_upstream_t *u)
             return;
         }
 
+        if (u->state->bytes_received == 0) {
+            ngx_sdt_probe2(http__upstream__first__byte, r,
+                           ngx_current_msec - u->start_time);
+        }
+
         u->state->bytes_received += n;
 
         u->buffer.last += n;
@@ -2567,6 +2587,9 @@ ngx_http_upstream_process_header(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     u->state->header_time = ngx_current_msec - u->start_time;
 
+    ngx_sdt_probe3(http__upstream__header, r, u->headers_in.status_n,
+                   u->state->header_time);
+
     if (u->headers_in.status_n >= NGX_HTTP_SPECIAL_RESPONSE) {
 
         if (ngx_http_upstream_test_next(r, u) == NGX_OK) {
@@ -6267,13 +6290,18 @@ ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
 {
     char                          *rv;
     void                          *mconf;
+    uint32_t                       hash, servers;
     ngx_str_t                     *value;
     ngx_url_t                      u;
-    ngx_uint_t                     m;
+    ngx_uint_t                     m, dynamic;
     ngx_conf_t                     pcf;
     ngx_http_module_t             *module;
     ngx_http_conf_ctx_t           *ctx, *http_ctx;
     ngx_http_upstream_srv_conf_t  *uscf;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                     i;
+    ngx_http_upstream_server_t    *server;
+#endif
 
     ngx_memzero(&u, sizeof(ngx_url_t));
 
@@ -6357,6 +6385,9 @@ ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
 
     /* parse inside upstream{} */
 
+    hash = cf->cycle->conf_dynamic_hash;
+    ngx_crc32_init(cf->cycle->conf_dynamic_hash);
+
     pcf = *cf;
     cf->ctx = ctx;
     cf->cmd_type = NGX_HTTP_UPS_CONF;
@@ -6375,6 +6406,38 @@ ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
         return NGX_CONF_ERROR;
     }
 
+    /*
+     * the server list can only be changed by an incremental reconfiguration
+     * if the upstream is in shared memory and has no resolvable servers,
+     * see ngx_http_upstream_init_zone()
+     */
+
+    servers = cf->cycle->conf_dynamic_hash;
+    cf->cycle->conf_dynamic_hash = hash;
+
+    dynamic = 0;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    if (uscf->shm_zone) {
+        dynamic = 1;
+
+        server = uscf->servers->elts;
+
+        for (i = 0; i < uscf->servers->nelts; i++) {
+            if (server[i].host.len) {
+                dynamic = 0;
+                break;
+            }
+        }
+    }
+
+#endif
+
+    ngx_crc32_update(dynamic ? &cf->cycle->conf_dynamic_hash
+                             : &cf->cycle->conf_hash,
+                     (u_char *) &servers, sizeof(uint32_t));
+
     return rv;
 }
 
@@ -59,6 +59,7 @@
 
 typedef struct {
     ngx_uint_t                       status;
+    ngx_msec_t                       start_time;
     ngx_msec_t                       response_time;
     ngx_msec_t                       connect_time;
     ngx_msec_t                       header_time;
@@ -75,6 +76,9 @@ typedef struct {
     ngx_hash_t                       headers_in_hash;
     ngx_array_t                      upstreams;
                                              /* ngx_http_upstream_srv_conf_t */
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_array_t                     *zone_updates;
+#endif
 } ngx_http_upstream_main_conf_t;
 
 typedef struct ngx_http_upstream_srv_conf_s  ngx_http_upstream_srv_conf_t;
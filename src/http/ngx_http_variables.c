@@ -2557,8 +2557,28 @@ ngx_http_map_find(ngx_http_request_t *r, ngx_http_map_t *map, ngx_str_t *match)
         ngx_http_map_regex_t  *reg;
 
         reg = map->regex;
+        i = 0;
 
-        for (i = 0; i < map->nregex; i++) {
+        if (map->regex_set) {
+            n = ngx_regex_exec_set(map->regex_set, match);
+
+            if (n == NGX_REGEX_NO_MATCHED) {
+                return NULL;
+            }
+
+            if (n < 0) {
+                ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                              ngx_regex_exec_set_n " failed: %i on \"%V\"",
+                              n, match);
+                return NULL;
+            }
+
+            /* skip to the first matching regex */
+
+            i = n;
+        }
+
+        for ( /* void */ ; i < map->nregex; i++) {
 
             n = ngx_http_regex_exec(r, reg[i].regex, match);
 
@@ -97,6 +97,7 @@ typedef struct {
     ngx_hash_combined_t           hash;
 #if (NGX_PCRE)
     ngx_http_map_regex_t         *regex;
+    ngx_regex_set_t              *regex_set;
     ngx_uint_t                    nregex;
 #endif
 } ngx_http_map_t;
@@ -34,6 +34,7 @@
 #define NGX_HTTP_V2_PING_SIZE                    8
 #define NGX_HTTP_V2_GOAWAY_SIZE                  8
 #define NGX_HTTP_V2_WINDOW_UPDATE_SIZE           4
+#define NGX_HTTP_V2_PRIORITY_UPDATE_SIZE         4
 
 #define NGX_HTTP_V2_SETTINGS_PARAM_SIZE          6
 
@@ -43,6 +44,7 @@
 #define NGX_HTTP_V2_MAX_STREAMS_SETTING          0x3
 #define NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING     0x4
 #define NGX_HTTP_V2_MAX_FRAME_SIZE_SETTING       0x5
+#define NGX_HTTP_V2_NO_RFC7540_PRIORITIES        0x9
 
 #define NGX_HTTP_V2_FRAME_BUFFER_SIZE            24
 
@@ -101,6 +103,8 @@ static u_char *ngx_http_v2_state_window_update(ngx_http_v2_connection_t *h2c,
     u_char *pos, u_char *end);
 static u_char *ngx_http_v2_state_continuation(ngx_http_v2_connection_t *h2c,
     u_char *pos, u_char *end);
+static u_char *ngx_http_v2_state_priority_update(
+    ngx_http_v2_connection_t *h2c, u_char *pos, u_char *end);
 static u_char *ngx_http_v2_state_complete(ngx_http_v2_connection_t *h2c,
     u_char *pos, u_char *end);
 static u_char *ngx_http_v2_state_skip_padded(ngx_http_v2_connection_t *h2c,
@@ -159,6 +163,7 @@ static ngx_int_t ngx_http_v2_cookie(ngx_http_request_t *r,
     ngx_http_v2_header_t *header);
 static ngx_int_t ngx_http_v2_construct_cookie_header(ngx_http_request_t *r);
 static ngx_int_t ngx_http_v2_construct_host_header(ngx_http_request_t *r);
+static void ngx_http_v2_set_priority(ngx_http_request_t *r);
 static void ngx_http_v2_run_request(ngx_http_request_t *r);
 static ngx_int_t ngx_http_v2_process_request_body(ngx_http_request_t *r,
     u_char *pos, size_t size, ngx_uint_t last, ngx_uint_t flush);
@@ -250,6 +255,13 @@ ngx_http_v2_init(ngx_event_t *rev)
 
     h2c->priority_limit = ngx_max(h2scf->concurrent_streams, 100);
 
+    h2c->encoder.size = ngx_min(h2scf->encoder_table_size,
+                                NGX_HTTP_V2_TABLE_SIZE);
+    h2c->encoder.free = h2c->encoder.size;
+    h2c->encoder.limit = NGX_HTTP_V2_TABLE_SIZE;
+
+    ngx_http_v2_index_output_queue(h2c);
+
     h2c->pool = ngx_create_pool(h2scf->pool_size, h2c->connection->log);
     if (h2c->pool == NULL) {
         ngx_http_close_connection(c);
@@ -597,6 +609,8 @@ ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
 
     h2c->last_out = frame;
 
+    ngx_http_v2_index_output_queue(h2c);
+
     if (!wev->ready) {
         ngx_add_timer(wev, clcf->send_timeout);
         return NGX_AGAIN;
@@ -620,6 +634,36 @@ error:
 }
 
 
+void
+ngx_http_v2_index_output_queue(ngx_http_v2_connection_t *h2c)
+{
+    ngx_uint_t                 level;
+    ngx_http_v2_out_frame_t  **out, *frame;
+
+    out = &h2c->last_out;
+    level = NGX_HTTP_V2_LEVELS;
+
+    while (level--) {
+
+        for ( ;; ) {
+            frame = *out;
+
+            if (frame == NULL
+                || frame->stream == NULL
+                || frame->blocked
+                || frame->stream->level <= level)
+            {
+                break;
+            }
+
+            out = &frame->next;
+        }
+
+        h2c->out_levels[level] = out;
+    }
+}
+
+
 static void
 ngx_http_v2_handle_connection(ngx_http_v2_connection_t *h2c)
 {
@@ -906,6 +950,10 @@ ngx_http_v2_state_head(ngx_http_v2_connection_t *h2c, u_char *pos, u_char *end)
                    "http2 frame type:%ui f:%Xd l:%uz sid:%ui",
                    type, h2c->state.flags, h2c->state.length, h2c->state.sid);
 
+    if (type == NGX_HTTP_V2_PRIORITY_UPDATE_FRAME) {
+        return ngx_http_v2_state_priority_update(h2c, pos, end);
+    }
+
     if (type >= NGX_HTTP_V2_FRAME_STATES) {
         ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
                       "client sent frame with unknown type %ui", type);
@@ -2247,6 +2295,7 @@ ngx_http_v2_state_settings_params(ngx_http_v2_connection_t *h2c, u_char *pos,
 
         case NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING:
 
+            h2c->encoder.limit = value;
             h2c->table_update = 1;
             break;
 
@@ -2523,6 +2572,124 @@ ngx_http_v2_state_continuation(ngx_http_v2_connection_t *h2c, u_char *pos,
 }
 
 
+static u_char *
+ngx_http_v2_state_priority_update(ngx_http_v2_connection_t *h2c, u_char *pos,
+    u_char *end)
+{
+    ngx_str_t            value;
+    ngx_uint_t           sid, urgency, incremental;
+    ngx_http_v2_node_t  *node;
+
+    if (h2c->state.length < NGX_HTTP_V2_PRIORITY_UPDATE_SIZE) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent PRIORITY_UPDATE frame "
+                      "with incorrect length %uz", h2c->state.length);
+
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_SIZE_ERROR);
+    }
+
+    if (h2c->state.sid) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent PRIORITY_UPDATE frame "
+                      "with incorrect identifier");
+
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR);
+    }
+
+    if (h2c->state.length > NGX_HTTP_V2_STATE_BUFFER_SIZE) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 PRIORITY_UPDATE frame too long: %uz",
+                       h2c->state.length);
+
+        return ngx_http_v2_state_skip(h2c, pos, end);
+    }
+
+    if ((size_t) (end - pos) < h2c->state.length) {
+        return ngx_http_v2_state_save(h2c, pos, end,
+                                      ngx_http_v2_state_priority_update);
+    }
+
+    if (--h2c->priority_limit == 0) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent too many PRIORITY_UPDATE frames");
+
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_ENHANCE_YOUR_CALM);
+    }
+
+    sid = ngx_http_v2_parse_sid(pos);
+
+    value.data = pos + NGX_HTTP_V2_PRIORITY_UPDATE_SIZE;
+    value.len = h2c->state.length - NGX_HTTP_V2_PRIORITY_UPDATE_SIZE;
+
+    pos += h2c->state.length;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 PRIORITY_UPDATE frame sid:%ui \"%V\"",
+                   sid, &value);
+
+    if (sid == 0) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent PRIORITY_UPDATE frame "
+                      "with incorrect prioritized stream");
+
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR);
+    }
+
+    urgency = NGX_HTTP_DEFAULT_URGENCY;
+    incremental = 0;
+
+    if (sid % 2 == 0
+        || ngx_http_parse_priority(&value, &urgency, &incremental)
+           != NGX_OK)
+    {
+        return ngx_http_v2_state_complete(h2c, pos, end);
+    }
+
+    node = ngx_http_v2_get_node_by_id(h2c, sid, 0);
+
+    if (node == NULL || node->stream == NULL) {
+
+        if (sid <= h2c->last_sid) {
+            /* closed stream */
+            return ngx_http_v2_state_complete(h2c, pos, end);
+        }
+
+        /* idle stream, the signal is kept until the request arrives */
+
+        if (node == NULL) {
+            node = ngx_http_v2_get_node_by_id(h2c, sid, 1);
+
+            if (node == NULL) {
+                return ngx_http_v2_connection_error(h2c,
+                                                    NGX_HTTP_V2_INTERNAL_ERROR);
+            }
+        }
+
+        if (node->parent == NULL) {
+            h2c->closed_nodes++;
+
+            node->weight = NGX_HTTP_V2_DEFAULT_WEIGHT;
+            ngx_http_v2_set_dependency(h2c, node, 0, 0);
+
+        } else {
+            ngx_queue_remove(&node->reuse);
+        }
+
+        ngx_queue_insert_tail(&h2c->closed, &node->reuse);
+    }
+
+    node->urgency = urgency;
+    node->incremental = incremental;
+    node->priority_update = 1;
+
+    if (node->stream && node->stream->queued == 0) {
+        node->stream->level = ngx_http_v2_node_level(node);
+    }
+
+    return ngx_http_v2_state_complete(h2c, pos, end);
+}
+
+
 static u_char *
 ngx_http_v2_state_complete(ngx_http_v2_connection_t *h2c, u_char *pos,
     u_char *end)
@@ -2719,7 +2886,7 @@ ngx_http_v2_send_settings(ngx_http_v2_connection_t *h2c)
         return NGX_ERROR;
     }
 
-    len = NGX_HTTP_V2_SETTINGS_PARAM_SIZE * 3;
+    len = NGX_HTTP_V2_SETTINGS_PARAM_SIZE * 4;
 
     buf = ngx_create_temp_buf(h2c->pool, NGX_HTTP_V2_FRAME_HEADER_SIZE + len);
     if (buf == NULL) {
@@ -2764,6 +2931,10 @@ ngx_http_v2_send_settings(ngx_http_v2_connection_t *h2c)
     buf->last = ngx_http_v2_write_uint32(buf->last,
                                          NGX_HTTP_V2_MAX_FRAME_SIZE);
 
+    buf->last = ngx_http_v2_write_uint16(buf->last,
+                                         NGX_HTTP_V2_NO_RFC7540_PRIORITIES);
+    buf->last = ngx_http_v2_write_uint32(buf->last, 1);
+
     ngx_http_v2_queue_blocked_frame(h2c, frame);
 
     return NGX_OK;
@@ -3142,6 +3313,7 @@ ngx_http_v2_get_node_by_id(ngx_http_v2_connection_t *h2c, ngx_uint_t sid,
     }
 
     node->id = sid;
+    node->urgency = NGX_HTTP_DEFAULT_URGENCY;
 
     ngx_queue_init(&node->children);
 
@@ -3618,6 +3790,9 @@ ngx_http_v2_construct_request_line(ngx_http_request_t *r)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http2 request line: \"%V\"", &r->request_line);
 
+    ngx_sdt_probe3(http__request__line, r, r->request_line.data,
+                   r->request_line.len);
+
     return NGX_OK;
 }
 
@@ -3789,6 +3964,50 @@ ngx_http_v2_construct_host_header(ngx_http_request_t *r)
 }
 
 
+static void
+ngx_http_v2_set_priority(ngx_http_request_t *r)
+{
+    ngx_uint_t             urgency, incremental;
+    ngx_table_elt_t       *h;
+    ngx_http_v2_node_t    *node;
+    ngx_http_v2_stream_t  *stream;
+
+    stream = r->stream;
+    node = stream->node;
+
+    /* PRIORITY_UPDATE received before the request takes precedence */
+
+    if (r->headers_in.priority == NULL || node->priority_update) {
+        stream->level = ngx_http_v2_node_level(node);
+        return;
+    }
+
+    urgency = NGX_HTTP_DEFAULT_URGENCY;
+    incremental = 0;
+
+    for (h = r->headers_in.priority; h; h = h->next) {
+        if (ngx_http_parse_priority(&h->value, &urgency, &incremental)
+            != NGX_OK)
+        {
+            ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                          "client sent invalid \"Priority\" header");
+
+            urgency = NGX_HTTP_DEFAULT_URGENCY;
+            incremental = 0;
+            break;
+        }
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http2 priority u:%ui i:%ui", urgency, incremental);
+
+    node->urgency = urgency;
+    node->incremental = incremental;
+
+    stream->level = ngx_http_v2_node_level(node);
+}
+
+
 static void
 ngx_http_v2_run_request(ngx_http_request_t *r)
 {
@@ -3892,6 +4111,8 @@ ngx_http_v2_run_request(ngx_http_request_t *r)
         goto failed;
     }
 
+    ngx_http_v2_set_priority(r);
+
     h2c = r->stream->connection;
 
     h2c->payload_bytes += r->request_length;
@@ -4788,6 +5009,8 @@ ngx_http_v2_finalize_connection(ngx_http_v2_connection_t *h2c,
 
     h2c->last_out = NULL;
 
+    ngx_http_v2_index_output_queue(h2c);
+
     h2scf = ngx_http_get_module_srv_conf(h2c->http_connection->conf_ctx,
                                          ngx_http_v2_module);
 
@@ -5021,6 +5244,8 @@ ngx_http_v2_pool_cleanup(void *data)
 {
     ngx_http_v2_connection_t  *h2c = data;
 
+    ngx_http_v2_cleanup_table(h2c);
+
     if (h2c->state.pool) {
         ngx_destroy_pool(h2c->state.pool);
     }
@@ -37,6 +37,7 @@
 #define NGX_HTTP_V2_GOAWAY_FRAME         0x7
 #define NGX_HTTP_V2_WINDOW_UPDATE_FRAME  0x8
 #define NGX_HTTP_V2_CONTINUATION_FRAME   0x9
+#define NGX_HTTP_V2_PRIORITY_UPDATE_FRAME  0x10
 
 /* frame flags */
 #define NGX_HTTP_V2_NO_FLAG              0x00
@@ -51,6 +52,16 @@
 
 #define NGX_HTTP_V2_DEFAULT_WEIGHT       16
 
+/*
+ * output queue levels: 0 is for control and blocked frames,
+ * then two levels (non-incremental and incremental) per urgency
+ */
+#define NGX_HTTP_V2_LEVELS               (2 * (NGX_HTTP_MAX_URGENCY + 1) + 1)
+
+#define NGX_HTTP_V2_TABLE_SIZE           4096
+#define NGX_HTTP_V2_MAX_TABLE_SIZE       65536
+#define NGX_HTTP_V2_TABLE_HISTORY        32
+
 
 typedef struct ngx_http_v2_connection_s   ngx_http_v2_connection_t;
 typedef struct ngx_http_v2_node_s         ngx_http_v2_node_t;
@@ -67,6 +78,7 @@ typedef struct {
     ngx_uint_t                       concurrent_streams;
     size_t                           preread_size;
     ngx_uint_t                       streams_index_mask;
+    size_t                           encoder_table_size;
 } ngx_http_v2_srv_conf_t;
 
 
@@ -121,6 +133,22 @@ typedef struct {
 } ngx_http_v2_hpack_t;
 
 
+typedef struct {
+    ngx_http_v2_header_t           **entries;
+
+    ngx_uint_t                       added;
+    ngx_uint_t                       deleted;
+    ngx_uint_t                       allocated;
+
+    size_t                           size;
+    size_t                           free;
+    size_t                           limit;
+
+    uint32_t                         history[NGX_HTTP_V2_TABLE_HISTORY];
+    ngx_uint_t                       nhistory;
+} ngx_http_v2_encoder_table_t;
+
+
 struct ngx_http_v2_connection_s {
     ngx_connection_t                *connection;
     ngx_http_connection_t           *http_connection;
@@ -146,6 +174,7 @@ struct ngx_http_v2_connection_s {
     ngx_http_v2_state_t              state;
 
     ngx_http_v2_hpack_t              hpack;
+    ngx_http_v2_encoder_table_t      encoder;
 
     ngx_pool_t                      *pool;
 
@@ -155,6 +184,7 @@ struct ngx_http_v2_connection_s {
     ngx_http_v2_node_t             **streams_index;
 
     ngx_http_v2_out_frame_t         *last_out;
+    ngx_http_v2_out_frame_t        **out_levels[NGX_HTTP_V2_LEVELS];
 
     ngx_queue_t                      dependencies;
     ngx_queue_t                      closed;
@@ -182,6 +212,10 @@ struct ngx_http_v2_node_s {
     ngx_uint_t                       weight;
     double                           rel_weight;
     ngx_http_v2_stream_t            *stream;
+
+    unsigned                         urgency:3;
+    unsigned                         incremental:1;
+    unsigned                         priority_update:1;
 };
 
 
@@ -191,6 +225,7 @@ struct ngx_http_v2_stream_s {
     ngx_http_v2_node_t              *node;
 
     ngx_uint_t                       queued;
+    ngx_uint_t                       level;
 
     /*
      * A change to SETTINGS_INITIAL_WINDOW_SIZE could cause the
@@ -240,47 +275,57 @@ struct ngx_http_v2_out_frame_s {
 };
 
 
+#define ngx_http_v2_node_level(node)                                          \
+    (1 + 2 * (node)->urgency + (node)->incremental)
+
+
+/*
+ * h2c->last_out is kept in reverse order of sending and is sorted
+ * by level, with the highest levels at the head; out_levels[n] points
+ * to the link before the first frame with level not greater than n,
+ * so that queueing a frame is O(1)
+ */
+
 static ngx_inline void
-ngx_http_v2_queue_frame(ngx_http_v2_connection_t *h2c,
-    ngx_http_v2_out_frame_t *frame)
+ngx_http_v2_queue_level_frame(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_out_frame_t *frame, ngx_uint_t level)
 {
     ngx_http_v2_out_frame_t  **out;
 
-    for (out = &h2c->last_out; *out; out = &(*out)->next) {
-
-        if ((*out)->blocked || (*out)->stream == NULL) {
-            break;
-        }
-
-        if ((*out)->stream->node->rank < frame->stream->node->rank
-            || ((*out)->stream->node->rank == frame->stream->node->rank
-                && (*out)->stream->node->rel_weight
-                   >= frame->stream->node->rel_weight))
-        {
-            break;
-        }
-    }
+    out = h2c->out_levels[level];
 
     frame->next = *out;
     *out = frame;
+
+    while (level-- && h2c->out_levels[level] == out) {
+        h2c->out_levels[level] = &frame->next;
+    }
 }
 
 
 static ngx_inline void
-ngx_http_v2_queue_blocked_frame(ngx_http_v2_connection_t *h2c,
+ngx_http_v2_queue_frame(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_out_frame_t *frame)
 {
-    ngx_http_v2_out_frame_t  **out;
+    ngx_http_v2_stream_t  *stream;
 
-    for (out = &h2c->last_out; *out; out = &(*out)->next) {
+    stream = frame->stream;
 
-        if ((*out)->blocked || (*out)->stream == NULL) {
-            break;
-        }
+    /* a new priority is applied only when the stream has nothing queued */
+
+    if (stream->queued == 0) {
+        stream->level = ngx_http_v2_node_level(stream->node);
     }
 
-    frame->next = *out;
-    *out = frame;
+    ngx_http_v2_queue_level_frame(h2c, frame, stream->level);
+}
+
+
+static ngx_inline void
+ngx_http_v2_queue_blocked_frame(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_out_frame_t *frame)
+{
+    ngx_http_v2_queue_level_frame(h2c, frame, 0);
 }
 
 
@@ -288,8 +333,14 @@ static ngx_inline void
 ngx_http_v2_queue_ordered_frame(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_out_frame_t *frame)
 {
+    ngx_uint_t  n;
+
     frame->next = h2c->last_out;
     h2c->last_out = frame;
+
+    for (n = 0; n < NGX_HTTP_V2_LEVELS; n++) {
+        h2c->out_levels[n] = &h2c->last_out;
+    }
 }
 
 
@@ -301,6 +352,7 @@ ngx_int_t ngx_http_v2_read_unbuffered_request_body(ngx_http_request_t *r);
 void ngx_http_v2_close_stream(ngx_http_v2_stream_t *stream, ngx_int_t rc);
 
 ngx_int_t ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c);
+void ngx_http_v2_index_output_queue(ngx_http_v2_connection_t *h2c);
 
 
 ngx_str_t *ngx_http_v2_get_static_name(ngx_uint_t index);
@@ -311,6 +363,10 @@ ngx_int_t ngx_http_v2_get_indexed_header(ngx_http_v2_connection_t *h2c,
 ngx_int_t ngx_http_v2_add_header(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_header_t *header);
 ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
+u_char *ngx_http_v2_table_update(ngx_http_v2_connection_t *h2c, u_char *pos);
+u_char *ngx_http_v2_encode_header(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, u_char *tmp);
+void ngx_http_v2_cleanup_table(ngx_http_v2_connection_t *h2c);
 
 
 #define ngx_http_v2_prefix(bits)  ((1 << (bits)) - 1)
@@ -415,6 +471,8 @@ ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
 
 u_char *ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len,
     u_char *tmp, ngx_uint_t lower);
+u_char *ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix,
+    ngx_uint_t value);
 
 
 extern ngx_module_t  ngx_http_v2_module;
@@ -108,7 +108,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 {
     u_char                     status, *pos, *start, *p, *tmp;
     size_t                     len, tmp_len;
-    ngx_str_t                  host, location;
+    ngx_str_t                  host, location, server, value;
     ngx_uint_t                 i, port, fin;
     ngx_list_part_t           *part;
     ngx_table_elt_t           *header;
@@ -120,20 +120,6 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     ngx_http_core_srv_conf_t  *cscf;
     u_char                     addr[NGX_SOCKADDR_STRLEN];
 
-    static const u_char nginx[5] = { 0x84, 0xaa, 0x63, 0x55, 0xe7 };
-#if (NGX_HTTP_GZIP)
-    static const u_char accept_encoding[12] = {
-        0x8b, 0x84, 0x84, 0x2d, 0x69, 0x5b, 0x05, 0x44, 0x3c, 0x86, 0xaa, 0x6f
-    };
-#endif
-
-    static size_t nginx_ver_len = ngx_http_v2_literal_size(NGINX_VER);
-    static u_char nginx_ver[ngx_http_v2_literal_size(NGINX_VER)];
-
-    static size_t nginx_ver_build_len =
-                                  ngx_http_v2_literal_size(NGINX_VER_BUILD);
-    static u_char nginx_ver_build[ngx_http_v2_literal_size(NGINX_VER_BUILD)];
-
     stream = r->stream;
 
     if (!stream) {
@@ -217,7 +203,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
     h2c = stream->connection;
 
-    len = h2c->table_update ? 1 : 0;
+    len = h2c->table_update ? 1 + NGX_HTTP_V2_INT_OCTETS : 0;
 
     len += status ? 1 : 1 + ngx_http_v2_literal_size("418");
 
@@ -226,22 +212,26 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     if (r->headers_out.server == NULL) {
 
         if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
-            len += 1 + nginx_ver_len;
+            ngx_str_set(&server, NGINX_VER);
 
         } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
-            len += 1 + nginx_ver_build_len;
+            ngx_str_set(&server, NGINX_VER_BUILD);
 
         } else {
-            len += 1 + sizeof(nginx);
+            ngx_str_set(&server, "nginx");
         }
+
+        /* a static name index takes up to 2 octets with a 4-bit prefix */
+
+        len += 2 + NGX_HTTP_V2_INT_OCTETS + server.len;
     }
 
     if (r->headers_out.date == NULL) {
-        len += 1 + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
+        len += 2 + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
     }
 
     if (r->headers_out.content_type.len) {
-        len += 1 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.content_type.len;
+        len += 2 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.content_type.len;
 
         if (r->headers_out.content_type_len == r->headers_out.content_type.len
             && r->headers_out.charset.len)
@@ -253,13 +243,13 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     if (r->headers_out.content_length == NULL
         && r->headers_out.content_length_n >= 0)
     {
-        len += 1 + ngx_http_v2_integer_octets(NGX_OFF_T_LEN) + NGX_OFF_T_LEN;
+        len += 2 + ngx_http_v2_integer_octets(NGX_OFF_T_LEN) + NGX_OFF_T_LEN;
     }
 
     if (r->headers_out.last_modified == NULL
         && r->headers_out.last_modified_time != -1)
     {
-        len += 1 + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
+        len += 2 + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
     }
 
     if (r->headers_out.location && r->headers_out.location->value.len) {
@@ -337,7 +327,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
         r->headers_out.location->hash = 0;
 
-        len += 1 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.location->value.len;
+        len += 2 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.location->value.len;
     }
 
     tmp_len = len;
@@ -345,7 +335,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 #if (NGX_HTTP_GZIP)
     if (r->gzip_vary) {
         if (clcf->gzip_vary) {
-            len += 1 + sizeof(accept_encoding);
+            len += 2 + ngx_http_v2_literal_size("Accept-Encoding");
 
         } else {
             r->gzip_vary = 0;
@@ -407,12 +397,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
     start = pos;
 
-    if (h2c->table_update) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 table size update: 0");
-        *pos++ = (1 << 5) | 0;
-        h2c->table_update = 0;
-    }
+    pos = ngx_http_v2_table_update(h2c, pos);
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                    "http2 output header: \":status: %03ui\"",
@@ -422,67 +407,38 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         *pos++ = status;
 
     } else {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_STATUS_INDEX);
-        *pos++ = NGX_HTTP_V2_ENCODE_RAW | 3;
-        pos = ngx_sprintf(pos, "%03ui", r->headers_out.status);
-    }
-
-    if (r->headers_out.server == NULL) {
-
-        if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: %s\"",
-                           NGINX_VER);
-
-        } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: %s\"",
-                           NGINX_VER_BUILD);
-
-        } else {
-            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: nginx\"");
+        value.len = 3;
+        value.data = ngx_pnalloc(r->pool, value.len);
+        if (value.data == NULL) {
+            return NGX_ERROR;
         }
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
-
-        if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
-            if (nginx_ver[0] == '\0') {
-                p = ngx_http_v2_write_value(nginx_ver, (u_char *) NGINX_VER,
-                                            sizeof(NGINX_VER) - 1, tmp);
-                nginx_ver_len = p - nginx_ver;
-            }
-
-            pos = ngx_cpymem(pos, nginx_ver, nginx_ver_len);
+        ngx_sprintf(value.data, "%03ui", r->headers_out.status);
 
-        } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
-            if (nginx_ver_build[0] == '\0') {
-                p = ngx_http_v2_write_value(nginx_ver_build,
-                                            (u_char *) NGINX_VER_BUILD,
-                                            sizeof(NGINX_VER_BUILD) - 1, tmp);
-                nginx_ver_build_len = p - nginx_ver_build;
-            }
+        pos = ngx_http_v2_encode_header(h2c, pos, NGX_HTTP_V2_STATUS_INDEX,
+                                        NULL, &value, tmp);
+    }
 
-            pos = ngx_cpymem(pos, nginx_ver_build, nginx_ver_build_len);
+    if (r->headers_out.server == NULL) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 output header: \"server: %V\"", &server);
 
-        } else {
-            pos = ngx_cpymem(pos, nginx, sizeof(nginx));
-        }
+        pos = ngx_http_v2_encode_header(h2c, pos, NGX_HTTP_V2_SERVER_INDEX,
+                                        NULL, &server, tmp);
     }
 
     if (r->headers_out.date == NULL) {
+        value.len = ngx_cached_http_time.len;
+        value.data = ngx_cached_http_time.data;
+
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 output header: \"date: %V\"",
-                       &ngx_cached_http_time);
+                       "http2 output header: \"date: %V\"", &value);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_DATE_INDEX);
-        pos = ngx_http_v2_write_value(pos, ngx_cached_http_time.data,
-                                      ngx_cached_http_time.len, tmp);
+        pos = ngx_http_v2_encode_header(h2c, pos, NGX_HTTP_V2_DATE_INDEX,
+                                        NULL, &value, tmp);
     }
 
     if (r->headers_out.content_type.len) {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_TYPE_INDEX);
-
         if (r->headers_out.content_type_len == r->headers_out.content_type.len
             && r->headers_out.charset.len)
         {
@@ -512,8 +468,9 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"content-type: %V\"",
                        &r->headers_out.content_type);
 
-        pos = ngx_http_v2_write_value(pos, r->headers_out.content_type.data,
-                                      r->headers_out.content_type.len, tmp);
+        pos = ngx_http_v2_encode_header(h2c, pos,
+                                        NGX_HTTP_V2_CONTENT_TYPE_INDEX, NULL,
+                                        &r->headers_out.content_type, tmp);
     }
 
     if (r->headers_out.content_length == NULL
@@ -523,30 +480,37 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"content-length: %O\"",
                        r->headers_out.content_length_n);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_LENGTH_INDEX);
+        value.data = ngx_pnalloc(r->pool, NGX_OFF_T_LEN);
+        if (value.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        value.len = ngx_sprintf(value.data, "%O",
+                                r->headers_out.content_length_n)
+                    - value.data;
 
-        p = pos;
-        pos = ngx_sprintf(pos + 1, "%O", r->headers_out.content_length_n);
-        *p = NGX_HTTP_V2_ENCODE_RAW | (u_char) (pos - p - 1);
+        pos = ngx_http_v2_encode_header(h2c, pos,
+                                        NGX_HTTP_V2_CONTENT_LENGTH_INDEX,
+                                        NULL, &value, tmp);
     }
 
     if (r->headers_out.last_modified == NULL
         && r->headers_out.last_modified_time != -1)
     {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LAST_MODIFIED_INDEX);
+        value.len = sizeof("Wed, 31 Dec 1986 18:00:00 GMT") - 1;
+        value.data = ngx_pnalloc(r->pool, value.len);
+        if (value.data == NULL) {
+            return NGX_ERROR;
+        }
 
-        ngx_http_time(pos, r->headers_out.last_modified_time);
-        len = sizeof("Wed, 31 Dec 1986 18:00:00 GMT") - 1;
+        ngx_http_time(value.data, r->headers_out.last_modified_time);
 
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 output header: \"last-modified: %*s\"",
-                       len, pos);
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 output header: \"last-modified: %V\"", &value);
 
-        /*
-         * Date will always be encoded using huffman in the temporary buffer,
-         * so it's safe here to use src and dst pointing to the same address.
-         */
-        pos = ngx_http_v2_write_value(pos, pos, len, tmp);
+        pos = ngx_http_v2_encode_header(h2c, pos,
+                                        NGX_HTTP_V2_LAST_MODIFIED_INDEX,
+                                        NULL, &value, tmp);
     }
 
     if (r->headers_out.location && r->headers_out.location->value.len) {
@@ -554,9 +518,9 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"location: %V\"",
                        &r->headers_out.location->value);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LOCATION_INDEX);
-        pos = ngx_http_v2_write_value(pos, r->headers_out.location->value.data,
-                                      r->headers_out.location->value.len, tmp);
+        pos = ngx_http_v2_encode_header(h2c, pos, NGX_HTTP_V2_LOCATION_INDEX,
+                                        NULL, &r->headers_out.location->value,
+                                        tmp);
     }
 
 #if (NGX_HTTP_GZIP)
@@ -564,8 +528,10 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                        "http2 output header: \"vary: Accept-Encoding\"");
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_VARY_INDEX);
-        pos = ngx_cpymem(pos, accept_encoding, sizeof(accept_encoding));
+        ngx_str_set(&value, "Accept-Encoding");
+
+        pos = ngx_http_v2_encode_header(h2c, pos, NGX_HTTP_V2_VARY_INDEX,
+                                        NULL, &value, tmp);
     }
 #endif
 
@@ -598,13 +564,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
 #endif
 
-        *pos++ = 0;
-
-        pos = ngx_http_v2_write_name(pos, header[i].key.data,
-                                     header[i].key.len, tmp);
-
-        pos = ngx_http_v2_write_value(pos, header[i].value.data,
-                                      header[i].value.len, tmp);
+        pos = ngx_http_v2_encode_header(h2c, pos, 0, &header[i].key,
+                                        &header[i].value, tmp);
     }
 
     fin = r->header_only
@@ -632,6 +593,7 @@ ngx_http_v2_early_hints_filter(ngx_http_request_t *r)
 {
     u_char                    *pos, *start, *tmp;
     size_t                     len, tmp_len;
+    ngx_str_t                  status;
     ngx_uint_t                 i;
     ngx_list_part_t           *part;
     ngx_table_elt_t           *header;
@@ -657,7 +619,7 @@ ngx_http_v2_early_hints_filter(ngx_http_request_t *r)
     }
 
     len = 0;
-    tmp_len = 0;
+    tmp_len = sizeof("103") - 1;
 
     part = &r->headers_out.headers.part;
     header = part->elts;
@@ -710,7 +672,7 @@ ngx_http_v2_early_hints_filter(ngx_http_request_t *r)
 
     h2c = stream->connection;
 
-    len += h2c->table_update ? 1 : 0;
+    len += h2c->table_update ? 1 + NGX_HTTP_V2_INT_OCTETS : 0;
     len += 1 + ngx_http_v2_literal_size("418");
 
     tmp = ngx_palloc(r->pool, tmp_len);
@@ -722,20 +684,16 @@ ngx_http_v2_early_hints_filter(ngx_http_request_t *r)
 
     start = pos;
 
-    if (h2c->table_update) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 table size update: 0");
-        *pos++ = (1 << 5) | 0;
-        h2c->table_update = 0;
-    }
+    pos = ngx_http_v2_table_update(h2c, pos);
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                    "http2 output header: \":status: %03ui\"",
                    (ngx_uint_t) NGX_HTTP_EARLY_HINTS);
 
-    *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_STATUS_INDEX);
-    *pos++ = NGX_HTTP_V2_ENCODE_RAW | 3;
-    pos = ngx_sprintf(pos, "%03ui", (ngx_uint_t) NGX_HTTP_EARLY_HINTS);
+    ngx_str_set(&status, "103");
+
+    pos = ngx_http_v2_encode_header(h2c, pos, NGX_HTTP_V2_STATUS_INDEX, NULL,
+                                    &status, tmp);
 
     part = &r->headers_out.headers.part;
     header = part->elts;
@@ -766,13 +724,8 @@ ngx_http_v2_early_hints_filter(ngx_http_request_t *r)
         }
 #endif
 
-        *pos++ = 0;
-
-        pos = ngx_http_v2_write_name(pos, header[i].key.data,
-                                     header[i].key.len, tmp);
-
-        pos = ngx_http_v2_write_value(pos, header[i].value.data,
-                                      header[i].value.len, tmp);
+        pos = ngx_http_v2_encode_header(h2c, pos, 0, &header[i].key,
+                                        &header[i].value, tmp);
     }
 
     frame = ngx_http_v2_create_headers_frame(r, start, pos, 0, 1);
@@ -1431,9 +1384,8 @@ ngx_http_v2_waiting_queue(ngx_http_v2_connection_t *h2c,
     {
         s = ngx_queue_data(q, ngx_http_v2_stream_t, queue);
 
-        if (s->node->rank < stream->node->rank
-            || (s->node->rank == stream->node->rank
-                && s->node->rel_weight >= stream->node->rel_weight))
+        if (ngx_http_v2_node_level(s->node)
+            <= ngx_http_v2_node_level(stream->node))
         {
             break;
         }
@@ -1730,6 +1682,8 @@ ngx_http_v2_filter_cleanup(void *data)
         fn = &frame->next;
     }
 
+    ngx_http_v2_index_output_queue(h2c);
+
     if (h2c->send_window == 0 && window) {
 
         while (!ngx_queue_empty(&h2c->waiting)) {
@@ -34,6 +34,8 @@ static char *ngx_http_v2_preread_size(ngx_conf_t *cf, void *post, void *data);
 static char *ngx_http_v2_streams_index_mask(ngx_conf_t *cf, void *post,
     void *data);
 static char *ngx_http_v2_chunk_size(ngx_conf_t *cf, void *post, void *data);
+static char *ngx_http_v2_encoder_table_size(ngx_conf_t *cf, void *post,
+    void *data);
 static char *ngx_http_v2_obsolete(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 
@@ -69,6 +71,8 @@ static ngx_conf_post_t  ngx_http_v2_streams_index_mask_post =
     { ngx_http_v2_streams_index_mask };
 static ngx_conf_post_t  ngx_http_v2_chunk_size_post =
     { ngx_http_v2_chunk_size };
+static ngx_conf_post_t  ngx_http_v2_encoder_table_size_post =
+    { ngx_http_v2_encoder_table_size };
 
 
 static ngx_command_t  ngx_http_v2_commands[] = {
@@ -143,6 +147,13 @@ static ngx_command_t  ngx_http_v2_commands[] = {
       offsetof(ngx_http_v2_srv_conf_t, streams_index_mask),
       &ngx_http_v2_streams_index_mask_post },
 
+    { ngx_string("http2_encoder_table_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, encoder_table_size),
+      &ngx_http_v2_encoder_table_size_post },
+
     { ngx_string("http2_recv_timeout"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
       ngx_http_v2_obsolete,
@@ -329,6 +340,8 @@ ngx_http_v2_create_srv_conf(ngx_conf_t *cf)
 
     h2scf->streams_index_mask = NGX_CONF_UNSET_UINT;
 
+    h2scf->encoder_table_size = NGX_CONF_UNSET_SIZE;
+
     return h2scf;
 }
 
@@ -351,6 +364,10 @@ ngx_http_v2_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_uint_value(conf->streams_index_mask,
                               prev->streams_index_mask, 32 - 1);
 
+    ngx_conf_merge_size_value(conf->encoder_table_size,
+                              prev->encoder_table_size,
+                              NGX_HTTP_V2_TABLE_SIZE);
+
     return NGX_CONF_OK;
 }
 
@@ -477,6 +494,19 @@ ngx_http_v2_chunk_size(ngx_conf_t *cf, void *post, void *data)
 }
 
 
+static char *
+ngx_http_v2_encoder_table_size(ngx_conf_t *cf, void *post, void *data)
+{
+    size_t *sp = data;
+
+    if (*sp > NGX_HTTP_V2_MAX_TABLE_SIZE) {
+        *sp = NGX_HTTP_V2_MAX_TABLE_SIZE;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
 static char *
 ngx_http_v2_obsolete(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -10,12 +10,19 @@
 #include <ngx_http.h>
 
 
-#define NGX_HTTP_V2_TABLE_SIZE  4096
-
-
 static ngx_int_t ngx_http_v2_table_account(ngx_http_v2_connection_t *h2c,
     size_t size);
 
+static ngx_int_t ngx_http_v2_table_lookup(ngx_http_v2_encoder_table_t *et,
+    ngx_str_t *name, ngx_str_t *value, ngx_int_t *named);
+static ngx_int_t ngx_http_v2_table_insert(ngx_http_v2_connection_t *h2c,
+    ngx_str_t *name, ngx_str_t *value);
+static void ngx_http_v2_table_evict(ngx_http_v2_encoder_table_t *et,
+    size_t size);
+static ngx_uint_t ngx_http_v2_table_indexable(ngx_http_v2_encoder_table_t *et,
+    ngx_str_t *name, ngx_str_t *value);
+static ngx_uint_t ngx_http_v2_table_match(ngx_str_t *list, ngx_str_t *name);
+
 
 static ngx_http_v2_header_t  ngx_http_v2_static_table[] = {
     { ngx_string(":authority"), ngx_string("") },
@@ -86,6 +93,30 @@ static ngx_http_v2_header_t  ngx_http_v2_static_table[] = {
      / sizeof(ngx_http_v2_header_t))
 
 
+/* sent as never indexed literals, see RFC 7541, Section 7.1.3 */
+
+static ngx_str_t  ngx_http_v2_sensitive_headers[] = {
+    ngx_string("authorization"),
+    ngx_string("cookie"),
+    ngx_string("proxy-authorization"),
+    ngx_string("set-cookie"),
+    ngx_null_string
+};
+
+
+/* values rarely repeat, not worth a table entry */
+
+static ngx_str_t  ngx_http_v2_unindexed_headers[] = {
+    ngx_string("age"),
+    ngx_string("content-length"),
+    ngx_string("content-range"),
+    ngx_string("etag"),
+    ngx_string("last-modified"),
+    ngx_string("location"),
+    ngx_null_string
+};
+
+
 ngx_str_t *
 ngx_http_v2_get_static_name(ngx_uint_t index)
 {
@@ -361,3 +392,283 @@ ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size)
 
     return NGX_OK;
 }
+
+
+u_char *
+ngx_http_v2_table_update(ngx_http_v2_connection_t *h2c, u_char *pos)
+{
+    size_t                        size;
+    ngx_http_v2_srv_conf_t       *h2scf;
+    ngx_http_v2_encoder_table_t  *et;
+
+    if (!h2c->table_update) {
+        return pos;
+    }
+
+    h2c->table_update = 0;
+
+    et = &h2c->encoder;
+
+    h2scf = ngx_http_get_module_srv_conf(h2c->http_connection->conf_ctx,
+                                         ngx_http_v2_module);
+
+    size = ngx_min(h2scf->encoder_table_size, et->limit);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 table size update: %uz", size);
+
+    /*
+     * the table is emptied with a zero size update first, this also
+     * covers the peer lowering and raising its limit in between
+     */
+
+    ngx_http_v2_cleanup_table(h2c);
+
+    *pos++ = (1 << 5) | 0;
+
+    if (size) {
+        *pos = (1 << 5);
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5), size);
+    }
+
+    if (size / 32 > et->allocated && et->entries) {
+        (void) ngx_pfree(h2c->connection->pool, et->entries);
+        et->entries = NULL;
+    }
+
+    et->size = size;
+    et->free = size;
+
+    return pos;
+}
+
+
+u_char *
+ngx_http_v2_encode_header(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, u_char *tmp)
+{
+    ngx_int_t                     found, named;
+    ngx_http_v2_encoder_table_t  *et;
+
+    et = &h2c->encoder;
+
+    if (name == NULL) {
+        name = ngx_http_v2_get_static_name(index);
+    }
+
+    if (ngx_http_v2_table_match(ngx_http_v2_sensitive_headers, name)) {
+        *pos = 0x10;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4), index);
+        goto literal;
+    }
+
+    found = ngx_http_v2_table_lookup(et, name, value, &named);
+
+    if (found != NGX_DECLINED) {
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 table index: %i \"%V: %V\"",
+                       found, name, value);
+
+        *pos = ngx_http_v2_indexed(0);
+        return ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7),
+                                     NGX_HTTP_V2_STATIC_TABLE_ENTRIES + 1
+                                     + found);
+    }
+
+    if (index == 0 && named != NGX_DECLINED) {
+        index = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + 1 + named;
+    }
+
+    /*
+     * the name index is taken before the insertion, as the peer
+     * resolves it prior to adding the new entry
+     */
+
+    if (32 + name->len + value->len <= et->size / 2
+        && ngx_http_v2_table_indexable(et, name, value)
+        && ngx_http_v2_table_insert(h2c, name, value) == NGX_OK)
+    {
+        *pos = ngx_http_v2_inc_indexed(0);
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(6), index);
+
+    } else {
+        *pos = 0;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4), index);
+    }
+
+literal:
+
+    if (index == 0) {
+        pos = ngx_http_v2_write_name(pos, name->data, name->len, tmp);
+    }
+
+    return ngx_http_v2_write_value(pos, value->data, value->len, tmp);
+}
+
+
+void
+ngx_http_v2_cleanup_table(ngx_http_v2_connection_t *h2c)
+{
+    ngx_http_v2_encoder_table_t  *et;
+
+    et = &h2c->encoder;
+
+    while (et->deleted != et->added) {
+        ngx_free(et->entries[et->deleted++ % et->allocated]);
+    }
+
+    et->free = et->size;
+}
+
+
+static ngx_int_t
+ngx_http_v2_table_lookup(ngx_http_v2_encoder_table_t *et, ngx_str_t *name,
+    ngx_str_t *value, ngx_int_t *named)
+{
+    ngx_uint_t             i, n;
+    ngx_http_v2_header_t  *entry;
+
+    *named = NGX_DECLINED;
+
+    n = et->added - et->deleted;
+
+    for (i = 0; i < n; i++) {
+        entry = et->entries[(et->added - i - 1) % et->allocated];
+
+        if (entry->name.len != name->len
+            || ngx_strncasecmp(entry->name.data, name->data, name->len) != 0)
+        {
+            continue;
+        }
+
+        if (entry->value.len == value->len
+            && ngx_memcmp(entry->value.data, value->data, value->len) == 0)
+        {
+            return i;
+        }
+
+        if (*named == NGX_DECLINED) {
+            *named = i;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_http_v2_table_insert(ngx_http_v2_connection_t *h2c, ngx_str_t *name,
+    ngx_str_t *value)
+{
+    u_char                       *p;
+    size_t                        size;
+    ngx_http_v2_header_t         *entry;
+    ngx_http_v2_encoder_table_t  *et;
+
+    et = &h2c->encoder;
+
+    if (et->entries == NULL) {
+        et->allocated = et->size / 32;
+
+        et->entries = ngx_palloc(h2c->connection->pool,
+                                 sizeof(ngx_http_v2_header_t *)
+                                 * et->allocated);
+        if (et->entries == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    entry = ngx_alloc(sizeof(ngx_http_v2_header_t) + name->len + value->len,
+                      h2c->connection->log);
+    if (entry == NULL) {
+        return NGX_ERROR;
+    }
+
+    size = 32 + name->len + value->len;
+
+    ngx_http_v2_table_evict(et, size);
+
+    p = (u_char *) &entry[1];
+
+    entry->name.len = name->len;
+    entry->name.data = p;
+
+    ngx_strlow(p, name->data, name->len);
+    p += name->len;
+
+    entry->value.len = value->len;
+    entry->value.data = p;
+
+    ngx_memcpy(p, value->data, value->len);
+
+    et->entries[et->added++ % et->allocated] = entry;
+    et->free -= size;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 table insert: \"%V: %V\" size:%uz free:%uz",
+                   name, value, size, et->free);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_v2_table_evict(ngx_http_v2_encoder_table_t *et, size_t size)
+{
+    ngx_http_v2_header_t  *entry;
+
+    while (size > et->free) {
+        entry = et->entries[et->deleted++ % et->allocated];
+        et->free += 32 + entry->name.len + entry->value.len;
+        ngx_free(entry);
+    }
+}
+
+
+static ngx_uint_t
+ngx_http_v2_table_indexable(ngx_http_v2_encoder_table_t *et, ngx_str_t *name,
+    ngx_str_t *value)
+{
+    uint32_t    hash;
+    ngx_uint_t  i;
+
+    if (ngx_http_v2_table_match(ngx_http_v2_unindexed_headers, name)) {
+        return 0;
+    }
+
+    /*
+     * a header is only indexed once it was seen before on the connection,
+     * unique values such as request ids never enter the table
+     */
+
+    ngx_crc32_init(hash);
+    ngx_crc32_update(&hash, name->data, name->len);
+    ngx_crc32_update(&hash, value->data, value->len);
+    ngx_crc32_final(hash);
+
+    for (i = 0; i < NGX_HTTP_V2_TABLE_HISTORY; i++) {
+        if (et->history[i] == hash) {
+            et->history[i] = 0;
+            return 1;
+        }
+    }
+
+    et->history[et->nhistory++ % NGX_HTTP_V2_TABLE_HISTORY] = hash;
+
+    return 0;
+}
+
+
+static ngx_uint_t
+ngx_http_v2_table_match(ngx_str_t *list, ngx_str_t *name)
+{
+    for ( /* void */ ; list->len; list++) {
+        if (list->len == name->len
+            && ngx_strncasecmp(list->data, name->data, name->len) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -33,6 +33,8 @@ ngx_http_v3_init_session(ngx_connection_t *c)
     h3c->http_connection = hc;
 
     ngx_queue_init(&h3c->blocked);
+    ngx_queue_init(&h3c->encoder.sections);
+    ngx_queue_init(&h3c->encoder.free_sections);
 
     h3c->keepalive.log = c->log;
     h3c->keepalive.data = c;
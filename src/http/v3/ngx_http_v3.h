@@ -108,6 +108,8 @@ typedef struct {
     size_t                        max_table_capacity;
     ngx_uint_t                    max_blocked_streams;
     ngx_uint_t                    max_concurrent_streams;
+    size_t                        encoder_table_capacity;
+    ngx_uint_t                    encoder_blocked_streams;
     ngx_quic_conf_t               quic;
 } ngx_http_v3_srv_conf_t;
 
@@ -124,6 +126,7 @@ struct ngx_http_v3_session_s {
     ngx_http_connection_t        *http_connection;
 
     ngx_http_v3_dynamic_table_t   table;
+    ngx_http_v3_encoder_table_t   encoder;
 
     ngx_event_t                   keepalive;
     ngx_uint_t                    nrequests;
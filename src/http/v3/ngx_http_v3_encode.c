@@ -302,3 +302,141 @@ ngx_http_v3_encode_field_lpbi(u_char *p, ngx_uint_t index, u_char *data,
 
     return (uintptr_t) p;
 }
+
+
+uintptr_t
+ngx_http_v3_encode_set_capacity(u_char *p, ngx_uint_t capacity)
+{
+    /* Set Dynamic Table Capacity */
+
+    if (p == NULL) {
+        return ngx_http_v3_encode_prefix_int(NULL, capacity, 5);
+    }
+
+    *p = 0x20;
+
+    return ngx_http_v3_encode_prefix_int(p, capacity, 5);
+}
+
+
+uintptr_t
+ngx_http_v3_encode_ref_insert(u_char *p, ngx_uint_t dynamic, ngx_uint_t index,
+    u_char *data, size_t len)
+{
+    size_t   hlen;
+    u_char  *p1, *p2;
+
+    /* Insert With Name Reference */
+
+    if (p == NULL) {
+        return ngx_http_v3_encode_prefix_int(NULL, index, 6)
+               + ngx_http_v3_encode_prefix_int(NULL, len, 7)
+               + len;
+    }
+
+    *p = dynamic ? 0x80 : 0xc0;
+    p = (u_char *) ngx_http_v3_encode_prefix_int(p, index, 6);
+
+    p1 = p;
+    *p = 0;
+    p = (u_char *) ngx_http_v3_encode_prefix_int(p, len, 7);
+
+    p2 = p;
+    hlen = ngx_http_huff_encode(data, len, p, 0);
+
+    if (hlen) {
+        p = p1;
+        *p = 0x80;
+        p = (u_char *) ngx_http_v3_encode_prefix_int(p, hlen, 7);
+
+        if (p != p2) {
+            ngx_memmove(p, p2, hlen);
+        }
+
+        p += hlen;
+
+    } else {
+        p = ngx_cpymem(p, data, len);
+    }
+
+    return (uintptr_t) p;
+}
+
+
+uintptr_t
+ngx_http_v3_encode_insert(u_char *p, ngx_str_t *name, ngx_str_t *value)
+{
+    size_t   hlen;
+    u_char  *p1, *p2;
+
+    /* Insert With Literal Name */
+
+    if (p == NULL) {
+        return ngx_http_v3_encode_prefix_int(NULL, name->len, 5)
+               + name->len
+               + ngx_http_v3_encode_prefix_int(NULL, value->len, 7)
+               + value->len;
+    }
+
+    p1 = p;
+    *p = 0x40;
+    p = (u_char *) ngx_http_v3_encode_prefix_int(p, name->len, 5);
+
+    p2 = p;
+    hlen = ngx_http_huff_encode(name->data, name->len, p, 1);
+
+    if (hlen) {
+        p = p1;
+        *p = 0x60;
+        p = (u_char *) ngx_http_v3_encode_prefix_int(p, hlen, 5);
+
+        if (p != p2) {
+            ngx_memmove(p, p2, hlen);
+        }
+
+        p += hlen;
+
+    } else {
+        ngx_strlow(p, name->data, name->len);
+        p += name->len;
+    }
+
+    p1 = p;
+    *p = 0;
+    p = (u_char *) ngx_http_v3_encode_prefix_int(p, value->len, 7);
+
+    p2 = p;
+    hlen = ngx_http_huff_encode(value->data, value->len, p, 0);
+
+    if (hlen) {
+        p = p1;
+        *p = 0x80;
+        p = (u_char *) ngx_http_v3_encode_prefix_int(p, hlen, 7);
+
+        if (p != p2) {
+            ngx_memmove(p, p2, hlen);
+        }
+
+        p += hlen;
+
+    } else {
+        p = ngx_cpymem(p, value->data, value->len);
+    }
+
+    return (uintptr_t) p;
+}
+
+
+uintptr_t
+ngx_http_v3_encode_duplicate(u_char *p, ngx_uint_t index)
+{
+    /* Duplicate */
+
+    if (p == NULL) {
+        return ngx_http_v3_encode_prefix_int(NULL, index, 5);
+    }
+
+    *p = 0;
+
+    return ngx_http_v3_encode_prefix_int(p, index, 5);
+}
@@ -84,20 +84,21 @@ static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
 static ngx_int_t
 ngx_http_v3_header_filter(ngx_http_request_t *r)
 {
-    u_char                    *p;
-    size_t                     len, n;
-    ngx_buf_t                 *b;
-    ngx_str_t                  host, location;
-    ngx_uint_t                 i, port;
-    ngx_chain_t               *out, *hl, *cl, **ll;
-    ngx_list_part_t           *part;
-    ngx_table_elt_t           *header;
-    ngx_connection_t          *c;
-    ngx_http_v3_session_t     *h3c;
-    ngx_http_v3_filter_ctx_t  *ctx;
-    ngx_http_core_loc_conf_t  *clcf;
-    ngx_http_core_srv_conf_t  *cscf;
-    u_char                     addr[NGX_SOCKADDR_STRLEN];
+    u_char                       *p;
+    size_t                        len, n;
+    ngx_buf_t                    *b;
+    ngx_str_t                     host, location, name, value;
+    ngx_uint_t                    i, port;
+    ngx_chain_t                  *out, *hl, *cl, **ll;
+    ngx_list_part_t              *part;
+    ngx_table_elt_t              *header;
+    ngx_connection_t             *c;
+    ngx_http_v3_session_t        *h3c;
+    ngx_http_v3_filter_ctx_t     *ctx;
+    ngx_http_core_loc_conf_t     *clcf;
+    ngx_http_core_srv_conf_t     *cscf;
+    ngx_http_v3_field_section_t   fs;
+    u_char                        addr[NGX_SOCKADDR_STRLEN];
 
     if (r->http_version != NGX_HTTP_VERSION_30) {
         return ngx_http_next_header_filter(r);
@@ -147,7 +148,9 @@ ngx_http_v3_header_filter(ngx_http_request_t *r)
     out = NULL;
     ll = &out;
 
-    len = ngx_http_v3_encode_field_section_prefix(NULL, 0, 0, 0);
+    /* field section prefix, reserved until all references are known */
+
+    len = 2 * NGX_HTTP_V3_PREFIX_INT_LEN;
 
     if (r->headers_out.status == NGX_HTTP_OK) {
         len += ngx_http_v3_encode_field_ri(NULL, 0,
@@ -324,8 +327,12 @@ ngx_http_v3_header_filter(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
-    b->last = (u_char *) ngx_http_v3_encode_field_section_prefix(b->last,
-                                                                 0, 0, 0);
+    b->pos += 2 * NGX_HTTP_V3_PREFIX_INT_LEN;
+    b->last = b->pos;
+
+    if (ngx_http_v3_init_section(c, &fs) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "http3 output header: \":status: %03ui\"",
@@ -359,9 +366,13 @@ ngx_http_v3_header_filter(ngx_http_request_t *r)
         ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
                        "http3 output header: \"server: %*s\"", n, p);
 
-        b->last = (u_char *) ngx_http_v3_encode_field_lri(b->last, 0,
+        ngx_str_set(&name, "server");
+        value.len = n;
+        value.data = p;
+
+        b->last = (u_char *) ngx_http_v3_encode_field(c, &fs, b->last,
                                                      NGX_HTTP_V3_HEADER_SERVER,
-                                                     p, n);
+                                                     &name, &value);
     }
 
     if (r->headers_out.date == NULL) {
@@ -369,10 +380,12 @@ ngx_http_v3_header_filter(ngx_http_request_t *r)
                        "http3 output header: \"date: %V\"",
                        &ngx_cached_http_time);
 
-        b->last = (u_char *) ngx_http_v3_encode_field_lri(b->last, 0,
+        ngx_str_set(&name, "date");
+        value = ngx_cached_http_time;
+
+        b->last = (u_char *) ngx_http_v3_encode_field(c, &fs, b->last,
                                                      NGX_HTTP_V3_HEADER_DATE,
-                                                     ngx_cached_http_time.data,
-                                                     ngx_cached_http_time.len);
+                                                     &name, &value);
     }
 
     if (r->headers_out.content_type.len) {
@@ -405,10 +418,11 @@ ngx_http_v3_header_filter(ngx_http_request_t *r)
                        "http3 output header: \"content-type: %V\"",
                        &r->headers_out.content_type);
 
-        b->last = (u_char *) ngx_http_v3_encode_field_lri(b->last, 0,
+        ngx_str_set(&name, "content-type");
+
+        b->last = (u_char *) ngx_http_v3_encode_field(c, &fs, b->last,
                                     NGX_HTTP_V3_HEADER_CONTENT_TYPE_TEXT_PLAIN,
-                                    r->headers_out.content_type.data,
-                                    r->headers_out.content_type.len);
+                                    &name, &r->headers_out.content_type);
     }
 
     if (r->headers_out.content_length == NULL
@@ -499,11 +513,23 @@ ngx_http_v3_header_filter(ngx_http_request_t *r)
                        "http3 output header: \"%V: %V\"",
                        &header[i].key, &header[i].value);
 
-        b->last = (u_char *) ngx_http_v3_encode_field_l(b->last,
-                                                        &header[i].key,
-                                                        &header[i].value);
+        b->last = (u_char *) ngx_http_v3_encode_field(c, &fs, b->last, -1,
+                                                      &header[i].key,
+                                                      &header[i].value);
     }
 
+    if (ngx_http_v3_finish_section(c, &fs) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    n = ngx_http_v3_encode_field_section_prefix(NULL, fs.encoded_insert_count,
+                                                fs.sign, fs.delta_base);
+    b->pos -= n;
+
+    (void) ngx_http_v3_encode_field_section_prefix(b->pos,
+                                                   fs.encoded_insert_count,
+                                                   fs.sign, fs.delta_base);
+
     if (r->header_only) {
         b->last_buf = 1;
     }
@@ -20,6 +20,13 @@ static char *ngx_http_quic_host_key(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 
 
+static ngx_conf_enum_t  ngx_http_quic_congestion_control[] = {
+    { ngx_string("cubic"), NGX_QUIC_CC_CUBIC },
+    { ngx_string("bbr"), NGX_QUIC_CC_BBR },
+    { ngx_null_string, 0 }
+};
+
+
 static ngx_command_t  ngx_http_v3_commands[] = {
 
     { ngx_string("http3"),
@@ -43,6 +50,20 @@ static ngx_command_t  ngx_http_v3_commands[] = {
       offsetof(ngx_http_v3_srv_conf_t, max_concurrent_streams),
       NULL },
 
+    { ngx_string("http3_encoder_table_capacity"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v3_srv_conf_t, encoder_table_capacity),
+      NULL },
+
+    { ngx_string("http3_encoder_blocked_streams"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v3_srv_conf_t, encoder_blocked_streams),
+      NULL },
+
     { ngx_string("http3_stream_buffer_size"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_size_slot,
@@ -64,6 +85,27 @@ static ngx_command_t  ngx_http_v3_commands[] = {
       offsetof(ngx_http_v3_srv_conf_t, quic.gso_enabled),
       NULL },
 
+    { ngx_string("quic_congestion_control"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v3_srv_conf_t, quic.congestion_control),
+      &ngx_http_quic_congestion_control },
+
+    { ngx_string("quic_pacing"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v3_srv_conf_t, quic.pacing),
+      NULL },
+
+    { ngx_string("quic_idle_compact"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v3_srv_conf_t, quic.idle_compact),
+      NULL },
+
     { ngx_string("quic_host_key"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
       ngx_http_quic_host_key,
@@ -200,12 +242,17 @@ ngx_http_v3_create_srv_conf(ngx_conf_t *cf)
     h3scf->enable_hq = NGX_CONF_UNSET;
     h3scf->max_table_capacity = NGX_HTTP_V3_MAX_TABLE_CAPACITY;
     h3scf->max_concurrent_streams = NGX_CONF_UNSET_UINT;
+    h3scf->encoder_table_capacity = NGX_CONF_UNSET_SIZE;
+    h3scf->encoder_blocked_streams = NGX_CONF_UNSET_UINT;
 
     h3scf->quic.stream_buffer_size = NGX_CONF_UNSET_SIZE;
     h3scf->quic.max_concurrent_streams_bidi = NGX_CONF_UNSET_UINT;
     h3scf->quic.max_concurrent_streams_uni = NGX_HTTP_V3_MAX_UNI_STREAMS;
     h3scf->quic.retry = NGX_CONF_UNSET;
     h3scf->quic.gso_enabled = NGX_CONF_UNSET;
+    h3scf->quic.congestion_control = NGX_CONF_UNSET_UINT;
+    h3scf->quic.pacing = NGX_CONF_UNSET;
+    h3scf->quic.idle_compact = NGX_CONF_UNSET;
     h3scf->quic.stream_close_code = NGX_HTTP_V3_ERR_NO_ERROR;
     h3scf->quic.stream_reject_code_bidi = NGX_HTTP_V3_ERR_REQUEST_REJECTED;
     h3scf->quic.active_connection_id_limit = NGX_CONF_UNSET_UINT;
@@ -235,6 +282,13 @@ ngx_http_v3_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
 
     conf->max_blocked_streams = conf->max_concurrent_streams;
 
+    ngx_conf_merge_size_value(conf->encoder_table_capacity,
+                              prev->encoder_table_capacity,
+                              NGX_HTTP_V3_MAX_TABLE_CAPACITY);
+
+    ngx_conf_merge_uint_value(conf->encoder_blocked_streams,
+                              prev->encoder_blocked_streams, 16);
+
     ngx_conf_merge_size_value(conf->quic.stream_buffer_size,
                               prev->quic.stream_buffer_size,
                               65536);
@@ -244,6 +298,14 @@ ngx_http_v3_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->quic.retry, prev->quic.retry, 0);
     ngx_conf_merge_value(conf->quic.gso_enabled, prev->quic.gso_enabled, 0);
 
+    ngx_conf_merge_uint_value(conf->quic.congestion_control,
+                              prev->quic.congestion_control,
+                              NGX_QUIC_CC_CUBIC);
+
+    ngx_conf_merge_value(conf->quic.pacing, prev->quic.pacing, 1);
+
+    ngx_conf_merge_value(conf->quic.idle_compact, prev->quic.idle_compact, 0);
+
     ngx_conf_merge_str_value(conf->quic.host_key, prev->quic.host_key, "");
 
     ngx_conf_merge_uint_value(conf->quic.active_connection_id_limit,
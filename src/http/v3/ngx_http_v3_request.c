@@ -950,6 +950,9 @@ ngx_http_v3_init_pseudo_headers(ngx_http_request_t *r)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http3 request line: \"%V\"", &r->request_line);
 
+    ngx_sdt_probe3(http__request__line, r, r->request_line.data,
+                   r->request_line.len);
+
     ngx_str_set(&r->http_protocol, "HTTP/3.0");
 
     if (ngx_http_process_request_uri(r) != NGX_OK) {
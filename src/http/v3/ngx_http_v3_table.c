@@ -16,6 +16,19 @@
 static ngx_int_t ngx_http_v3_evict(ngx_connection_t *c, size_t target);
 static void ngx_http_v3_unblock(void *data);
 static ngx_int_t ngx_http_v3_new_entry(ngx_connection_t *c);
+static ngx_int_t ngx_http_v3_encoder_lookup(ngx_http_v3_encoder_table_t *et,
+    ngx_uint_t limit, ngx_str_t *name, ngx_str_t *value, ngx_int_t *named);
+static ngx_int_t ngx_http_v3_encoder_insert(ngx_connection_t *c,
+    ngx_int_t index, ngx_int_t dup, ngx_str_t *name, ngx_str_t *value);
+static ngx_int_t ngx_http_v3_encoder_evict(ngx_connection_t *c,
+    ngx_http_v3_field_section_t *fs, size_t target);
+static ngx_uint_t ngx_http_v3_encoder_draining(
+    ngx_http_v3_encoder_table_t *et);
+static ngx_uint_t ngx_http_v3_indexable(ngx_http_v3_encoder_table_t *et,
+    ngx_str_t *name, ngx_str_t *value);
+static ngx_uint_t ngx_http_v3_field_match(ngx_str_t *names, ngx_str_t *name);
+static uintptr_t ngx_http_v3_encode_dynamic(u_char *p,
+    ngx_http_v3_field_section_t *fs, ngx_uint_t index, ngx_str_t *value);
 
 
 typedef struct {
@@ -25,6 +38,38 @@ typedef struct {
 } ngx_http_v3_block_t;
 
 
+typedef struct {
+    ngx_queue_t        queue;
+    uint64_t           stream_id;
+    uint64_t           insert_count;
+    uint64_t           min_index;
+} ngx_http_v3_section_t;
+
+
+/* sent as never indexed literals, see RFC 9204, Section 7.1.3 */
+
+static ngx_str_t  ngx_http_v3_sensitive_fields[] = {
+    ngx_string("authorization"),
+    ngx_string("cookie"),
+    ngx_string("proxy-authorization"),
+    ngx_string("set-cookie"),
+    ngx_null_string
+};
+
+
+/* response fields whose values rarely repeat */
+
+static ngx_str_t  ngx_http_v3_never_index[] = {
+    ngx_string("age"),
+    ngx_string("content-length"),
+    ngx_string("content-range"),
+    ngx_string("etag"),
+    ngx_string("last-modified"),
+    ngx_string("location"),
+    ngx_null_string
+};
+
+
 static ngx_http_v3_field_t  ngx_http_v3_static_table[] = {
 
     { ngx_string(":authority"),            ngx_string("") },
@@ -331,8 +376,19 @@ void
 ngx_http_v3_cleanup_table(ngx_http_v3_session_t *h3c)
 {
     ngx_uint_t                    n;
+    ngx_http_v3_encoder_table_t  *et;
     ngx_http_v3_dynamic_table_t  *dt;
 
+    et = &h3c->encoder;
+
+    if (et->elts) {
+        for (n = 0; n < et->nelts; n++) {
+            ngx_free(et->elts[n]);
+        }
+
+        ngx_free(et->elts);
+    }
+
     dt = &h3c->table;
 
     if (dt->elts == NULL) {
@@ -411,10 +467,40 @@ ngx_http_v3_duplicate(ngx_connection_t *c, ngx_uint_t index)
 ngx_int_t
 ngx_http_v3_ack_section(ngx_connection_t *c, ngx_uint_t stream_id)
 {
+    ngx_queue_t                  *q;
+    ngx_http_v3_section_t        *section;
+    ngx_http_v3_session_t        *h3c;
+    ngx_http_v3_encoder_table_t  *et;
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "http3 ack section %ui", stream_id);
 
-    /* we do not use dynamic tables */
+    h3c = ngx_http_v3_get_session(c);
+    et = &h3c->encoder;
+
+    for (q = ngx_queue_head(&et->sections);
+         q != ngx_queue_sentinel(&et->sections);
+         q = ngx_queue_next(q))
+    {
+        section = ngx_queue_data(q, ngx_http_v3_section_t, queue);
+
+        if (section->stream_id != stream_id) {
+            continue;
+        }
+
+        if (et->known_received_count < section->insert_count) {
+            et->known_received_count = section->insert_count;
+        }
+
+        ngx_queue_remove(q);
+        ngx_queue_insert_tail(&et->free_sections, q);
+        et->nsections--;
+
+        return NGX_OK;
+    }
+
+    ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                  "client acknowledged unknown field section");
 
     return NGX_HTTP_V3_ERR_DECODER_STREAM_ERROR;
 }
@@ -423,12 +509,27 @@ ngx_http_v3_ack_section(ngx_connection_t *c, ngx_uint_t stream_id)
 ngx_int_t
 ngx_http_v3_inc_insert_count(ngx_connection_t *c, ngx_uint_t inc)
 {
+    ngx_http_v3_session_t        *h3c;
+    ngx_http_v3_encoder_table_t  *et;
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "http3 increment insert count %ui", inc);
 
-    /* we do not use dynamic tables */
+    h3c = ngx_http_v3_get_session(c);
+    et = &h3c->encoder;
 
-    return NGX_HTTP_V3_ERR_DECODER_STREAM_ERROR;
+    if (inc == 0
+        || inc > et->base + et->nelts - et->known_received_count)
+    {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "client sent invalid insert count increment");
+
+        return NGX_HTTP_V3_ERR_DECODER_STREAM_ERROR;
+    }
+
+    et->known_received_count += inc;
+
+    return NGX_OK;
 }
 
 
@@ -687,11 +788,17 @@ ngx_http_v3_new_entry(ngx_connection_t *c)
 ngx_int_t
 ngx_http_v3_set_param(ngx_connection_t *c, uint64_t id, uint64_t value)
 {
+    ngx_http_v3_session_t  *h3c;
+
+    h3c = ngx_http_v3_get_session(c);
+
     switch (id) {
 
     case NGX_HTTP_V3_PARAM_MAX_TABLE_CAPACITY:
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
                        "http3 param QPACK_MAX_TABLE_CAPACITY:%uL", value);
+
+        h3c->encoder.max_capacity = ngx_min(value, NGX_MAX_SIZE_T_VALUE);
         break;
 
     case NGX_HTTP_V3_PARAM_MAX_FIELD_SECTION_SIZE:
@@ -703,6 +810,8 @@ ngx_http_v3_set_param(ngx_connection_t *c, uint64_t id, uint64_t value)
     case NGX_HTTP_V3_PARAM_BLOCKED_STREAMS:
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
                        "http3 param QPACK_BLOCKED_STREAMS:%uL", value);
+
+        h3c->encoder.max_blocked = ngx_min(value, NGX_MAX_INT_T_VALUE);
         break;
 
     default:
@@ -713,3 +822,556 @@ ngx_http_v3_set_param(ngx_connection_t *c, uint64_t id, uint64_t value)
 
     return NGX_OK;
 }
+
+
+ngx_int_t
+ngx_http_v3_init_section(ngx_connection_t *c, ngx_http_v3_field_section_t *fs)
+{
+    size_t                        capacity;
+    ngx_uint_t                    nblocked;
+    ngx_queue_t                  *q;
+    ngx_http_v3_field_t         **elts;
+    ngx_http_v3_section_t        *section;
+    ngx_http_v3_session_t        *h3c;
+    ngx_http_v3_srv_conf_t       *h3scf;
+    ngx_http_v3_encoder_table_t  *et;
+
+    ngx_memzero(fs, sizeof(ngx_http_v3_field_section_t));
+
+    h3c = ngx_http_v3_get_session(c);
+    et = &h3c->encoder;
+
+    h3scf = ngx_http_v3_get_module_srv_conf(c, ngx_http_v3_module);
+
+    if (et->capacity == 0) {
+        capacity = ngx_min(h3scf->encoder_table_capacity, et->max_capacity);
+
+        if (capacity / 32 == 0) {
+            return NGX_OK;
+        }
+
+        elts = ngx_alloc((capacity / 32 + 1) * sizeof(void *), c->log);
+        if (elts == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_http_v3_send_set_capacity(c, capacity) != NGX_OK) {
+            ngx_free(elts);
+            return NGX_ERROR;
+        }
+
+        et->elts = elts;
+        et->capacity = capacity;
+    }
+
+    if (et->nsections >= 2 * h3scf->max_concurrent_streams) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http3 encoder sections:%ui, table disabled",
+                       et->nsections);
+        return NGX_OK;
+    }
+
+    fs->stream_id = c->quic->id;
+    fs->base = et->base + et->nelts;
+    fs->min_index = (uint64_t) -1;
+    fs->dynamic = 1;
+
+    /*
+     * a field section referencing entries the client has not acknowledged
+     * yet may block its stream; count the other streams at risk
+     */
+
+    nblocked = 0;
+
+    for (q = ngx_queue_head(&et->sections);
+         q != ngx_queue_sentinel(&et->sections);
+         q = ngx_queue_next(q))
+    {
+        section = ngx_queue_data(q, ngx_http_v3_section_t, queue);
+
+        if (section->insert_count > et->known_received_count
+            && section->stream_id != fs->stream_id)
+        {
+            nblocked++;
+        }
+    }
+
+    if (nblocked < ngx_min(et->max_blocked, h3scf->encoder_blocked_streams)) {
+        fs->blocking = 1;
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http3 encoder section base:%ui known:%uL "
+                   "blocked:%ui blocking:%ui",
+                   fs->base, et->known_received_count, nblocked,
+                   (ngx_uint_t) fs->blocking);
+
+    return NGX_OK;
+}
+
+
+uintptr_t
+ngx_http_v3_encode_field(ngx_connection_t *c, ngx_http_v3_field_section_t *fs,
+    u_char *p, ngx_int_t index, ngx_str_t *name, ngx_str_t *value)
+{
+    u_char                       *start;
+    size_t                        len, size;
+    ngx_int_t                     found, named, dup;
+    ngx_uint_t                    limit, drain, sensitive;
+    ngx_http_v3_session_t        *h3c;
+    ngx_http_v3_encoder_table_t  *et;
+
+    /*
+     * the size of the literal representation is an upper bound,
+     * a dynamic table representation is only used if not larger
+     */
+
+    if (index >= 0) {
+        len = ngx_http_v3_encode_field_lri(NULL, 0, index, NULL, value->len);
+
+    } else {
+        len = ngx_http_v3_encode_field_l(NULL, name, value);
+    }
+
+    if (p == NULL) {
+        return len;
+    }
+
+    /* sensitive fields neither enter the table nor reference its entries */
+
+    sensitive = ngx_http_v3_field_match(ngx_http_v3_sensitive_fields, name);
+
+    if (sensitive || !fs->dynamic) {
+        goto literal;
+    }
+
+    h3c = ngx_http_v3_get_session(c);
+    et = &h3c->encoder;
+
+    limit = fs->blocking ? et->base + et->nelts : et->known_received_count;
+
+    found = ngx_http_v3_encoder_lookup(et, limit, name, value, &named);
+
+    /*
+     * references to draining entries would keep them from being evicted,
+     * such entries are inserted anew instead
+     */
+
+    drain = ngx_http_v3_encoder_draining(et);
+    dup = NGX_DECLINED;
+
+    if (found >= 0 && (ngx_uint_t) found < drain) {
+        dup = et->base + et->nelts - 1 - found;
+        found = NGX_DECLINED;
+    }
+
+    if (named >= 0 && (ngx_uint_t) named < drain) {
+        named = NGX_DECLINED;
+    }
+
+    size = ngx_http_v3_table_entry_size(name, value);
+
+    if (found == NGX_DECLINED
+        && size <= et->capacity / 4
+        && (dup >= 0 || ngx_http_v3_indexable(et, name, value))
+        && ngx_http_v3_encoder_evict(c, fs, et->capacity - size) == NGX_OK)
+    {
+        if (named < (ngx_int_t) et->base) {
+            named = NGX_DECLINED;
+        }
+
+        if (ngx_http_v3_encoder_insert(c, index, dup, name, value) == NGX_OK)
+        {
+            found = et->base + et->nelts - 1;
+            limit = fs->blocking ? et->base + et->nelts : limit;
+        }
+    }
+
+    if (found >= 0 && (ngx_uint_t) found < limit
+        && ngx_http_v3_encode_dynamic(NULL, fs, found, NULL) <= len)
+    {
+        return ngx_http_v3_encode_dynamic(p, fs, found, NULL);
+    }
+
+    if (index < 0 && named >= 0
+        && ngx_http_v3_encode_dynamic(NULL, fs, named, value) <= len)
+    {
+        return ngx_http_v3_encode_dynamic(p, fs, named, value);
+    }
+
+literal:
+
+    start = p;
+
+    if (index >= 0) {
+        p = (u_char *) ngx_http_v3_encode_field_lri(p, 0, index, value->data,
+                                                    value->len);
+
+    } else {
+        p = (u_char *) ngx_http_v3_encode_field_l(p, name, value);
+    }
+
+    if (sensitive) {
+        /* the N bit of the representation */
+        *start |= (index >= 0) ? 0x20 : 0x10;
+    }
+
+    return (uintptr_t) p;
+}
+
+
+ngx_int_t
+ngx_http_v3_finish_section(ngx_connection_t *c, ngx_http_v3_field_section_t *fs)
+{
+    ngx_uint_t                    max_entries;
+    ngx_queue_t                  *q;
+    ngx_connection_t             *pc;
+    ngx_http_v3_section_t        *section;
+    ngx_http_v3_session_t        *h3c;
+    ngx_http_v3_encoder_table_t  *et;
+
+    if (fs->insert_count == 0) {
+        return NGX_OK;
+    }
+
+    h3c = ngx_http_v3_get_session(c);
+    et = &h3c->encoder;
+
+    /* QPACK 4.5.1.1. Required Insert Count */
+
+    max_entries = et->max_capacity / 32;
+
+    fs->encoded_insert_count = fs->insert_count % (2 * max_entries) + 1;
+
+    if (fs->base >= fs->insert_count) {
+        fs->sign = 0;
+        fs->delta_base = fs->base - fs->insert_count;
+
+    } else {
+        fs->sign = 1;
+        fs->delta_base = fs->insert_count - fs->base - 1;
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http3 encoder section insert_count:%uL->%ui, "
+                   "base:%ui, min:%uL",
+                   fs->insert_count, fs->encoded_insert_count, fs->base,
+                   fs->min_index);
+
+    if (!ngx_queue_empty(&et->free_sections)) {
+        q = ngx_queue_head(&et->free_sections);
+        ngx_queue_remove(q);
+        section = ngx_queue_data(q, ngx_http_v3_section_t, queue);
+
+    } else {
+        pc = c->quic ? c->quic->parent : c;
+
+        section = ngx_palloc(pc->pool, sizeof(ngx_http_v3_section_t));
+        if (section == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    section->stream_id = fs->stream_id;
+    section->insert_count = fs->insert_count;
+    section->min_index = fs->min_index;
+
+    ngx_queue_insert_tail(&et->sections, &section->queue);
+    et->nsections++;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_v3_cancel_sections(ngx_connection_t *c, uint64_t stream_id)
+{
+    ngx_queue_t                  *q, *next;
+    ngx_http_v3_section_t        *section;
+    ngx_http_v3_session_t        *h3c;
+    ngx_http_v3_encoder_table_t  *et;
+
+    h3c = ngx_http_v3_get_session(c);
+    et = &h3c->encoder;
+
+    for (q = ngx_queue_head(&et->sections);
+         q != ngx_queue_sentinel(&et->sections);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+
+        section = ngx_queue_data(q, ngx_http_v3_section_t, queue);
+
+        if (section->stream_id == stream_id) {
+            ngx_queue_remove(q);
+            ngx_queue_insert_tail(&et->free_sections, q);
+            et->nsections--;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_v3_encoder_lookup(ngx_http_v3_encoder_table_t *et, ngx_uint_t limit,
+    ngx_str_t *name, ngx_str_t *value, ngx_int_t *named)
+{
+    ngx_uint_t            n;
+    ngx_http_v3_field_t  *field;
+
+    *named = NGX_DECLINED;
+
+    for (n = et->nelts; n > 0; n--) {
+        field = et->elts[n - 1];
+
+        if (field->name.len != name->len
+            || ngx_strncasecmp(field->name.data, name->data, name->len) != 0)
+        {
+            continue;
+        }
+
+        if (field->value.len == value->len
+            && ngx_memcmp(field->value.data, value->data, value->len) == 0)
+        {
+            return et->base + n - 1;
+        }
+
+        if (*named == NGX_DECLINED && et->base + n - 1 < limit) {
+            *named = et->base + n - 1;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_http_v3_encoder_insert(ngx_connection_t *c, ngx_int_t index,
+    ngx_int_t dup, ngx_str_t *name, ngx_str_t *value)
+{
+    u_char                       *p;
+    ngx_int_t                     rc;
+    ngx_http_v3_field_t          *field;
+    ngx_http_v3_session_t        *h3c;
+    ngx_http_v3_encoder_table_t  *et;
+
+    h3c = ngx_http_v3_get_session(c);
+    et = &h3c->encoder;
+
+    p = ngx_alloc(sizeof(ngx_http_v3_field_t) + name->len + value->len,
+                  c->log);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * a duplicated entry may already be evicted here, its copy
+     * is made from the field being encoded
+     */
+
+    if (dup >= 0) {
+        rc = ngx_http_v3_send_duplicate(c, dup);
+
+    } else {
+        rc = ngx_http_v3_send_insert(c, index, name, value);
+    }
+
+    if (rc != NGX_OK) {
+        ngx_free(p);
+        return NGX_ERROR;
+    }
+
+    field = (ngx_http_v3_field_t *) p;
+
+    field->name.data = p + sizeof(ngx_http_v3_field_t);
+    field->name.len = name->len;
+    field->value.data = field->name.data + name->len;
+    field->value.len = value->len;
+
+    ngx_strlow(field->name.data, name->data, name->len);
+    ngx_memcpy(field->value.data, value->data, value->len);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http3 encoder insert [%ui] \"%V\":\"%V\"",
+                   et->base + et->nelts, &field->name, &field->value);
+
+    et->elts[et->nelts++] = field;
+    et->size += ngx_http_v3_table_entry_size(name, value);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v3_encoder_evict(ngx_connection_t *c, ngx_http_v3_field_section_t *fs,
+    size_t target)
+{
+    size_t                        size;
+    uint64_t                      limit;
+    ngx_uint_t                    n, i;
+    ngx_queue_t                  *q;
+    ngx_http_v3_field_t          *field;
+    ngx_http_v3_section_t        *section;
+    ngx_http_v3_session_t        *h3c;
+    ngx_http_v3_encoder_table_t  *et;
+
+    h3c = ngx_http_v3_get_session(c);
+    et = &h3c->encoder;
+
+    /*
+     * an entry can only be evicted once the client has received it
+     * and no unacknowledged field section references it
+     */
+
+    limit = ngx_min(et->known_received_count, fs->min_index);
+
+    for (q = ngx_queue_head(&et->sections);
+         q != ngx_queue_sentinel(&et->sections);
+         q = ngx_queue_next(q))
+    {
+        section = ngx_queue_data(q, ngx_http_v3_section_t, queue);
+        limit = ngx_min(limit, section->min_index);
+    }
+
+    size = et->size;
+    n = 0;
+
+    while (size > target) {
+        if (et->base + n >= limit) {
+            return NGX_DECLINED;
+        }
+
+        field = et->elts[n++];
+        size -= ngx_http_v3_table_entry_size(&field->name, &field->value);
+    }
+
+    if (n == 0) {
+        return NGX_OK;
+    }
+
+    for (i = 0; i < n; i++) {
+        field = et->elts[i];
+
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http3 encoder evict [%ui] \"%V\":\"%V\"",
+                       et->base + i, &field->name, &field->value);
+
+        ngx_free(field);
+    }
+
+    et->nelts -= n;
+    et->base += n;
+    et->size = size;
+    ngx_memmove(et->elts, &et->elts[n], et->nelts * sizeof(void *));
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_v3_encoder_draining(ngx_http_v3_encoder_table_t *et)
+{
+    size_t                n, target;
+    ngx_uint_t            i;
+    ngx_http_v3_field_t  *field;
+
+    /* entries within the last quarter of capacity to be evicted next */
+
+    if (et->capacity - et->size >= et->capacity / 4) {
+        return et->base;
+    }
+
+    target = et->capacity / 4 - (et->capacity - et->size);
+
+    for (i = 0, n = 0; i < et->nelts && n < target; i++) {
+        field = et->elts[i];
+        n += ngx_http_v3_table_entry_size(&field->name, &field->value);
+    }
+
+    return et->base + i;
+}
+
+
+static ngx_uint_t
+ngx_http_v3_indexable(ngx_http_v3_encoder_table_t *et, ngx_str_t *name,
+    ngx_str_t *value)
+{
+    uint32_t    hash;
+    ngx_uint_t  i;
+
+    if (ngx_http_v3_field_match(ngx_http_v3_never_index, name)) {
+        return 0;
+    }
+
+    /*
+     * a field is only inserted once it was seen before,
+     * unique values such as request ids never enter the table
+     */
+
+    ngx_crc32_init(hash);
+    ngx_crc32_update(&hash, name->data, name->len);
+    ngx_crc32_update(&hash, value->data, value->len);
+    ngx_crc32_final(hash);
+
+    for (i = 0; i < NGX_HTTP_V3_ENCODER_HISTORY; i++) {
+        if (et->history[i] == hash) {
+            et->history[i] = 0;
+            return 1;
+        }
+    }
+
+    et->history[et->nhistory++ % NGX_HTTP_V3_ENCODER_HISTORY] = hash;
+
+    return 0;
+}
+
+
+static ngx_uint_t
+ngx_http_v3_field_match(ngx_str_t *names, ngx_str_t *name)
+{
+    ngx_str_t  *s;
+
+    for (s = names; s->len; s++) {
+        if (s->len == name->len
+            && ngx_strncasecmp(s->data, name->data, name->len) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static uintptr_t
+ngx_http_v3_encode_dynamic(u_char *p, ngx_http_v3_field_section_t *fs,
+    ngx_uint_t index, ngx_str_t *value)
+{
+    if (p) {
+        if (fs->insert_count < index + 1) {
+            fs->insert_count = index + 1;
+        }
+
+        if (fs->min_index > index) {
+            fs->min_index = index;
+        }
+    }
+
+    if (index < fs->base) {
+        index = fs->base - 1 - index;
+
+        if (value == NULL) {
+            return ngx_http_v3_encode_field_ri(p, 1, index);
+        }
+
+        return ngx_http_v3_encode_field_lri(p, 1, index, value->data,
+                                            value->len);
+    }
+
+    index -= fs->base;
+
+    if (value == NULL) {
+        return ngx_http_v3_encode_field_pbi(p, index);
+    }
+
+    return ngx_http_v3_encode_field_lpbi(p, index, value->data, value->len);
+}
@@ -32,6 +32,39 @@ typedef struct {
 } ngx_http_v3_dynamic_table_t;
 
 
+#define NGX_HTTP_V3_ENCODER_HISTORY        32
+
+
+typedef struct {
+    ngx_http_v3_field_t         **elts;
+    ngx_uint_t                    nelts;
+    ngx_uint_t                    base;
+    size_t                        size;
+    size_t                        capacity;
+    size_t                        max_capacity;
+    ngx_uint_t                    max_blocked;
+    uint64_t                      known_received_count;
+    ngx_queue_t                   sections;
+    ngx_queue_t                   free_sections;
+    ngx_uint_t                    nsections;
+    uint32_t                      history[NGX_HTTP_V3_ENCODER_HISTORY];
+    ngx_uint_t                    nhistory;
+} ngx_http_v3_encoder_table_t;
+
+
+typedef struct {
+    uint64_t                      stream_id;
+    ngx_uint_t                    base;
+    uint64_t                      insert_count;
+    uint64_t                      min_index;
+    ngx_uint_t                    encoded_insert_count;
+    ngx_uint_t                    sign;
+    ngx_uint_t                    delta_base;
+    unsigned                      dynamic:1;
+    unsigned                      blocking:1;
+} ngx_http_v3_field_section_t;
+
+
 void ngx_http_v3_inc_insert_count_handler(ngx_event_t *ev);
 void ngx_http_v3_cleanup_table(ngx_http_v3_session_t *h3c);
 ngx_int_t ngx_http_v3_ref_insert(ngx_connection_t *c, ngx_uint_t dynamic,
@@ -54,5 +87,14 @@ void ngx_http_v3_ack_insert_count(ngx_connection_t *c, uint64_t insert_count);
 ngx_int_t ngx_http_v3_set_param(ngx_connection_t *c, uint64_t id,
     uint64_t value);
 
+ngx_int_t ngx_http_v3_init_section(ngx_connection_t *c,
+    ngx_http_v3_field_section_t *fs);
+uintptr_t ngx_http_v3_encode_field(ngx_connection_t *c,
+    ngx_http_v3_field_section_t *fs, u_char *p, ngx_int_t index,
+    ngx_str_t *name, ngx_str_t *value);
+ngx_int_t ngx_http_v3_finish_section(ngx_connection_t *c,
+    ngx_http_v3_field_section_t *fs);
+void ngx_http_v3_cancel_sections(ngx_connection_t *c, uint64_t stream_id);
+
 
 #endif /* _NGX_HTTP_V3_TABLE_H_INCLUDED_ */
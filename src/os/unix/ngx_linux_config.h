@@ -107,7 +107,7 @@ typedef struct iocb  ngx_aiocb_t;
 #include <linux/capability.h>
 #endif
 
-#if (NGX_HAVE_UDP_SEGMENT)
+#if (NGX_HAVE_UDP_SEGMENT || NGX_HAVE_UDP_GRO)
 #include <netinet/udp.h>
 #endif
 
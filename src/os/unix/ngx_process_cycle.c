@@ -15,17 +15,23 @@ static void ngx_start_worker_processes(ngx_cycle_t *cycle, ngx_int_t n,
     ngx_int_t type);
 static void ngx_start_cache_manager_processes(ngx_cycle_t *cycle,
     ngx_uint_t respawn);
+static void ngx_start_log_writer_process(ngx_cycle_t *cycle,
+    ngx_uint_t respawn);
 static void ngx_pass_open_channel(ngx_cycle_t *cycle);
 static void ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo);
+static void ngx_handoff_worker_processes(ngx_cycle_t *cycle);
 static ngx_uint_t ngx_reap_children(ngx_cycle_t *cycle);
 static void ngx_master_process_exit(ngx_cycle_t *cycle);
 static void ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data);
 static void ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker);
 static void ngx_worker_process_exit(ngx_cycle_t *cycle);
 static void ngx_channel_handler(ngx_event_t *ev);
+static void ngx_handoff_idle_connections(ngx_cycle_t *cycle);
 static void ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data);
 static void ngx_cache_manager_process_handler(ngx_event_t *ev);
 static void ngx_cache_loader_process_handler(ngx_event_t *ev);
+static void ngx_log_writer_process_cycle(ngx_cycle_t *cycle, void *data);
+static void ngx_log_writer_process_handler(ngx_event_t *ev);
 
 
 ngx_uint_t    ngx_process;
@@ -65,6 +71,8 @@ static ngx_cache_manager_ctx_t  ngx_cache_loader_ctx = {
 };
 
 
+static ngx_int_t        ngx_handoff = -1;
+
 static ngx_cycle_t      ngx_exit_cycle;
 static ngx_log_t        ngx_exit_log;
 static ngx_open_file_t  ngx_exit_log_file;
@@ -397,6 +405,7 @@ ngx_master_process_cycle(ngx_cycle_t *cycle)
      *   - 只在配置了缓存路径时启动
      */
     ngx_start_cache_manager_processes(cycle, 0);
+    ngx_start_log_writer_process(cycle, 0);
 
     /* 8. 初始化状态变量：
      *   - ngx_new_binary: 热升级时的新进程PID
@@ -611,6 +620,7 @@ ngx_master_process_cycle(ngx_cycle_t *cycle)
                 ngx_start_worker_processes(cycle, ccf->worker_processes,
                                            NGX_PROCESS_RESPAWN);
                 ngx_start_cache_manager_processes(cycle, 0);
+                ngx_start_log_writer_process(cycle, 0);
                 ngx_noaccepting = 0;
 
                 continue;
@@ -630,17 +640,32 @@ ngx_master_process_cycle(ngx_cycle_t *cycle)
             ngx_cycle = cycle;
             ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx,
                                                    ngx_core_module);
+
+            if (cycle->incremental) {
+
+                /*
+                 * the running worker processes were updated through
+                 * shared memory, see ngx_init_cycle()
+                 */
+
+                continue;
+            }
             
             /* 启动新的Worker进程（使用新配置） */
             ngx_start_worker_processes(cycle, ccf->worker_processes,
                                        NGX_PROCESS_JUST_RESPAWN);
             ngx_start_cache_manager_processes(cycle, 1);
+            ngx_start_log_writer_process(cycle, 1);
 
             /* 等待新进程启动：给新进程时间初始化 */
             ngx_msleep(100);
 
             /* 标记有存活的进程 */
             live = 1;
+
+            if (ccf->shutdown_handoff) {
+                ngx_handoff_worker_processes(cycle);
+            }
             
             /* 向旧Worker进程发送SIGQUIT信号，优雅关闭 */
             ngx_signal_worker_processes(cycle,
@@ -663,6 +688,7 @@ ngx_master_process_cycle(ngx_cycle_t *cycle)
             ngx_start_worker_processes(cycle, ccf->worker_processes,
                                        NGX_PROCESS_RESPAWN);
             ngx_start_cache_manager_processes(cycle, 0);
+            ngx_start_log_writer_process(cycle, 0);
             live = 1;
         }
 
@@ -860,6 +886,21 @@ ngx_start_cache_manager_processes(ngx_cycle_t *cycle, ngx_uint_t respawn)
 }
 
 
+static void
+ngx_start_log_writer_process(ngx_cycle_t *cycle, ngx_uint_t respawn)
+{
+    if (!ngx_log_ring_used(cycle)) {
+        return;
+    }
+
+    ngx_spawn_process(cycle, ngx_log_writer_process_cycle, NULL,
+                      "log writer process",
+                      respawn ? NGX_PROCESS_JUST_RESPAWN : NGX_PROCESS_RESPAWN);
+
+    ngx_pass_open_channel(cycle);
+}
+
+
 static void
 ngx_pass_open_channel(ngx_cycle_t *cycle)
 {
@@ -998,6 +1039,70 @@ ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo)
 }
 
 
+static void
+ngx_handoff_worker_processes(ngx_cycle_t *cycle)
+{
+    ngx_int_t      i, k, n;
+    ngx_channel_t  ch;
+
+    /*
+     * each worker process of the previous generation is told which
+     * new worker process should get its idle connections on shutdown;
+     * the new channel was passed to it earlier by ngx_pass_open_channel()
+     */
+
+    ngx_memzero(&ch, sizeof(ngx_channel_t));
+
+    ch.command = NGX_CMD_HANDOFF;
+    ch.fd = -1;
+
+    n = -1;
+
+    for (i = 0; i < ngx_last_process; i++) {
+
+        if (ngx_processes[i].detached
+            || ngx_processes[i].pid == -1
+            || ngx_processes[i].just_spawn
+            || ngx_processes[i].exiting
+            || ngx_processes[i].proc != ngx_worker_process_cycle)
+        {
+            continue;
+        }
+
+        /* round-robin over the new worker processes */
+
+        for (k = 0; k < ngx_last_process; k++) {
+            if (++n >= ngx_last_process) {
+                n = 0;
+            }
+
+            if (ngx_processes[n].just_spawn
+                && ngx_processes[n].pid != -1
+                && ngx_processes[n].proc == ngx_worker_process_cycle)
+            {
+                break;
+            }
+        }
+
+        if (k == ngx_last_process) {
+            return;
+        }
+
+        ch.pid = ngx_processes[n].pid;
+        ch.slot = n;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                       "pass handoff s:%i pid:%P to:%P",
+                       ch.slot, ch.pid, ngx_processes[i].pid);
+
+        /* TODO: NGX_AGAIN */
+
+        ngx_write_channel(ngx_processes[i].channel[0],
+                          &ch, sizeof(ngx_channel_t), cycle->log);
+    }
+}
+
+
 static ngx_uint_t
 ngx_reap_children(ngx_cycle_t *cycle)
 {
@@ -1203,6 +1308,7 @@ ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
                 ngx_exiting = 1;
                 ngx_set_shutdown_timer(cycle);
                 ngx_close_listening_sockets(cycle);
+                ngx_handoff_idle_connections(cycle);
                 ngx_close_idle_connections(cycle);
                 ngx_event_process_posted(cycle, &ngx_posted_events);
             }
@@ -1548,8 +1654,120 @@ ngx_channel_handler(ngx_event_t *ev)
 
             ngx_processes[ch.slot].channel[0] = -1;
             break;
+
+        case NGX_CMD_HANDOFF:
+
+            ngx_log_debug2(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                           "get handoff s:%i pid:%P", ch.slot, ch.pid);
+
+            ngx_handoff = ch.slot;
+            break;
+
+        case NGX_CMD_PASS_CONNECTION:
+
+            ngx_log_debug3(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                           "get connection s:%i pid:%P fd:%d",
+                           ch.slot, ch.pid, ch.fd);
+
+            if (ch.fd == -1) {
+                break;
+            }
+
+            if (ngx_process != NGX_PROCESS_WORKER || ngx_exiting) {
+                if (close(ch.fd) == -1) {
+                    ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_errno,
+                                  "close() handed off connection failed");
+                }
+
+                break;
+            }
+
+            ngx_event_handoff((ngx_cycle_t *) ngx_cycle, ch.fd);
+            break;
+        }
+    }
+}
+
+
+static void
+ngx_handoff_idle_connections(ngx_cycle_t *cycle)
+{
+    ngx_int_t          rc;
+    ngx_uint_t         i, n;
+    ngx_socket_t       fd;
+    ngx_channel_t      ch;
+    ngx_connection_t  *c;
+
+    if (ngx_handoff == -1) {
+        return;
+    }
+
+    fd = ngx_processes[ngx_handoff].channel[0];
+
+    if (fd == -1) {
+        return;
+    }
+
+    ngx_memzero(&ch, sizeof(ngx_channel_t));
+
+    ch.command = NGX_CMD_PASS_CONNECTION;
+    ch.pid = ngx_pid;
+    ch.slot = ngx_process_slot;
+
+    n = 0;
+    c = cycle->connections;
+
+    for (i = 0; i < cycle->connection_n; i++) {
+
+        if (c[i].fd == (ngx_socket_t) -1 || !c[i].idle || !c[i].handoff) {
+            continue;
+        }
+
+        /*
+         * the socket stays open in the new worker process, so it is removed
+         * from our notification mechanism explicitly: epoll does not do it
+         * on close() while another descriptor refers to the same socket
+         */
+
+        if (ngx_del_conn) {
+            rc = ngx_del_conn(&c[i], 0);
+
+        } else {
+            rc = NGX_OK;
+
+            if (c[i].read->active || c[i].read->disabled) {
+                rc = ngx_del_event(c[i].read, NGX_READ_EVENT, 0);
+            }
+
+            if (rc == NGX_OK
+                && (c[i].write->active || c[i].write->disabled))
+            {
+                rc = ngx_del_event(c[i].write, NGX_WRITE_EVENT, 0);
+            }
+        }
+
+        if (rc != NGX_OK) {
+            continue;
+        }
+
+        ch.fd = c[i].fd;
+
+        if (ngx_write_channel(fd, &ch, sizeof(ngx_channel_t), cycle->log)
+            != NGX_OK)
+        {
+            /* the rest is closed by ngx_close_idle_connections() */
+            break;
         }
+
+        n++;
+
+        c[i].close = 1;
+        c[i].read->handler(c[i].read);
     }
+
+    ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                  "%ui idle connections handed off to worker process %P",
+                  n, ngx_processes[ngx_handoff].pid);
 }
 
 
@@ -1657,3 +1875,89 @@ ngx_cache_loader_process_handler(ngx_event_t *ev)
 
     exit(0);
 }
+
+
+static void
+ngx_log_writer_process_cycle(ngx_cycle_t *cycle, void *data)
+{
+    void         *ident[4];
+    ngx_msec_t    start;
+    ngx_event_t   ev;
+
+    ngx_process = NGX_PROCESS_HELPER;
+
+    ngx_close_listening_sockets(cycle);
+
+    cycle->connection_n = 512;
+
+    ngx_worker_process_init(cycle, -1);
+
+    ngx_memzero(&ev, sizeof(ngx_event_t));
+    ev.handler = ngx_log_writer_process_handler;
+    ev.data = ident;
+    ev.log = cycle->log;
+    ident[3] = (void *) -1;
+
+    ngx_use_accept_mutex = 0;
+
+    ngx_setproctitle("log writer process");
+
+    ngx_add_timer(&ev, 0);
+
+    for ( ;; ) {
+
+        if (ngx_terminate || ngx_quit) {
+
+            /*
+             * workers of a new configuration keep appending to the rings,
+             * so write only the records committed before the quit,
+             * and give up after a while
+             */
+
+            ngx_log_ring_stop(cycle);
+
+            (void) ngx_log_ring_write(cycle);
+
+            ngx_time_update();
+            start = ngx_current_msec;
+
+            do {
+                ngx_msleep(10);
+                ngx_time_update();
+
+                if (ngx_current_msec - start >= NGX_LOG_RING_EXIT_TIME) {
+                    ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                                  "log rings were not drained in %M ms",
+                                  (ngx_msec_t) NGX_LOG_RING_EXIT_TIME);
+                    break;
+                }
+
+            } while (ngx_log_ring_write(cycle));
+
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "exiting");
+            exit(0);
+        }
+
+        if (ngx_reopen) {
+            ngx_reopen = 0;
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "reopening logs");
+            (void) ngx_log_ring_write(cycle);
+            ngx_reopen_files(cycle, -1);
+        }
+
+        ngx_process_events_and_timers(cycle);
+    }
+}
+
+
+static void
+ngx_log_writer_process_handler(ngx_event_t *ev)
+{
+    size_t  n;
+
+    n = ngx_log_ring_write((ngx_cycle_t *) ngx_cycle);
+
+    ngx_time_update();
+
+    ngx_add_timer(ev, n ? 10 : 100);
+}
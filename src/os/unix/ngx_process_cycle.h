@@ -13,11 +13,13 @@
 #include <ngx_core.h>
 
 
-#define NGX_CMD_OPEN_CHANNEL   1
-#define NGX_CMD_CLOSE_CHANNEL  2
-#define NGX_CMD_QUIT           3
-#define NGX_CMD_TERMINATE      4
-#define NGX_CMD_REOPEN         5
+#define NGX_CMD_OPEN_CHANNEL     1
+#define NGX_CMD_CLOSE_CHANNEL    2
+#define NGX_CMD_QUIT             3
+#define NGX_CMD_TERMINATE        4
+#define NGX_CMD_REOPEN           5
+#define NGX_CMD_HANDOFF          6
+#define NGX_CMD_PASS_CONNECTION  7
 
 
 #define NGX_PROCESS_SINGLE     0
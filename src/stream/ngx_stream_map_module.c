@@ -41,6 +41,10 @@ typedef struct {
 
 static int ngx_libc_cdecl ngx_stream_map_cmp_dns_wildcards(const void *one,
     const void *two);
+#if (NGX_PCRE)
+static ngx_int_t ngx_stream_map_regex_set(ngx_conf_t *cf, ngx_pool_t *pool,
+    ngx_stream_map_t *map);
+#endif
 static void *ngx_stream_map_create_conf(ngx_conf_t *cf);
 static char *ngx_stream_map_block(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -354,6 +358,13 @@ ngx_stream_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     if (ctx.regexes.nelts) {
         map->map.regex = ctx.regexes.elts;
         map->map.nregex = ctx.regexes.nelts;
+
+        if (ctx.regexes.nelts >= NGX_REGEX_SET_MIN) {
+            if (ngx_stream_map_regex_set(cf, pool, &map->map) != NGX_OK) {
+                ngx_destroy_pool(pool);
+                return NGX_CONF_ERROR;
+            }
+        }
     }
 
 #endif
@@ -364,6 +375,36 @@ ngx_stream_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+#if (NGX_PCRE)
+
+static ngx_int_t
+ngx_stream_map_regex_set(ngx_conf_t *cf, ngx_pool_t *pool,
+    ngx_stream_map_t *map)
+{
+    ngx_uint_t            i;
+    ngx_regex_set_elt_t  *elts;
+
+    elts = ngx_palloc(pool, map->nregex * sizeof(ngx_regex_set_elt_t));
+    if (elts == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < map->nregex; i++) {
+        elts[i].regex = map->regex[i].regex->regex;
+        elts[i].pattern = map->regex[i].regex->name;
+    }
+
+    map->regex_set = ngx_regex_compile_set(cf->pool, elts, map->nregex);
+    if (map->regex_set == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static int ngx_libc_cdecl
 ngx_stream_map_cmp_dns_wildcards(const void *one, const void *two)
 {
@@ -0,0 +1,767 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_stream.h>
+
+
+typedef struct {
+    uint64_t                          sessions[6];
+    uint64_t                          received;
+    uint64_t                          sent;
+    ngx_metrics_hist_t                session_time;
+    ngx_metrics_hist_t                upstream_connect_time;
+    ngx_metrics_hist_t                upstream_first_byte_time;
+    ngx_metrics_hist_t                upstream_session_time;
+    ngx_metrics_hist_t                handshake_time;
+} ngx_stream_metrics_server_t;
+
+
+typedef struct {
+    uint64_t                          connects;
+    uint64_t                          received;
+    uint64_t                          sent;
+    ngx_metrics_hist_t                connect_time;
+    ngx_metrics_hist_t                first_byte_time;
+    ngx_metrics_hist_t                session_time;
+} ngx_stream_metrics_peer_t;
+
+
+typedef struct {
+    ngx_metrics_t                    *metrics;
+    ngx_metrics_family_t             *server;
+    ngx_metrics_family_t             *peer;
+} ngx_stream_metrics_zone_t;
+
+
+typedef struct {
+    ngx_stream_upstream_srv_conf_t   *upstream;
+    ngx_str_t                         name;
+    ngx_uint_t                        hash;
+    ngx_uint_t                        index;
+} ngx_stream_metrics_peer_key_t;
+
+
+typedef struct {
+    ngx_array_t                       zones;  /* ngx_stream_metrics_zone_t * */
+
+    ngx_stream_metrics_peer_key_t    *peers;
+    ngx_uint_t                        peers_mask;
+} ngx_stream_metrics_main_conf_t;
+
+
+typedef struct {
+    ngx_stream_metrics_zone_t        *zone;
+    ngx_uint_t                        index;
+} ngx_stream_metrics_srv_conf_t;
+
+
+static ngx_int_t ngx_stream_metrics_handler(ngx_stream_session_t *s);
+static void ngx_stream_metrics_upstream(ngx_stream_session_t *s,
+    ngx_stream_metrics_zone_t *zone, ngx_stream_metrics_server_t *srv);
+static ngx_int_t ngx_stream_metrics_find_peer(
+    ngx_stream_metrics_main_conf_t *mmcf, ngx_stream_upstream_srv_conf_t *us,
+    ngx_str_t *name);
+
+static ngx_stream_metrics_zone_t *ngx_stream_metrics_add_zone(ngx_conf_t *cf,
+    ngx_str_t *name, size_t size);
+static ngx_int_t ngx_stream_metrics_add_servers(ngx_conf_t *cf);
+static ngx_int_t ngx_stream_metrics_add_peers(ngx_conf_t *cf,
+    ngx_stream_metrics_main_conf_t *mmcf);
+static ngx_int_t ngx_stream_metrics_add_peer(ngx_conf_t *cf,
+    ngx_stream_metrics_main_conf_t *mmcf, ngx_stream_upstream_srv_conf_t *us,
+    ngx_str_t *name);
+static void *ngx_stream_metrics_create_main_conf(ngx_conf_t *cf);
+static void *ngx_stream_metrics_create_srv_conf(ngx_conf_t *cf);
+static char *ngx_stream_metrics_merge_srv_conf(ngx_conf_t *cf, void *parent,
+    void *child);
+static char *ngx_stream_metrics_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_stream_metrics(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_stream_metrics_init(ngx_conf_t *cf);
+
+
+static ngx_command_t  ngx_stream_metrics_commands[] = {
+
+    { ngx_string("metrics_zone"),
+      NGX_STREAM_MAIN_CONF|NGX_CONF_TAKE2,
+      ngx_stream_metrics_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("metrics"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_stream_metrics,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_stream_module_t  ngx_stream_metrics_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_stream_metrics_init,               /* postconfiguration */
+
+    ngx_stream_metrics_create_main_conf,   /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_stream_metrics_create_srv_conf,    /* create server configuration */
+    ngx_stream_metrics_merge_srv_conf      /* merge server configuration */
+};
+
+
+ngx_module_t  ngx_stream_metrics_module = {
+    NGX_MODULE_V1,
+    &ngx_stream_metrics_module_ctx,        /* module context */
+    ngx_stream_metrics_commands,           /* module directives */
+    NGX_STREAM_MODULE,                     /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+#define ngx_stream_metrics_counter(name, help, label, type, field)            \
+    { name, help, label, NGX_METRICS_COUNTER, 0, offsetof(type, field) }
+
+#define ngx_stream_metrics_histogram(name, help, msec, type, field)           \
+    { name, help, NULL, NGX_METRICS_HISTOGRAM, msec, offsetof(type, field) }
+
+
+static ngx_metrics_desc_t  ngx_stream_metrics_server_desc[] = {
+
+#define ngx_stream_metrics_sessions(label, n)                                 \
+    ngx_stream_metrics_counter("nginx_stream_sessions_total",                 \
+        "Sessions by status class.", label,                                   \
+        ngx_stream_metrics_server_t, sessions[n])
+
+    ngx_stream_metrics_sessions("code=\"2xx\"", 1),
+    ngx_stream_metrics_sessions("code=\"4xx\"", 3),
+    ngx_stream_metrics_sessions("code=\"5xx\"", 4),
+    ngx_stream_metrics_sessions("code=\"other\"", 5),
+
+    ngx_stream_metrics_counter("nginx_stream_received_bytes_total",
+        "Bytes received from clients.", NULL,
+        ngx_stream_metrics_server_t, received),
+
+    ngx_stream_metrics_counter("nginx_stream_sent_bytes_total",
+        "Bytes sent to clients.", NULL,
+        ngx_stream_metrics_server_t, sent),
+
+    ngx_stream_metrics_histogram("nginx_stream_session_duration_seconds",
+        "Session duration.", 1,
+        ngx_stream_metrics_server_t, session_time),
+
+    ngx_stream_metrics_histogram("nginx_stream_upstream_connect_seconds",
+        "Time to connect to an upstream server.", 1,
+        ngx_stream_metrics_server_t, upstream_connect_time),
+
+    ngx_stream_metrics_histogram("nginx_stream_upstream_first_byte_seconds",
+        "Time to receive the first byte from an upstream server.", 1,
+        ngx_stream_metrics_server_t, upstream_first_byte_time),
+
+    ngx_stream_metrics_histogram("nginx_stream_upstream_session_seconds",
+        "Duration of a session with an upstream server.", 1,
+        ngx_stream_metrics_server_t, upstream_session_time),
+
+    ngx_stream_metrics_histogram("nginx_stream_ssl_handshake_seconds",
+        "Time from accepting a connection to completing the SSL handshake.",
+        1, ngx_stream_metrics_server_t, handshake_time),
+
+    { NULL, NULL, NULL, 0, 0, 0 }
+};
+
+
+static ngx_metrics_desc_t  ngx_stream_metrics_peer_desc[] = {
+
+    ngx_stream_metrics_counter("nginx_stream_upstream_connects_total",
+        "Connection attempts to the server.", NULL,
+        ngx_stream_metrics_peer_t, connects),
+
+    ngx_stream_metrics_counter("nginx_stream_upstream_received_bytes_total",
+        "Bytes received from the server.", NULL,
+        ngx_stream_metrics_peer_t, received),
+
+    ngx_stream_metrics_counter("nginx_stream_upstream_sent_bytes_total",
+        "Bytes sent to the server.", NULL,
+        ngx_stream_metrics_peer_t, sent),
+
+    ngx_stream_metrics_histogram("nginx_stream_upstream_peer_connect_seconds",
+        "Time to connect to the server.", 1,
+        ngx_stream_metrics_peer_t, connect_time),
+
+    ngx_stream_metrics_histogram(
+        "nginx_stream_upstream_peer_first_byte_seconds",
+        "Time to receive the first byte from the server.", 1,
+        ngx_stream_metrics_peer_t, first_byte_time),
+
+    ngx_stream_metrics_histogram("nginx_stream_upstream_peer_session_seconds",
+        "Duration of a session with the server.", 1,
+        ngx_stream_metrics_peer_t, session_time),
+
+    { NULL, NULL, NULL, 0, 0, 0 }
+};
+
+
+static ngx_str_t  ngx_stream_metrics_server_label = ngx_string("server");
+static ngx_str_t  ngx_stream_metrics_upstream_label = ngx_string("upstream");
+static ngx_str_t  ngx_stream_metrics_peer_label = ngx_string("peer");
+
+
+#define ngx_stream_metrics_class(status)                                      \
+    (((status) >= 100 && (status) < 600) ? (status) / 100 - 1 : 5)
+
+
+static ngx_int_t
+ngx_stream_metrics_handler(ngx_stream_session_t *s)
+{
+    ngx_time_t                     *tp;
+    ngx_msec_int_t                  ms;
+    ngx_connection_t               *c;
+    ngx_stream_metrics_zone_t      *zone;
+    ngx_stream_metrics_server_t    *srv;
+    ngx_stream_metrics_srv_conf_t  *mscf;
+
+    mscf = ngx_stream_get_module_srv_conf(s, ngx_stream_metrics_module);
+
+    zone = mscf->zone;
+
+    if (zone == NULL) {
+        return NGX_OK;
+    }
+
+    c = s->connection;
+
+    srv = (ngx_stream_metrics_server_t *)
+              ngx_metrics_entry(zone->metrics, zone->server, mscf->index);
+
+    srv->sessions[ngx_stream_metrics_class(s->status)]++;
+
+    tp = ngx_timeofday();
+
+    ms = (ngx_msec_int_t)
+             ((tp->sec - s->start_sec) * 1000 + (tp->msec - s->start_msec));
+
+    ngx_metrics_observe(&srv->session_time, ngx_max(ms, 0));
+
+    srv->received += s->received;
+    srv->sent += c->sent;
+
+    if (s->upstream_states) {
+        ngx_stream_metrics_upstream(s, zone, srv);
+    }
+
+#if (NGX_STREAM_SSL)
+
+    if (c->ssl && c->ssl->handshaked && !c->ssl->handshake_reported) {
+        c->ssl->handshake_reported = 1;
+        ngx_metrics_observe(&srv->handshake_time, c->ssl->handshake_time);
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_stream_metrics_upstream(ngx_stream_session_t *s,
+    ngx_stream_metrics_zone_t *zone, ngx_stream_metrics_server_t *srv)
+{
+    ngx_int_t                         n;
+    ngx_uint_t                        i;
+    ngx_stream_metrics_peer_t        *peer;
+    ngx_stream_upstream_state_t      *state;
+    ngx_stream_upstream_srv_conf_t   *us;
+    ngx_stream_metrics_main_conf_t   *mmcf;
+
+    mmcf = ngx_stream_get_module_main_conf(s, ngx_stream_metrics_module);
+
+    state = s->upstream_states->elts;
+
+    us = s->upstream ? s->upstream->upstream : NULL;
+
+    for (i = 0; i < s->upstream_states->nelts; i++) {
+
+        if (state[i].peer == NULL) {
+            continue;
+        }
+
+        if (state[i].connect_time != (ngx_msec_t) -1) {
+            ngx_metrics_observe(&srv->upstream_connect_time,
+                                state[i].connect_time);
+        }
+
+        if (state[i].first_byte_time != (ngx_msec_t) -1) {
+            ngx_metrics_observe(&srv->upstream_first_byte_time,
+                                state[i].first_byte_time);
+        }
+
+        if (state[i].response_time != (ngx_msec_t) -1) {
+            ngx_metrics_observe(&srv->upstream_session_time,
+                                state[i].response_time);
+        }
+
+        if (us == NULL) {
+            continue;
+        }
+
+        n = ngx_stream_metrics_find_peer(mmcf, us, state[i].peer);
+
+        if (n == NGX_DECLINED) {
+            continue;
+        }
+
+        peer = (ngx_stream_metrics_peer_t *)
+                   ngx_metrics_entry(zone->metrics, zone->peer, n);
+
+        peer->connects++;
+        peer->received += state[i].bytes_received;
+        peer->sent += state[i].bytes_sent;
+
+        if (state[i].connect_time != (ngx_msec_t) -1) {
+            ngx_metrics_observe(&peer->connect_time, state[i].connect_time);
+        }
+
+        if (state[i].first_byte_time != (ngx_msec_t) -1) {
+            ngx_metrics_observe(&peer->first_byte_time,
+                                state[i].first_byte_time);
+        }
+
+        if (state[i].response_time != (ngx_msec_t) -1) {
+            ngx_metrics_observe(&peer->session_time, state[i].response_time);
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_stream_metrics_find_peer(ngx_stream_metrics_main_conf_t *mmcf,
+    ngx_stream_upstream_srv_conf_t *us, ngx_str_t *name)
+{
+    ngx_uint_t                      i, hash;
+    ngx_stream_metrics_peer_key_t  *key;
+
+    if (mmcf->peers == NULL) {
+        return NGX_DECLINED;
+    }
+
+    hash = ngx_hash_key(name->data, name->len) ^ ((uintptr_t) us >> 4);
+
+    for (i = hash & mmcf->peers_mask;
+         mmcf->peers[i].upstream;
+         i = (i + 1) & mmcf->peers_mask)
+    {
+        key = &mmcf->peers[i];
+
+        if (key->upstream == us
+            && key->hash == hash
+            && key->name.len == name->len
+            && ngx_strncmp(key->name.data, name->data, name->len) == 0)
+        {
+            return key->index;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_stream_metrics_zone_t *
+ngx_stream_metrics_add_zone(ngx_conf_t *cf, ngx_str_t *name, size_t size)
+{
+    ngx_uint_t                       i;
+    ngx_metrics_t                   *metrics;
+    ngx_stream_metrics_zone_t       *zone, **zp;
+    ngx_stream_metrics_main_conf_t  *mmcf;
+
+    mmcf = ngx_stream_conf_get_module_main_conf(cf, ngx_stream_metrics_module);
+
+    metrics = ngx_metrics_add(cf, name, size);
+    if (metrics == NULL) {
+        return NULL;
+    }
+
+    zp = mmcf->zones.elts;
+
+    for (i = 0; i < mmcf->zones.nelts; i++) {
+        if (zp[i]->metrics == metrics) {
+            return zp[i];
+        }
+    }
+
+    zone = ngx_pcalloc(cf->pool, sizeof(ngx_stream_metrics_zone_t));
+    if (zone == NULL) {
+        return NULL;
+    }
+
+    zone->metrics = metrics;
+
+    zone->server = ngx_metrics_add_family(cf, metrics,
+                                        ngx_stream_metrics_server_desc,
+                                        sizeof(ngx_stream_metrics_server_t));
+    if (zone->server == NULL) {
+        return NULL;
+    }
+
+    zone->peer = ngx_metrics_add_family(cf, metrics,
+                                        ngx_stream_metrics_peer_desc,
+                                        sizeof(ngx_stream_metrics_peer_t));
+    if (zone->peer == NULL) {
+        return NULL;
+    }
+
+    zp = ngx_array_push(&mmcf->zones);
+    if (zp == NULL) {
+        return NULL;
+    }
+
+    *zp = zone;
+
+    return zone;
+}
+
+
+static ngx_int_t
+ngx_stream_metrics_add_servers(ngx_conf_t *cf)
+{
+    ngx_int_t                        n;
+    ngx_str_t                       *name;
+    ngx_uint_t                       i, j, k, l;
+    ngx_keyval_t                     label;
+    ngx_stream_conf_addr_t          *addr;
+    ngx_stream_conf_port_t          *port;
+    ngx_stream_core_srv_conf_t     **cscfp, **server;
+    ngx_stream_core_main_conf_t     *cmcf;
+    ngx_stream_metrics_srv_conf_t   *mscf;
+
+    cmcf = ngx_stream_conf_get_module_main_conf(cf, ngx_stream_core_module);
+
+    cscfp = cmcf->servers.elts;
+
+    for (i = 0; i < cmcf->servers.nelts; i++) {
+
+        mscf = cscfp[i]->ctx->srv_conf[ngx_stream_metrics_module.ctx_index];
+
+        if (mscf->zone == NULL) {
+            continue;
+        }
+
+        /* servers without names are identified by their first listen */
+
+        name = &cscfp[i]->server_name;
+
+        if (name->len == 0 && cmcf->ports) {
+            port = cmcf->ports->elts;
+
+            for (j = 0; j < cmcf->ports->nelts; j++) {
+                addr = port[j].addrs.elts;
+
+                for (k = 0; k < port[j].addrs.nelts; k++) {
+                    server = addr[k].servers.elts;
+
+                    for (l = 0; l < addr[k].servers.nelts; l++) {
+                        if (server[l] == cscfp[i]) {
+                            name = &addr[k].opt.addr_text;
+                            goto found;
+                        }
+                    }
+                }
+            }
+        }
+
+    found:
+
+        label.key = ngx_stream_metrics_server_label;
+        label.value = *name;
+
+        n = ngx_metrics_add_entry(cf, mscf->zone->server, &label, 1);
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        mscf->index = n;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_metrics_add_peers(ngx_conf_t *cf,
+    ngx_stream_metrics_main_conf_t *mmcf)
+{
+    ngx_uint_t                         i, j, k, n;
+    ngx_stream_upstream_server_t      *server;
+    ngx_stream_upstream_rr_peer_t     *peer;
+    ngx_stream_upstream_rr_peers_t    *peers;
+    ngx_stream_upstream_srv_conf_t   **uscfp;
+    ngx_stream_upstream_main_conf_t   *umcf;
+
+    umcf = ngx_stream_conf_get_module_main_conf(cf, ngx_stream_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    n = 0;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->servers) {
+            server = uscfp[i]->servers->elts;
+
+            for (j = 0; j < uscfp[i]->servers->nelts; j++) {
+                n += server[j].naddrs;
+            }
+
+            continue;
+        }
+
+        for (peers = uscfp[i]->peer.data; peers; peers = peers->next) {
+            n += peers->number;
+        }
+    }
+
+    if (n == 0) {
+        return NGX_OK;
+    }
+
+    for (k = 2; k < 2 * n; k <<= 1) { /* void */ }
+
+    mmcf->peers = ngx_pcalloc(cf->pool,
+                              k * sizeof(ngx_stream_metrics_peer_key_t));
+    if (mmcf->peers == NULL) {
+        return NGX_ERROR;
+    }
+
+    mmcf->peers_mask = k - 1;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->servers) {
+            server = uscfp[i]->servers->elts;
+
+            for (j = 0; j < uscfp[i]->servers->nelts; j++) {
+                for (k = 0; k < server[j].naddrs; k++) {
+                    if (ngx_stream_metrics_add_peer(cf, mmcf, uscfp[i],
+                                                    &server[j].addrs[k].name)
+                        != NGX_OK)
+                    {
+                        return NGX_ERROR;
+                    }
+                }
+            }
+
+            continue;
+        }
+
+        for (peers = uscfp[i]->peer.data; peers; peers = peers->next) {
+            for (peer = peers->peer; peer; peer = peer->next) {
+                if (ngx_stream_metrics_add_peer(cf, mmcf, uscfp[i],
+                                                &peer->name)
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_metrics_add_peer(ngx_conf_t *cf,
+    ngx_stream_metrics_main_conf_t *mmcf, ngx_stream_upstream_srv_conf_t *us,
+    ngx_str_t *name)
+{
+    ngx_int_t                       n;
+    ngx_uint_t                      i, hash;
+    ngx_keyval_t                    labels[2];
+    ngx_stream_metrics_zone_t     **zp;
+    ngx_stream_metrics_peer_key_t  *key;
+
+    if (ngx_stream_metrics_find_peer(mmcf, us, name) != NGX_DECLINED) {
+        return NGX_OK;
+    }
+
+    labels[0].key = ngx_stream_metrics_upstream_label;
+    labels[0].value = us->host;
+    labels[1].key = ngx_stream_metrics_peer_label;
+    labels[1].value = *name;
+
+    n = NGX_ERROR;
+    zp = mmcf->zones.elts;
+
+    for (i = 0; i < mmcf->zones.nelts; i++) {
+        n = ngx_metrics_add_entry(cf, zp[i]->peer, labels, 2);
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
+    hash = ngx_hash_key(name->data, name->len) ^ ((uintptr_t) us >> 4);
+
+    for (i = hash & mmcf->peers_mask;
+         mmcf->peers[i].upstream;
+         i = (i + 1) & mmcf->peers_mask)
+    {
+        /* void */
+    }
+
+    key = &mmcf->peers[i];
+
+    key->upstream = us;
+    key->name = *name;
+    key->hash = hash;
+    key->index = n;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_stream_metrics_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_stream_metrics_main_conf_t  *mmcf;
+
+    mmcf = ngx_pcalloc(cf->pool, sizeof(ngx_stream_metrics_main_conf_t));
+    if (mmcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&mmcf->zones, cf->pool, 1,
+                       sizeof(ngx_stream_metrics_zone_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return mmcf;
+}
+
+
+static void *
+ngx_stream_metrics_create_srv_conf(ngx_conf_t *cf)
+{
+    ngx_stream_metrics_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_stream_metrics_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->zone = NGX_CONF_UNSET_PTR;
+
+    return conf;
+}
+
+
+static char *
+ngx_stream_metrics_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_stream_metrics_srv_conf_t *prev = parent;
+    ngx_stream_metrics_srv_conf_t *conf = child;
+
+    ngx_conf_merge_ptr_value(conf->zone, prev->zone, NULL);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_stream_metrics_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ssize_t     size;
+    ngx_str_t  *value;
+
+    value = cf->args->elts;
+
+    size = ngx_parse_size(&value[2]);
+
+    if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_stream_metrics_add_zone(cf, &value[1], size) == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_stream_metrics(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_stream_metrics_srv_conf_t *mscf = conf;
+
+    ngx_str_t  *value;
+
+    if (mscf->zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        mscf->zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    mscf->zone = ngx_stream_metrics_add_zone(cf, &value[1], 0);
+    if (mscf->zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_metrics_init(ngx_conf_t *cf)
+{
+    ngx_stream_handler_pt           *h;
+    ngx_stream_core_main_conf_t     *cmcf;
+    ngx_stream_metrics_main_conf_t  *mmcf;
+
+    mmcf = ngx_stream_conf_get_module_main_conf(cf, ngx_stream_metrics_module);
+
+    if (mmcf->zones.nelts == 0) {
+        return NGX_OK;
+    }
+
+    if (ngx_stream_metrics_add_servers(cf) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_stream_metrics_add_peers(cf, mmcf) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    cmcf = ngx_stream_conf_get_module_main_conf(cf, ngx_stream_core_module);
+
+    h = ngx_array_push(&cmcf->phases[NGX_STREAM_LOG_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_stream_metrics_handler;
+
+    return NGX_OK;
+}
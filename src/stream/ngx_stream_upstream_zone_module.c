@@ -141,7 +141,12 @@ ngx_stream_upstream_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     umcf = shm_zone->data;
     uscfp = umcf->upstreams.elts;
 
-    if (shm_zone->shm.exists) {
+    /*
+     * the zone is also reused by an incremental reconfiguration,
+     * which does not change stream upstreams
+     */
+
+    if (shm_zone->shm.exists || shpool->data) {
         peers = shpool->data;
 
         for (i = 0; i < umcf->upstreams.nelts; i++) {
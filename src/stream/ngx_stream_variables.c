@@ -1009,8 +1009,28 @@ ngx_stream_map_find(ngx_stream_session_t *s, ngx_stream_map_t *map,
         ngx_stream_map_regex_t  *reg;
 
         reg = map->regex;
+        i = 0;
 
-        for (i = 0; i < map->nregex; i++) {
+        if (map->regex_set) {
+            n = ngx_regex_exec_set(map->regex_set, match);
+
+            if (n == NGX_REGEX_NO_MATCHED) {
+                return NULL;
+            }
+
+            if (n < 0) {
+                ngx_log_error(NGX_LOG_ALERT, s->connection->log, 0,
+                              ngx_regex_exec_set_n " failed: %i on \"%V\"",
+                              n, match);
+                return NULL;
+            }
+
+            /* skip to the first matching regex */
+
+            i = n;
+        }
+
+        for ( /* void */ ; i < map->nregex; i++) {
 
             n = ngx_stream_regex_exec(s, reg[i].regex, match);
 
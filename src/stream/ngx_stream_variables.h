@@ -93,6 +93,7 @@ typedef struct {
     ngx_hash_combined_t           hash;
 #if (NGX_PCRE)
     ngx_stream_map_regex_t       *regex;
+    ngx_regex_set_t              *regex_set;
     ngx_uint_t                    nregex;
 #endif
 } ngx_stream_map_t;